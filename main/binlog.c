@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "metrics.h"
+#include "binlog.h"
+
+#define FORMAT_PERIOD_MS 50
+#define FORMAT_PRIORITY 1				/**< below every task of the pipeline*/
+#define LINE_MAX 160
+
+struct binlog_desc {
+	esp_log_level_t level;
+	const char* tag;
+	const char* fmt;
+};
+
+struct binlog_record {
+	uint32_t seq;			/**< position + 1 once written, 0 while being written*/
+	uint32_t ms;
+	uint16_t id;
+	uint8_t argc;
+	uint8_t reserved;
+	uint32_t suppressed;		/**< records of the message over its rate in the previous second*/
+	uint32_t args[BINLOG_ARGS_MAX];
+};
+
+struct __attribute__((packed)) binlog_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t record_size;
+	uint16_t table_len;
+	uint32_t count;			/**< records in the dump, oldest first*/
+	uint32_t dropped;		/**< records not taken by a full ring since boot*/
+	uint32_t suppressed;		/**< records over their rate since boot*/
+	uint32_t now_ms;
+};
+
+struct binlog_rate {
+	uint32_t second;
+	uint32_t count;
+	uint32_t suppressed;
+};
+
+_Static_assert((BINLOG_RECORDS & (BINLOG_RECORDS - 1)) == 0, "BINLOG_RECORDS must be a power of two");
+_Static_assert(sizeof(struct binlog_record) == 32, "dump format");
+_Static_assert(sizeof(struct binlog_header) == 24, "dump format");
+
+static const struct binlog_desc msgs[BINLOG_MSG_COUNT] = {
+	[BINLOG_TARGET]			= {ESP_LOG_INFO, "main", "Frame %u = Target %.2f - (%f), tid: %d"},
+	[BINLOG_WRONG_TID]		= {ESP_LOG_ERROR, "main", "Wrong tid from features"},
+	[BINLOG_PASS_HEIGHT]		= {ESP_LOG_INFO, "FALL_LOGIC", "Pass height"},
+	[BINLOG_PASS_VELOCITY]		= {ESP_LOG_INFO, "FALL_LOGIC", "Velo pass"},
+	[BINLOG_MISSING_FEATURES]	= {ESP_LOG_WARN, "radar_interface", "Missing Frame %u after %u"},
+	[BINLOG_RING_FETCH]		= {ESP_LOG_ERROR, "radar_interface", "Cant receive buf from Ring"},
+	[BINLOG_MISSING_FRAME]		= {ESP_LOG_ERROR, "radar_interface", "Missing frame: %u, %u"},
+	[BINLOG_RING_EMPTY]		= {ESP_LOG_ERROR, "radar_interface", "(Frame data) No data in Ring buffer!"},
+	[BINLOG_RING_MUTEX]		= {ESP_LOG_ERROR, "radar_interface", "Cannot get mutex!!!"},
+	[BINLOG_EXTRACT_FAILED]		= {ESP_LOG_ERROR, "radar_interface", "Error when extract frame information, frame %u"},
+	[BINLOG_QUEUE_BUSY]		= {ESP_LOG_ERROR, "radar_interface", "Busy in accessing Data Queue"},
+	[BINLOG_BAD_TLV]		= {ESP_LOG_ERROR, "radar_interface", "Wrong bytes data when extract frame info %u %u"},
+	[BINLOG_BAD_CHECKSUM]		= {ESP_LOG_ERROR, "radar_interface", "Wrong check sum! %u %u"},
+	[BINLOG_RING_SEND]		= {ESP_LOG_ERROR, "radar_interface", "Cannot send data to ring buffer"},
+};
+
+_Static_assert(sizeof(msgs) / sizeof(msgs[0]) == BINLOG_MSG_COUNT, "every message needs a format");
+
+/* Producers claim a slot by moving head, the formatter frees it by moving tail */
+static struct binlog_record ring[BINLOG_RECORDS];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static struct binlog_rate rates[BINLOG_MSG_COUNT];
+
+
+/**
+ * @brief Count the message in its second, the first one of a second carries what the last one suppressed
+ *
+ * @return true within the rate
+ */
+static bool s_rate(enum binlog_msg id, uint32_t ms, uint32_t* suppressed)
+{
+	struct binlog_rate* r = &rates[id];
+	uint32_t second = ms / 1000;
+
+	*suppressed = 0;
+	// Two writers starting the same second both reset, one more record gets through
+	if (__atomic_load_n(&r->second, __ATOMIC_RELAXED) != second) {
+		__atomic_store_n(&r->second, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&r->count, 0, __ATOMIC_RELAXED);
+		*suppressed = __atomic_exchange_n(&r->suppressed, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_fetch_add(&r->count, 1, __ATOMIC_RELAXED) < BINLOG_RATE_PER_S)
+		return true;
+	__atomic_fetch_add(&r->suppressed, 1, __ATOMIC_RELAXED);
+	metric_inc(METRIC_LOG_SUPPRESSED);
+	return false;
+}
+
+void binlog_write(enum binlog_msg id, const uint32_t* args, size_t argc)
+{
+	uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+	uint32_t suppressed;
+	uint32_t pos = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	struct binlog_record* rec;
+
+	if (!s_rate(id, ms, &suppressed))
+		return;
+	do {
+		if (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= BINLOG_RECORDS) {
+			// Still reported with the next record that gets in
+			__atomic_fetch_add(&rates[id].suppressed, suppressed, __ATOMIC_RELAXED);
+			metric_inc(METRIC_LOG_DROPPED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	rec = &ring[pos & (BINLOG_RECORDS - 1)];
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->ms = ms;
+	rec->id = id;
+	rec->argc = argc < BINLOG_ARGS_MAX ? argc : BINLOG_ARGS_MAX;
+	rec->suppressed = suppressed;
+	memcpy(rec->args, args, rec->argc * sizeof(uint32_t));
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief printf with arguments of 32 bits, one conversion at a time
+ *
+ */
+static void s_format(char* out, size_t cap, const char* fmt, const uint32_t* args, size_t argc)
+{
+	size_t len = 0;
+	size_t i = 0;
+
+	while (*fmt != '\0' && len + 1 < cap) {
+		char spec[16];
+		const char* start = fmt;
+		size_t spec_len;
+		uint32_t arg;
+		float f;
+		int n;
+
+		if (*fmt != '%' || fmt[1] == '%') {
+			out[len++] = *fmt;
+			fmt += *fmt == '%' ? 2 : 1;
+			continue;
+		}
+		fmt++;
+		while (*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != NULL)
+			fmt++;
+		spec_len = fmt - start;
+		// Every argument is 32 bits, length modifiers are dropped
+		while (*fmt != '\0' && strchr("hlzjt", *fmt) != NULL)
+			fmt++;
+		if (*fmt == '\0' || spec_len + 2 > sizeof(spec))
+			break;
+		memcpy(spec, start, spec_len);
+		spec[spec_len] = *fmt;
+		spec[spec_len + 1] = '\0';
+		arg = i < argc ? args[i++] : 0;
+		switch (*fmt++) {
+		case 'f': case 'e': case 'g':
+			memcpy(&f, &arg, sizeof(f));
+			n = snprintf(out + len, cap - len, spec, (double)f);
+			break;
+		case 'd': case 'i': case 'c':
+			n = snprintf(out + len, cap - len, spec, (int)(int32_t)arg);
+			break;
+		default:
+			n = snprintf(out + len, cap - len, spec, (unsigned)arg);
+			break;
+		}
+		if (n < 0)
+			break;
+		len += (size_t)n < cap - len ? (size_t)n : cap - len - 1;
+	}
+	out[len] = '\0';
+}
+
+static void s_print(const struct binlog_record* rec)
+{
+	static const char letters[] = "NEWIDV";
+	const struct binlog_desc* m = &msgs[rec->id];
+	char line[LINE_MAX];
+
+	s_format(line, sizeof(line), m->fmt, rec->args, rec->argc);
+	if (rec->suppressed > 0)
+		esp_log_write(m->level, m->tag, "%c (%" PRIu32 ") %s: %s (%" PRIu32 " suppressed)\n",
+			      letters[m->level], rec->ms, m->tag, line, rec->suppressed);
+	else
+		esp_log_write(m->level, m->tag, "%c (%" PRIu32 ") %s: %s\n", letters[m->level], rec->ms, m->tag, line);
+}
+
+static void binlog_task(void* arg)
+{
+	for (;;) {
+		uint32_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		struct binlog_record* slot = &ring[pos & (BINLOG_RECORDS - 1)];
+		struct binlog_record rec;
+
+		// A writer preempted before its last store holds back the records after it
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+			vTaskDelay(pdMS_TO_TICKS(FORMAT_PERIOD_MS));
+			continue;
+		}
+		rec = *slot;
+		__atomic_store_n(&tail, pos + 1, __ATOMIC_RELEASE);
+		if (rec.id < BINLOG_MSG_COUNT)
+			s_print(&rec);
+	}
+}
+
+void binlog_init(void)
+{
+	xTaskCreatePinnedToCore(binlog_task, "binlog", 1024*3, NULL, FORMAT_PRIORITY, NULL, 0);
+}
+
+size_t binlog_dump(uint8_t* buf, size_t cap)
+{
+	struct binlog_header hdr;
+	size_t len = sizeof(hdr);
+	uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	uint32_t pos = end < BINLOG_RECORDS ? 0 : end - BINLOG_RECORDS;
+
+	if (cap < len)
+		return 0;
+	for (int i = 0; i < BINLOG_MSG_COUNT; i++) {
+		int n = snprintf((char*)buf + len, cap - len, "%c %s\t%s\n", "NEWIDV"[msgs[i].level], msgs[i].tag, msgs[i].fmt);
+		if (n < 0 || (size_t)n >= cap - len)
+			return 0;
+		len += n;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic));
+	hdr.version = BINLOG_VERSION;
+	hdr.record_size = sizeof(struct binlog_record);
+	hdr.table_len = len - sizeof(hdr);
+	// Formatted records stay in the ring until written over, a record changing under the copy is left out
+	for (; pos != end && len + sizeof(struct binlog_record) <= cap; pos++) {
+		struct binlog_record* slot = &ring[pos & (BINLOG_RECORDS - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+			continue;
+		memcpy(buf + len, slot, sizeof(*slot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+			continue;
+		len += sizeof(*slot);
+		hdr.count++;
+	}
+	hdr.dropped = __atomic_load_n(&metric_counters[METRIC_LOG_DROPPED], __ATOMIC_RELAXED);
+	hdr.suppressed = __atomic_load_n(&metric_counters[METRIC_LOG_SUPPRESSED], __ATOMIC_RELAXED);
+	hdr.now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+	memcpy(buf, &hdr, sizeof(hdr));
+	return len;
+}
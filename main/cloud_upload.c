@@ -0,0 +1,295 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "lzf.h"
+#include "frame_codec.h"
+#include "cloud_upload.h"
+
+#define BATCH_VERSION 1
+#define PAYLOAD_STORED 0				/**< batch sent as is, compression did not help*/
+#define PAYLOAD_LZF 1
+#define PAYLOAD_HEADER 3				/**< format, raw length (u16)*/
+#define FRAME_WORST (CODEC_U32_WORST + 1 + CLOUD_POINTS_MAX * 11)	/**< dframe, count, 3 varints + doppler + snr per point*/
+#define VOXEL_SLOTS 128					/**< open addressing, twice CLOUD_POINTS_MAX*/
+#define US_PER_MIN 60000000LL
+
+static const char* TAG = "cloud_upload";
+
+struct cloud_point {
+	int16_t x;			/**< voxel index, CLOUD_VOXEL_CM per step*/
+	int16_t y;
+	int16_t z;
+	int8_t doppler;			/**< 0.1 m/s*/
+	uint8_t snr;
+};
+
+struct cloud_frame {
+	uint32_t frame;
+	uint16_t count;
+	struct cloud_point pts[CLOUD_POINTS_MAX];
+};
+
+/* Radar task records, mqtt task builds and commits */
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct cloud_frame ring[CLOUD_RING_LEN];
+static uint32_t ring_head = 0;			/**< total frames recorded*/
+static uint32_t ring_tail = 0;			/**< total frames sent or dropped*/
+static struct cloud_upload_stats stats;
+static volatile bool enabled = false;
+
+static uint8_t raw_buf[CLOUD_RAW_MAX];
+static struct lzf_state lzf;
+static uint32_t budget = CLOUD_BUDGET_DEFAULT;
+static int64_t tokens = CLOUD_BUDGET_DEFAULT * US_PER_MIN;	/**< bytes scaled by US_PER_MIN*/
+static int64_t refill_us = 0;
+static int64_t stop_us = 0;				/**< end of a timed capture, 0 for none*/
+
+
+static int16_t s_voxel(float value)
+{
+	float v = floorf(value * (100.0f / CLOUD_VOXEL_CM));
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)v;
+}
+
+static uint8_t s_slot(const struct cloud_point* p)
+{
+	uint32_t h = (uint16_t)p->x * 73856093u ^ (uint16_t)p->y * 19349663u ^ (uint16_t)p->z * 83492791u;
+	return h % VOXEL_SLOTS;
+}
+
+void cloud_upload_record(uint32_t frame, const float* pcs, int num_points)
+{
+	static struct cloud_frame f;
+	uint8_t slots[VOXEL_SLOTS];
+	int64_t start;
+	int stride;
+
+	if (!enabled)
+		return;
+	start = esp_timer_get_time();
+	stride = num_points > CLOUD_SCAN_MAX ? (num_points + CLOUD_SCAN_MAX - 1) / CLOUD_SCAN_MAX : 1;
+	memset(slots, 0, sizeof(slots));
+	f.frame = frame;
+	f.count = 0;
+	for (int i = 0; i < num_points && f.count < CLOUD_POINTS_MAX; i += stride) {
+		const float* p = pcs + i*5;
+		float doppler = p[3] * 10;
+		float snr = p[4];
+		struct cloud_point pt = {
+			.x = s_voxel(p[0]),
+			.y = s_voxel(p[1]),
+			.z = s_voxel(p[2]),
+			.doppler = doppler > 127 ? 127 : doppler < -127 ? -127 : (int8_t)lroundf(doppler),
+			.snr = snr > 255 ? 255 : snr < 0 ? 0 : (uint8_t)lroundf(snr),
+		};
+		uint8_t s = s_slot(&pt);
+
+		// Slots hold index + 1, a free slot always exists since CLOUD_POINTS_MAX < VOXEL_SLOTS
+		while (slots[s] != 0) {
+			struct cloud_point* q = &f.pts[slots[s] - 1];
+			if (q->x == pt.x && q->y == pt.y && q->z == pt.z)
+				break;
+			s = (s + 1) % VOXEL_SLOTS;
+		}
+		if (slots[s] == 0) {
+			f.pts[f.count++] = pt;
+			slots[s] = f.count;
+		} else if (pt.snr > f.pts[slots[s] - 1].snr) {
+			f.pts[slots[s] - 1] = pt;
+		}
+	}
+
+	portENTER_CRITICAL(&ring_lock);
+	if (ring_head - ring_tail == CLOUD_RING_LEN) {
+		ring_tail++;
+		stats.frames_dropped++;
+	}
+	memcpy(&ring[ring_head % CLOUD_RING_LEN], &f,
+	       offsetof(struct cloud_frame, pts) + f.count * sizeof(struct cloud_point));
+	ring_head++;
+	stats.frames++;
+	portEXIT_CRITICAL(&ring_lock);
+
+	uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+	if (elapsed > stats.max_record_us)
+		stats.max_record_us = elapsed;
+}
+
+
+/* ================================================	Batch encoding	================================================*/
+/**
+ * @brief Append one frame as deltas, first point of a frame is relative to the origin
+ *
+ * @return uint8_t* end of written data
+ */
+static uint8_t* s_encode_frame(uint8_t* p, const struct cloud_frame* f, uint32_t dframe)
+{
+	struct cloud_point prev = {0};
+
+	p = codec_put_uvarint(p, dframe);
+	*p++ = (uint8_t)f->count;
+	for (int i = 0; i < f->count; i++) {
+		const struct cloud_point* pt = &f->pts[i];
+		p = codec_put_svarint(p, pt->x - prev.x);
+		p = codec_put_svarint(p, pt->y - prev.y);
+		p = codec_put_svarint(p, pt->z - prev.z);
+		*p++ = (uint8_t)pt->doppler;
+		*p++ = pt->snr;
+		prev = *pt;
+	}
+	return p;
+}
+
+size_t cloud_upload_build(uint8_t* buf, size_t cap, uint32_t* until)
+{
+	static struct cloud_frame f;
+	uint32_t head, tail, prev_frame = 0;
+	uint8_t* p = raw_buf;
+	uint8_t num_frames = 0;
+	size_t raw_len, len;
+
+	portENTER_CRITICAL(&ring_lock);
+	head = ring_head;
+	tail = ring_tail;
+	portEXIT_CRITICAL(&ring_lock);
+	*until = tail;
+	if (stop_us != 0 && esp_timer_get_time() >= stop_us) {
+		// This batch is still sent, leftovers are dropped when the upload is enabled again
+		enabled = false;
+		stop_us = 0;
+		ESP_LOGI(TAG, "Timed capture finished");
+	}
+	if (head == tail || cap <= PAYLOAD_HEADER)
+		return 0;
+
+	// version, voxel size, first frame number (u32), frame count
+	*p++ = BATCH_VERSION;
+	*p++ = CLOUD_VOXEL_CM;
+	p += 4;
+	*p++ = 0;
+	for (uint32_t i = tail; i != head && num_frames < UINT8_MAX; i++) {
+		if (p + FRAME_WORST > raw_buf + sizeof(raw_buf))
+			break;
+		portENTER_CRITICAL(&ring_lock);
+		// Frames may have been overwritten by the radar task meanwhile
+		bool valid = (ring_head - i) <= CLOUD_RING_LEN;
+		if (valid)
+			memcpy(&f, &ring[i % CLOUD_RING_LEN], sizeof(f));
+		portEXIT_CRITICAL(&ring_lock);
+		if (!valid)
+			break;
+		if (num_frames == 0) {
+			prev_frame = f.frame;
+			memcpy(raw_buf + 2, &f.frame, 4);
+		}
+		p = s_encode_frame(p, &f, f.frame - prev_frame);
+		prev_frame = f.frame;
+		num_frames++;
+		*until = i + 1;
+	}
+	if (num_frames == 0)
+		return 0;
+	raw_buf[6] = num_frames;
+	raw_len = p - raw_buf;
+
+	len = lzf_compress(&lzf, raw_buf, raw_len, buf + PAYLOAD_HEADER, cap - PAYLOAD_HEADER);
+	if (len == 0 || len >= raw_len) {
+		if (raw_len > cap - PAYLOAD_HEADER)
+			return 0;
+		buf[0] = PAYLOAD_STORED;
+		memcpy(buf + PAYLOAD_HEADER, raw_buf, raw_len);
+		len = raw_len;
+	} else {
+		buf[0] = PAYLOAD_LZF;
+	}
+	buf[1] = raw_len & 0xFF;
+	buf[2] = raw_len >> 8;
+	stats.raw_bytes += raw_len;
+	return len + PAYLOAD_HEADER;
+}
+
+
+/* ================================================	Budget	================================================*/
+bool cloud_upload_spend(size_t len)
+{
+	int64_t now = esp_timer_get_time();
+	int64_t cap = (int64_t)budget * US_PER_MIN;
+
+	tokens += (now - refill_us) * budget;
+	refill_us = now;
+	if (tokens > cap)
+		tokens = cap;
+	if (tokens < (int64_t)len * US_PER_MIN)
+		return false;
+	tokens -= (int64_t)len * US_PER_MIN;
+	return true;
+}
+
+void cloud_upload_commit(uint32_t until, size_t sent_len)
+{
+	portENTER_CRITICAL(&ring_lock);
+	// Overwrites during the publish may already have moved the tail further
+	if ((int32_t)(until - ring_tail) > 0) {
+		if (sent_len > 0) {
+			stats.frames_sent += until - ring_tail;
+		} else {
+			stats.frames_dropped += until - ring_tail;
+		}
+		ring_tail = until;
+	}
+	if (sent_len > 0) {
+		stats.batches++;
+		stats.bytes += sent_len;
+	}
+	portEXIT_CRITICAL(&ring_lock);
+}
+
+void cloud_upload_enable(bool enable)
+{
+	if (enable && !enabled) {
+		// Start with a full minute of budget and without frames left from a timed capture
+		refill_us = esp_timer_get_time();
+		tokens = (int64_t)budget * US_PER_MIN;
+		ESP_LOGI(TAG, "Point cloud upload on, %u B/min", budget);
+	}
+	if (enable != enabled) {
+		portENTER_CRITICAL(&ring_lock);
+		ring_tail = ring_head;
+		portEXIT_CRITICAL(&ring_lock);
+	}
+	enabled = enable;
+	stop_us = 0;
+}
+
+void cloud_upload_enable_for(uint32_t seconds)
+{
+	cloud_upload_enable(true);
+	if (seconds > 0)
+		stop_us = esp_timer_get_time() + (int64_t)seconds * 1000000;
+}
+
+bool cloud_upload_enabled(void)
+{
+	return enabled;
+}
+
+void cloud_upload_set_budget(uint32_t bytes_per_min)
+{
+	budget = bytes_per_min;
+}
+
+void cloud_upload_get_stats(struct cloud_upload_stats* out)
+{
+	portENTER_CRITICAL(&ring_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&ring_lock);
+}
@@ -0,0 +1,363 @@
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "json_arena.h"
+#include "handle_spiffs.h"
+#include "kv_store.h"
+#include "config_store.h"
+
+#define DEVICE_PATH "/spiffs/device.json"
+#define WIFI_PATH "/spiffs/wifi.json"
+#define MQTT_PATH "/spiffs/mqtt.json"
+#define NW_PATH "/spiffs/nw.json"
+#define RADAR_PATH "/spiffs/radar.json"
+#define NOT_INIT "NOT_INIT"
+/* Bump the schema of a struct whenever its layout changes, older copies are then ignored */
+#define DEVICE_SCHEMA 1
+#define WIFI_SCHEMA 1
+#define MQTT_SCHEMA 1
+#define NW_SCHEMA 1
+#define RADAR_SCHEMA 1
+#define APP_SCHEMA 1
+
+static const char* TAG = "config_store";
+
+/* Readers copy under the spinlock, a copy is at most a radar config */
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct config_device device_cfg = {NOT_INIT};
+static struct config_wifi wifi_cfg = {NOT_INIT, NOT_INIT};
+static struct config_mqtt mqtt_cfg = {NOT_INIT, 0, NOT_INIT, NOT_INIT};
+static enum config_nw_mode nw_mode = CONFIG_NW_UNSET;
+static struct config_radar radar_cfg;
+static struct config_app app_cfg;
+/* Serializes writers, a write and its cache update are one step for readers */
+static SemaphoreHandle_t write_lock = NULL;
+/* Documents of older firmware, read once to migrate them */
+static char doc_buf[CONFIG_DOC_MAX];
+
+_Static_assert(sizeof(struct config_radar) <= KV_VALUE_MAX, "radar config must fit one store value");
+
+
+static void s_copy_string(char* dst, size_t cap, const cJSON* root, const char* key)
+{
+	const cJSON* item = cJSON_GetObjectItemCaseSensitive(root, key);
+
+	if (cJSON_IsString(item) && item->valuestring != NULL)
+		snprintf(dst, cap, "%s", item->valuestring);
+	else
+		ESP_LOGE(TAG, "Missing \"%s\" in config", key);
+}
+
+/**
+ * @brief Fill radar from the "radar_config" object, or from the top level of older documents
+ *
+ */
+static void s_parse_radar(const cJSON* root, struct config_radar* radar)
+{
+	const cJSON* obj = cJSON_GetObjectItemCaseSensitive(root, "radar_config");
+	const cJSON* item;
+
+	if (!cJSON_IsObject(obj))
+		obj = root;
+	radar->num_keys = 0;
+	cJSON_ArrayForEach(item, obj) {
+		if (!cJSON_IsString(item) || strlen(item->string) >= CONFIG_RADAR_KEY_MAX ||
+		    strlen(item->valuestring) >= CONFIG_RADAR_VALUE_MAX || radar->num_keys == CONFIG_RADAR_KEYS)
+			continue;
+		strcpy(radar->item[radar->num_keys].key, item->string);
+		strcpy(radar->item[radar->num_keys].value, item->valuestring);
+		radar->num_keys++;
+	}
+}
+
+/**
+ * @brief Read and parse the SPIFFS document of older firmware
+ *
+ * @return cJSON* tree in the arena, NULL when missing or not JSON
+ */
+static cJSON* s_load(const char* path)
+{
+	if (spiffs_read_file(path, doc_buf, sizeof(doc_buf)) == 0)
+		return NULL;
+	return cJSON_Parse(doc_buf);
+}
+
+/**
+ * @brief Copy the SPIFFS documents of older firmware into the store
+ * @details Only sections the store does not hold yet are migrated, the files are left in place.
+ *
+ * @param missing sections without stored value, bit per section in the order of #config_init
+ */
+static void s_migrate(uint32_t missing)
+{
+	cJSON* root;
+
+	json_arena_begin();
+	if ((missing & (1 << 0)) && (root = s_load(DEVICE_PATH)) != NULL) {
+		s_copy_string(device_cfg.uuid, sizeof(device_cfg.uuid), root, "uuid");
+		kv_set("device", DEVICE_SCHEMA, &device_cfg, sizeof(device_cfg));
+		cJSON_Delete(root);
+	}
+	if ((missing & (1 << 1)) && (root = s_load(WIFI_PATH)) != NULL) {
+		s_copy_string(wifi_cfg.ssid, sizeof(wifi_cfg.ssid), root, "ssid");
+		s_copy_string(wifi_cfg.password, sizeof(wifi_cfg.password), root, "password");
+		kv_set("wifi", WIFI_SCHEMA, &wifi_cfg, sizeof(wifi_cfg));
+		cJSON_Delete(root);
+	}
+	if ((missing & (1 << 2)) && (root = s_load(MQTT_PATH)) != NULL) {
+		const cJSON* port = cJSON_GetObjectItemCaseSensitive(root, "mqtt_port");
+		s_copy_string(mqtt_cfg.hostname, sizeof(mqtt_cfg.hostname), root, "mqtt_hostname");
+		s_copy_string(mqtt_cfg.username, sizeof(mqtt_cfg.username), root, "mqtt_username");
+		s_copy_string(mqtt_cfg.password, sizeof(mqtt_cfg.password), root, "mqtt_password");
+		if (cJSON_IsString(port) && port->valuestring != NULL)
+			mqtt_cfg.port = (uint16_t)atoi(port->valuestring);
+		kv_set("mqtt", MQTT_SCHEMA, &mqtt_cfg, sizeof(mqtt_cfg));
+		cJSON_Delete(root);
+	}
+	if ((missing & (1 << 3)) && (root = s_load(NW_PATH)) != NULL) {
+		const cJSON* state = cJSON_GetObjectItemCaseSensitive(root, "nw_state");
+		if (cJSON_IsString(state) && state->valuestring != NULL) {
+			nw_mode = strcmp(state->valuestring, "STA") == 0 ? CONFIG_NW_STA : CONFIG_NW_AP;
+			kv_set("nw", NW_SCHEMA, &nw_mode, sizeof(nw_mode));
+		}
+		cJSON_Delete(root);
+	}
+	if ((missing & (1 << 4)) && (root = s_load(RADAR_PATH)) != NULL) {
+		s_parse_radar(root, &radar_cfg);
+		kv_set("radar", RADAR_SCHEMA, &radar_cfg, sizeof(radar_cfg));
+		cJSON_Delete(root);
+	}
+	json_arena_end();
+}
+
+esp_err_t config_init(void)
+{
+	uint32_t missing = 0;
+	esp_err_t err;
+
+	write_lock = xSemaphoreCreateMutex();
+	if (write_lock == NULL)
+		return ESP_ERR_NO_MEM;
+	err = kv_init();
+	if (err != ESP_OK)
+		return err;
+	// A failed read leaves the default in place, the struct is only copied when intact
+	if (kv_get("device", DEVICE_SCHEMA, &device_cfg, sizeof(device_cfg)) != ESP_OK)
+		missing |= 1 << 0;
+	if (kv_get("wifi", WIFI_SCHEMA, &wifi_cfg, sizeof(wifi_cfg)) != ESP_OK)
+		missing |= 1 << 1;
+	if (kv_get("mqtt", MQTT_SCHEMA, &mqtt_cfg, sizeof(mqtt_cfg)) != ESP_OK)
+		missing |= 1 << 2;
+	if (kv_get("nw", NW_SCHEMA, &nw_mode, sizeof(nw_mode)) != ESP_OK)
+		missing |= 1 << 3;
+	if (kv_get("radar", RADAR_SCHEMA, &radar_cfg, sizeof(radar_cfg)) != ESP_OK)
+		missing |= 1 << 4;
+	// Not in the SPIFFS documents, defaults when missing
+	kv_get("app", APP_SCHEMA, &app_cfg, sizeof(app_cfg));
+	if (missing != 0)
+		s_migrate(missing);
+	ESP_LOGI(TAG, "Config loaded, %d radar keys", radar_cfg.num_keys);
+	return ESP_OK;
+}
+
+void config_get_device(struct config_device* out)
+{
+	portENTER_CRITICAL(&cache_lock);
+	*out = device_cfg;
+	portEXIT_CRITICAL(&cache_lock);
+}
+
+void config_get_wifi(struct config_wifi* out)
+{
+	portENTER_CRITICAL(&cache_lock);
+	*out = wifi_cfg;
+	portEXIT_CRITICAL(&cache_lock);
+}
+
+void config_get_mqtt(struct config_mqtt* out)
+{
+	portENTER_CRITICAL(&cache_lock);
+	*out = mqtt_cfg;
+	portEXIT_CRITICAL(&cache_lock);
+}
+
+enum config_nw_mode config_get_nw_mode(void)
+{
+	return nw_mode;
+}
+
+void config_get_app(struct config_app* out)
+{
+	portENTER_CRITICAL(&cache_lock);
+	*out = app_cfg;
+	portEXIT_CRITICAL(&cache_lock);
+}
+
+void config_get_radar(struct config_radar* out)
+{
+	portENTER_CRITICAL(&cache_lock);
+	*out = radar_cfg;
+	portEXIT_CRITICAL(&cache_lock);
+}
+
+/**
+ * @brief Print a tree without allocating the output
+ *
+ * @return size_t length, 0 when it does not fit
+ */
+static size_t s_print(cJSON* root, char* buf, size_t cap)
+{
+	size_t len = 0;
+
+	if (root != NULL && cJSON_PrintPreallocated(root, buf, (int)cap, false))
+		len = strlen(buf);
+	cJSON_Delete(root);
+	return len;
+}
+
+static size_t s_device_doc(const struct config_device* cfg, char* buf, size_t cap)
+{
+	cJSON* root = cJSON_CreateObject();
+
+	cJSON_AddStringToObject(root, "uuid", cfg->uuid);
+	return s_print(root, buf, cap);
+}
+
+static size_t s_wifi_doc(const struct config_wifi* cfg, char* buf, size_t cap)
+{
+	cJSON* root = cJSON_CreateObject();
+
+	cJSON_AddStringToObject(root, "ssid", cfg->ssid);
+	cJSON_AddStringToObject(root, "password", cfg->password);
+	return s_print(root, buf, cap);
+}
+
+static size_t s_mqtt_doc(const struct config_mqtt* cfg, char* buf, size_t cap)
+{
+	cJSON* root = cJSON_CreateObject();
+	char port[8];
+
+	// Kept a string, the provisioning page and older documents use one
+	snprintf(port, sizeof(port), "%u", cfg->port);
+	cJSON_AddStringToObject(root, "mqtt_hostname", cfg->hostname);
+	cJSON_AddStringToObject(root, "mqtt_port", port);
+	cJSON_AddStringToObject(root, "mqtt_username", cfg->username);
+	cJSON_AddStringToObject(root, "mqtt_password", cfg->password);
+	return s_print(root, buf, cap);
+}
+
+/**
+ * @brief Store a value then update its cache, the caller holds no lock
+ *
+ * @param key store key
+ * @param schema layout version of the struct
+ * @param cache RAM copy, written only once the store committed
+ * @param value new value
+ * @param len size of the struct
+ */
+static esp_err_t s_set(const char* key, uint16_t schema, void* cache, const void* value, size_t len)
+{
+	esp_err_t err;
+
+	xSemaphoreTake(write_lock, portMAX_DELAY);
+	err = kv_set(key, schema, value, len);
+	if (err == ESP_OK) {
+		portENTER_CRITICAL(&cache_lock);
+		memcpy(cache, value, len);
+		portEXIT_CRITICAL(&cache_lock);
+	}
+	xSemaphoreGive(write_lock);
+	return err;
+}
+
+esp_err_t config_set_device(const struct config_device* cfg)
+{
+	return s_set("device", DEVICE_SCHEMA, &device_cfg, cfg, sizeof(*cfg));
+}
+
+esp_err_t config_set_wifi(const struct config_wifi* cfg)
+{
+	return s_set("wifi", WIFI_SCHEMA, &wifi_cfg, cfg, sizeof(*cfg));
+}
+
+esp_err_t config_set_mqtt(const struct config_mqtt* cfg)
+{
+	return s_set("mqtt", MQTT_SCHEMA, &mqtt_cfg, cfg, sizeof(*cfg));
+}
+
+esp_err_t config_set_nw_mode(enum config_nw_mode mode)
+{
+	return s_set("nw", NW_SCHEMA, &nw_mode, &mode, sizeof(mode));
+}
+
+esp_err_t config_set_app(const struct config_app* cfg)
+{
+	return s_set("app", APP_SCHEMA, &app_cfg, cfg, sizeof(*cfg));
+}
+
+esp_err_t config_set_radar(const struct config_radar* cfg)
+{
+	return s_set("radar", RADAR_SCHEMA, &radar_cfg, cfg, sizeof(*cfg));
+}
+
+size_t config_device_json(char* buf, size_t cap)
+{
+	struct config_device cfg;
+	size_t len;
+
+	config_get_device(&cfg);
+	json_arena_begin();
+	len = s_device_doc(&cfg, buf, cap);
+	json_arena_end();
+	return len;
+}
+
+size_t config_wifi_json(char* buf, size_t cap)
+{
+	struct config_wifi cfg;
+	size_t len;
+
+	config_get_wifi(&cfg);
+	json_arena_begin();
+	len = s_wifi_doc(&cfg, buf, cap);
+	json_arena_end();
+	return len;
+}
+
+size_t config_mqtt_json(char* buf, size_t cap)
+{
+	struct config_mqtt cfg;
+	size_t len;
+
+	config_get_mqtt(&cfg);
+	json_arena_begin();
+	len = s_mqtt_doc(&cfg, buf, cap);
+	json_arena_end();
+	return len;
+}
+
+size_t config_ui_json(char* buf, size_t cap)
+{
+	struct config_wifi wifi;
+	struct config_mqtt mqtt;
+	char port[8];
+	size_t len;
+
+	config_get_wifi(&wifi);
+	config_get_mqtt(&mqtt);
+	snprintf(port, sizeof(port), "%u", mqtt.port);
+	json_arena_begin();
+	cJSON* root = cJSON_CreateObject();
+	// Names of the form fields, passwords are never sent back
+	cJSON_AddStringToObject(root, "ssid", wifi.ssid);
+	cJSON_AddStringToObject(root, "mqtt_hostname", mqtt.hostname);
+	cJSON_AddStringToObject(root, "mqtt_port", port);
+	cJSON_AddStringToObject(root, "mqtt_username", mqtt.username);
+	len = s_print(root, buf, cap);
+	json_arena_end();
+	return len;
+}
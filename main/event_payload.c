@@ -0,0 +1,375 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "event_payload.h"
+
+#define FALL_EVENT 1
+#define PRESENCE_EVENT 0
+#define COMMAND_RESPONSE 2
+#define FALL_CAPTURE 3
+
+
+static void s_put(struct payload_writer* w, const char* data, size_t len)
+{
+	if (w->overflow || w->len + len >= w->cap) {
+		w->overflow = true;
+		return;
+	}
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+static void s_putc(struct payload_writer* w, char c)
+{
+	s_put(w, &c, 1);
+}
+
+/* CBOR major types (RFC 8949 section 3.1) */
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY_INDEFINITE 0x9F
+#define CBOR_MAP_INDEFINITE 0xBF
+#define CBOR_BREAK 0xFF
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+
+/**
+ * @brief Write CBOR initial byte with argument in shortest form
+ * 
+ * @param w writer
+ * @param major major type
+ * @param value argument
+ */
+static void s_cbor_head(struct payload_writer* w, uint8_t major, uint32_t value)
+{
+	uint8_t head[5];
+	size_t n;
+
+	if (value < 24) {
+		head[0] = major << 5 | value;
+		n = 1;
+	} else if (value <= 0xFF) {
+		head[0] = major << 5 | 24;
+		head[1] = value;
+		n = 2;
+	} else if (value <= 0xFFFF) {
+		head[0] = major << 5 | 25;
+		head[1] = value >> 8;
+		head[2] = value;
+		n = 3;
+	} else {
+		head[0] = major << 5 | 26;
+		head[1] = value >> 24;
+		head[2] = value >> 16;
+		head[3] = value >> 8;
+		head[4] = value;
+		n = 5;
+	}
+	s_put(w, (const char*)head, n);
+}
+
+static void s_cbor_text(struct payload_writer* w, const char* text)
+{
+	size_t len = strlen(text);
+	s_cbor_head(w, CBOR_TEXT, len);
+	s_put(w, text, len);
+}
+
+static void s_separator(struct payload_writer* w)
+{
+	if (w->encoding == PAYLOAD_CBOR)
+		return;
+	if (w->need_comma)
+		s_putc(w, ',');
+	w->need_comma = true;
+}
+
+static void s_quoted(struct payload_writer* w, const char* text)
+{
+	s_putc(w, '"');
+	for (const char* c = text; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			s_putc(w, '\\');
+			s_putc(w, *c);
+		} else if ((unsigned char)*c < 0x20) {
+			char esc[7];
+			snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*c);
+			s_put(w, esc, 6);
+		} else {
+			s_putc(w, *c);
+		}
+	}
+	s_putc(w, '"');
+}
+
+void pw_init(struct payload_writer* w, enum payload_encoding encoding, char* buf, size_t cap)
+{
+	w->encoding = encoding;
+	w->buf = buf;
+	w->cap = cap;
+	w->len = 0;
+	w->need_comma = false;
+	w->overflow = (cap == 0);
+}
+
+void pw_map_begin(struct payload_writer* w)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_putc(w, (char)CBOR_MAP_INDEFINITE);
+		return;
+	}
+	s_separator(w);
+	s_putc(w, '{');
+	w->need_comma = false;
+}
+
+void pw_map_end(struct payload_writer* w)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_putc(w, (char)CBOR_BREAK);
+		return;
+	}
+	s_putc(w, '}');
+	w->need_comma = true;
+}
+
+void pw_array_begin(struct payload_writer* w)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_putc(w, (char)CBOR_ARRAY_INDEFINITE);
+		return;
+	}
+	s_separator(w);
+	s_putc(w, '[');
+	w->need_comma = false;
+}
+
+void pw_array_end(struct payload_writer* w)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_putc(w, (char)CBOR_BREAK);
+		return;
+	}
+	s_putc(w, ']');
+	w->need_comma = true;
+}
+
+void pw_key(struct payload_writer* w, const char* key)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_cbor_text(w, key);
+		return;
+	}
+	s_separator(w);
+	s_quoted(w, key);
+	s_putc(w, ':');
+	// Value follows the key directly
+	w->need_comma = false;
+}
+
+void pw_uint(struct payload_writer* w, uint32_t value)
+{
+	char digits[10];
+	int n = 0;
+
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_cbor_head(w, CBOR_UINT, value);
+		return;
+	}
+	s_separator(w);
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (n > 0)
+		s_putc(w, digits[--n]);
+}
+
+void pw_int(struct payload_writer* w, int32_t value)
+{
+	if (value >= 0) {
+		pw_uint(w, value);
+		return;
+	}
+	if (w->encoding == PAYLOAD_CBOR) {
+		// Negative integer n is encoded as -1 - n
+		s_cbor_head(w, CBOR_NEGINT, (uint32_t)(-1 - value));
+		return;
+	}
+	s_separator(w);
+	s_putc(w, '-');
+	// pw_uint must not add a second separator
+	w->need_comma = false;
+	pw_uint(w, (uint32_t)(-(int64_t)value));
+}
+
+void pw_bool(struct payload_writer* w, bool value)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_putc(w, (char)(value ? CBOR_TRUE : CBOR_FALSE));
+		return;
+	}
+	s_separator(w);
+	if (value)
+		s_put(w, "true", 4);
+	else
+		s_put(w, "false", 5);
+}
+
+void pw_text(struct payload_writer* w, const char* text)
+{
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_cbor_text(w, text);
+		return;
+	}
+	s_separator(w);
+	s_quoted(w, text);
+}
+
+void pw_bytes(struct payload_writer* w, const uint8_t* data, size_t len)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char quad[4];
+
+	if (w->encoding == PAYLOAD_CBOR) {
+		s_cbor_head(w, CBOR_BYTES, len);
+		s_put(w, (const char*)data, len);
+		return;
+	}
+	s_separator(w);
+	s_putc(w, '"');
+	for (size_t i = 0; i < len && !w->overflow; i += 3) {
+		uint32_t v = (uint32_t)data[i] << 16;
+		if (i + 1 < len)
+			v |= (uint32_t)data[i + 1] << 8;
+		if (i + 2 < len)
+			v |= data[i + 2];
+		quad[0] = alphabet[v >> 18 & 0x3F];
+		quad[1] = alphabet[v >> 12 & 0x3F];
+		quad[2] = i + 1 < len ? alphabet[v >> 6 & 0x3F] : '=';
+		quad[3] = i + 2 < len ? alphabet[v & 0x3F] : '=';
+		s_put(w, quad, 4);
+	}
+	s_putc(w, '"');
+}
+
+size_t pw_finish(struct payload_writer* w)
+{
+	if (w->overflow)
+		return 0;
+	// s_put always leaves one spare byte
+	w->buf[w->len] = '\0';
+	return w->len;
+}
+
+
+void event_payload_fall_write(struct payload_writer* w, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts)
+{
+	pw_map_begin(w);
+	pw_key(w, "type");
+	pw_uint(w, FALL_EVENT);
+	pw_key(w, "payload");
+	pw_map_begin(w);
+	pw_key(w, "status");
+	pw_text(w, status);
+	pw_key(w, "timestamp");
+	pw_uint(w, ts);
+	pw_key(w, "statusUpdateTimestamp");
+	pw_uint(w, update_ts);
+	pw_key(w, "endTimestamp");
+	pw_uint(w, end_ts);
+	pw_map_end(w);
+	pw_map_end(w);
+}
+
+size_t event_payload_fall(enum payload_encoding encoding, char* buf, size_t cap, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts)
+{
+	struct payload_writer w;
+
+	pw_init(&w, encoding, buf, cap);
+	event_payload_fall_write(&w, status, ts, update_ts, end_ts);
+	return pw_finish(&w);
+}
+
+size_t event_payload_presence(enum payload_encoding encoding, char* buf, size_t cap, bool is_present, uint32_t ts)
+{
+	struct payload_writer w;
+
+	pw_init(&w, encoding, buf, cap);
+	pw_map_begin(&w);
+	pw_key(&w, "type");
+	pw_uint(&w, PRESENCE_EVENT);
+	pw_key(&w, "payload");
+	pw_map_begin(&w);
+	pw_key(&w, "presenceDetected");
+	pw_bool(&w, is_present);
+	pw_key(&w, "timestamp");
+	pw_uint(&w, ts);
+	pw_map_end(&w);
+	pw_map_end(&w);
+	return pw_finish(&w);
+}
+
+size_t event_payload_response(enum payload_encoding encoding, char* buf, size_t cap, const char* id, int code, const char* msg, uint32_t ts)
+{
+	struct payload_writer w;
+
+	pw_init(&w, encoding, buf, cap);
+	pw_map_begin(&w);
+	pw_key(&w, "type");
+	pw_uint(&w, COMMAND_RESPONSE);
+	pw_key(&w, "payload");
+	pw_map_begin(&w);
+	pw_key(&w, "id");
+	pw_text(&w, id);
+	pw_key(&w, "code");
+	pw_int(&w, code);
+	pw_key(&w, "msg");
+	pw_text(&w, msg);
+	pw_key(&w, "timestamp");
+	pw_uint(&w, ts);
+	pw_map_end(&w);
+	pw_map_end(&w);
+	return pw_finish(&w);
+}
+
+size_t event_payload_capture(enum payload_encoding encoding, char* buf, size_t cap, uint8_t target_id, uint32_t ts,
+			     uint16_t pre_frames, uint16_t frames, const uint8_t* data, size_t len)
+{
+	struct payload_writer w;
+
+	pw_init(&w, encoding, buf, cap);
+	pw_map_begin(&w);
+	pw_key(&w, "type");
+	pw_uint(&w, FALL_CAPTURE);
+	pw_key(&w, "payload");
+	pw_map_begin(&w);
+	pw_key(&w, "targetId");
+	pw_uint(&w, target_id);
+	pw_key(&w, "timestamp");
+	pw_uint(&w, ts);
+	pw_key(&w, "preFrames");
+	pw_uint(&w, pre_frames);
+	pw_key(&w, "frames");
+	pw_uint(&w, frames);
+	pw_key(&w, "data");
+	pw_bytes(&w, data, len);
+	pw_map_end(&w);
+	pw_map_end(&w);
+	return pw_finish(&w);
+}
+
+bool payload_encoding_from_name(const char* name, enum payload_encoding* encoding)
+{
+	if (strcmp(name, "json") == 0) {
+		*encoding = PAYLOAD_JSON;
+		return true;
+	}
+	if (strcmp(name, "cbor") == 0) {
+		*encoding = PAYLOAD_CBOR;
+		return true;
+	}
+	return false;
+}
@@ -1,17 +1,142 @@
+#include <stdlib.h>
 #include "mqtt_client.h"
 #include "esp_log.h"
-#include "cJSON.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "time.h"
+#include "common.h"
 #include "ex_com_mqtt.h"
 #include "utils.h"
-#include "handle_spiffs.h"
+#include "config_store.h"
+#include "kv_store.h"
+#include "json_arena.h"
+#include "outbox.h"
+#include "telemetry.h"
+#include "cloud_upload.h"
+#include "uart_tap.h"
+#include "recorder.h"
+#include "fall_capture.h"
+#include "latency.h"
+#include "frame_loss.h"
+#include "metrics.h"
+#include "matrix_calc.h"
+#include "cJSON.h"
+#include "mqtt_command.h"
+#include "freertos/ringbuf.h"
+#include "radar_interface.h"
 
 const char* MQTT = "mqtt";
 
+/* Only the mqtt task publishes, one buffer is enough */
+static char publish_buf[EVENT_PAYLOAD_MAX];
+/* Replay of OUTBOX_BATCH_MAX fall events as one array */
+static char batch_buf[EVENT_PAYLOAD_MAX * 4];
+static char telemetry_buf[TELEMETRY_PAYLOAD_MAX];
+static uint8_t cloud_buf[CLOUD_PAYLOAD_MAX];
+/* Fall captures, the frames are compressed into capture_data before the event is written */
+static union {
+        uint8_t raw[CAPTURE_RAW_MAX];
+        char event[CAPTURE_EVENT_MAX];
+} capture_scratch;
+static uint8_t capture_data[CAPTURE_DATA_MAX];
+/* Written by the command worker */
+static char stats_buf[1024*2];
+static char latency_buf[1024];
+static char frame_loss_buf[1024];
+
+static enum command_code s_cmd_config(struct command_ctx* ctx);
+static enum command_code s_cmd_dump_stats(struct command_ctx* ctx);
+
+#define PENDING_ACKS 8                                  /**< QoS1 publishes tracked until PUBLISHED*/
+
+struct pending_ack {
+        int msg_id;
+        enum mqtt_lane lane;
+        int64_t enqueue_us;
+};
+
+/* Written by the publisher task, matched in the MQTT client task */
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct pending_ack pending_acks[PENDING_ACKS];
+static uint8_t pending_next = 0;
+static struct mqtt_publish_latency lane_latency[MQTT_LANE_COUNT];
+
+/* Indexed by enum DEVICE_STATE */
+static const struct fall_status fall_statuses[] = {
+        [FALL_DETECTED]  = {"fall detected", true, false},
+        [FALL_CONFIRMED] = {"fall confirmed", true, false},
+        [CALLING]        = {"calling", false, false},
+        [FINISHED]       = {"finished", false, true},
+        [FALL_EXITED]    = {"fall exited", false, true},
+};
+
+/* Outbox replay is stop-and-wait, one batch in flight at a time */
+static bool broker_connected = false;
+static uint32_t connect_gen = 0;
+/* Owned by the mqtt task */
+static int inflight_msg_id = 0;
+static int inflight_count = 0;
+static uint32_t inflight_gen = 0;
+static int64_t inflight_deadline_us = 0;
+static uint32_t inflight_seqs[OUTBOX_BATCH_MAX];
+
+#define RECORD_TIMES 32                                 /**< outbox records of this boot timed until acked*/
+
+struct record_time {
+        uint32_t seq;                   /**< outbox record, 0 when free*/
+        bool handed;                    /**< publish and frame to alert stages recorded*/
+        int64_t enqueue_us;
+        int64_t frame_us;
+};
+
+/* Owned by the mqtt task, indexed by seq % RECORD_TIMES */
+static struct record_time record_times[RECORD_TIMES];
+
+#define DELIVERY_NOTES 8                                /**< acks and deletions kept until the outbox looks for them*/
+
+enum delivery {
+        DELIVERY_NONE,
+        DELIVERY_ACKED,
+        DELIVERY_DELETED,
+};
+
+struct delivery_note {
+        int msg_id;
+        enum delivery result;
+};
 
-#define FALL_EVENT 1
-#define PRESENCE_EVENT 0
+/* Written by the MQTT client task under ack_lock, whether or not the msg_id is known to be in flight yet:
+ * the PUBLISHED ack can be handled before esp_mqtt_client_publish has returned its msg_id */
+static struct delivery_note delivery_notes[DELIVERY_NOTES];
+static uint8_t delivery_next = 0;
+
+struct mqtt_topic_table {
+        char device_id[MQTT_DEVICE_ID_MAX];
+        char topic[MQTT_TOPIC_COUNT][MQTT_TOPIC_MAX];
+};
+
+static const char* const topic_formats[MQTT_TOPIC_COUNT] = {
+        [MQTT_TOPIC_EVENTS] = TOPIC_UPSTREAM_EVENTS,
+        [MQTT_TOPIC_STATE] = TOPIC_UPSTREAM_STATE,
+        [MQTT_TOPIC_TELEMETRY] = TOPIC_UPSTREAM_TELEMETRY,
+        [MQTT_TOPIC_POINTCLOUD] = TOPIC_UPSTREAM_POINTCLOUD,
+        [MQTT_TOPIC_ANALYTICS] = TOPIC_UPSTREAM_ANALYTICS,
+        [MQTT_TOPIC_RECORDER] = TOPIC_UPSTREAM_RECORDER,
+        [MQTT_TOPIC_COMMANDS] = TOPIC_DOWNSTREAM_COMMANDS,
+        [MQTT_TOPIC_CONFIG] = TOPIC_DOWNSTREAM_CONFIG,
+};
+
+/* A format with the longest device id in place of %s, terminator included, fits in MQTT_TOPIC_MAX */
+#define TOPIC_FITS(fmt) (sizeof(fmt) - sizeof("%s") + MQTT_DEVICE_ID_MAX <= MQTT_TOPIC_MAX)
+_Static_assert(TOPIC_FITS(TOPIC_UPSTREAM_EVENTS) && TOPIC_FITS(TOPIC_UPSTREAM_STATE) &&
+               TOPIC_FITS(TOPIC_UPSTREAM_TELEMETRY) && TOPIC_FITS(TOPIC_UPSTREAM_POINTCLOUD) &&
+               TOPIC_FITS(TOPIC_UPSTREAM_ANALYTICS) && TOPIC_FITS(TOPIC_UPSTREAM_RECORDER) &&
+               TOPIC_FITS(TOPIC_DOWNSTREAM_COMMANDS) && TOPIC_FITS(TOPIC_DOWNSTREAM_CONFIG),
+               "MQTT_TOPIC_MAX too small for a topic with the longest device id");
+
+/* Double buffered so the publisher never reads a table being rewritten */
+static struct mqtt_topic_table topic_tables[2];
+static struct mqtt_topic_table* volatile topics = &topic_tables[0];
 
 void log_error_if_nonzero(const char* message, int error_code)
 {
@@ -20,141 +145,29 @@ void log_error_if_nonzero(const char* message, int error_code)
         }
 }
 
-/**
- * @brief Create presence buffer to send to MQTT
- * 
- * @param is_present True or False
- * @param ts Timestamp
- * @return char* The buffer
- */
-static char* s_contruct_presence_data_json(bool is_present, uint32_t ts)
-{
-        // cJson Components
-        char* string = NULL;
-        cJSON *type = NULL;
-        cJSON *payload = NULL;
-        cJSON *is_present_json = NULL;
-        cJSON *ts_json = NULL;
-        cJSON *presence_data = cJSON_CreateObject();
-        if (presence_data == NULL) {
-                goto end;
-        }
-        /*  Type */
-        type = cJSON_CreateNumber(PRESENCE_EVENT);
-        if (type == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(presence_data, "type", type);
-        /*  Payload */
-        payload = cJSON_CreateObject();
-        if (payload == NULL) {
-                goto end;
-        }
-        is_present_json = cJSON_CreateBool(is_present);
-        if (is_present_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "presenceDetected", is_present_json);
-        ts_json = cJSON_CreateNumber(ts);
-        if (ts_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "timestamp", ts_json);
-        cJSON_AddItemToObject(presence_data, "payload", payload);
-        // Result
-        string = cJSON_Print(presence_data);
-        if (string == NULL) {
-                printf("Failed to print fall_data.\n");
-        }
-end:
-        cJSON_Delete(presence_data);
-        return string;
-}
-
-/**
- * @brief Create fall buffer to send to MQTT
- * 
- * @param status The fall status
- * @param ts The timestamp      
- * @param update_ts The timestamp at update moment
- * @param end_ts The timestamp where event ends
- * @return char* The buffer
- */
-static char* s_contruct_fall_data_json(const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts)
-{
-        // cJson Components
-        char* string = NULL;
-        cJSON *type = NULL;
-        cJSON *payload = NULL;
-        cJSON *status_json = NULL;
-        cJSON *ts_json = NULL;
-        cJSON *update_ts_json = NULL;
-        cJSON *end_ts_json = NULL;
-        cJSON *fall_data = cJSON_CreateObject();
-        if (fall_data == NULL) {
-                goto end;
-        }
-        /*  Type */
-        type = cJSON_CreateNumber(FALL_EVENT);
-        if (type == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(fall_data, "type", type);
-        /*  Payload */
-        payload = cJSON_CreateObject();
-        if (payload == NULL) {
-                goto end;
-        }
-        status_json = cJSON_CreateString(status);
-        if (status_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "status", status_json);
-        ts_json = cJSON_CreateNumber(ts);
-        if (ts_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "timestamp", ts_json);
-        update_ts_json = cJSON_CreateNumber(update_ts);
-        if (update_ts_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "statusUpdateTimestamp", update_ts_json);
-        end_ts_json = cJSON_CreateNumber(end_ts);
-        if (end_ts_json == NULL) {
-                goto end;
-        }
-        cJSON_AddItemToObject(payload, "endTimestamp", end_ts_json);
-        cJSON_AddItemToObject(fall_data, "payload", payload);
-        // Result
-        string = cJSON_Print(fall_data);
-        if (string == NULL) {
-                printf("Failed to print fall_data.\n");
-        }
-end:
-        cJSON_Delete(fall_data);
-        return string;
-}
-
 esp_mqtt_client_handle_t init_mqtt_client(void *callback)
 {
-        // TODO: get flash memory
-        char* mqtt_json = read_mqtt_cfg();
-        char* mqtt_hostname = parse_mqtt_hostname(mqtt_json);
-        char* mqtt_port = parse_mqtt_port(mqtt_json);
-        char* mqtt_username = parse_mqtt_username(mqtt_json);
-        char* mqtt_password = parse_mqtt_password(mqtt_json);
+        struct config_mqtt broker;
 
+        config_get_mqtt(&broker);
         const esp_mqtt_client_config_t mqtt_cfg = {
-            .uri = mqtt_hostname,
-            .port = atoi(mqtt_port),
+            .uri = broker.hostname,
+            .port = broker.port,
             .client_id = "danh-esp",
-            // .username = mqtt_username,
-            // .password = mqtt_password,
+            // .username = broker.username,
+            // .password = broker.password,
             .keepalive = 15,
             .reconnect_timeout_ms = 15,
             .message_retransmit_timeout = 60};
+        // Client keeps its own copy of the config strings
         esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+        if (client == NULL) {
+                return NULL;
+        }
+        mqtt_topics_build();
+        mqtt_command_register("config", s_cmd_config);
+        mqtt_command_register("dump-stats", s_cmd_dump_stats);
+        mqtt_command_start(client);
         esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, callback, client);
         if (esp_mqtt_client_start(client) != ESP_OK) {
                 return NULL;
@@ -162,44 +175,529 @@ esp_mqtt_client_handle_t init_mqtt_client(void *callback)
         return (client);
 }
 
-char* s_get_mqtt_topic(char* mqtt_topic)
+bool mqtt_topics_build(void)
 {
-        int next_ptr_pos = 0;
         char device_id[100];
+        const struct mqtt_topic_table* curr = topics;
+        struct mqtt_topic_table* next = (curr == &topic_tables[0]) ? &topic_tables[1] : &topic_tables[0];
+
         get_device_id(device_id);
-        // printf("mydev %s\n", device_id);
-        int total_len = strlen(MQTT_PREFIX_TOPIC) + 1 + strlen(device_id) + strlen(mqtt_topic) + 1;
-        char* topic = (char* )malloc(sizeof(char) * total_len);
-        strcpy(topic, MQTT_PREFIX_TOPIC);
-        next_ptr_pos += strlen(MQTT_PREFIX_TOPIC);
-        strcpy(topic + next_ptr_pos, "/");
-        next_ptr_pos += 1;
-        // TODO: get device id
-        strcpy(topic + next_ptr_pos, device_id);
-        next_ptr_pos += strlen(device_id);
-        strcpy(topic + next_ptr_pos, mqtt_topic);
-        // free(device_id);
-        return topic;
-}
-
-void send_fall(esp_mqtt_client_handle_t client, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts)
-{
-        char* topic = s_get_mqtt_topic(TOPIC_UPSTREAM_EVENTS);
-        char* msg = s_contruct_fall_data_json(status, ts, update_ts, end_ts);
-        int msg_id = esp_mqtt_client_publish(client, topic, msg, 0, 1, 0);
-        ESP_LOGI(MQTT, "sent publish successful, msg_id=%d", msg_id);
-        free(topic);
-        free(msg);
-}
-
-void send_presence(presence_mqtt_params *presence_msg)
-{
-        char* topic = s_get_mqtt_topic(TOPIC_UPSTREAM_EVENTS);
-        char* msg = s_contruct_presence_data_json(presence_msg->is_present, (intmax_t)time(NULL));
-        int msg_id = esp_mqtt_client_publish(presence_msg->client, topic, msg, 0, 1, 0);
-        ESP_LOGI(MQTT, "sent publish successful, msg_id=%d", msg_id);
-        free(topic);
-        free(msg);
+        if (strlen(device_id) >= MQTT_DEVICE_ID_MAX) {
+                ESP_LOGE(MQTT, "Device id %s too long for topics", device_id);
+                return curr->device_id[0] != '\0';
+        }
+        if (strcmp(device_id, curr->device_id) == 0)
+                return true;
+
+        strcpy(next->device_id, device_id);
+        for (int i = 0; i < MQTT_TOPIC_COUNT; i++) {
+                // Cannot truncate, see TOPIC_FITS, kept in case a format gains a second conversion
+                int len = snprintf(next->topic[i], MQTT_TOPIC_MAX, topic_formats[i], device_id);
+                if (len < 0 || len >= MQTT_TOPIC_MAX) {
+                        ESP_LOGE(MQTT, "Topic %d truncated", i);
+                        return false;
+                }
+        }
+        // Readers take the pointer once, the old table stays intact until the following rebuild
+        topics = next;
+        ESP_LOGI(MQTT, "Topic table built for %s", device_id);
+        return true;
+}
+
+const char* mqtt_topic(enum mqtt_topic topic)
+{
+        return topics->topic[topic];
+}
+
+int send_fall(esp_mqtt_client_handle_t client, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts)
+{
+        int msg_id = -1;
+        const char* topic = mqtt_topic(MQTT_TOPIC_EVENTS);
+        size_t len = event_payload_fall(mqtt_payload_encoding(), publish_buf, sizeof(publish_buf), status, ts, update_ts, end_ts);
+        if (len > 0) {
+                msg_id = esp_mqtt_client_publish(client, topic, publish_buf, len, 1, 0);
+                ESP_LOGI(MQTT, "sent publish successful, msg_id=%d", msg_id);
+        } else {
+                ESP_LOGE(MQTT, "Fall event does not fit in publish buffer");
+        }
+        return msg_id;
+}
+
+int send_presence(presence_mqtt_params *presence_msg)
+{
+        int msg_id = -1;
+        const char* topic = mqtt_topic(MQTT_TOPIC_EVENTS);
+        size_t len = event_payload_presence(mqtt_payload_encoding(), publish_buf, sizeof(publish_buf), presence_msg->is_present, (intmax_t)time(NULL));
+        if (len > 0) {
+                msg_id = esp_mqtt_client_publish(presence_msg->client, topic, publish_buf, len, 1, 0);
+                ESP_LOGI(MQTT, "sent publish successful, msg_id=%d", msg_id);
+        } else {
+                ESP_LOGE(MQTT, "Presence event does not fit in publish buffer");
+        }
+        return msg_id;
+}
+
+int send_telemetry(esp_mqtt_client_handle_t client)
+{
+        int sent = 0;
+
+        // Bounded so a backlog cannot hold the fall lane for long
+        while (sent < 4 && telemetry_pending() > 0) {
+                uint32_t until;
+                size_t len = telemetry_build(mqtt_payload_encoding(), telemetry_buf, sizeof(telemetry_buf), &until);
+                if (len == 0)
+                        break;
+                if (esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_TELEMETRY), telemetry_buf, len, 0, 0) < 0) {
+                        ESP_LOGW(MQTT, "Telemetry not sent, %u samples kept", telemetry_pending());
+                        break;
+                }
+                telemetry_commit(until);
+                sent++;
+        }
+        return sent;
+}
+
+int send_point_cloud(esp_mqtt_client_handle_t client)
+{
+        uint32_t until;
+        int msg_id;
+        size_t len = cloud_upload_build(cloud_buf, sizeof(cloud_buf), &until);
+
+        if (len == 0)
+                return -1;
+        if (!cloud_upload_spend(len)) {
+                ESP_LOGD(MQTT, "Point cloud batch of %u B over budget", (unsigned)len);
+                cloud_upload_commit(until, 0);
+                return -1;
+        }
+        msg_id = esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_POINTCLOUD), (const char*)cloud_buf, len, 0, 0);
+        cloud_upload_commit(until, msg_id < 0 ? 0 : len);
+        return msg_id;
+}
+
+int send_fall_capture(esp_mqtt_client_handle_t client)
+{
+        struct fall_capture_info info;
+        int msg_id = -1;
+        size_t len = 0;
+
+        // Kept frozen until the broker can take it, the ring is small enough to wait
+        if (!broker_connected || !fall_capture_ready())
+                return -1;
+        size_t data_len = fall_capture_build(capture_data, sizeof(capture_data), capture_scratch.raw, &info);
+        if (data_len > 0) {
+                uint32_t ts = (uint32_t)(time(NULL) - (esp_timer_get_time() - info.trigger_us) / 1000000);
+                len = event_payload_capture(mqtt_payload_encoding(), capture_scratch.event, sizeof(capture_scratch.event),
+                                            info.target_id, ts, info.pre_frames, info.frames, capture_data, data_len);
+        }
+        if (len > 0) {
+                msg_id = esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_EVENTS), capture_scratch.event, len, 1, 0);
+                ESP_LOGI(MQTT, "Fall capture of %u B sent, msg_id=%d", (unsigned)len, msg_id);
+        } else {
+                ESP_LOGE(MQTT, "Fall capture not built");
+        }
+        fall_capture_release(msg_id >= 0);
+        return msg_id;
+}
+
+int send_latency_snapshot(esp_mqtt_client_handle_t client)
+{
+        struct payload_writer w;
+        size_t len;
+
+        pw_init(&w, mqtt_payload_encoding(), latency_buf, sizeof(latency_buf));
+        pw_map_begin(&w);
+        pw_key(&w, "type");
+        pw_text(&w, "latency");
+        pw_key(&w, "timestamp");
+        pw_uint(&w, (uint32_t)time(NULL));
+        pw_key(&w, "unit");
+        pw_text(&w, "us");
+        pw_key(&w, "stages");
+        pw_map_begin(&w);
+        for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+                struct latency_summary sum;
+                latency_get_summary(i, &sum);
+                pw_key(&w, latency_stage_name(i));
+                pw_map_begin(&w);
+                pw_key(&w, "count");
+                pw_uint(&w, sum.count);
+                pw_key(&w, "p50");
+                pw_uint(&w, sum.p50);
+                pw_key(&w, "p90");
+                pw_uint(&w, sum.p90);
+                pw_key(&w, "p99");
+                pw_uint(&w, sum.p99);
+                pw_key(&w, "max");
+                pw_uint(&w, sum.max);
+                pw_map_end(&w);
+        }
+        pw_map_end(&w);
+        pw_map_end(&w);
+        len = pw_finish(&w);
+        if (len == 0) {
+                ESP_LOGE(MQTT, "Latency snapshot does not fit");
+                return -1;
+        }
+        return esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_ANALYTICS), latency_buf, len, 0, 0);
+}
+
+int send_frame_loss_summary(esp_mqtt_client_handle_t client)
+{
+        struct payload_writer w;
+        uint32_t causes[FRAME_LOSS_CAUSE_COUNT] = {0};
+        size_t len;
+
+        pw_init(&w, mqtt_payload_encoding(), frame_loss_buf, sizeof(frame_loss_buf));
+        pw_map_begin(&w);
+        pw_key(&w, "type");
+        pw_text(&w, "frameLoss");
+        pw_key(&w, "timestamp");
+        pw_uint(&w, (uint32_t)time(NULL));
+        pw_key(&w, "parsed");
+        pw_uint(&w, __atomic_load_n(&metric_counters[METRIC_FRAMES_PARSED], __ATOMIC_RELAXED));
+        pw_key(&w, "stages");
+        pw_map_begin(&w);
+        for (int i = 0; i < FRAME_LOSS_STAGE_COUNT; i++) {
+                struct frame_loss_stats stats;
+                frame_loss_get(i, &stats);
+                causes[frame_loss_cause_of(i)] += stats.lost;
+                pw_key(&w, frame_loss_stage_name(i));
+                pw_map_begin(&w);
+                pw_key(&w, "lost");
+                pw_uint(&w, stats.lost);
+                pw_key(&w, "events");
+                pw_uint(&w, stats.events);
+                pw_key(&w, "lastFrame");
+                pw_uint(&w, stats.last_frame);
+                pw_map_end(&w);
+        }
+        pw_map_end(&w);
+        pw_key(&w, "causes");
+        pw_map_begin(&w);
+        for (int i = 0; i < FRAME_LOSS_CAUSE_COUNT; i++) {
+                pw_key(&w, frame_loss_cause_name(i));
+                pw_uint(&w, causes[i]);
+        }
+        pw_map_end(&w);
+        pw_map_end(&w);
+        len = pw_finish(&w);
+        if (len == 0) {
+                ESP_LOGE(MQTT, "Frame loss summary does not fit");
+                return -1;
+        }
+        return esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_ANALYTICS), frame_loss_buf, len, 0, 0);
+}
+
+void mqtt_track_publish(int msg_id, enum mqtt_lane lane, int64_t enqueue_us)
+{
+        if (msg_id <= 0) {
+                // Not handed to the client, there will be no ack to wait for
+                portENTER_CRITICAL(&ack_lock);
+                lane_latency[lane].failed++;
+                portEXIT_CRITICAL(&ack_lock);
+                return;
+        }
+        portENTER_CRITICAL(&ack_lock);
+        struct pending_ack* slot = &pending_acks[pending_next];
+        if (slot->msg_id > 0) {
+                // Oldest entry never acked, most likely dropped with the session
+                lane_latency[slot->lane].untracked++;
+        }
+        slot->msg_id = msg_id;
+        slot->lane = lane;
+        slot->enqueue_us = enqueue_us;
+        pending_next = (pending_next + 1) % PENDING_ACKS;
+        portEXIT_CRITICAL(&ack_lock);
+}
+
+/**
+ * @brief Remember what became of a publish, ack_lock held
+ * 
+ */
+static void s_note_delivery(int msg_id, enum delivery result)
+{
+        delivery_notes[delivery_next].msg_id = msg_id;
+        delivery_notes[delivery_next].result = result;
+        delivery_next = (delivery_next + 1) % DELIVERY_NOTES;
+}
+
+/**
+ * @brief Take the note of a publish
+ * 
+ * @return enum delivery DELIVERY_NONE while neither acked nor deleted
+ */
+static enum delivery s_take_delivery(int msg_id)
+{
+        enum delivery result = DELIVERY_NONE;
+
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < DELIVERY_NOTES; i++) {
+                if (delivery_notes[i].msg_id != msg_id)
+                        continue;
+                result = delivery_notes[i].result;
+                delivery_notes[i].msg_id = 0;
+                break;
+        }
+        portEXIT_CRITICAL(&ack_lock);
+        return result;
+}
+
+/**
+ * @brief Count an acked event of a lane, ack_lock held
+ * 
+ * @return uint32_t latency from enqueue to ack in ms
+ */
+static uint32_t s_count_ack(enum mqtt_lane lane, int64_t enqueue_us, int64_t now)
+{
+        struct mqtt_publish_latency* stat = &lane_latency[lane];
+        uint32_t latency_ms = (uint32_t)((now - enqueue_us) / 1000);
+
+        stat->count++;
+        stat->last_ms = latency_ms;
+        stat->total_ms += latency_ms;
+        if (latency_ms > stat->max_ms)
+                stat->max_ms = latency_ms;
+        return latency_ms;
+}
+
+void mqtt_on_published(int msg_id)
+{
+        int64_t now = esp_timer_get_time();
+        bool found = false;
+        enum mqtt_lane lane = MQTT_LANE_FALL;
+        uint32_t latency_ms = 0;
+
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < PENDING_ACKS; i++) {
+                if (pending_acks[i].msg_id != msg_id)
+                        continue;
+                lane = pending_acks[i].lane;
+                latency_ms = s_count_ack(lane, pending_acks[i].enqueue_us, now);
+                pending_acks[i].msg_id = 0;
+                found = true;
+                break;
+        }
+        s_note_delivery(msg_id, DELIVERY_ACKED);
+        portEXIT_CRITICAL(&ack_lock);
+        if (found) {
+                ESP_LOGI(MQTT, "%s event acked %u ms after enqueue, msg_id=%d",
+                         lane == MQTT_LANE_FALL ? "Fall" : "Presence", latency_ms, msg_id);
+        }
+}
+
+void mqtt_on_deleted(int msg_id)
+{
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < PENDING_ACKS; i++) {
+                if (pending_acks[i].msg_id != msg_id)
+                        continue;
+                lane_latency[pending_acks[i].lane].deleted++;
+                pending_acks[i].msg_id = 0;
+                break;
+        }
+        s_note_delivery(msg_id, DELIVERY_DELETED);
+        portEXIT_CRITICAL(&ack_lock);
+}
+
+const struct fall_status* mqtt_fall_status(uint8_t status)
+{
+        if (status >= sizeof(fall_statuses) / sizeof(fall_statuses[0]) || fall_statuses[status].name == NULL)
+                return NULL;
+        return &fall_statuses[status];
+}
+
+void mqtt_set_connected(bool connected)
+{
+        if (connected)
+                __atomic_fetch_add(&connect_gen, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&broker_connected, connected, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Publish outbox records, one object for a single record or an array for a batch
+ * @details Every status must be known to #mqtt_fall_status.
+ * 
+ * @return int msg_id, -1 on failure
+ */
+static int s_publish_outbox_batch(esp_mqtt_client_handle_t client, const struct outbox_entry* entries, int count)
+{
+        enum payload_encoding enc = mqtt_payload_encoding();
+        struct payload_writer w;
+        size_t len;
+
+        if (count == 1) {
+                len = event_payload_fall(enc, publish_buf, sizeof(publish_buf), mqtt_fall_status(entries[0].status)->name,
+                                         entries[0].ts, entries[0].update_ts, entries[0].end_ts);
+                return len > 0 ? esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_EVENTS), publish_buf, len, 1, 0) : -1;
+        }
+        pw_init(&w, enc, batch_buf, sizeof(batch_buf));
+        pw_array_begin(&w);
+        for (int i = 0; i < count; i++) {
+                event_payload_fall_write(&w, mqtt_fall_status(entries[i].status)->name,
+                                         entries[i].ts, entries[i].update_ts, entries[i].end_ts);
+        }
+        pw_array_end(&w);
+        len = pw_finish(&w);
+        return len > 0 ? esp_mqtt_client_publish(client, mqtt_topic(MQTT_TOPIC_EVENTS), batch_buf, len, 1, 0) : -1;
+}
+
+void mqtt_outbox_track(uint32_t seq, int64_t enqueue_us, int64_t frame_us)
+{
+        struct record_time* t = &record_times[seq % RECORD_TIMES];
+
+        if (t->seq != 0) {
+                // Still unacked RECORD_TIMES records later, its ack is not timed
+                portENTER_CRITICAL(&ack_lock);
+                lane_latency[MQTT_LANE_FALL].untracked++;
+                portEXIT_CRITICAL(&ack_lock);
+        }
+        t->seq = seq;
+        t->handed = false;
+        t->enqueue_us = enqueue_us;
+        t->frame_us = frame_us;
+}
+
+/**
+ * @brief Timing of an outbox record appended this boot
+ * 
+ * @return struct record_time* NULL when not tracked
+ */
+static struct record_time* s_record_time(uint32_t seq)
+{
+        struct record_time* t = &record_times[seq % RECORD_TIMES];
+
+        return t->seq == seq && seq != 0 ? t : NULL;
+}
+
+/**
+ * @brief Close the publish and frame to alert stages of the records just handed to the client
+ * @details A record sent again keeps the time of its first hand-off, its ack is timed separately.
+ */
+static void s_time_handed(const uint32_t* seqs, int count)
+{
+        int64_t now = esp_timer_get_time();
+
+        for (int i = 0; i < count; i++) {
+                struct record_time* t = s_record_time(seqs[i]);
+                if (t == NULL || t->handed)
+                        continue;
+                latency_record(LATENCY_PUBLISH, t->enqueue_us, now);
+                latency_record(LATENCY_FRAME_TO_ALERT, t->frame_us, now);
+                t->handed = true;
+        }
+}
+
+/**
+ * @brief Count the ack or the deletion of every timed record of the batch in flight
+ * 
+ */
+static void s_time_delivery(enum delivery result)
+{
+        int64_t now = esp_timer_get_time();
+        uint32_t worst_ms = 0;
+        int timed = 0;
+
+        portENTER_CRITICAL(&ack_lock);
+        for (int i = 0; i < inflight_count; i++) {
+                struct record_time* t = s_record_time(inflight_seqs[i]);
+                if (t == NULL)
+                        continue;
+                timed++;
+                if (result == DELIVERY_DELETED) {
+                        lane_latency[MQTT_LANE_FALL].deleted++;
+                        continue;
+                }
+                uint32_t latency_ms = s_count_ack(MQTT_LANE_FALL, t->enqueue_us, now);
+                if (latency_ms > worst_ms)
+                        worst_ms = latency_ms;
+                t->seq = 0;
+        }
+        portEXIT_CRITICAL(&ack_lock);
+        if (result == DELIVERY_ACKED && timed > 0) {
+                ESP_LOGI(MQTT, "Fall events acked up to %u ms after enqueue, %d records, msg_id=%d",
+                         worst_ms, timed, inflight_msg_id);
+        }
+}
+
+int mqtt_outbox_service(esp_mqtt_client_handle_t client)
+{
+        struct outbox_entry entries[OUTBOX_BATCH_MAX];
+        uint32_t seqs[OUTBOX_BATCH_MAX];
+        int first_msg_id = 0;
+
+        for (;;) {
+                uint32_t gen = __atomic_load_n(&connect_gen, __ATOMIC_ACQUIRE);
+
+                if (inflight_msg_id > 0) {
+                        enum delivery result = s_take_delivery(inflight_msg_id);
+                        if (result == DELIVERY_ACKED) {
+                                s_time_delivery(result);
+                                outbox_ack(inflight_count);
+                                inflight_msg_id = 0;
+                        } else if (result == DELIVERY_DELETED || inflight_gen != gen ||
+                                   esp_timer_get_time() >= inflight_deadline_us) {
+                                // Given up by the client, lost with the session or never acked, replay from the tail
+                                ESP_LOGW(MQTT, "Outbox msg_id=%d %s, sending %d records again", inflight_msg_id,
+                                         result == DELIVERY_DELETED ? "deleted" : (inflight_gen != gen ? "lost" : "timed out"),
+                                         inflight_count);
+                                metric_inc(METRIC_OUTBOX_RETRIES);
+                                if (result == DELIVERY_DELETED)
+                                        s_time_delivery(result);
+                                inflight_msg_id = 0;
+                        } else {
+                                return first_msg_id;
+                        }
+                }
+                if (!__atomic_load_n(&broker_connected, __ATOMIC_ACQUIRE))
+                        return first_msg_id;
+                int count = outbox_peek(entries, seqs, OUTBOX_BATCH_MAX);
+                if (count == 0)
+                        return first_msg_id;
+                // The batch stops before a status this firmware does not know
+                int known = 0;
+                while (known < count && mqtt_fall_status(entries[known].status) != NULL)
+                        known++;
+                if (known == 0) {
+                        // Written by a firmware with another DEVICE_STATE numbering, it can never be sent
+                        ESP_LOGE(MQTT, "Outbox record with unknown status %u dropped", entries[0].status);
+                        outbox_ack(1);
+                        continue;
+                }
+                count = known;
+                int msg_id = s_publish_outbox_batch(client, entries, count);
+                if (msg_id <= 0) {
+                        ESP_LOGE(MQTT, "Outbox replay of %d records failed", count);
+                        return first_msg_id;
+                }
+                ESP_LOGI(MQTT, "Outbox sent %d records, msg_id=%d", count, msg_id);
+                s_time_handed(seqs, count);
+                memcpy(inflight_seqs, seqs, count * sizeof(seqs[0]));
+                // An ack handled meanwhile is kept in delivery_notes
+                inflight_msg_id = msg_id;
+                inflight_count = count;
+                inflight_gen = gen;
+                inflight_deadline_us = esp_timer_get_time() + OUTBOX_ACK_TIMEOUT_MS * 1000LL;
+                if (first_msg_id == 0)
+                        first_msg_id = msg_id;
+        }
+}
+
+uint32_t mqtt_outbox_wait_ms(void)
+{
+        int64_t left_us;
+
+        if (inflight_msg_id <= 0)
+                return UINT32_MAX;
+        left_us = inflight_deadline_us - esp_timer_get_time();
+        return left_us > 0 ? (uint32_t)((left_us + 999) / 1000) : 0;
+}
+
+void mqtt_get_publish_latency(enum mqtt_lane lane, struct mqtt_publish_latency* out)
+{
+        portENTER_CRITICAL(&ack_lock);
+        *out = lane_latency[lane];
+        portEXIT_CRITICAL(&ack_lock);
 }
 /**
  * @brief Handler for MQTT_CONNECTED event
@@ -231,22 +729,312 @@ static void s_mqtt_subscribe(esp_mqtt_client_handle_t client, esp_mqtt_event_han
         ESP_LOGI(MQTT, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
 }
 
-void s_handle_mqtt_topic(esp_mqtt_event_handle_t event)
+enum payload_encoding mqtt_payload_encoding(void)
+{
+        struct config_app app;
+
+        // Set by the command worker, read by every publisher
+        config_get_app(&app);
+        return (enum payload_encoding)app.payload_encoding;
+}
+
+/**
+ * @brief Apply app config keys handled at runtime (encoding, telemetry and point cloud upload)
+ * 
+ * @param cfg parsed config message
+ */
+static void s_apply_app_config(const cJSON* cfg)
 {
-        char mq_topic[50];
-        char mq_data[500];
-        char* check_cmd;
-        char* check_cfg;
-        sprintf(mq_topic, "%.*s", event->topic_len, event->topic);
-        sprintf(mq_data, "%.*s", event->data_len, event->data);
-        check_cmd = strstr(mq_topic, "commands");
-        check_cfg = strstr(mq_topic, "config");
-        if (check_cmd != NULL) {
-                //topic is from command
+        cJSON *app_cfg = cJSON_GetObjectItemCaseSensitive(cfg, "app_config");
+        cJSON *enc = cJSON_GetObjectItemCaseSensitive(app_cfg, "payloadEncoding");
+        cJSON *telemetry = cJSON_GetObjectItemCaseSensitive(app_cfg, "telemetryIntervalSec");
+        cJSON *cloud = cJSON_GetObjectItemCaseSensitive(app_cfg, "pointCloudUpload");
+        cJSON *cloud_budget = cJSON_GetObjectItemCaseSensitive(app_cfg, "pointCloudBudget");
+        if (cJSON_IsString(enc) && (enc->valuestring != NULL)) {
+                struct config_app app;
+                enum payload_encoding encoding;
+
+                config_get_app(&app);
+                if (payload_encoding_from_name(enc->valuestring, &encoding)) {
+                        app.payload_encoding = encoding;
+                        if (config_set_app(&app) == ESP_OK)
+                                ESP_LOGI(MQTT, "Upstream payload encoding: %s", enc->valuestring);
+                        else
+                                ESP_LOGE(MQTT, "Cannot store payload encoding %s", enc->valuestring);
+                } else {
+                        ESP_LOGE(MQTT, "Unknown payload encoding %s", enc->valuestring);
+                }
         }
-        if (check_cfg != NULL) {
-                //topic is from config
-                write_radar_cfg(mq_data);
+        if (cJSON_IsNumber(telemetry) && telemetry->valueint >= 0) {
+                telemetry_set_interval(telemetry->valueint);
+                ESP_LOGI(MQTT, "Telemetry interval: %d s", telemetry->valueint);
+        }
+        if (cJSON_IsNumber(cloud_budget) && cloud_budget->valueint > 0)
+                cloud_upload_set_budget(cloud_budget->valueint);
+        if (cJSON_IsBool(cloud))
+                cloud_upload_enable(cJSON_IsTrue(cloud));
+}
+
+/**
+ * @brief Merge the "radar_config" keys into the stored radar config and send the changes
+ * @details Keys are CLI command words, values their arguments. Stored only when the radar took them.
+ * 
+ * @param cfg parsed config message
+ */
+static void s_apply_radar_config(const cJSON* cfg)
+{
+        // Too large for the worker stack
+        static struct config_radar radar;
+        const cJSON* radar_cfg = cJSON_GetObjectItemCaseSensitive(cfg, "radar_config");
+        const cJSON* item;
+
+        if (!cJSON_IsObject(radar_cfg))
+                return;
+        config_get_radar(&radar);
+        cJSON_ArrayForEach(item, radar_cfg) {
+                int i = 0;
+                if (!cJSON_IsString(item) || strlen(item->string) >= CONFIG_RADAR_KEY_MAX ||
+                    strlen(item->valuestring) >= CONFIG_RADAR_VALUE_MAX) {
+                        ESP_LOGE(MQTT, "Radar config %s rejected", item->string);
+                        return;
+                }
+                while (i < radar.num_keys && strcmp(radar.item[i].key, item->string) != 0)
+                        i++;
+                if (i == CONFIG_RADAR_KEYS) {
+                        ESP_LOGE(MQTT, "Radar config has more than %d keys", CONFIG_RADAR_KEYS);
+                        return;
+                }
+                if (i == radar.num_keys) {
+                        strcpy(radar.item[i].key, item->string);
+                        radar.num_keys++;
+                }
+                strcpy(radar.item[i].value, item->valuestring);
+        }
+        if (radar_apply_config(&radar) < 0) {
+                ESP_LOGE(MQTT, "Radar config rejected, running config kept");
+                return;
+        }
+        config_set_radar(&radar);
+}
+
+/**
+ * @brief Config topic, applied on the command worker without response
+ * 
+ */
+static enum command_code s_cmd_config(struct command_ctx* ctx)
+{
+        s_apply_app_config(ctx->args);
+        s_apply_radar_config(ctx->args);
+        return COMMAND_SUCCESS;
+}
+
+static void s_write_latency(struct payload_writer* w, const char* key, enum mqtt_lane lane)
+{
+        struct mqtt_publish_latency lat;
+
+        mqtt_get_publish_latency(lane, &lat);
+        pw_key(w, key);
+        pw_map_begin(w);
+        pw_key(w, "count");
+        pw_uint(w, lat.count);
+        pw_key(w, "lastMs");
+        pw_uint(w, lat.last_ms);
+        pw_key(w, "maxMs");
+        pw_uint(w, lat.max_ms);
+        pw_key(w, "avgMs");
+        pw_uint(w, lat.count ? (uint32_t)(lat.total_ms / lat.count) : 0);
+        pw_key(w, "failed");
+        pw_uint(w, lat.failed);
+        pw_key(w, "deleted");
+        pw_uint(w, lat.deleted);
+        pw_map_end(w);
+}
+
+/**
+ * @brief dump-stats, publish the runtime counters on the analytics topic
+ * 
+ */
+static enum command_code s_cmd_dump_stats(struct command_ctx* ctx)
+{
+        struct payload_writer w;
+        struct outbox_stats outbox;
+        struct cloud_upload_stats cloud;
+        struct uart_tap_stats tap;
+        struct radar_cfg_stats radar_cfg;
+        struct kv_stats kv;
+        struct recorder_stats rec;
+        struct fall_capture_stats capture;
+        size_t len;
+
+        outbox_get_stats(&outbox);
+        cloud_upload_get_stats(&cloud);
+        uart_tap_get_stats(&tap);
+        radar_get_cfg_stats(&radar_cfg);
+        kv_get_stats(&kv);
+        recorder_get_stats(&rec);
+        fall_capture_get_stats(&capture);
+        pw_init(&w, mqtt_payload_encoding(), stats_buf, sizeof(stats_buf));
+        pw_map_begin(&w);
+        pw_key(&w, "type");
+        pw_text(&w, "stats");
+        pw_key(&w, "timestamp");
+        pw_uint(&w, (uint32_t)time(NULL));
+        pw_key(&w, "uptime");
+        pw_uint(&w, (uint32_t)(esp_timer_get_time() / 1000000));
+        pw_key(&w, "freeHeap");
+        pw_uint(&w, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+        s_write_latency(&w, "fallLatency", MQTT_LANE_FALL);
+        s_write_latency(&w, "presenceLatency", MQTT_LANE_PRESENCE);
+        pw_key(&w, "outbox");
+        pw_map_begin(&w);
+        pw_key(&w, "pending");
+        pw_uint(&w, outbox.pending);
+        pw_key(&w, "dropped");
+        pw_uint(&w, outbox.dropped);
+        pw_key(&w, "corrupt");
+        pw_uint(&w, outbox.corrupt);
+        pw_key(&w, "maxEraseCount");
+        pw_uint(&w, outbox.max_erase_count);
+        pw_map_end(&w);
+        pw_key(&w, "telemetry");
+        pw_map_begin(&w);
+        pw_key(&w, "pending");
+        pw_uint(&w, telemetry_pending());
+        pw_key(&w, "dropped");
+        pw_uint(&w, telemetry_dropped());
+        pw_map_end(&w);
+        pw_key(&w, "pointCloud");
+        pw_map_begin(&w);
+        pw_key(&w, "frames");
+        pw_uint(&w, cloud.frames);
+        pw_key(&w, "sent");
+        pw_uint(&w, cloud.frames_sent);
+        pw_key(&w, "dropped");
+        pw_uint(&w, cloud.frames_dropped);
+        pw_key(&w, "bytes");
+        pw_uint(&w, cloud.bytes);
+        pw_key(&w, "maxRecordUs");
+        pw_uint(&w, cloud.max_record_us);
+        pw_map_end(&w);
+        pw_key(&w, "uartTap");
+        pw_map_begin(&w);
+        pw_key(&w, "bytes");
+        pw_uint(&w, tap.bytes);
+        pw_key(&w, "dropped");
+        pw_uint(&w, tap.dropped_bytes);
+        pw_map_end(&w);
+        pw_key(&w, "radarConfig");
+        pw_map_begin(&w);
+        pw_key(&w, "commands");
+        pw_uint(&w, radar_cfg.commands);
+        pw_key(&w, "retries");
+        pw_uint(&w, radar_cfg.retries);
+        pw_key(&w, "errors");
+        pw_uint(&w, radar_cfg.errors);
+        pw_key(&w, "timeouts");
+        pw_uint(&w, radar_cfg.timeouts);
+        pw_key(&w, "maxCmdMs");
+        pw_uint(&w, radar_cfg.max_cmd_ms);
+        pw_key(&w, "lastMs");
+        pw_uint(&w, radar_cfg.last_ms);
+        pw_key(&w, "failed");
+        pw_text(&w, radar_cfg.failed);
+        pw_key(&w, "recoveries");
+        pw_uint(&w, radar_cfg.recoveries);
+        pw_map_end(&w);
+        pw_key(&w, "kvStore");
+        pw_map_begin(&w);
+        pw_key(&w, "reads");
+        pw_uint(&w, kv.reads);
+        pw_key(&w, "writes");
+        pw_uint(&w, kv.writes);
+        pw_key(&w, "corrupt");
+        pw_uint(&w, kv.corrupt);
+        pw_key(&w, "staleSchema");
+        pw_uint(&w, kv.stale_schema);
+        pw_map_end(&w);
+        pw_key(&w, "recorder");
+        pw_map_begin(&w);
+        pw_key(&w, "frames");
+        pw_uint(&w, rec.frames);
+        pw_key(&w, "dropped");
+        pw_uint(&w, rec.dropped);
+        pw_key(&w, "sectors");
+        pw_uint(&w, rec.sectors);
+        pw_key(&w, "rawBytes");
+        pw_uint(&w, rec.raw_bytes);
+        pw_key(&w, "bytes");
+        pw_uint(&w, rec.bytes);
+        pw_key(&w, "errors");
+        pw_uint(&w, rec.errors);
+        pw_key(&w, "maxWriteMs");
+        pw_uint(&w, rec.max_write_ms);
+        pw_key(&w, "historyS");
+        pw_uint(&w, rec.history_s);
+        pw_map_end(&w);
+        pw_key(&w, "fallCapture");
+        pw_map_begin(&w);
+        pw_key(&w, "triggers");
+        pw_uint(&w, capture.triggers);
+        pw_key(&w, "busy");
+        pw_uint(&w, capture.busy);
+        pw_key(&w, "published");
+        pw_uint(&w, capture.published);
+        pw_key(&w, "failed");
+        pw_uint(&w, capture.failed);
+        pw_key(&w, "cutFrames");
+        pw_uint(&w, capture.cut_frames);
+        pw_map_end(&w);
+        pw_key(&w, "commandsDropped");
+        pw_uint(&w, mqtt_command_dropped());
+        pw_key(&w, "jsonHeapFallbacks");
+        pw_uint(&w, json_arena_heap_fallbacks());
+        pw_key(&w, "calcHeapAllocs");
+        pw_uint(&w, calc_heap_alloc_count());
+        pw_key(&w, "calcArenaHighWater");
+        pw_uint(&w, __atomic_load_n(&calc_frame_arena()->high_water, __ATOMIC_RELAXED));
+        pw_map_end(&w);
+        len = pw_finish(&w);
+        if (len == 0) {
+                snprintf(ctx->msg, sizeof(ctx->msg), "Stats do not fit");
+                return COMMAND_INVALID;
         }
+        if (esp_mqtt_client_publish(ctx->client, mqtt_topic(MQTT_TOPIC_ANALYTICS), stats_buf, len, 0, 0) < 0)
+                return COMMAND_NETWORK_TIMEOUT;
+        return COMMAND_SUCCESS;
 }
 
+/**
+ * @brief Compare the topic of an incoming message with a cached topic
+ * 
+ * @param event MQTT event
+ * @param topic cached topic
+ * @param len bytes of topic to compare, prefix match when shorter than topic
+ */
+static bool s_topic_matches(esp_mqtt_event_handle_t event, const char* topic, size_t len)
+{
+        if (topic[0] == '\0' || event->topic_len < (int)len)
+                return false;
+        if (len == strlen(topic) && event->topic_len != (int)len)
+                return false;
+        return strncmp(event->topic, topic, len) == 0;
+}
+
+void s_handle_mqtt_topic(esp_mqtt_event_handle_t event)
+{
+        const char* cmd_topic = mqtt_topic(MQTT_TOPIC_COMMANDS);
+        const char* cfg_topic = mqtt_topic(MQTT_TOPIC_CONFIG);
+        // Commands are subscribed with a trailing '#', the command name follows it
+        size_t cmd_prefix = strlen(cmd_topic) - 1;
+
+        if (event->data_len != event->total_data_len) {
+                ESP_LOGW(MQTT, "Message of %d bytes in fragments ignored", event->total_data_len);
+                return;
+        }
+        if (s_topic_matches(event, cmd_topic, cmd_prefix)) {
+                mqtt_command_post(event->topic + cmd_prefix, event->topic_len - cmd_prefix,
+                                  event->data, event->data_len, true);
+        } else if (s_topic_matches(event, cfg_topic, strlen(cfg_topic))) {
+                mqtt_command_post("config", strlen("config"), event->data, event->data_len, false);
+        }
+}
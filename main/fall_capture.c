@@ -0,0 +1,295 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lzf.h"
+#include "frame_codec.h"
+#include "fall_capture.h"
+
+#define CAPTURE_VERSION 1
+#define DATA_STORED 0
+#define DATA_LZF 1
+#define DATA_HEADER 12					/**< format, version, raw length, first frame, lead ms*/
+#define POINT_WORST (1 + 3 * CODEC_I16_WORST + 1)
+#define FRAME_WORST (2 * CODEC_U32_WORST + 1 + CAPTURE_TRACKS_MAX * CODEC_TRACK_WORST + 1 + CAPTURE_POINTS_MAX * POINT_WORST)
+#define INDEX_NONE 253					/**< indexes from 253 are noise or out of the boundary*/
+
+static const char* TAG = "fall_capture";
+
+enum capture_state {
+	CAPTURE_RECORDING,	/**< ring overwritten frame after frame*/
+	CAPTURE_POST,		/**< triggered, recording the post-trigger frames*/
+	CAPTURE_READY		/**< frozen until released*/
+};
+
+struct cap_track {
+	int16_t pos[3];			/**< cm*/
+	int16_t vel[3];			/**< cm/s*/
+	uint8_t tid;
+};
+
+struct cap_point {
+	int16_t x;			/**< CAPTURE_POINT_CM per step*/
+	int16_t y;
+	int16_t z;
+	int8_t doppler;			/**< 0.1 m/s*/
+	uint8_t tid;			/**< track the point is associated to*/
+};
+
+struct cap_frame {
+	uint32_t frame;
+	uint32_t ms;			/**< uptime*/
+	uint8_t num_tracks;
+	uint8_t num_points;
+	struct cap_track tracks[CAPTURE_TRACKS_MAX];
+	struct cap_point points[CAPTURE_POINTS_MAX];
+};
+
+_Static_assert(CAPTURE_POST_FRAMES < CAPTURE_FRAMES, "the ring must hold pre-trigger frames");
+_Static_assert(DATA_HEADER + CAPTURE_FRAMES * FRAME_WORST > CAPTURE_RAW_MAX, "raw buffer is the limit, not the ring");
+_Static_assert(CAPTURE_RAW_MAX <= UINT16_MAX, "raw length is stored in 16 bits");
+
+/* Slots are written by the radar task alone, and read by the MQTT task only once frozen */
+static struct cap_frame ring[CAPTURE_FRAMES];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static enum capture_state state = CAPTURE_RECORDING;
+static uint32_t head = 0;			/**< frames written since boot*/
+static uint32_t trigger_head = 0;		/**< head when triggered*/
+static uint32_t post_left = 0;
+static uint8_t trigger_tid = 0;
+static int64_t trigger_us = 0;
+static struct fall_capture_stats stats;
+
+
+void fall_capture_record(uint32_t frame, const float* targets, int num_targets, const float* pcs, int num_points,
+			 const uint8_t* indexes, int num_indexes)
+{
+	struct cap_frame* f;
+	enum capture_state s;
+
+	portENTER_CRITICAL(&lock);
+	s = state;
+	portEXIT_CRITICAL(&lock);
+	if (s == CAPTURE_READY)
+		return;
+
+	// Slot head is not part of the capture until head moves past it
+	f = &ring[head % CAPTURE_FRAMES];
+	f->frame = frame;
+	f->ms = (uint32_t)(esp_timer_get_time() / 1000);
+	f->num_tracks = num_targets > CAPTURE_TRACKS_MAX ? CAPTURE_TRACKS_MAX : num_targets;
+	for (int i = 0; i < f->num_tracks; i++) {
+		const float* t = targets + i*CODEC_TARGET_COLS;
+		f->tracks[i].tid = (uint8_t)t[0];
+		for (int k = 0; k < 3; k++) {
+			f->tracks[i].pos[k] = codec_scaled(t[1 + k], 100.0f);
+			f->tracks[i].vel[k] = codec_scaled(t[4 + k], 100.0f);
+		}
+	}
+	f->num_points = 0;
+	if (num_indexes == num_points) {
+		for (int i = 0; i < num_points && f->num_points < CAPTURE_POINTS_MAX; i++) {
+			if (indexes[i] >= INDEX_NONE)
+				continue;
+			const float* p = pcs + i*5;
+			struct cap_point* pt = &f->points[f->num_points++];
+			pt->x = codec_scaled(p[0], 100.0f / CAPTURE_POINT_CM);
+			pt->y = codec_scaled(p[1], 100.0f / CAPTURE_POINT_CM);
+			pt->z = codec_scaled(p[2], 100.0f / CAPTURE_POINT_CM);
+			pt->doppler = p[3] * 10 > 127 ? 127 : p[3] * 10 < -127 ? -127 : (int8_t)lroundf(p[3] * 10);
+			pt->tid = indexes[i];
+		}
+	}
+
+	portENTER_CRITICAL(&lock);
+	head++;
+	if (state == CAPTURE_POST && --post_left == 0)
+		state = CAPTURE_READY;
+	portEXIT_CRITICAL(&lock);
+}
+
+void fall_capture_trigger(uint8_t target_id)
+{
+	bool started = false;
+
+	portENTER_CRITICAL(&lock);
+	if (state == CAPTURE_RECORDING) {
+		state = CAPTURE_POST;
+		post_left = CAPTURE_POST_FRAMES;
+		trigger_head = head;
+		trigger_tid = target_id;
+		trigger_us = esp_timer_get_time();
+		stats.triggers++;
+		started = true;
+	} else {
+		stats.busy++;
+	}
+	portEXIT_CRITICAL(&lock);
+	if (started)
+		ESP_LOGI(TAG, "Capturing fall of target %u", target_id);
+}
+
+bool fall_capture_pending(void)
+{
+	bool pending;
+
+	portENTER_CRITICAL(&lock);
+	pending = (state != CAPTURE_RECORDING);
+	portEXIT_CRITICAL(&lock);
+	return pending;
+}
+
+bool fall_capture_ready(void)
+{
+	bool ready;
+
+	portENTER_CRITICAL(&lock);
+	ready = (state == CAPTURE_READY);
+	portEXIT_CRITICAL(&lock);
+	return ready;
+}
+
+
+/* ================================================	Encoding	================================================*/
+static uint8_t* s_put_u32(uint8_t* p, uint32_t value)
+{
+	for (int k = 0; k < 4; k++)
+		*p++ = (uint8_t)(value >> 8*k);
+	return p;
+}
+
+/**
+ * @brief Append a frame, the caller made room for #FRAME_WORST bytes
+ *
+ */
+static uint8_t* s_encode(uint8_t* p, const struct cap_frame* f, const struct cap_frame* prev)
+{
+	struct cap_point last = {0};
+
+	p = codec_put_uvarint(p, prev != NULL ? f->frame - prev->frame : 0);
+	p = codec_put_uvarint(p, prev != NULL ? f->ms - prev->ms : 0);
+	*p++ = f->num_tracks;
+	for (int i = 0; i < f->num_tracks; i++) {
+		const struct cap_track* t = &f->tracks[i];
+		*p++ = t->tid;
+		for (int k = 0; k < 3; k++)
+			p = codec_put_svarint(p, t->pos[k]);
+		for (int k = 0; k < 3; k++)
+			p = codec_put_svarint(p, t->vel[k]);
+	}
+	*p++ = f->num_points;
+	for (int i = 0; i < f->num_points; i++) {
+		const struct cap_point* pt = &f->points[i];
+		*p++ = pt->tid;
+		p = codec_put_svarint(p, pt->x - last.x);
+		p = codec_put_svarint(p, pt->y - last.y);
+		p = codec_put_svarint(p, pt->z - last.z);
+		*p++ = (uint8_t)pt->doppler;
+		last = *pt;
+	}
+	return p;
+}
+
+/**
+ * @brief Encode frames first to last of the frozen ring into raw, header included
+ *
+ * @return size_t raw length, 0 when the frames do not fit #CAPTURE_RAW_MAX
+ */
+static size_t s_encode_range(uint8_t* raw, uint32_t first, uint32_t last)
+{
+	const struct cap_frame* prev = NULL;
+	uint8_t* p = raw + DATA_HEADER;
+	uint32_t lead_ms = (uint32_t)(trigger_us / 1000) - ring[first % CAPTURE_FRAMES].ms;
+
+	for (uint32_t n = first; n < last; n++) {
+		const struct cap_frame* f = &ring[n % CAPTURE_FRAMES];
+		if ((size_t)(p - raw) + FRAME_WORST > CAPTURE_RAW_MAX)
+			return 0;
+		p = s_encode(p, f, prev);
+		prev = f;
+	}
+	raw[0] = DATA_STORED;
+	raw[1] = CAPTURE_VERSION;
+	raw[2] = (uint8_t)(p - raw - DATA_HEADER);
+	raw[3] = (uint8_t)((p - raw - DATA_HEADER) >> 8);
+	s_put_u32(raw + 4, ring[first % CAPTURE_FRAMES].frame);
+	s_put_u32(raw + 8, lead_ms);
+	return p - raw;
+}
+
+size_t fall_capture_build(uint8_t* buf, size_t cap, uint8_t* scratch, struct fall_capture_info* info)
+{
+	static struct lzf_state lzf;
+	uint32_t first, last, trigger;
+	uint8_t* raw = scratch;
+	size_t raw_len = 0, len = 0;
+
+	portENTER_CRITICAL(&lock);
+	if (state != CAPTURE_READY) {
+		portEXIT_CRITICAL(&lock);
+		return 0;
+	}
+	last = head;
+	trigger = trigger_head;
+	portEXIT_CRITICAL(&lock);
+
+	first = last > CAPTURE_FRAMES ? last - CAPTURE_FRAMES : 0;
+	// Cut a quarter of the pre-trigger frames until the capture fits, the fall itself is kept
+	while (first <= trigger) {
+		raw_len = s_encode_range(raw, first, last);
+		if (raw_len > 0) {
+			size_t n = lzf_compress(&lzf, raw + DATA_HEADER, raw_len - DATA_HEADER, buf + DATA_HEADER, cap - DATA_HEADER);
+			if (n > 0 && n < raw_len - DATA_HEADER) {
+				memcpy(buf, raw, DATA_HEADER);
+				buf[0] = DATA_LZF;
+				len = DATA_HEADER + n;
+				break;
+			}
+			if (raw_len <= cap) {
+				memcpy(buf, raw, raw_len);
+				len = raw_len;
+				break;
+			}
+		}
+		if (first == trigger)
+			break;
+		first += (trigger - first + 3) / 4;
+	}
+	if (len == 0) {
+		ESP_LOGE(TAG, "Capture does not fit %u bytes", (unsigned)cap);
+		stats.failed++;
+		return 0;
+	}
+
+	stats.cut_frames += first - (last > CAPTURE_FRAMES ? last - CAPTURE_FRAMES : 0);
+	info->target_id = trigger_tid;
+	info->first_frame = ring[first % CAPTURE_FRAMES].frame;
+	info->frames = last - first;
+	info->pre_frames = trigger - first;
+	info->trigger_us = trigger_us;
+	ESP_LOGI(TAG, "Capture of %u frames, %u bytes from %u", info->frames, (unsigned)len, (unsigned)raw_len);
+	return len;
+}
+
+void fall_capture_release(bool published)
+{
+	portENTER_CRITICAL(&lock);
+	if (state == CAPTURE_READY)
+		state = CAPTURE_RECORDING;
+	if (published)
+		stats.published++;
+	portEXIT_CRITICAL(&lock);
+}
+
+void fall_capture_get_stats(struct fall_capture_stats* out)
+{
+	portENTER_CRITICAL(&lock);
+	*out = stats;
+	portEXIT_CRITICAL(&lock);
+}
@@ -4,20 +4,56 @@
 #include "freertos/task.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "utils.h"
 
 #include "driver/gpio.h"
 
 #include "common.h"
 #include "fall_logic.h"
+#include "binlog.h"
+#include "metrics.h"
 
 // Fall condition setting
 #define DELTA_HEIGHT_CONSTRAINT -0.08                   /**< Delta height conditon*/	
 #define VELOCITY_CONSTRAINT -0.05                       /**< Velocity condition*/	
+#define DELTA_HEIGHT_FLOOR -0.45                        /**< Larger drops are tracking jumps*/
+#define EXIT_HEIGHT 1.3                                 /**< Mean height to leave a fall*/
+#define FALL_LANE_WAIT_MS 1000                          /**< Longest wait for room in the fall lane*/
 
 const char * TAG = "FALL_LOGIC";
 
+/* Tunable at runtime through set-threshold, float stores are atomic on the ESP32 */
+static volatile float delta_height_max = DELTA_HEIGHT_CONSTRAINT;
+static volatile float delta_height_min = DELTA_HEIGHT_FLOOR;
+static volatile float velocity_max = VELOCITY_CONSTRAINT;
+static volatile float exit_height = EXIT_HEIGHT;
+
+static const struct {
+	const char* name;
+	volatile float* value;
+} thresholds[] = {
+	{"deltaHeight", &delta_height_max},
+	{"deltaHeightMin", &delta_height_min},
+	{"exitHeight", &exit_height},
+	{"velocity", &velocity_max},
+};
+
+
+bool fall_set_threshold(const char* name, float value)
+{
+	for (int i = 0; i < sizeof(thresholds) / sizeof(thresholds[0]); i++) {
+		if (strcmp(name, thresholds[i].name) == 0) {
+			*thresholds[i].value = value;
+			ESP_LOGI(TAG, "Threshold %s = %.3f", name, value);
+			return true;
+		}
+	}
+	return false;
+}
+
 
 float calc_absolute_height(float* pcs, uint8_t* indexes, int num_pcs, int num_index, uint8_t tid)
 {
@@ -65,7 +101,7 @@ bool check_fall_exit_height(float* abs_height_queue, int len)
 	for (int i = len; i > len - num_frames_to_check; i--)
 		mean_height += *(abs_height_queue + i -1);
 	mean_height = mean_height / num_frames_to_check;
-	if (mean_height > 1.3)
+	if (mean_height > exit_height)
 		return true;
 	return false;
 }
@@ -76,8 +112,8 @@ bool check_prescreening(float* q_height, uint8_t id, uint8_t len)
 	q_height += id*len;
 	float deltaH = *(q_height + len - 1) - *(q_height + len - 10);
 	q_height -= id*len;
-	if ((deltaH > -0.45) && (deltaH < DELTA_HEIGHT_CONSTRAINT)) {
-		ESP_LOGE(TAG, "Pass height");
+	if ((deltaH > delta_height_min) && (deltaH < delta_height_max)) {
+		BINLOG(BINLOG_PASS_HEIGHT);
 		return true;
 	}
 	return false;
@@ -93,8 +129,8 @@ bool check_velocity_condition(float* q_velo, uint8_t id, uint8_t len)
 		mean_vz += *(q_velo + i)/30;
 	}
 	q_velo -= id*len;
-	if (mean_vz <= VELOCITY_CONSTRAINT) {
-		ESP_LOGE(TAG, "Velo pass");
+	if (mean_vz <= velocity_max) {
+		BINLOG(BINLOG_PASS_VELOCITY);
 		return true;
 	}
 	return false;
@@ -123,13 +159,46 @@ void presence_led_control()
 }
 
 
-void pub_to_mqtt(QueueHandle_t* q_mqtt, uint8_t id, char* msg)
+/**
+ * @brief Queue an event for the mqtt task
+ *
+ * @param wait ticks to wait for room in the lane
+ * @param dropped counter of events the lane did not take
+ * @return true when queued
+ */
+static bool s_pub_to_mqtt(QueueHandle_t* q_mqtt, struct mqtt_event* event, TickType_t wait, enum metric_counter dropped)
+{
+	event->enqueue_us = esp_timer_get_time();
+	if (xQueueSend(*q_mqtt, event, wait) == pdTRUE)
+		return true;
+	metric_inc(dropped);
+	ESP_LOGE(TAG, "MQTT lane full, dropped event %u", event->status);
+	return false;
+}
+
+
+void pub_presence_to_mqtt(QueueHandle_t* q_mqtt, enum DEVICE_STATE status, uint16_t num_targets)
+{
+	struct mqtt_event event = {
+		.status = status,
+		.target_id = 0,
+		.data.num_targets = num_targets,
+	};
+	// A newer state follows with the next change, the frame is not held up
+	s_pub_to_mqtt(q_mqtt, &event, (TickType_t)1, METRIC_PRESENCE_EVENTS_DROPPED);
+}
+
+
+void pub_fall_to_mqtt(QueueHandle_t* q_mqtt, enum DEVICE_STATE status, uint8_t target_id, float abs_height, int64_t frame_us)
 {
-	struct mqtt_fall_event event;
-	struct mqtt_fall_event* p_event = &event;
-	p_event->event_id = 0;
-	p_event->msg = msg;
-	xQueueSend(*q_mqtt, &p_event, (TickType_t)1);
+	struct mqtt_event event = {
+		.status = status,
+		.target_id = target_id,
+		.frame_us = frame_us,
+		.data.abs_height = abs_height,
+	};
+	// Frames wait in q_radar2fall meanwhile, the mqtt task drains the lane into the outbox
+	s_pub_to_mqtt(q_mqtt, &event, pdMS_TO_TICKS(FALL_LANE_WAIT_MS), METRIC_FALL_EVENTS_DROPPED);
 }
 
 
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+#include "frame_loss.h"
+
+struct stage_desc {
+	const char* name;
+	enum frame_loss_cause cause;
+};
+
+static const struct stage_desc stages[FRAME_LOSS_STAGE_COUNT] = {
+	[FRAME_LOSS_LINK]		= {"link", FRAME_LOSS_CAUSE_LINK},
+	[FRAME_LOSS_UART_OVERFLOW]	= {"uartOverflow", FRAME_LOSS_CAUSE_STARVATION},
+	[FRAME_LOSS_RING_FULL]		= {"ringFull", FRAME_LOSS_CAUSE_STARVATION},
+	[FRAME_LOSS_RESYNC]		= {"resync", FRAME_LOSS_CAUSE_LINK},
+	[FRAME_LOSS_CHECKSUM]		= {"checksum", FRAME_LOSS_CAUSE_LINK},
+	[FRAME_LOSS_PARSE]		= {"parse", FRAME_LOSS_CAUSE_DATA},
+	[FRAME_LOSS_FEATURES]		= {"features", FRAME_LOSS_CAUSE_DATA},
+	[FRAME_LOSS_QUEUE]		= {"queue", FRAME_LOSS_CAUSE_BACKPRESSURE},
+};
+
+static const char* const cause_names[FRAME_LOSS_CAUSE_COUNT] = {
+	[FRAME_LOSS_CAUSE_LINK]		= "link",
+	[FRAME_LOSS_CAUSE_STARVATION]	= "starvation",
+	[FRAME_LOSS_CAUSE_BACKPRESSURE]	= "backpressure",
+	[FRAME_LOSS_CAUSE_DATA]		= "data",
+};
+
+_Static_assert(sizeof(stages) / sizeof(stages[0]) == FRAME_LOSS_STAGE_COUNT, "every stage needs a name");
+
+/* Noted by the UART reader and the radar task, settled by the radar task at each header */
+static portMUX_TYPE ledger_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct frame_loss_stats ledger[FRAME_LOSS_STAGE_COUNT];
+static uint32_t pending_checksum = 0;
+static enum frame_loss_stage pending_first = FRAME_LOSS_LINK;		/**< first flush or resync noted, LINK when none*/
+
+
+/**
+ * @brief Charge frames to a stage, ledger_lock held
+ *
+ */
+static void s_charge(enum frame_loss_stage stage, uint32_t count, uint32_t frame)
+{
+	ledger[stage].lost += count;
+	ledger[stage].events++;
+	ledger[stage].last_frame = frame;
+}
+
+void frame_loss_note(enum frame_loss_stage stage)
+{
+	portENTER_CRITICAL(&ledger_lock);
+	if (stage == FRAME_LOSS_CHECKSUM)
+		pending_checksum++;
+	else if (pending_first == FRAME_LOSS_LINK)
+		pending_first = stage;
+	portEXIT_CRITICAL(&ledger_lock);
+}
+
+void frame_loss_gap(uint32_t last, uint32_t frame)
+{
+	uint32_t missing = frame - last - 1;
+	uint32_t by_checksum;
+
+	portENTER_CRITICAL(&ledger_lock);
+	// A frame number going back is a radar restart, not a gap
+	if (frame > last + 1) {
+		// A bad header is one whole frame, the frame number it carried is unknown
+		by_checksum = pending_checksum < missing ? pending_checksum : missing;
+		if (by_checksum > 0)
+			s_charge(FRAME_LOSS_CHECKSUM, by_checksum, frame - 1);
+		if (missing > by_checksum)
+			s_charge(pending_first, missing - by_checksum, frame - 1);
+	}
+	pending_checksum = 0;
+	pending_first = FRAME_LOSS_LINK;
+	portEXIT_CRITICAL(&ledger_lock);
+}
+
+void frame_loss_drop(enum frame_loss_stage stage, uint32_t frame)
+{
+	portENTER_CRITICAL(&ledger_lock);
+	s_charge(stage, 1, frame);
+	portEXIT_CRITICAL(&ledger_lock);
+}
+
+void frame_loss_flush(void)
+{
+	portENTER_CRITICAL(&ledger_lock);
+	pending_checksum = 0;
+	pending_first = FRAME_LOSS_LINK;
+	portEXIT_CRITICAL(&ledger_lock);
+}
+
+void frame_loss_get(enum frame_loss_stage stage, struct frame_loss_stats* out)
+{
+	portENTER_CRITICAL(&ledger_lock);
+	*out = ledger[stage];
+	portEXIT_CRITICAL(&ledger_lock);
+}
+
+enum frame_loss_cause frame_loss_cause_of(enum frame_loss_stage stage)
+{
+	return stages[stage].cause;
+}
+
+const char* frame_loss_stage_name(enum frame_loss_stage stage)
+{
+	return stages[stage].name;
+}
+
+const char* frame_loss_cause_name(enum frame_loss_cause cause)
+{
+	return cause_names[cause];
+}
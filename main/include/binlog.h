@@ -0,0 +1,99 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Records waiting for the formatter, a power of two, 32 bytes each
+ *
+ */
+#define BINLOG_RECORDS 128
+
+/**
+ * @brief Arguments of a message, 32-bit words
+ *
+ */
+#define BINLOG_ARGS_MAX 4
+
+/**
+ * @brief Records of one message per second, the others are counted and reported with the next one
+ *
+ */
+#define BINLOG_RATE_PER_S 10
+
+/**
+ * @brief Largest /log document
+ *
+ */
+#define BINLOG_DOC_MAX (1024*6)
+
+/**
+ * @brief First bytes of a dump
+ *
+ */
+#define BINLOG_MAGIC "FLOG"
+#define BINLOG_VERSION 1
+
+/**
+ * @brief Messages of the frame path, the format of each one is in binlog.c
+ * @details Formats take %d, %u, %x, %c and %f with flags, width and precision, never strings.
+ */
+enum binlog_msg {
+	BINLOG_TARGET,			/**< fall task, every target of every frame*/
+	BINLOG_WRONG_TID,
+	BINLOG_PASS_HEIGHT,		/**< check_prescreening passed*/
+	BINLOG_PASS_VELOCITY,		/**< check_velocity_condition passed*/
+	BINLOG_MISSING_FEATURES,	/**< feature_processing dropped a frame*/
+	BINLOG_RING_FETCH,
+	BINLOG_MISSING_FRAME,		/**< gap in radar frame numbers*/
+	BINLOG_RING_EMPTY,
+	BINLOG_RING_MUTEX,
+	BINLOG_EXTRACT_FAILED,
+	BINLOG_QUEUE_BUSY,
+	BINLOG_BAD_TLV,
+	BINLOG_BAD_CHECKSUM,
+	BINLOG_RING_SEND,
+	BINLOG_MSG_COUNT
+};
+
+/**
+ * @brief Copy a message into the ring, without lock and without formatting
+ * @details A full ring or a message over its rate only counts the record.
+ *
+ * @param id message
+ * @param args arguments, floats as their bits
+ * @param argc number of arguments, at most BINLOG_ARGS_MAX
+ */
+void binlog_write(enum binlog_msg id, const uint32_t* args, size_t argc);
+
+static inline uint32_t binlog_f(float value)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+/**
+ * @brief Log a message, integer arguments as is and float arguments through binlog_f()
+ *
+ */
+#define BINLOG(id, ...) do {								\
+	const uint32_t binlog_args_[] = {0, ##__VA_ARGS__};				\
+	binlog_write((id), binlog_args_ + 1, sizeof(binlog_args_) / sizeof(uint32_t) - 1);	\
+} while (0)
+
+/**
+ * @brief Start the formatter task, messages are printed through esp_log at the lowest priority
+ *
+ */
+void binlog_init(void);
+
+/**
+ * @brief Write the last records and the format table, for tools/binlog_decode.py
+ * @details The dump is a header, a "level tag<TAB>format\n" line per message, then the records.
+ *
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @return size_t length, 0 when cap is too small for the table
+ */
+size_t binlog_dump(uint8_t* buf, size_t cap);
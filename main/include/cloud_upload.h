@@ -0,0 +1,138 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Edge of a voxel in cm, points in the same voxel are merged
+ *
+ */
+#define CLOUD_VOXEL_CM 10
+
+/**
+ * @brief Points looked at per frame, larger clouds are strided
+ * @details Bounds the time #cloud_upload_record adds to the frame path
+ */
+#define CLOUD_SCAN_MAX 256
+
+/**
+ * @brief Voxels kept per frame after decimation
+ *
+ */
+#define CLOUD_POINTS_MAX 64
+
+/**
+ * @brief Decimated frames kept between two uploads
+ *
+ */
+#define CLOUD_RING_LEN 16
+
+/**
+ * @brief Largest batch before compression
+ *
+ */
+#define CLOUD_RAW_MAX (1024*4)
+
+/**
+ * @brief Largest compressed batch, LZF worst case of #CLOUD_RAW_MAX plus header
+ *
+ */
+#define CLOUD_PAYLOAD_MAX (CLOUD_RAW_MAX + CLOUD_RAW_MAX / 32 + 16)
+
+/**
+ * @brief Milliseconds between two uploads while enabled
+ *
+ */
+#define CLOUD_FLUSH_MS 500
+
+/**
+ * @brief Upload budget in bytes per minute until config sets "pointCloudBudget"
+ *
+ */
+#define CLOUD_BUDGET_DEFAULT (1024*60)
+
+/**
+ * @brief Counters of the point cloud upload since enabled
+ *
+ */
+struct cloud_upload_stats {
+	uint32_t frames;		/**< frames decimated on the frame path*/
+	uint32_t frames_sent;		/**< frames in published batches*/
+	uint32_t frames_dropped;	/**< frames overwritten or discarded over budget*/
+	uint32_t batches;		/**< batches published*/
+	uint32_t raw_bytes;		/**< batch bytes before compression*/
+	uint32_t bytes;			/**< batch bytes published*/
+	uint32_t max_record_us;		/**< worst time spent in #cloud_upload_record*/
+};
+
+/**
+ * @brief Decimate the point cloud of a frame into the upload ring, called from the radar task
+ * @details
+ *  Returns at once while disabled. Otherwise at most #CLOUD_SCAN_MAX points are
+ *  quantised into #CLOUD_VOXEL_CM voxels and at most #CLOUD_POINTS_MAX voxels are kept,
+ *  the strongest point of a voxel wins. Compression is left to the MQTT task.
+ *
+ * @param frame frame number
+ * @param pcs point clouds matrix M(num_points, 5) of (x, y, z, doppler, snr)
+ * @param num_points number of points
+ */
+void cloud_upload_record(uint32_t frame, const float* pcs, int num_points);
+
+/**
+ * @brief Delta encode and compress the oldest frames without removing them
+ *
+ * @param buf output buffer
+ * @param cap size of buffer, at least #CLOUD_PAYLOAD_MAX to fit a full batch
+ * @param until position after the last frame of the batch, for #cloud_upload_commit
+ * @return size_t length of payload, 0 when there is nothing to send
+ */
+size_t cloud_upload_build(uint8_t* buf, size_t cap, uint32_t* until);
+
+/**
+ * @brief Take len bytes from the per minute budget
+ *
+ * @param len size of the batch
+ * @return true when the batch fits into the budget
+ */
+bool cloud_upload_spend(size_t len);
+
+/**
+ * @brief Remove the frames of a batch from the ring
+ *
+ * @param until value from #cloud_upload_build
+ * @param sent_len published length, 0 when the batch was discarded
+ */
+void cloud_upload_commit(uint32_t until, size_t sent_len);
+
+/**
+ * @brief Enable or disable the upload, a change of state drops the frames not yet sent
+ *
+ * @param enable upload state
+ */
+void cloud_upload_enable(bool enable);
+
+/**
+ * @brief Enable the upload for a limited time
+ *
+ * @param seconds capture length, 0 until disabled
+ */
+void cloud_upload_enable_for(uint32_t seconds);
+
+/**
+ * @brief Upload enabled
+ *
+ */
+bool cloud_upload_enabled(void);
+
+/**
+ * @brief Set the upload budget
+ *
+ * @param bytes_per_min bytes per minute, bursts up to one minute of budget
+ */
+void cloud_upload_set_budget(uint32_t bytes_per_min);
+
+/**
+ * @brief Copy upload counters
+ *
+ * @param out destination
+ */
+void cloud_upload_get_stats(struct cloud_upload_stats* out);
@@ -26,10 +26,6 @@ struct frame_struct{
         uint8_t* indexes;
 };
 
-struct mqtt_fall_event{
-        uint32_t event_id;
-        char * msg;
-};
 
 /**
  * @brief State machine of device life
@@ -50,6 +46,21 @@ enum DEVICE_STATE {
         MQTT_DISCONNECTED       /*!< MQTT state */
 };
 
+/**
+ * @brief Event copied by value from the fall task to the mqtt task
+ * 
+ */
+struct mqtt_event {
+        uint8_t status;                 /**< enum DEVICE_STATE, fall states or OCCUPIED / VACANT*/
+        uint8_t target_id;              /**< tracker id of the target, 0 for presence*/
+        int64_t enqueue_us;             /**< esp_timer time when queued, monotonic*/
+        int64_t frame_us;               /**< fall: esp_timer time the frame header was found, 0 when unknown*/
+        union {
+                uint16_t num_targets;   /**< presence: targets in the frame*/
+                float abs_height;       /**< fall: height of the target in m*/
+        } data;
+};
+
 /**
  * @brief Timer to change state in fall event
  * 
@@ -70,4 +81,6 @@ struct fall_features {
         int num_targets;
         float abs_height[13];
         float target[10*13]; 
+        int64_t header_us;              /**< esp_timer time the header completing the features was found*/
+        int64_t features_us;            /**< esp_timer time the features were queued*/
 };
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Radar config keys kept, one per CLI command
+ *
+ */
+#define CONFIG_RADAR_KEYS 16
+
+/**
+ * @brief Longest radar config key, the CLI command word
+ *
+ */
+#define CONFIG_RADAR_KEY_MAX 32
+
+/**
+ * @brief Longest radar config value, the CLI arguments
+ *
+ */
+#define CONFIG_RADAR_VALUE_MAX 80
+
+/**
+ * @brief Largest SPIFFS config document of older firmware, read once to migrate it
+ *
+ */
+#define CONFIG_DOC_MAX 1536
+
+/**
+ * @brief Device identity, store key "device"
+ *
+ */
+struct config_device {
+	char uuid[64];
+};
+
+/**
+ * @brief Station credentials, store key "wifi"
+ *
+ */
+struct config_wifi {
+	char ssid[33];			/**< 32 bytes as in wifi_config_t*/
+	char password[65];		/**< 64 bytes as in wifi_config_t*/
+};
+
+/**
+ * @brief Broker settings, store key "mqtt"
+ *
+ */
+struct config_mqtt {
+	char hostname[128];		/**< broker uri*/
+	uint16_t port;			/**< 0 uses the port of the uri scheme*/
+	char username[64];
+	char password[64];
+};
+
+/**
+ * @brief Network mode after the next boot, store key "nw"
+ *
+ */
+enum config_nw_mode {
+	CONFIG_NW_UNSET,		/**< never written, the device starts as AP*/
+	CONFIG_NW_AP,
+	CONFIG_NW_STA,
+};
+
+/**
+ * @brief App settings pushed under "app_config" that outlive a reboot, store key "app"
+ *
+ */
+struct config_app {
+	uint8_t payload_encoding;	/**< enum payload_encoding of upstream payloads, 0 is JSON*/
+};
+
+/**
+ * @brief Radar config pushed over MQTT, store key "radar"
+ * @details Each key is a CLI command word and its value the arguments, applied over the boot table.
+ */
+struct config_radar {
+	int num_keys;
+	struct {
+		char key[CONFIG_RADAR_KEY_MAX];
+		char value[CONFIG_RADAR_VALUE_MAX];
+	} item[CONFIG_RADAR_KEYS];
+};
+
+/**
+ * @brief Load every config from the key-value store once, call after #init_spiffs and nvs_flash_init
+ * @details
+ *  A key the store does not hold is migrated from the SPIFFS document of older firmware when
+ *  present. Anything still missing keeps its default ("NOT_INIT" strings, empty radar config).
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM when the write lock cannot be created, error of #kv_init
+ */
+esp_err_t config_init(void);
+
+/**
+ * @brief Copy the device config
+ *
+ * @param out snapshot, never torn by a concurrent write
+ */
+void config_get_device(struct config_device* out);
+
+/**
+ * @brief Copy the Wi-Fi config
+ *
+ * @param out snapshot, never torn by a concurrent write
+ */
+void config_get_wifi(struct config_wifi* out);
+
+/**
+ * @brief Copy the MQTT config
+ *
+ * @param out snapshot, never torn by a concurrent write
+ */
+void config_get_mqtt(struct config_mqtt* out);
+
+/**
+ * @brief Network mode stored for the next boot
+ *
+ */
+enum config_nw_mode config_get_nw_mode(void);
+
+/**
+ * @brief Copy the app config
+ *
+ * @param out snapshot, never torn by a concurrent write
+ */
+void config_get_app(struct config_app* out);
+
+/**
+ * @brief Copy the radar config
+ *
+ * @param out snapshot, never torn by a concurrent write
+ */
+void config_get_radar(struct config_radar* out);
+
+/**
+ * @brief Store the device config
+ * @details The RAM copy changes only once #kv_set committed the new value.
+ *
+ * @param cfg new config
+ * @return esp_err_t error of #kv_set, the old config stays
+ */
+esp_err_t config_set_device(const struct config_device* cfg);
+
+/**
+ * @brief Store the Wi-Fi config, same rules as #config_set_device
+ *
+ */
+esp_err_t config_set_wifi(const struct config_wifi* cfg);
+
+/**
+ * @brief Store the MQTT config, same rules as #config_set_device
+ *
+ */
+esp_err_t config_set_mqtt(const struct config_mqtt* cfg);
+
+/**
+ * @brief Store the network mode, same rules as #config_set_device
+ *
+ */
+esp_err_t config_set_nw_mode(enum config_nw_mode mode);
+
+/**
+ * @brief Store the app config, same rules as #config_set_device
+ *
+ */
+esp_err_t config_set_app(const struct config_app* cfg);
+
+/**
+ * @brief Store the radar config, same rules as #config_set_device
+ *
+ */
+esp_err_t config_set_radar(const struct config_radar* cfg);
+
+/**
+ * @brief Device config as JSON, the format of the /conn endpoint
+ *
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @return size_t length without terminator, 0 when it does not fit
+ */
+size_t config_device_json(char* buf, size_t cap);
+
+/**
+ * @brief Wi-Fi config as JSON, the format of the /wifi/info endpoint
+ *
+ */
+size_t config_wifi_json(char* buf, size_t cap);
+
+/**
+ * @brief MQTT config as JSON, the format of the /mqtt/info endpoint
+ *
+ */
+size_t config_mqtt_json(char* buf, size_t cap);
+
+/**
+ * @brief Current Wi-Fi and MQTT settings for the provisioning page, without passwords
+ *
+ */
+size_t config_ui_json(char* buf, size_t cap);
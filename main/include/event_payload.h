@@ -0,0 +1,142 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Largest serialized event, size of publish buffers
+ * 
+ */
+#define EVENT_PAYLOAD_MAX 256
+
+/**
+ * @brief Wire encoding of published payloads, negotiated through the config topic
+ * 
+ */
+enum payload_encoding {
+        PAYLOAD_JSON,           /*!< Compact JSON text (default) */
+        PAYLOAD_CBOR            /*!< RFC 8949 CBOR, same keys and structure as JSON */
+};
+
+/**
+ * @brief Streaming writer of compact JSON or CBOR into a caller buffer
+ * @details
+ *  Nothing is allocated, values are appended as they come. Maps and arrays are written as CBOR
+ *  indefinite-length items so both encodings stream without knowing member counts.
+ *  On overflow the writer stops appending and #pw_finish reports failure, 
+ *  the buffer content is then undefined.
+ */
+struct payload_writer {
+	enum payload_encoding encoding;	/**< output format*/
+	char* buf;		/**< output buffer*/
+	size_t cap;		/**< capacity including NUL*/
+	size_t len;		/**< bytes written*/
+	bool need_comma;	/**< next member needs a separator*/
+	bool overflow;		/**< ran out of space*/
+};
+
+void pw_init(struct payload_writer* w, enum payload_encoding encoding, char* buf, size_t cap);
+void pw_map_begin(struct payload_writer* w);
+void pw_map_end(struct payload_writer* w);
+void pw_array_begin(struct payload_writer* w);
+void pw_array_end(struct payload_writer* w);
+void pw_key(struct payload_writer* w, const char* key);
+void pw_uint(struct payload_writer* w, uint32_t value);
+void pw_int(struct payload_writer* w, int32_t value);
+void pw_bool(struct payload_writer* w, bool value);
+void pw_text(struct payload_writer* w, const char* text);
+
+/**
+ * @brief Append binary data, a CBOR byte string or a base64 JSON string
+ * 
+ * @param w writer
+ * @param data bytes
+ * @param len number of bytes
+ */
+void pw_bytes(struct payload_writer* w, const uint8_t* data, size_t len);
+
+/**
+ * @brief Terminate the payload
+ * @note JSON output is also NUL terminated, CBOR is binary and must be sent with its length
+ * 
+ * @param w writer
+ * @return length of payload, 0 if it did not fit
+ */
+size_t pw_finish(struct payload_writer* w);
+
+/**
+ * @brief Serialize a fall event (type 1)
+ * 
+ * @param encoding wire encoding
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @param status State of fall
+ * @param ts Timestamp of fall process
+ * @param update_ts Timestamp of fall process update
+ * @param end_ts Timestamp of fall process end
+ * @return length of payload, 0 if it did not fit
+ */
+size_t event_payload_fall(enum payload_encoding encoding, char* buf, size_t cap, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts);
+
+/**
+ * @brief Append a fall event object to a writer, to build batches of events
+ * 
+ * @param w writer, inside an array or at top level
+ * @param status State of fall
+ * @param ts Timestamp of fall process
+ * @param update_ts Timestamp of fall process update
+ * @param end_ts Timestamp of fall process end
+ */
+void event_payload_fall_write(struct payload_writer* w, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts);
+
+/**
+ * @brief Serialize a presence event (type 0)
+ * 
+ * @param encoding wire encoding
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @param is_present True or False
+ * @param ts Timestamp
+ * @return length of payload, 0 if it did not fit
+ */
+size_t event_payload_presence(enum payload_encoding encoding, char* buf, size_t cap, bool is_present, uint32_t ts);
+
+/**
+ * @brief Serialize the response to a command (type 2)
+ * 
+ * @param encoding wire encoding
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @param id id of the command
+ * @param code 0 success, 1 invalid, 2 network timeout, 3 hardware issue
+ * @param msg human readable result
+ * @param ts Timestamp
+ * @return length of payload, 0 if it did not fit
+ */
+size_t event_payload_response(enum payload_encoding encoding, char* buf, size_t cap, const char* id, int code, const char* msg, uint32_t ts);
+
+/**
+ * @brief Serialize a fall capture (type 3), the frames around a detected fall
+ * 
+ * @param encoding wire encoding
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @param target_id tracker id of the falling target
+ * @param ts Timestamp of the fall detection
+ * @param pre_frames frames before the detection
+ * @param frames frames in the capture
+ * @param data capture as built by #fall_capture_build
+ * @param len length of data
+ * @return length of payload, 0 if it did not fit
+ */
+size_t event_payload_capture(enum payload_encoding encoding, char* buf, size_t cap, uint8_t target_id, uint32_t ts,
+			     uint16_t pre_frames, uint16_t frames, const uint8_t* data, size_t len);
+
+/**
+ * @brief Parse encoding name from config ("json" or "cbor")
+ * 
+ * @param name encoding name
+ * @param encoding result
+ * @retval 1 known name
+ * @retval 0 unknown, encoding untouched
+ */
+bool payload_encoding_from_name(const char* name, enum payload_encoding* encoding);
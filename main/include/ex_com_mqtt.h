@@ -1,3 +1,5 @@
+#include "event_payload.h"
+
 /**
  * @brief Prefix to MQTT topics
  * 
@@ -5,40 +7,72 @@
 #define MQTT_PREFIX_TOPIC "/devices"
 
 /**
- * @brief Topic for upstream events
+ * @brief Topic for upstream events, format takes the device id
+ * 
+ */
+#define TOPIC_UPSTREAM_EVENTS MQTT_PREFIX_TOPIC "/%s/events"
+
+/**
+ * @brief Topic for upstream state, format takes the device id
+ * 
+ */
+#define TOPIC_UPSTREAM_STATE MQTT_PREFIX_TOPIC "/%s/state"
+
+/**
+ * @brief Topic for upstream telemetry, format takes the device id
+ * 
+ */
+#define TOPIC_UPSTREAM_TELEMETRY MQTT_PREFIX_TOPIC "/%s/events/telemetry"
+
+/**
+ * @brief Topic for upstream point clouds, format takes the device id
  * 
  */
-#define TOPIC_UPSTREAM_EVENTS "/events"
+#define TOPIC_UPSTREAM_POINTCLOUD MQTT_PREFIX_TOPIC "/%s/events/pointcloud"
 
 /**
- * @brief Topic for upstream state
+ * @brief Topic for upstream analytics, format takes the device id
  * 
  */
-#define TOPIC_UPSTREAM_STATE "/devices/%s/state", id
+#define TOPIC_UPSTREAM_ANALYTICS MQTT_PREFIX_TOPIC "/%s/events/analytics"
 
 /**
- * @brief Topic for upstream telemetry
+ * @brief Topic for flight recorder sectors, format takes the device id
  * 
  */
-#define TOPIC_UPSTREAM_TELEMETRY(id) "/devices/%s/events/telemetry", id
+#define TOPIC_UPSTREAM_RECORDER MQTT_PREFIX_TOPIC "/%s/events/recorder"
 
 /**
- * @brief Topic for upstream analytics
+ * @brief Topic for downstream commands, format takes the device id
  * 
  */
-#define TOPIC_UPSTREAM_ANALYTICS(id) "/devices/%s/events/analytics", id
+#define TOPIC_DOWNSTREAM_COMMANDS MQTT_PREFIX_TOPIC "/%s/commands/#"
 
 /**
- * @brief Topic for downstream commands
+ * @brief Topic for downstream config, format takes the device id
  * 
  */
-#define TOPIC_DOWNSTREAM_COMMANDS "/commands/#"
+#define TOPIC_DOWNSTREAM_CONFIG MQTT_PREFIX_TOPIC "/%s/config"
+
+#define MQTT_DEVICE_ID_MAX 40                   /**< Longest device id the topic table accepts*/
+#define MQTT_TOPIC_MAX 72                       /**< Longest topic, prefix + id + "/events/pointcloud"*/
+#define OUTBOX_ACK_TIMEOUT_MS (1000*30)         /**< Outbox batch published again when not acked by then*/
 
 /**
- * @brief Topic for downstream config
+ * @brief Entries of the topic table
  * 
  */
-#define TOPIC_DOWNSTREAM_CONFIG "/config"
+enum mqtt_topic {
+        MQTT_TOPIC_EVENTS,
+        MQTT_TOPIC_STATE,
+        MQTT_TOPIC_TELEMETRY,
+        MQTT_TOPIC_POINTCLOUD,
+        MQTT_TOPIC_ANALYTICS,
+        MQTT_TOPIC_RECORDER,
+        MQTT_TOPIC_COMMANDS,
+        MQTT_TOPIC_CONFIG,
+        MQTT_TOPIC_COUNT
+};
 
 /**
  * @brief Time interval between states in seconds
@@ -46,6 +80,40 @@
  */
 #define EVENT_STATE_INTERVAL 60
 
+/**
+ * @brief Publishing lanes of the MQTT task, fall events always go first
+ * 
+ */
+enum mqtt_lane {
+        MQTT_LANE_FALL,         /*!< Fall state machine events */
+        MQTT_LANE_PRESENCE,     /*!< Presence and telemetry */
+        MQTT_LANE_COUNT
+};
+
+/**
+ * @brief Enqueue to broker ack latency of one lane
+ * 
+ */
+struct mqtt_publish_latency {
+        uint32_t count;         /*!< Acked publishes */
+        uint32_t last_ms;       /*!< Latency of the last ack */
+        uint32_t max_ms;        /*!< Worst latency since boot */
+        uint64_t total_ms;      /*!< Sum of latencies, mean is total_ms / count */
+        uint32_t failed;        /*!< Publishes refused by the client */
+        uint32_t untracked;     /*!< Publishes evicted before their ack arrived */
+        uint32_t deleted;       /*!< Publishes given up by the client, MQTT_EVENT_DELETED */
+};
+
+/**
+ * @brief Payload status and timestamp update of a fall state
+ * 
+ */
+struct fall_status {
+        const char* name;       /*!< status field of the payload */
+        bool opens;             /*!< starts a fall, resets ts */
+        bool closes;            /*!< ends a fall, sets end_ts */
+};
+
 typedef struct presence_mqtt_params{
     esp_mqtt_client_handle_t client;
     bool is_present;
@@ -63,8 +131,9 @@ esp_mqtt_client_handle_t init_mqtt_client();
  * @brief Send presence message via MQTT
  * 
  * @param presence_msg The message
+ * @return int msg_id of the QoS1 publish, -1 on failure
  */
-void send_presence(presence_mqtt_params* presence_msg);
+int send_presence(presence_mqtt_params* presence_msg);
 
 
 /**
@@ -75,8 +144,146 @@ void send_presence(presence_mqtt_params* presence_msg);
  *  @param   ts         Timestamp of fall process
  *  @param   update_ts  Timestamp of fall process update
  *  @param   end_ts     Timestamp of fall process end
+ *  @return  msg_id of the QoS1 publish, -1 on failure
 */
-void send_fall(esp_mqtt_client_handle_t client, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts);
+int send_fall(esp_mqtt_client_handle_t client, const char* status, uint32_t ts, uint32_t update_ts, uint32_t end_ts);
+
+
+/**
+ * @brief Publish recorded target samples to the telemetry topic (QoS0)
+ * @details Samples stay in the ring when the publish fails and are sent next time
+ * 
+ * @param client MQTT client
+ * @return int number of messages sent, at most 4 per call
+ */
+int send_telemetry(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Publish the decimated point clouds recorded since the last call (QoS0)
+ * @details Batches exceeding the per minute budget are discarded, the radar keeps recording
+ * 
+ * @param client MQTT client
+ * @return int message id, -1 when nothing was published
+ */
+int send_point_cloud(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Publish the frames captured around a fall to the events topic (QoS1)
+ * @details Waits for the broker while disconnected, the capture is released once handed to the client
+ * 
+ * @param client MQTT client
+ * @return int message id, -1 when nothing was published
+ */
+int send_fall_capture(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Publish the latency percentiles of every pipeline stage since boot to the analytics topic (QoS0)
+ * 
+ * @param client MQTT client
+ * @return int message id, -1 on failure
+ */
+int send_latency_snapshot(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Publish the frames lost by every stage since boot to the analytics topic (QoS0)
+ * 
+ * @param client MQTT client
+ * @return int message id, -1 on failure
+ */
+int send_frame_loss_summary(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Remember a publish so its PUBLISHED ack can be timed
+ * 
+ * @param msg_id value returned by send_fall / send_presence
+ * @param lane lane the event came from
+ * @param enqueue_us esp_timer time the producer queued the event
+ */
+void mqtt_track_publish(int msg_id, enum mqtt_lane lane, int64_t enqueue_us);
+
+/**
+ * @brief Match a MQTT_EVENT_PUBLISHED ack and record its latency
+ * 
+ * @param msg_id msg_id of the ack
+ */
+void mqtt_on_published(int msg_id);
+
+/**
+ * @brief Note a MQTT_EVENT_DELETED, the client gave up on a publish without ack
+ * @details An outbox batch deleted this way is published again by the next #mqtt_outbox_service.
+ * 
+ * @param msg_id msg_id of the deleted message
+ */
+void mqtt_on_deleted(int msg_id);
+
+/**
+ * @brief Look up a fall state
+ * 
+ * @param status enum DEVICE_STATE of the event
+ * @return const struct fall_status* NULL when status is not a fall state
+ */
+const struct fall_status* mqtt_fall_status(uint8_t status);
+
+/**
+ * @brief Track broker connection, call from MQTT_EVENT_CONNECTED / DISCONNECTED
+ * 
+ * @param connected connection state
+ */
+void mqtt_set_connected(bool connected);
+
+/**
+ * @brief Time an outbox record until its ack, whichever batch it goes out in
+ * @details
+ *  The publish and frame to alert stages end when the record is first handed to the client,
+ *  the fall lane latency when its batch is acked. Records of an earlier boot are not timed.
+ * 
+ * @param seq sequence number from #outbox_append
+ * @param enqueue_us esp_timer time the producer queued the event
+ * @param frame_us esp_timer time the frame header was found, 0 when unknown
+ */
+void mqtt_outbox_track(uint32_t seq, int64_t enqueue_us, int64_t frame_us);
+
+/**
+ * @brief Publish unacked outbox records and trim acked ones
+ * @details
+ *  Records are replayed oldest first, up to #OUTBOX_BATCH_MAX per publish, one batch in flight.
+ *  A batch is trimmed from flash only after its QoS1 PUBLISHED ack. It is published again when
+ *  the client deletes it, the session drops, or no ack came within #OUTBOX_ACK_TIMEOUT_MS.
+ *  Call from the mqtt task after appending, after an ack or deletion, after reconnecting and
+ *  when #mqtt_outbox_wait_ms runs out.
+ * 
+ * @param client MQTT client
+ * @return int msg_id of the first publish made by this call, 0 if none
+ */
+int mqtt_outbox_service(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Time left before the batch in flight is published again
+ * 
+ * @return uint32_t milliseconds, UINT32_MAX when nothing is in flight
+ */
+uint32_t mqtt_outbox_wait_ms(void);
+
+/**
+ * @brief Copy latency statistics of one lane
+ * 
+ * @param lane the lane
+ * @param out destination
+ */
+void mqtt_get_publish_latency(enum mqtt_lane lane, struct mqtt_publish_latency* out);
+
+
+/**
+ * @brief Encoding of upstream payloads, JSON until the config topic asks for CBOR
+ * @details Stored under the "app" config key, the choice survives a reboot.
+ * 
+ * @return enum payload_encoding current encoding
+ */
+enum payload_encoding mqtt_payload_encoding(void);
 
 
 /**
@@ -95,9 +302,21 @@ void log_error_if_nonzero(const char *message, int error_code);
 void s_handle_mqtt_topic(esp_mqtt_event_handle_t event);
 
 /**
- * @brief Get MQTT topic based on device uuid
+ * @brief Build the topic table for the current device id
+ * @details
+ *  Called when the client starts and on every connect, does nothing while the device id
+ *  is unchanged. The device id is not part of the pushed config and a config push does not
+ *  restart the device, so a new id only takes effect at the next connect.
+ *  Topics returned by #mqtt_topic stay valid until the next rebuild.
+ * 
+ * @return true table is valid
+ */
+bool mqtt_topics_build(void);
+
+/**
+ * @brief Full topic string from the cached table
  * 
- * @param mqtt_topic the topic from #DEFINE
- * @return char* The finalised opic
+ * @param topic entry of the table
+ * @return const char* topic, never NULL
  */
-char *s_get_mqtt_topic(char *mqtt_topic);
\ No newline at end of file
+const char* mqtt_topic(enum mqtt_topic topic);
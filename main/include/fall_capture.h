@@ -0,0 +1,142 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Frames held in RAM, pre-trigger and post-trigger together
+ *
+ */
+#define CAPTURE_FRAMES 128
+
+/**
+ * @brief Frames recorded after the trigger, about 2 s at 55 ms per frame
+ * @details The other frames of the ring, about 5 s, precede the trigger.
+ */
+#define CAPTURE_POST_FRAMES 36
+
+/**
+ * @brief Tracks kept per frame, more are cut
+ *
+ */
+#define CAPTURE_TRACKS_MAX 4
+
+/**
+ * @brief Points associated to a track kept per frame, the first ones win
+ *
+ */
+#define CAPTURE_POINTS_MAX 12
+
+/**
+ * @brief Quantisation of captured points in cm
+ *
+ */
+#define CAPTURE_POINT_CM 5
+
+/**
+ * @brief Largest capture before compression, older pre-trigger frames are cut to fit
+ *
+ */
+#define CAPTURE_RAW_MAX (1024*16)
+
+/**
+ * @brief Largest compressed capture, format and length header included
+ *
+ */
+#define CAPTURE_DATA_MAX (1024*12)
+
+/**
+ * @brief Largest capture event, the attachment is base64 in JSON
+ *
+ */
+#define CAPTURE_EVENT_MAX (CAPTURE_DATA_MAX / 3 * 4 + 256)
+
+/**
+ * @brief Milliseconds between two checks of the MQTT task while a capture is pending
+ *
+ */
+#define CAPTURE_POLL_MS 250
+
+/**
+ * @brief What a built capture covers
+ *
+ */
+struct fall_capture_info {
+	uint8_t target_id;		/**< tracker id of the falling target*/
+	uint32_t first_frame;		/**< frame number of the first frame*/
+	uint16_t frames;		/**< frames in the capture*/
+	uint16_t pre_frames;		/**< frames before the trigger*/
+	int64_t trigger_us;		/**< esp_timer time of the trigger*/
+};
+
+/**
+ * @brief Counters of the capture since boot
+ *
+ */
+struct fall_capture_stats {
+	uint32_t triggers;		/**< captures started*/
+	uint32_t busy;			/**< triggers ignored while a capture was pending*/
+	uint32_t published;		/**< captures handed to MQTT*/
+	uint32_t failed;		/**< captures dropped, too large*/
+	uint32_t cut_frames;		/**< pre-trigger frames cut to fit #CAPTURE_DATA_MAX*/
+};
+
+/**
+ * @brief Write a frame into the ring, called from the radar task
+ * @details
+ *  The only work per frame: tracks are quantised and points associated to a track are copied
+ *  straight into the ring slot. Nothing is written while a capture waits to be published.
+ *
+ * @param frame frame number
+ * @param targets tracks matrix M(num_targets, 28) of (tid, x, y, z, vx, vy, vz, ...)
+ * @param num_targets number of tracks
+ * @param pcs point clouds matrix M(num_points, 5) of (x, y, z, doppler, snr)
+ * @param num_points number of points
+ * @param indexes track id of every point, points are skipped unless num_indexes equals num_points
+ * @param num_indexes number of indexes
+ */
+void fall_capture_record(uint32_t frame, const float* targets, int num_targets, const float* pcs, int num_points,
+			 const uint8_t* indexes, int num_indexes);
+
+/**
+ * @brief Freeze the pre-trigger frames and record #CAPTURE_POST_FRAMES more, called on FALL_DETECTED
+ *
+ * @param target_id tracker id of the falling target
+ */
+void fall_capture_trigger(uint8_t target_id);
+
+/**
+ * @brief A capture was triggered and is not published yet
+ *
+ */
+bool fall_capture_pending(void);
+
+/**
+ * @brief The post-trigger frames are recorded, the capture can be built
+ *
+ */
+bool fall_capture_ready(void);
+
+/**
+ * @brief Delta encode and compress a complete capture
+ *
+ * @param buf output buffer, at least #CAPTURE_DATA_MAX
+ * @param cap size of buffer
+ * @param scratch #CAPTURE_RAW_MAX bytes for the frames before compression, free again on return
+ * @param info what the capture covers
+ * @return size_t length, 0 when not ready or when it failed
+ */
+size_t fall_capture_build(uint8_t* buf, size_t cap, uint8_t* scratch, struct fall_capture_info* info);
+
+/**
+ * @brief Resume recording after the capture was published or given up
+ *
+ * @param published true when the capture went out
+ */
+void fall_capture_release(bool published);
+
+/**
+ * @brief Copy capture counters
+ *
+ * @param out destination
+ */
+void fall_capture_get_stats(struct fall_capture_stats* out);
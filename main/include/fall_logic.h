@@ -95,13 +95,35 @@ void fill_computation_queue( float** q_absH, float** q_avgH,  float** q_velocity
 			     uint8_t idx, uint8_t max_len, float absH, float vel);
 
 /**
- * @brief Publish event to mqtt task
+ * @brief Publish presence change to mqtt task
  * 
- * @param q_mqtt bridge to communicate between mqtt and fall task
- * @param id index of msg (fall 1, presence 0)
- * @param msg message to send (fall event, presence event)
+ * @param q_mqtt presence lane of the mqtt task
+ * @param status OCCUPIED or VACANT
+ * @param num_targets targets in the current frame
  */
-void pub_to_mqtt(QueueHandle_t* q_mqtt, uint8_t id, char* msg);
+void pub_presence_to_mqtt(QueueHandle_t* q_mqtt, enum DEVICE_STATE status, uint16_t num_targets);
+
+/**
+ * @brief Publish fall state change to mqtt task
+ * @details Waits up to a second for room in the lane, an event still not taken is counted as dropped.
+ * 
+ * @param q_mqtt fall lane of the mqtt task
+ * @param status one of FALL_DETECTED .. FALL_EXITED
+ * @param target_id tracker id of the falling target
+ * @param abs_height height of the target in m
+ * @param frame_us esp_timer time the header of the frame was found, for frame to alert latency
+ */
+void pub_fall_to_mqtt(QueueHandle_t* q_mqtt, enum DEVICE_STATE status, uint8_t target_id, float abs_height, int64_t frame_us);
+
+/**
+ * @brief Change a fall condition at runtime
+ * 
+ * @param name "deltaHeight", "deltaHeightMin", "velocity" or "exitHeight"
+ * @param value new threshold, m or m/s
+ * @retval 1 changed
+ * @retval 0 unknown name
+ */
+bool fall_set_threshold(const char* name, float value);
 
 /**
  * @brief Send state to control center
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * @brief Columns of the tracks matrix, M(num_targets, 28) of (tid, x, y, z, vx, vy, vz, ...)
+ *
+ */
+#define CODEC_TARGET_COLS 28
+
+/**
+ * @brief Largest uvarint of 32 bits
+ *
+ */
+#define CODEC_U32_WORST 5
+
+/**
+ * @brief Largest svarint of an int16
+ *
+ */
+#define CODEC_I16_WORST 3
+
+/**
+ * @brief Largest track, tid then position and velocity as svarints of int16
+ *
+ */
+#define CODEC_TRACK_WORST (1 + 6 * CODEC_I16_WORST)
+
+/**
+ * @brief Quantise a float to int16, saturated
+ *
+ * @param value value in its unit
+ * @param scale steps per unit, 100 for cm from m
+ */
+static inline int16_t codec_scaled(float value, float scale)
+{
+	float v = roundf(value * scale);
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)v;
+}
+
+/**
+ * @brief Append an unsigned LEB128 varint, at most #CODEC_U32_WORST bytes
+ *
+ * @return uint8_t* byte after the varint
+ */
+static inline uint8_t* codec_put_uvarint(uint8_t* p, uint32_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t)value;
+	return p;
+}
+
+/**
+ * @brief Append a zigzag varint, small values of either sign take one byte
+ *
+ * @return uint8_t* byte after the varint
+ */
+static inline uint8_t* codec_put_svarint(uint8_t* p, int32_t value)
+{
+	return codec_put_uvarint(p, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
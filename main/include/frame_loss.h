@@ -0,0 +1,103 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Seconds between two summaries published on the analytics topic
+ *
+ */
+#define FRAME_LOSS_SUMMARY_S 60
+
+/**
+ * @brief Stages where a radar frame is lost
+ *
+ */
+enum frame_loss_stage {
+	FRAME_LOSS_LINK,		/**< missing with nothing local to explain it, radar or wire*/
+	FRAME_LOSS_UART_OVERFLOW,	/**< input flushed on UART_FIFO_OVF or UART_BUFFER_FULL*/
+	FRAME_LOSS_RING_FULL,		/**< UART read not taken by the ring buffer*/
+	FRAME_LOSS_RESYNC,		/**< header lost in the bytes skipped to find the magic word*/
+	FRAME_LOSS_CHECKSUM,		/**< header failing its checksum*/
+	FRAME_LOSS_PARSE,		/**< TLVs not parsed*/
+	FRAME_LOSS_FEATURES,		/**< features not built, the next frame is missing*/
+	FRAME_LOSS_QUEUE,		/**< features not taken by q_radar2fall*/
+	FRAME_LOSS_STAGE_COUNT
+};
+
+/**
+ * @brief What a stage points at
+ *
+ */
+enum frame_loss_cause {
+	FRAME_LOSS_CAUSE_LINK,		/**< the radar or the UART line*/
+	FRAME_LOSS_CAUSE_STARVATION,	/**< the UART reader did not run in time*/
+	FRAME_LOSS_CAUSE_BACKPRESSURE,	/**< the fall task did not take the features*/
+	FRAME_LOSS_CAUSE_DATA,		/**< a frame that arrived whole but could not be used*/
+	FRAME_LOSS_CAUSE_COUNT
+};
+
+/**
+ * @brief Frames lost by a stage since boot
+ *
+ */
+struct frame_loss_stats {
+	uint32_t lost;
+	uint32_t events;		/**< gaps or drops the frames were lost in*/
+	uint32_t last_frame;		/**< last frame number lost, 0 when none*/
+};
+
+/**
+ * @brief Note an event that may lose frames not known yet
+ * @details The frames it lost show up as a gap at the next frame header, see frame_loss_gap().
+ *
+ * @param stage FRAME_LOSS_UART_OVERFLOW, FRAME_LOSS_RING_FULL, FRAME_LOSS_RESYNC or FRAME_LOSS_CHECKSUM
+ */
+void frame_loss_note(enum frame_loss_stage stage);
+
+/**
+ * @brief Attribute the frames between two headers to the events noted since the last one
+ * @details
+ *  Each checksum failure accounts for one frame. The rest goes to the first UART overflow,
+ *  ring buffer failure or resync noted, and to the link when nothing was noted.
+ *
+ * @param last frame number of the previous header
+ * @param frame frame number of this header
+ */
+void frame_loss_gap(uint32_t last, uint32_t frame);
+
+/**
+ * @brief Count a frame lost after its header was read
+ *
+ * @param stage FRAME_LOSS_PARSE, FRAME_LOSS_FEATURES or FRAME_LOSS_QUEUE
+ * @param frame frame number
+ */
+void frame_loss_drop(enum frame_loss_stage stage, uint32_t frame);
+
+/**
+ * @brief Forget the noted events, the input was flushed on purpose
+ *
+ */
+void frame_loss_flush(void);
+
+/**
+ * @brief Read the counters of a stage
+ *
+ */
+void frame_loss_get(enum frame_loss_stage stage, struct frame_loss_stats* out);
+
+/**
+ * @brief Cause a stage points at
+ *
+ */
+enum frame_loss_cause frame_loss_cause_of(enum frame_loss_stage stage);
+
+/**
+ * @brief Name of a stage, used as key and label
+ *
+ */
+const char* frame_loss_stage_name(enum frame_loss_stage stage);
+
+/**
+ * @brief Name of a cause, used as key
+ *
+ */
+const char* frame_loss_cause_name(enum frame_loss_cause cause);
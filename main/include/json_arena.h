@@ -0,0 +1,37 @@
+#include <stdint.h>
+
+/**
+ * @brief Size of the bump arena backing cJSON trees
+ * 
+ */
+#define JSON_ARENA_SIZE (1024*6)
+
+/**
+ * @brief Route cJSON allocations through the arena, call once at boot before any cJSON use
+ * 
+ */
+void json_arena_init(void);
+
+/**
+ * @brief Start a JSON operation (build, print or parse) on the arena
+ * @details
+ *  Takes the arena lock, every cJSON allocation from the calling task is bumped from the 
+ *  arena until the matching #json_arena_end. Calls can be nested by the same task.
+ *  Other tasks (or an exhausted arena) fall back to the general heap.
+ * 
+ */
+void json_arena_begin(void);
+
+/**
+ * @brief Release everything allocated since #json_arena_begin in one step
+ * @warning Strings and trees from the operation are invalid afterward, copy what need to be kept
+ * 
+ */
+void json_arena_end(void);
+
+/**
+ * @brief Number of cJSON allocations which did not fit in the arena
+ * 
+ * @return fallback count since boot
+ */
+uint32_t json_arena_heap_fallbacks(void);
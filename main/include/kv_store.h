@@ -0,0 +1,84 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief NVS namespace of the store
+ *
+ */
+#define KV_NAMESPACE "kv"
+
+/**
+ * @brief Longest key, NVS keys are 15 characters and each value takes two
+ *
+ */
+#define KV_KEY_MAX 13
+
+/**
+ * @brief Largest value
+ *
+ */
+#define KV_VALUE_MAX 2048
+
+/**
+ * @brief Header in front of every stored value
+ * @details
+ *  A value lives in two NVS blobs, key.0 and key.1. A write goes to the blob not holding the
+ *  newest copy and is committed before the old copy may be overwritten, a cut at any point
+ *  leaves at least one copy whose CRC matches.
+ */
+struct kv_header {
+	uint32_t seq;			/**< grows with every write of the key, newest valid copy wins*/
+	uint16_t schema;		/**< layout version of the value, checked on read*/
+	uint16_t len;			/**< bytes of value following the header*/
+	uint32_t crc;			/**< over seq, schema, len and the value*/
+};
+
+/**
+ * @brief Counters of the store since boot
+ *
+ */
+struct kv_stats {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t corrupt;		/**< copies skipped on CRC or length mismatch*/
+	uint32_t stale_schema;		/**< reads refused because the stored schema differs*/
+};
+
+/**
+ * @brief Open the namespace, call after nvs_flash_init
+ *
+ * @return esp_err_t error of nvs_open or ESP_ERR_NO_MEM
+ */
+esp_err_t kv_init(void);
+
+/**
+ * @brief Read the newest valid copy of a value
+ *
+ * @param key at most #KV_KEY_MAX characters
+ * @param schema layout version the caller expects
+ * @param value destination
+ * @param len size of value, the stored length must match
+ * @return esp_err_t
+ *  ESP_ERR_NOT_FOUND when never written or no copy is valid,
+ *  ESP_ERR_INVALID_VERSION when the newest copy has another schema or length
+ */
+esp_err_t kv_get(const char* key, uint16_t schema, void* value, size_t len);
+
+/**
+ * @brief Write a value over the older of its two copies
+ *
+ * @param key at most #KV_KEY_MAX characters
+ * @param schema layout version of value
+ * @param value content
+ * @param len at most #KV_VALUE_MAX
+ * @return esp_err_t error of NVS, the previous value stays readable
+ */
+esp_err_t kv_set(const char* key, uint16_t schema, const void* value, size_t len);
+
+/**
+ * @brief Copy store counters
+ *
+ * @param out destination
+ */
+void kv_get_stats(struct kv_stats* out);
@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Sub-buckets per power of two, 8 keeps every bucket within 12.5 % of its values
+ *
+ */
+#define LATENCY_SUB_BITS 3
+
+/**
+ * @brief Largest latency told apart, about 16.8 s, longer ones land in the last bucket
+ *
+ */
+#define LATENCY_MAX_BITS 24
+
+/**
+ * @brief Buckets per histogram, linear up to 2 << LATENCY_SUB_BITS us then log-linear
+ *
+ */
+#define LATENCY_BUCKETS ((2 << LATENCY_SUB_BITS) + (LATENCY_MAX_BITS - LATENCY_SUB_BITS - 1) * (1 << LATENCY_SUB_BITS))
+
+/**
+ * @brief Seconds between two snapshots published on the analytics topic
+ *
+ */
+#define LATENCY_SNAPSHOT_S 60
+
+/**
+ * @brief Stages of the frame pipeline
+ * @details
+ *  Features of a frame are complete once the next frame brings its point associations, the
+ *  timestamps of features and later stages come from the header of that next frame.
+ */
+enum latency_stage {
+	LATENCY_PARSE,			/**< header found to TLVs parsed, radar task*/
+	LATENCY_FEATURES,		/**< TLVs parsed to features queued, radar task*/
+	LATENCY_QUEUE,			/**< features queued to taken by the fall task*/
+	LATENCY_FALL_LOGIC,		/**< features taken to fall logic done*/
+	LATENCY_PUBLISH,		/**< fall event queued to handed to the MQTT client*/
+	LATENCY_FRAME_TO_ALERT,		/**< header found to fall event handed to the MQTT client*/
+	LATENCY_STAGE_COUNT
+};
+
+/**
+ * @brief Percentiles of a stage since boot, in us
+ *
+ */
+struct latency_summary {
+	uint32_t count;			/**< samples recorded*/
+	uint32_t p50;
+	uint32_t p90;
+	uint32_t p99;
+	uint32_t max;			/**< exact worst sample*/
+	uint64_t sum;			/**< sum of samples, mean is sum / count*/
+};
+
+/**
+ * @brief Count a sample in the histogram of the calling core, without lock
+ *
+ * @param stage pipeline stage
+ * @param start_us esp_timer time the stage started, 0 records nothing
+ * @param end_us esp_timer time the stage ended
+ */
+void latency_record(enum latency_stage stage, int64_t start_us, int64_t end_us);
+
+/**
+ * @brief Merge the histograms of both cores and read percentiles
+ * @details Percentiles are the upper edge of their bucket.
+ *
+ * @param stage pipeline stage
+ * @param out result
+ */
+void latency_get_summary(enum latency_stage stage, struct latency_summary* out);
+
+/**
+ * @brief Name of a stage, used as key and label
+ *
+ */
+const char* latency_stage_name(enum latency_stage stage);
@@ -0,0 +1,28 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bits of the match hash, the table has 1 << LZF_HLOG entries
+ *
+ */
+#define LZF_HLOG 10
+
+/**
+ * @brief Hash table of one compressor, owned by the caller so tasks never share it
+ * @details 2 KB, keep it static rather than on a task stack.
+ */
+struct lzf_state {
+	uint16_t htab[1 << LZF_HLOG];		/**< position + 1, 0 for empty*/
+};
+
+/**
+ * @brief Compress with LZF (liblzf format), ≥3 byte matches within 8 KB
+ *
+ * @param state hash table, reset on every call
+ * @param in data
+ * @param in_len length of data, at most 64 KB
+ * @param out output buffer
+ * @param out_cap size of output buffer
+ * @return size_t compressed length, 0 when it does not fit out_cap
+ */
+size_t lzf_compress(struct lzf_state* state, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_cap);
@@ -1,8 +1,97 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Bytes of the frame arena, the decision function of 167 support vectors takes 1568
+ *
+ */
+#define CALC_FRAME_ARENA_SIZE (1024*4)
+
+/**
+ * @brief Bump allocator for scratch matrices
+ * @details
+ *  Hands out double buffers from a fixed block and never frees them one by one.
+ *  The whole block is released with #calc_arena_reset at the end of a frame, or
+ *  back to a #calc_arena_mark inside a computation.
+ */
+struct calc_arena {
+	uint8_t* base;			/**< backing storage*/
+	size_t size;			/**< capacity in bytes*/
+	size_t used;			/**< bytes handed out since last reset*/
+	size_t high_water;		/**< maximum used since init, to size the block*/
+};
+
+double* calc_arena_alloc(struct calc_arena* arena, int count);
+size_t calc_arena_mark(struct calc_arena* arena);
+void calc_arena_release(struct calc_arena* arena, size_t mark);
+void calc_arena_reset(struct calc_arena* arena);
+
+/**
+ * @brief Arena shared by the computation task, reset once per frame
+ * @details Its high_water tells how close a frame came to CALC_FRAME_ARENA_SIZE.
+ */
+struct calc_arena* calc_frame_arena(void);
+
+/**
+ * @brief Number of heap allocations made by the legacy matrix API
+ * @note Stays constant in steady state when only the *_to and arena variants are used. The
+ *  features handed to the computation task come from a pool and are not allocated per frame.
+ */
+uint32_t calc_heap_alloc_count(void);
+
+/* Output-buffer variants, result must not alias inputs unless stated */
+void substract_two_matrixes_to(double* src, double* des, int m, int n, double* result);
+void substract_matrix_array_to(double* mat, double* arr, int m, int n, double* result);
+void transpose_matrix_to(double* mat, int m, int n, double* result);
+bool dot_two_matrixes_to(double* src, double* des, int msrc, int nsrc, int mdes, int ndes, double* result);
+
+/* Legacy variants, result is malloc'd and owned by the caller */
 double* substract_two_matrixes(double* src, double* des, int m, int n);
 double* substract_matrix_array(double* mat, double* arr, int m, int n);
 double* transpose_matrix(double* mat, int m, int n);
 double* dot_two_matrixes(double* src, double* des, int msrc, int nsrc, int mdes, int ndes);
 void print_matrix(double* matrix, int m, int n);
+
+/* In place */
+void substract_matrix_array_inplace(double* mat, double* arr, int m, int n);
 void exp_array(double* arr, int n);
 void pow_array(double* arr, int n, double pow_value);
-void mul_array(double* arr, int n, double t);
\ No newline at end of file
+void mul_array(double* arr, int n, double t);
+
+/* ================================================	Float32 kernels	================================================*/
+/*
+ * Dispatch layer for the hot vector kernels. On target with esp-dsp available the
+ * esp-dsp float32 routines are used, otherwise (host builds, or MATRIX_CALC_FORCE_REFERENCE)
+ * the portable *_ref versions below. Both are always compiled so they can be compared.
+ */
+#if !defined(MATRIX_CALC_FORCE_REFERENCE) && defined(__has_include)
+#if __has_include("esp_dsp.h")
+#define MATRIX_CALC_USE_DSP 1
+#endif
+#endif
+#ifndef MATRIX_CALC_USE_DSP
+#define MATRIX_CALC_USE_DSP 0
+#endif
+
+float calc_dot_f32(const float* a, const float* b, int len);
+void calc_mat_mult_f32(const float* a, const float* b, float* c, int m, int n, int k);
+void calc_mul_array_f32(float* arr, int n, float t);
+void calc_exp_array_f32(float* arr, int n);
+void calc_pow_array_f32(float* arr, int n, float pow_value);
+
+float calc_dot_f32_ref(const float* a, const float* b, int len);
+void calc_mat_mult_f32_ref(const float* a, const float* b, float* c, int m, int n, int k);
+void calc_mul_array_f32_ref(float* arr, int n, float t);
+
+/**
+ * @brief Name of the active kernel backend ("esp-dsp" or "reference")
+ */
+const char* calc_kernel_backend(void);
+
+/**
+ * @brief Run dispatched and reference kernels on the same inputs and compare them to double
+ * @details The double computation also checks the reference build, where both paths are the same.
+ * @retval true both paths agree with double within float tolerance
+ */
+bool calc_kernel_selfcheck(void);
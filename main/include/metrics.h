@@ -0,0 +1,114 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/**
+ * @brief Queues whose depth can be registered
+ *
+ */
+#define METRICS_QUEUES_MAX 8
+
+/**
+ * @brief Buffer /metrics is written through, sent as one HTTP chunk each time it fills
+ *
+ */
+#define METRICS_CHUNK_MAX 1024
+
+/**
+ * @brief Counters, only ever incremented
+ *
+ */
+enum metric_counter {
+	METRIC_FRAMES_PARSED,		/**< frames handed to the fall logic*/
+	METRIC_FRAMES_MISSING,		/**< gaps in radar frame numbers*/
+	METRIC_RESYNCS,			/**< magic word not where the header was expected*/
+	METRIC_RESYNC_BYTES,		/**< bytes skipped to find the magic word*/
+	METRIC_CHECKSUM_ERRORS,		/**< frame headers failing their checksum*/
+	METRIC_UART_FIFO_OVF,		/**< UART_FIFO_OVF events, input flushed*/
+	METRIC_UART_BUFFER_FULL,	/**< UART_BUFFER_FULL events, input flushed*/
+	METRIC_RING_SEND_FAILS,		/**< UART reads not taken by the ring buffer*/
+	METRIC_QUEUE_SEND_FAILS,	/**< features not taken by q_radar2fall*/
+	METRIC_LOG_DROPPED,		/**< log records not taken by a full ring*/
+	METRIC_LOG_SUPPRESSED,		/**< log records over the rate of their message*/
+	METRIC_RADAR_RECOVERIES,	/**< radar reset after a reconfiguration left it stopped*/
+	METRIC_METRICS_DROPPED,		/**< /metrics lines longer than METRICS_CHUNK_MAX, left out*/
+	METRIC_OUTBOX_RETRIES,		/**< outbox batches published again, deleted, lost with the session or not acked in time*/
+	METRIC_FALL_EVENTS_DROPPED,	/**< fall events not taken by a full fall lane*/
+	METRIC_PRESENCE_EVENTS_DROPPED,	/**< presence changes not taken by a full presence lane*/
+	METRIC_COUNTER_COUNT
+};
+
+/**
+ * @brief High-water marks, only ever raised
+ *
+ */
+enum metric_peak {
+	METRIC_PEAK_RING_BYTES,		/**< bytes waiting in the UART ring buffer*/
+	METRIC_PEAK_RADAR2FALL,		/**< features waiting in q_radar2fall*/
+	METRIC_PEAK_COUNT
+};
+
+extern uint32_t metric_counters[METRIC_COUNTER_COUNT];
+extern uint32_t metric_peaks[METRIC_PEAK_COUNT];
+
+/**
+ * @brief Add to a counter, a single atomic add without lock
+ *
+ * @param id counter
+ * @param n amount
+ */
+static inline void metric_add(enum metric_counter id, uint32_t n)
+{
+	__atomic_fetch_add(&metric_counters[id], n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_inc(enum metric_counter id)
+{
+	metric_add(id, 1);
+}
+
+/**
+ * @brief Raise a high-water mark, costs a load and a compare unless the mark moves
+ *
+ * @param id mark
+ * @param value current level
+ */
+static inline void metric_peak(enum metric_peak id, uint32_t value)
+{
+	uint32_t cur = __atomic_load_n(&metric_peaks[id], __ATOMIC_RELAXED);
+
+	while (value > cur && !__atomic_compare_exchange_n(&metric_peaks[id], &cur, value, true,
+							   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * @brief Report the depth of a queue, call once at init before the HTTP server starts
+ *
+ * @param name label value of the queue
+ * @param queue queue handle, NULL is ignored
+ */
+void metrics_register_queue(const char* name, QueueHandle_t queue);
+
+/**
+ * @brief Takes the document a piece at a time, false stops the writer
+ *
+ */
+typedef bool (*metrics_sink_t)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Write every metric in Prometheus text format 0.0.4, whatever the number of queues, tasks or stages
+ * @details
+ *  Counters and marks are read without locks, gauges are sampled now. Complete lines are
+ *  gathered in buf, which goes to the sink each time the next line does not fit and at the end.
+ *  A line longer than cap is left out, logged and counted in METRIC_METRICS_DROPPED.
+ *
+ * @param buf line buffer, METRICS_CHUNK_MAX bytes
+ * @param cap size of buffer
+ * @param sink called with each piece, in order
+ * @param ctx passed to sink
+ * @return size_t length of the document, 0 when the sink failed
+ */
+size_t metrics_write(char* buf, size_t cap, metrics_sink_t sink, void* ctx);
@@ -0,0 +1,98 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include "mqtt_client.h"
+#include "cJSON.h"
+
+/**
+ * @brief Longest command name, the topic suffix after /commands/
+ *
+ */
+#define COMMAND_NAME_MAX 24
+
+/**
+ * @brief Largest payload a command or config message may carry
+ *
+ */
+#define COMMAND_PAYLOAD_MAX 1024
+
+/**
+ * @brief Messages waiting for the command worker
+ *
+ */
+#define COMMAND_SLOTS 4
+
+/**
+ * @brief Handlers the registry can hold
+ *
+ */
+#define COMMAND_HANDLERS_MAX 16
+
+/**
+ * @brief Result code of a command, sent back in the response (type 2)
+ *
+ */
+enum command_code {
+	COMMAND_SUCCESS = 0,
+	COMMAND_INVALID = 1,
+	COMMAND_NETWORK_TIMEOUT = 2,
+	COMMAND_HARDWARE_ISSUE = 3,
+};
+
+/**
+ * @brief Context handed to a command handler
+ *
+ */
+struct command_ctx {
+	esp_mqtt_client_handle_t client;	/**< client to publish extra data with*/
+	const cJSON* args;			/**< parsed payload, NULL when empty or not JSON*/
+	const char* payload;			/**< raw payload, null terminated*/
+	size_t len;				/**< length of payload*/
+	char msg[48];				/**< "msg" of the response, "Success" when left empty*/
+};
+
+/**
+ * @brief Command handler, runs on the command worker task
+ *
+ * @return enum command_code result sent back to the backend
+ */
+typedef enum command_code (*command_fn)(struct command_ctx* ctx);
+
+/**
+ * @brief Add a handler, the table is kept sorted by name
+ *
+ * @param name command name, the last level of the commands topic
+ * @param fn handler
+ * @retval 1 registered
+ * @retval 0 table full, name too long or already taken
+ */
+bool mqtt_command_register(const char* name, command_fn fn);
+
+/**
+ * @brief Start the command worker
+ *
+ * @param client MQTT client used for responses
+ * @return esp_err_t ESP_ERR_NO_MEM when the queues or task cannot be created
+ */
+esp_err_t mqtt_command_start(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Queue a message for its handler, called from the MQTT event task
+ * @details
+ *  The handler is looked up by binary search, the payload is copied once into a free slot
+ *  and parsed there by the worker. Unknown commands are answered as invalid.
+ *
+ * @param name command name, not null terminated
+ * @param name_len length of name
+ * @param data payload, not null terminated
+ * @param len length of payload
+ * @param reply publish a response on the events topic when done
+ * @retval 1 queued
+ * @retval 0 dropped, no free slot or payload too large
+ */
+bool mqtt_command_post(const char* name, size_t name_len, const char* data, size_t len, bool reply);
+
+/**
+ * @brief Messages dropped because every slot was taken or the payload was too large
+ *
+ */
+uint32_t mqtt_command_dropped(void);
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Label of the data partition holding the outbox
+ * @details
+ *  The partition table needs an entry such as
+ *  ``outbox, data, 0x40, , 64K``. Without it the outbox is disabled and events
+ *  are only published live.
+ */
+#define OUTBOX_PARTITION_LABEL "outbox"
+
+/**
+ * @brief Maximum records replayed in one publish
+ *
+ */
+#define OUTBOX_BATCH_MAX 8
+
+/**
+ * @brief Fall event as stored in flash, enough to rebuild the payload after a reboot
+ *
+ */
+struct outbox_entry {
+	uint8_t status;			/**< enum DEVICE_STATE of the fall event*/
+	uint8_t target_id;		/**< tracker id of the target*/
+	uint16_t reserved;
+	uint32_t ts;			/**< fall start, unix time*/
+	uint32_t update_ts;		/**< status update, unix time*/
+	uint32_t end_ts;		/**< fall end, 0 while ongoing*/
+};
+
+/**
+ * @brief Counters of the outbox since boot
+ *
+ */
+struct outbox_stats {
+	uint32_t appended;		/**< records written*/
+	uint32_t acked;			/**< records trimmed after broker ack*/
+	uint32_t pending;		/**< records waiting for ack*/
+	uint32_t dropped;		/**< unacked records overwritten when the log was full*/
+	uint32_t corrupt;		/**< records skipped on CRC mismatch*/
+	uint32_t max_erase_count;	/**< most erased sector, for wear monitoring*/
+};
+
+/**
+ * @brief Mount the outbox partition and find the unacked records left from the last boot
+ *
+ * @return esp_err_t ESP_ERR_NOT_FOUND without partition
+ */
+esp_err_t outbox_init(void);
+
+/**
+ * @brief Outbox mounted and usable
+ *
+ */
+bool outbox_ready(void);
+
+/**
+ * @brief Append a record at the head of the log
+ * @details
+ *  Sectors are used round-robin so every sector is erased once per lap. When the next
+ *  sector still holds unacked records they are dropped, the newest events are kept.
+ *
+ * @param entry record to store
+ * @param seq set to the sequence number of the record when not NULL
+ * @return esp_err_t flash error
+ */
+esp_err_t outbox_append(const struct outbox_entry* entry, uint32_t* seq);
+
+/**
+ * @brief Read the oldest unacked records without removing them
+ *
+ * @param entries destination, at least max records
+ * @param seqs sequence numbers of the records, at least max, or NULL
+ * @param max records wanted, at most #OUTBOX_BATCH_MAX
+ * @return int number of records, 0 when everything is acked
+ */
+int outbox_peek(struct outbox_entry* entries, uint32_t* seqs, int max);
+
+/**
+ * @brief Mark the records returned by the last #outbox_peek as delivered
+ *
+ * @param count records acked, from the start of the peeked batch
+ */
+void outbox_ack(int count);
+
+/**
+ * @brief Copy outbox counters
+ *
+ * @param out destination
+ */
+void outbox_get_stats(struct outbox_stats* out);
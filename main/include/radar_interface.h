@@ -1,3 +1,72 @@
+struct config_radar;
+
+/**
+ * @brief Config lines remembered as the running config
+ *
+ */
+#define RADAR_CFG_LINES 48
+
+/**
+ * @brief Longest config line, command word included
+ *
+ */
+#define RADAR_CFG_LINE_MAX 128
+
+/**
+ * @brief Milliseconds to wait for the CLI to answer a config line
+ *
+ */
+#define RADAR_CMD_TIMEOUT_MS 1000
+
+/**
+ * @brief Times a rejected or unanswered line is sent again before the config is aborted
+ *
+ */
+#define RADAR_CMD_RETRIES 2
+
+/**
+ * @brief Tail of the CLI output kept while looking for the status of a line
+ *
+ */
+#define RADAR_REPLY_MAX 256
+
+/**
+ * @brief Size of the ring buffer between the UART and the frame parser
+ *
+ */
+#define RADAR_RING_SIZE (1024*10)
+
+/**
+ * @brief Features the data queue of #extract_radar_data holds
+ *
+ */
+#define RADAR_FEATURES_QUEUE_LEN (40*2)
+
+/**
+ * @brief Answer of the radar CLI to a config line
+ *
+ */
+enum radar_cmd_status {
+	RADAR_CMD_DONE,
+	RADAR_CMD_ERROR,
+	RADAR_CMD_TIMEOUT,
+};
+
+/**
+ * @brief Counters of the config port since boot
+ *
+ */
+struct radar_cfg_stats {
+	uint32_t commands;		/**< lines sent, retries included*/
+	uint32_t retries;		/**< lines sent again after an error or timeout*/
+	uint32_t errors;		/**< "Error" answers*/
+	uint32_t timeouts;		/**< lines without answer after #RADAR_CMD_TIMEOUT_MS*/
+	uint32_t max_cmd_ms;		/**< slowest line from write to "Done"*/
+	uint32_t last_ms;		/**< duration of the last full config or reconfiguration*/
+	char failed[32];		/**< start of the line the last config was aborted at, empty when it went through*/
+	uint32_t recoveries;		/**< resets after a reconfiguration could not stop or start the radar*/
+};
+
 
 /**
  * @brief Set up communication between sensor and mcu
@@ -7,10 +76,62 @@ void init_uart_port(QueueHandle_t* q_uart_event);
 
 
 /**
- * @brief   Read data from sensor through uart 1
- * @param   cfg lines of config
+ * @brief   Send config lines to the radar through uart 2
+ * @details
+ *  Each line is sent once the previous one is answered with "Done". A line answered with
+ *  "Error" or not at all is retried #RADAR_CMD_RETRIES times, then the config is aborted
+ *  and the line is kept in #radar_cfg_stats.
+ * @param   cfg lines of config, NULL terminated
+ * @param   overrides stored radar config replacing lines of cfg, NULL to send cfg as is
+ * @retval 1 every line acknowledged
+ * @retval 0 aborted
 */   
-bool send_sensor_config(char* cfg[]);
+bool send_sensor_config(char* cfg[], const struct config_radar* overrides);
+
+
+/**
+ * @brief Send the running config again, after #reset_radar
+ * @details The UART and the parser ring buffer are flushed first, as in #radar_reconfigure.
+ * @retval 1 sent
+ * @retval 0 no config was sent since boot
+*/
+bool send_running_config(void);
+
+
+/**
+ * @brief Change a running radar without reset
+ * @details
+ *  Each line replaces the running line with the same command word, only commands sent once
+ *  (boundary boxes, gatingParam, trackingCfg...) qualify. Lines equal to the running ones are
+ *  skipped, the others are sent between sensorStop and sensorStart. When the radar rejects
+ *  one of them the lines already changed are sent back with their old values. The UART and the parser
+ *  ring buffer are flushed before the radar starts again and the first new frame is used
+ *  only as previous frame, so no frame mixes both configs. The running lines change only once
+ *  sensorStart is acknowledged. When sensorStop, sensorStart or putting back an old line fails
+ *  the radar is reset and configured again with the running lines, see radar_cfg_stats.recoveries.
+ * 
+ * @param lines CLI lines, "boundaryBox -2.5 2.5 0 4.5 -1.5 2.9"
+ * @param num_lines number of lines
+ * @return int number of lines sent, 0 when nothing changed, -1 when a line cannot be changed at runtime or was rejected
+*/
+int radar_reconfigure(const char* lines[], int num_lines);
+
+
+/**
+ * @brief #radar_reconfigure with the lines of a radar config
+ * 
+ * @param cfg radar config, keys not changed are skipped
+ * @return int same as #radar_reconfigure
+*/
+int radar_apply_config(const struct config_radar* cfg);
+
+
+/**
+ * @brief Copy config port counters
+ * 
+ * @param out destination
+*/
+void radar_get_cfg_stats(struct radar_cfg_stats* out);
 
 
 /**
@@ -53,6 +174,13 @@ int read_and_send_to_ring_buffer(RingbufHandle_t* buffer, SemaphoreHandle_t* buf
 */
 bool extract_radar_data(RingbufHandle_t* buffer, QueueHandle_t* data_queue, SemaphoreHandle_t* buffer_sph, SemaphoreHandle_t* data_key);
 
+/**
+ * @brief Give back features received from the data queue of #extract_radar_data, instead of free
+ *
+ * @param feat features, ignored when not from the pool
+ */
+void radar_release_features(struct fall_features* feat);
+
 /**
  * @brief Set radar mode to running mode
  * 
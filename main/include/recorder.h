@@ -0,0 +1,156 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Label of the data partition holding the flight recorder
+ * @details
+ *  The partition table needs an entry such as ``recorder, data, 0x41, , 1M``. One sector
+ *  holds about 3.5 s of frames with two people in view, 1 MB keeps about 15 minutes.
+ *  Without the partition frames are not recorded.
+ */
+#define RECORDER_PARTITION_LABEL "recorder"
+
+/**
+ * @brief Size of a flash sector, the unit of every write
+ *
+ */
+#define RECORDER_SECTOR_SIZE 4096
+
+/**
+ * @brief Tracks kept per frame, more are cut
+ *
+ */
+#define RECORDER_TRACKS_MAX 8
+
+/**
+ * @brief Points kept per recorded point cloud, larger clouds are strided
+ *
+ */
+#define RECORDER_POINTS_MAX 16
+
+/**
+ * @brief Point cloud recorded on every Nth frame, tracks on every frame
+ *
+ */
+#define RECORDER_CLOUD_EVERY 2
+
+/**
+ * @brief Quantisation of recorded points in cm
+ *
+ */
+#define RECORDER_POINT_CM 5
+
+/**
+ * @brief Frames buffered between the radar task and the writer, about 1.7 s at 55 ms per frame
+ *
+ */
+#define RECORDER_STAGE_FRAMES 32
+
+/**
+ * @brief History the partition is expected to hold, a shorter measured history is logged
+ *
+ */
+#define RECORDER_HISTORY_MIN_S 600
+
+/**
+ * @brief Start of every recorded sector, "REC1" little endian
+ *
+ */
+#define RECORDER_MAGIC 0x31434552
+
+/**
+ * @brief Header of a recorded sector, little endian
+ * @details
+ *  Followed by len bytes of payload, LZF compressed (format 1) or stored (format 0). The
+ *  uncompressed payload is a run of frames, each one:
+ *
+ *  uvarint frame delta, uvarint ms delta, u8 tracks, per track u8 tid and svarint
+ *  x, y, z (cm), vx, vy, vz (cm/s), then u8 points, per point svarint x, y, z as delta
+ *  to the previous point (#RECORDER_POINT_CM), i8 doppler (0.1 m/s) and u8 snr.
+ *
+ *  The deltas of the first frame are relative to base_frame and base_ms, a sector decodes
+ *  without its neighbours.
+ */
+struct recorder_sector {
+	uint32_t magic;			/**< #RECORDER_MAGIC*/
+	uint32_t seq;			/**< grows by one per sector, the sector index is seq modulo sectors*/
+	uint32_t base_frame;		/**< radar frame number before the first frame*/
+	uint32_t base_ms;		/**< uptime in ms of base_frame*/
+	uint32_t unix_s;		/**< wall clock of base_ms, wrong until the clock is set*/
+	uint16_t frames;		/**< frames in the payload*/
+	uint16_t raw_len;		/**< payload length before compression*/
+	uint16_t len;			/**< payload bytes following the header*/
+	uint8_t format;			/**< 0 stored, 1 LZF*/
+	uint8_t version;		/**< 1*/
+	uint32_t crc;			/**< over the header before crc and the payload*/
+};
+
+/**
+ * @brief Counters of the recorder since boot
+ *
+ */
+struct recorder_stats {
+	uint32_t frames;		/**< frames taken from the radar task*/
+	uint32_t dropped;		/**< frames lost because the writer fell behind*/
+	uint32_t sectors;		/**< sectors written*/
+	uint32_t raw_bytes;		/**< payload bytes before compression*/
+	uint32_t bytes;			/**< payload bytes written*/
+	uint32_t errors;		/**< failed erases or writes*/
+	uint32_t max_write_ms;		/**< worst time to compress, erase and write a sector*/
+	uint32_t history_s;		/**< history the partition holds at the measured rate, 0 until known*/
+};
+
+/**
+ * @brief Find the recorder partition and its newest sector, then start the writer task
+ *
+ * @return esp_err_t ESP_ERR_NOT_FOUND without partition, ESP_ERR_NO_MEM when the task cannot be created
+ */
+esp_err_t recorder_init(void);
+
+/**
+ * @brief Stage the tracks and a decimated point cloud of a frame, called from the radar task
+ * @details Never blocks, a frame is dropped and counted when the writer is #RECORDER_STAGE_FRAMES behind.
+ *
+ * @param frame frame number
+ * @param targets tracks matrix M(num_targets, 28) of (tid, x, y, z, vx, vy, vz, ...)
+ * @param num_targets number of tracks
+ * @param pcs point clouds matrix M(num_points, 5) of (x, y, z, doppler, snr)
+ * @param num_points number of points
+ */
+void recorder_record(uint32_t frame, const float* targets, int num_targets, const float* pcs, int num_points);
+
+/**
+ * @brief Write the frames not yet in flash as a partial sector
+ *
+ * @param wait_ms time to wait for the write, 0 to return at once
+ * @retval 1 written or nothing pending
+ * @retval 0 still pending after wait_ms or no partition
+ */
+bool recorder_flush(uint32_t wait_ms);
+
+/**
+ * @brief Sequence number of the oldest sector to read
+ *
+ * @param seconds history wanted before now, 0 for all of it
+ * @return uint32_t first sequence number for #recorder_read
+ */
+uint32_t recorder_first(uint32_t seconds);
+
+/**
+ * @brief Copy the next intact sector, oldest first
+ * @details Sectors overwritten or corrupt since #recorder_first are skipped.
+ *
+ * @param seq sequence number to start at, advanced past the sector returned
+ * @param buf output, #RECORDER_SECTOR_SIZE bytes
+ * @return size_t header and payload length, 0 after the newest sector
+ */
+size_t recorder_read(uint32_t* seq, uint8_t* buf);
+
+/**
+ * @brief Copy recorder counters
+ *
+ * @param out destination
+ */
+void recorder_get_stats(struct recorder_stats* out);
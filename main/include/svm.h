@@ -1,4 +1,6 @@
 
+#define PREDICT_ERROR -1				// predict() without a label, features or decision out of frame arena
+
 struct svm_params
 {
 	int num_sv;					// Number of support vectors
@@ -11,6 +13,8 @@ struct svm_params
 
 void int_svm_params(struct svm_params* params);
 double frobenius_norm(double* arr, int m);
-double decision_function(struct svm_params* params, double* X_test, double* support_vectors);
+double decision_function(struct svm_params* params, double* X_test, double* support_vectors);	// NAN when the frame arena is exhausted
 double* substract_matrix_array(double* mat, double* arr, int m, int n);
-int predict(struct frame_struct* q_frame, uint8_t len);
\ No newline at end of file
+float decision_function_f32(struct svm_params* params, double* X_test);
+int predict(struct frame_struct* q_frame, uint8_t len);		// 1 fall, 0 no fall, PREDICT_ERROR
+bool svm_reload_model(void);				// Rebuild float32 model on next prediction, returns kernel selfcheck
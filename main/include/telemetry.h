@@ -0,0 +1,82 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Samples kept between two telemetry publishes
+ *
+ */
+#define TELEMETRY_RING_LEN 512
+
+/**
+ * @brief Largest telemetry message, a few hundred samples in CBOR
+ *
+ */
+#define TELEMETRY_PAYLOAD_MAX (1024*3)
+
+/**
+ * @brief Seconds between two telemetry publishes until config sets "telemetryIntervalSec"
+ *
+ */
+#define TELEMETRY_INTERVAL_DEFAULT 10
+
+/**
+ * @brief Values in a sample per field, positions in cm, velocity in cm/s
+ *
+ */
+#define TELEMETRY_SCALE 100
+
+/**
+ * @brief Record one target of a frame, called from the fall task
+ * @details
+ *  Values are quantised to #TELEMETRY_SCALE on entry. When the ring is full the oldest
+ *  sample is overwritten.
+ *
+ * @param frame frame number
+ * @param target row of fall_features.target (tid, x, y, z, vx, vy, vz, ...)
+ * @param abs_height absolute height of the target in m
+ */
+void telemetry_record(uint32_t frame, const float* target, float abs_height);
+
+/**
+ * @brief Serialize the oldest samples, delta encoded per target, without removing them
+ *
+ * @param encoding wire encoding
+ * @param buf output buffer
+ * @param cap size of buffer
+ * @param until position after the last serialized sample, for #telemetry_commit
+ * @return length of payload, 0 when there is nothing to send
+ */
+size_t telemetry_build(enum payload_encoding encoding, char* buf, size_t cap, uint32_t* until);
+
+/**
+ * @brief Drop samples which have been published
+ *
+ * @param until value from #telemetry_build
+ */
+void telemetry_commit(uint32_t until);
+
+/**
+ * @brief Samples waiting in the ring
+ *
+ */
+uint32_t telemetry_pending(void);
+
+/**
+ * @brief Samples overwritten before they could be published
+ *
+ */
+uint32_t telemetry_dropped(void);
+
+/**
+ * @brief Set publish interval
+ *
+ * @param seconds interval, 0 stops recording and publishing
+ */
+void telemetry_set_interval(uint32_t seconds);
+
+/**
+ * @brief Publish interval in seconds, 0 when disabled
+ *
+ */
+uint32_t telemetry_interval(void);
@@ -0,0 +1,124 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Record begin and end events of the pipeline stages, off unless built with TRACE_ENABLE=1
+ * @details Disabled, the macros below compile to nothing and the ring takes no memory.
+ *
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+
+/**
+ * @brief Events kept in the ring, a power of two, 12 bytes each
+ *
+ */
+#define TRACE_EVENTS 2048
+
+/**
+ * @brief First bytes of a dump
+ *
+ */
+#define TRACE_MAGIC "FTRC"
+#define TRACE_VERSION 1
+
+/**
+ * @brief Spans of the pipeline, each one is recorded by a single task
+ *
+ */
+enum trace_span {
+	TRACE_ANCHOR,			/**< internal, pairs the cycle counter of a core with esp_timer*/
+	TRACE_UART_READ,		/**< UART driver to ring buffer, uart_event_task*/
+	TRACE_FRAME_READ,		/**< header checked to TLVs read from the ring buffer, radar_interface*/
+	TRACE_FEATURES,			/**< TLVs parsed and features queued, radar_interface*/
+	TRACE_FALL_LOGIC,		/**< features taken to fall logic done, fall_logic_processing_task*/
+	TRACE_MQTT_PUBLISH,		/**< fall or presence event handed to the MQTT client, mqtt_station_task*/
+	TRACE_SPAN_COUNT
+};
+
+/**
+ * @brief A dump is this header, names_len bytes of "span task\n" lines in enum order, then count events
+ *
+ */
+struct __attribute__((packed)) trace_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t event_size;
+	uint16_t cpu_mhz;		/**< cycles per us of the timestamps*/
+	uint32_t count;			/**< events in the dump, oldest first*/
+	uint32_t recorded;		/**< events recorded since boot, older ones are overwritten*/
+	uint32_t skipped;		/**< events not recorded while a dump was read*/
+	uint32_t event_cycles;		/**< cost of one event measured at init*/
+	int64_t now_us;			/**< esp_timer time of the dump*/
+	uint16_t names_len;
+	uint16_t reserved;
+};
+
+/**
+ * @brief One begin or end, anchors carry the low 32 bits of esp_timer in frame
+ *
+ */
+struct __attribute__((packed)) trace_event {
+	uint32_t cycles;		/**< cycle counter of the core*/
+	uint32_t frame;			/**< radar frame number, 0 when unknown*/
+	uint8_t span;
+	uint8_t flags;			/**< bit 0 begin, bits 1-7 core*/
+	uint16_t reserved;
+};
+
+#if TRACE_ENABLE
+void trace_record(enum trace_span span, bool begin, uint32_t frame);
+#define TRACE_BEGIN(span, frame) trace_record((span), true, (frame))
+#define TRACE_END(span, frame) trace_record((span), false, (frame))
+#else
+#define TRACE_BEGIN(span, frame) ((void)0)
+#define TRACE_END(span, frame) ((void)0)
+#endif
+
+/**
+ * @brief Measure the cost of an event, call once before the pipeline tasks start
+ *
+ */
+void trace_init(void);
+
+/**
+ * @brief Stop recording and describe the events left in the ring
+ * @details Events recorded until trace_resume() are counted as skipped.
+ *
+ * @param hdr header of the dump
+ * @return uint32_t position of the oldest event, for trace_read()
+ */
+uint32_t trace_pause(struct trace_header* hdr);
+
+/**
+ * @brief Copy the "span task\n" lines written after the header
+ *
+ * @param buf output buffer
+ * @param cap size of buffer, names_len of the header is enough
+ * @return size_t bytes written
+ */
+size_t trace_names(char* buf, size_t cap);
+
+/**
+ * @brief Copy events of a paused ring, oldest first
+ *
+ * @param pos position, advanced by the events copied
+ * @param out events
+ * @param max size of out
+ * @return size_t events copied, 0 when all were read
+ */
+size_t trace_read(uint32_t* pos, struct trace_event* out, size_t max);
+
+/**
+ * @brief Record again after a dump
+ *
+ */
+void trace_resume(void);
+
+/**
+ * @brief Print a dump to the console as base64 lines between "TRACE BEGIN" and "TRACE END"
+ *
+ */
+void trace_print(void);
@@ -0,0 +1,71 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief TCP port of the tap server
+ *
+ */
+#define UART_TAP_PORT 5005
+
+/**
+ * @brief Bytes buffered between the UART reader and the socket, about 350 ms at 921600 baud
+ *
+ */
+#define UART_TAP_BUF_SIZE (1024*32)
+
+/**
+ * @brief Start of every chunk on the socket, "TAP1" little endian
+ *
+ */
+#define UART_TAP_MAGIC 0x31504154
+
+/**
+ * @brief Header of a chunk of raw radar bytes, little endian
+ * @details Followed by len bytes exactly as read from UART1.
+ */
+struct uart_tap_chunk {
+	uint32_t magic;			/**< #UART_TAP_MAGIC*/
+	uint32_t len;			/**< raw bytes following the header*/
+	uint32_t time_ms;		/**< esp_timer time of the UART read*/
+	uint32_t dropped;		/**< bytes dropped since the client connected, a gap before this chunk when it grows*/
+};
+
+/**
+ * @brief Counters of the tap since boot
+ *
+ */
+struct uart_tap_stats {
+	uint32_t clients;		/**< clients accepted*/
+	uint32_t chunks;		/**< chunks queued for the client*/
+	uint32_t bytes;			/**< raw bytes queued for the client*/
+	uint32_t dropped_chunks;	/**< chunks dropped because the buffer was full*/
+	uint32_t dropped_bytes;		/**< raw bytes of those chunks*/
+	uint32_t sent_bytes;		/**< bytes written to the socket, headers included*/
+};
+
+/**
+ * @brief Create the tap buffer and the server task, lab builds only
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM when the buffer or task cannot be created
+ */
+esp_err_t uart_tap_start(void);
+
+/**
+ * @brief Copy raw radar bytes for the connected client, called by the UART reader
+ * @details
+ *  Never blocks. Without a client nothing is copied, when the buffer cannot take the
+ *  whole chunk it is dropped and counted.
+ *
+ * @param data bytes read from UART1
+ * @param len number of bytes
+ */
+void uart_tap_feed(const uint8_t* data, size_t len);
+
+/**
+ * @brief Copy tap counters
+ *
+ * @param out destination
+ */
+void uart_tap_get_stats(struct uart_tap_stats* out);
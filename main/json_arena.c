@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "json_arena.h"
+
+static const char* TAG = "json_arena";
+
+static uint8_t arena_buf[JSON_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t arena_used = 0;
+static size_t arena_high_water = 0;
+static uint8_t arena_depth = 0;
+static TaskHandle_t arena_owner = NULL;
+static SemaphoreHandle_t arena_lock = NULL;
+static uint32_t heap_fallbacks = 0;
+
+/**
+ * @brief malloc hook for cJSON
+ * 
+ * @param size requested bytes
+ * @return pointer in arena when called by the owner task, otherwise from heap
+ */
+static void* s_arena_malloc(size_t size)
+{
+	if (arena_depth > 0 && arena_owner == xTaskGetCurrentTaskHandle()) {
+		size_t offset = (arena_used + 7) & ~((size_t)7);
+		if (offset + size <= sizeof(arena_buf)) {
+			arena_used = offset + size;
+			if (arena_used > arena_high_water)
+				arena_high_water = arena_used;
+			return arena_buf + offset;
+		}
+		heap_fallbacks++;
+		ESP_LOGW(TAG, "Arena exhausted (%u + %u), fallback to heap", arena_used, size);
+	}
+	return malloc(size);
+}
+
+/**
+ * @brief free hook for cJSON, arena memory is released by #json_arena_end
+ * 
+ * @param ptr pointer to release
+ */
+static void s_arena_free(void* ptr)
+{
+	if ((uint8_t*)ptr >= arena_buf && (uint8_t*)ptr < arena_buf + sizeof(arena_buf))
+		return;
+	free(ptr);
+}
+
+void json_arena_init(void)
+{
+	cJSON_Hooks hooks = {
+		.malloc_fn = s_arena_malloc,
+		.free_fn = s_arena_free,
+	};
+
+	arena_lock = xSemaphoreCreateRecursiveMutex();
+	if (arena_lock == NULL) {
+		ESP_LOGE(TAG, "Cannot create json arena lock");
+		return;
+	}
+	cJSON_InitHooks(&hooks);
+}
+
+void json_arena_begin(void)
+{
+	if (arena_lock == NULL)
+		return;
+	xSemaphoreTakeRecursive(arena_lock, portMAX_DELAY);
+	if (arena_depth == 0) {
+		arena_owner = xTaskGetCurrentTaskHandle();
+		arena_used = 0;
+	}
+	arena_depth++;
+}
+
+void json_arena_end(void)
+{
+	if (arena_lock == NULL || arena_depth == 0)
+		return;
+	arena_depth--;
+	if (arena_depth == 0) {
+		arena_used = 0;
+		arena_owner = NULL;
+	}
+	xSemaphoreGiveRecursive(arena_lock);
+}
+
+uint32_t json_arena_heap_fallbacks(void)
+{
+	return heap_fallbacks;
+}
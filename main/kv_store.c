@@ -0,0 +1,143 @@
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_crc.h"
+#include "nvs.h"
+
+#include "kv_store.h"
+
+static const char* TAG = "kv_store";
+
+struct kv_record {
+	struct kv_header hdr;
+	uint8_t value[KV_VALUE_MAX];
+};
+
+static nvs_handle_t kv_handle;
+static SemaphoreHandle_t kv_lock = NULL;
+/* Both copies of a key are read, too large for the caller stacks */
+static struct kv_record records[2];
+static struct kv_stats stats;
+
+
+static uint32_t s_record_crc(const struct kv_record* r)
+{
+	uint32_t crc = esp_crc32_le(0, (const uint8_t*)&r->hdr, offsetof(struct kv_header, crc));
+	return esp_crc32_le(crc, r->value, r->hdr.len);
+}
+
+/**
+ * @brief Load copy slot of key into records[slot]
+ *
+ * @retval 1 copy present and intact
+ * @retval 0 missing or corrupt
+ */
+static bool s_load(const char* key, int slot)
+{
+	char name[KV_KEY_MAX + 3];
+	size_t len = sizeof(records[slot]);
+
+	snprintf(name, sizeof(name), "%s.%d", key, slot);
+	if (nvs_get_blob(kv_handle, name, &records[slot], &len) != ESP_OK)
+		return false;
+	if (len < sizeof(struct kv_header) || len != sizeof(struct kv_header) + records[slot].hdr.len ||
+	    records[slot].hdr.crc != s_record_crc(&records[slot])) {
+		stats.corrupt++;
+		ESP_LOGW(TAG, "Copy %s is corrupt", name);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Slot holding the newest intact copy of key
+ *
+ * @return int 0 or 1, -1 when neither copy is intact
+ */
+static int s_newest(const char* key)
+{
+	bool valid0 = s_load(key, 0);
+	bool valid1 = s_load(key, 1);
+
+	if (valid0 && valid1)
+		return (int32_t)(records[1].hdr.seq - records[0].hdr.seq) > 0 ? 1 : 0;
+	if (valid0)
+		return 0;
+	return valid1 ? 1 : -1;
+}
+
+esp_err_t kv_init(void)
+{
+	esp_err_t err;
+
+	kv_lock = xSemaphoreCreateMutex();
+	if (kv_lock == NULL)
+		return ESP_ERR_NO_MEM;
+	err = nvs_open(KV_NAMESPACE, NVS_READWRITE, &kv_handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Cannot open namespace %s (%s)", KV_NAMESPACE, esp_err_to_name(err));
+		vSemaphoreDelete(kv_lock);
+		kv_lock = NULL;
+	}
+	return err;
+}
+
+esp_err_t kv_get(const char* key, uint16_t schema, void* value, size_t len)
+{
+	esp_err_t err = ESP_OK;
+
+	if (kv_lock == NULL || strlen(key) > KV_KEY_MAX)
+		return ESP_ERR_NOT_FOUND;
+	xSemaphoreTake(kv_lock, portMAX_DELAY);
+	stats.reads++;
+	int slot = s_newest(key);
+	if (slot < 0) {
+		err = ESP_ERR_NOT_FOUND;
+	} else if (records[slot].hdr.schema != schema || records[slot].hdr.len != len) {
+		stats.stale_schema++;
+		ESP_LOGW(TAG, "%s has schema %u, expected %u", key, records[slot].hdr.schema, schema);
+		err = ESP_ERR_INVALID_VERSION;
+	} else {
+		memcpy(value, records[slot].value, len);
+	}
+	xSemaphoreGive(kv_lock);
+	return err;
+}
+
+esp_err_t kv_set(const char* key, uint16_t schema, const void* value, size_t len)
+{
+	char name[KV_KEY_MAX + 3];
+	esp_err_t err;
+
+	if (kv_lock == NULL)
+		return ESP_ERR_INVALID_STATE;
+	if (strlen(key) > KV_KEY_MAX || len > KV_VALUE_MAX)
+		return ESP_ERR_INVALID_SIZE;
+	xSemaphoreTake(kv_lock, portMAX_DELAY);
+	int newest = s_newest(key);
+	// The other copy is older or broken, the newest one stays until this commit is done
+	int slot = newest == 0 ? 1 : 0;
+	struct kv_record* r = &records[slot];
+	r->hdr.seq = newest < 0 ? 1 : records[newest].hdr.seq + 1;
+	r->hdr.schema = schema;
+	r->hdr.len = len;
+	memcpy(r->value, value, len);
+	r->hdr.crc = s_record_crc(r);
+	snprintf(name, sizeof(name), "%s.%d", key, slot);
+	err = nvs_set_blob(kv_handle, name, r, sizeof(struct kv_header) + len);
+	if (err == ESP_OK)
+		err = nvs_commit(kv_handle);
+	if (err == ESP_OK)
+		stats.writes++;
+	else
+		ESP_LOGE(TAG, "Cannot write %s (%s)", name, esp_err_to_name(err));
+	xSemaphoreGive(kv_lock);
+	return err;
+}
+
+void kv_get_stats(struct kv_stats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "latency.h"
+
+#define CORES 2
+#define LINEAR (2 << LATENCY_SUB_BITS)		/**< values below are counted one per bucket*/
+#define SUB_COUNT (1 << LATENCY_SUB_BITS)
+
+/* Each core counts into its own histograms, readers merge them without lock */
+static uint32_t counts[CORES][LATENCY_STAGE_COUNT][LATENCY_BUCKETS];
+static uint32_t max_us[LATENCY_STAGE_COUNT];
+static uint64_t sum_us[CORES][LATENCY_STAGE_COUNT];
+
+static const char* const stage_names[LATENCY_STAGE_COUNT] = {
+	[LATENCY_PARSE]		= "parse",
+	[LATENCY_FEATURES]	= "features",
+	[LATENCY_QUEUE]		= "queue",
+	[LATENCY_FALL_LOGIC]	= "fallLogic",
+	[LATENCY_PUBLISH]	= "publish",
+	[LATENCY_FRAME_TO_ALERT] = "frameToAlert",
+};
+
+
+/**
+ * @brief Bucket of a value, the top LATENCY_SUB_BITS bits below the leading one pick the sub-bucket
+ *
+ */
+static int s_bucket(uint32_t us)
+{
+	if (us < LINEAR)
+		return us;
+	int exp = 31 - __builtin_clz(us);
+	if (exp >= LATENCY_MAX_BITS)
+		return LATENCY_BUCKETS - 1;
+	return LINEAR + (exp - LATENCY_SUB_BITS - 1) * SUB_COUNT + ((us >> (exp - LATENCY_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/**
+ * @brief Largest value counted in a bucket
+ *
+ */
+static uint32_t s_bucket_top(int bucket)
+{
+	if (bucket < LINEAR)
+		return bucket;
+	int exp = (bucket - LINEAR) / SUB_COUNT + LATENCY_SUB_BITS + 1;
+	uint32_t sub = (bucket - LINEAR) % SUB_COUNT;
+	return ((SUB_COUNT + sub + 1) << (exp - LATENCY_SUB_BITS)) - 1;
+}
+
+void latency_record(enum latency_stage stage, int64_t start_us, int64_t end_us)
+{
+	if (start_us == 0)
+		return;
+	int64_t d = end_us - start_us;
+	uint32_t us = d < 0 ? 0 : d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+	uint32_t cur = __atomic_load_n(&max_us[stage], __ATOMIC_RELAXED);
+
+	// A task preempted between reading the core and counting still counts once, on either core
+	int core = xPortGetCoreID();
+	__atomic_fetch_add(&counts[core][stage][s_bucket(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sum_us[core][stage], us, __ATOMIC_RELAXED);
+	while (us > cur && !__atomic_compare_exchange_n(&max_us[stage], &cur, us, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void latency_get_summary(enum latency_stage stage, struct latency_summary* out)
+{
+	static const uint32_t permille[3] = {500, 900, 990};
+	uint32_t* results[3] = {&out->p50, &out->p90, &out->p99};
+	uint32_t merged[LATENCY_BUCKETS];
+	uint32_t total = 0, seen = 0;
+	int q = 0;
+
+	memset(out, 0, sizeof(*out));
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		merged[b] = 0;
+		for (int c = 0; c < CORES; c++)
+			merged[b] += __atomic_load_n(&counts[c][stage][b], __ATOMIC_RELAXED);
+		total += merged[b];
+	}
+	out->count = total;
+	for (int c = 0; c < CORES; c++)
+		out->sum += __atomic_load_n(&sum_us[c][stage], __ATOMIC_RELAXED);
+	out->max = __atomic_load_n(&max_us[stage], __ATOMIC_RELAXED);
+	if (total == 0)
+		return;
+	for (int b = 0; b < LATENCY_BUCKETS && q < 3; b++) {
+		seen += merged[b];
+		// Rank of the percentile, rounded up so p99 of 100 samples is the 99th
+		while (q < 3 && (uint64_t)seen * 1000 >= (uint64_t)total * permille[q]) {
+			// The last bucket has no top, everything beyond LATENCY_MAX_BITS
+			uint32_t top = b == LATENCY_BUCKETS - 1 ? out->max : s_bucket_top(b);
+			*results[q++] = top < out->max ? top : out->max;
+		}
+	}
+}
+
+const char* latency_stage_name(enum latency_stage stage)
+{
+	return stage_names[stage];
+}
@@ -0,0 +1,67 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lzf.h"
+
+#define LZF_MAX_LIT 32
+#define LZF_MAX_OFF (1 << 13)
+#define LZF_MAX_REF ((1 << 8) + (1 << 3))
+
+
+size_t lzf_compress(struct lzf_state* state, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_cap)
+{
+	uint16_t* htab = state->htab;
+	const uint8_t* ip = in;
+	const uint8_t* in_end = in + in_len;
+	uint8_t* op = out + 1;				/**< out[0] is the control byte of the first literal run*/
+	uint8_t* out_end = out + out_cap;
+	int lit = 0;
+
+	if (in_len == 0 || out_cap < 2)
+		return 0;
+	memset(state->htab, 0, sizeof(state->htab));
+	while (ip < in_end) {
+		if (ip + 2 < in_end) {
+			uint32_t v = ip[0] << 16 | ip[1] << 8 | ip[2];
+			uint32_t h = ((v >> (24 - LZF_HLOG)) - v * 5) & ((1 << LZF_HLOG) - 1);
+			const uint8_t* ref = htab[h] ? in + htab[h] - 1 : NULL;
+			htab[h] = (uint16_t)(ip - in + 1);
+			if (ref != NULL && ip - ref - 1 < LZF_MAX_OFF &&
+			    ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+				size_t off = ip - ref - 1;
+				size_t max = in_end - ip < LZF_MAX_REF ? in_end - ip : LZF_MAX_REF;
+				size_t len = 3;
+				while (len < max && ref[len] == ip[len])
+					len++;
+				if (op + 3 + 1 > out_end)
+					return 0;
+				// Close the literal run, drop its control byte when empty
+				op[-lit - 1] = lit - 1;
+				op -= !lit;
+				if (len - 2 < 7) {
+					*op++ = (off >> 8) + ((len - 2) << 5);
+				} else {
+					*op++ = (off >> 8) + (7 << 5);
+					*op++ = len - 2 - 7;
+				}
+				*op++ = (uint8_t)off;
+				op++;
+				lit = 0;
+				ip += len;
+				continue;
+			}
+		}
+		if (op + 1 + 1 > out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == LZF_MAX_LIT) {
+			op[-lit - 1] = lit - 1;
+			lit = 0;
+			op++;
+		}
+	}
+	op[-lit - 1] = lit - 1;
+	op -= !lit;
+	return op - out;
+}
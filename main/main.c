@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/uart.h"
 #include "freertos/ringbuf.h"
 #include "driver/gpio.h"
@@ -19,10 +20,25 @@
 
 #include "svm.h"
 #include "common.h"
+#include "matrix_calc.h"
 #include "utils.h"
 #include "fall_logic.h"
 #include "ex_com_mqtt.h"
 #include "handle_spiffs.h"
+#include "config_store.h"
+#include "json_arena.h"
+#include "outbox.h"
+#include "telemetry.h"
+#include "cloud_upload.h"
+#include "uart_tap.h"
+#include "recorder.h"
+#include "fall_capture.h"
+#include "metrics.h"
+#include "latency.h"
+#include "trace.h"
+#include "binlog.h"
+#include "frame_loss.h"
+#include "mqtt_command.h"
 #include "sensor_command.h"
 #include "radar_interface.h"
 #include "network_interface.h"
@@ -31,18 +47,29 @@
 
 #define DEBUG_VELOCITY 0
 #define DEBUG_TIME 0
+#define DEBUG_ALLOC 0
+#define DEBUG_KERNEL 0
+#define LAB_UART_TAP 0
 #define TEST_FALL 1
 #define CLOSE 1
 #define VERBOSE 0
 #define MAX_BUFF_SIZE 4666
 
 #define MAX_TARGETS 13
+#define FALL_LANE_LEN 10
+#define PRESENCE_LANE_LEN 10
+/* Deepest path is telemetry_build into latency_get_summary with a float printf, about 3 KB.
+ * Check task_stack_high_water_bytes{task="mqtt_station_task"} on /metrics after changing it. */
+#define MQTT_STATION_STACK (1024*6)
 
 static const char* TAG = "main";
 static const char* MQTT = "mqtt";
 
 static QueueHandle_t q_radar2fall;
 static QueueHandle_t q_fall2mqtt;
+static QueueHandle_t q_presence2mqtt;
+static QueueSetHandle_t qs_mqtt_lanes;
+static SemaphoreHandle_t sem_mqtt_kick;
 static QueueHandle_t isr_uart;
 static QueueHandle_t ppr_queue;
 
@@ -53,44 +80,21 @@ static SemaphoreHandle_t mutex_rb_data_cube;
 
 static enum DEVICE_STATE curr_state = IDLE;
 
-/**
- * @brief Get current network state
- * 
- * @param json the json State from storage
- * @return enum DEVICE_STATE curr network state
- */
-static enum DEVICE_STATE get_nw_state(char* json)
-{
-        char* check_ap;
-        char* check_sta;
-
-        check_ap = strstr(json, "AP");
-        check_sta = strstr(json, "STA");
-        if (check_ap != NULL) {
-                return AP;
-        } else if (check_sta != NULL) {
-                return STA;
-        } else {
-                return IDLE;
-        }
-}
-
 /**
  * @brief Initialize network state
  * 
  */
 static void init_network(void)
 {
-        char* nw_state = read_nw_state();
-        if (nw_state == NULL) {
-                write_nw_state("AP");
+        enum config_nw_mode mode = config_get_nw_mode();
+        if (mode == CONFIG_NW_UNSET) {
+                config_set_nw_mode(CONFIG_NW_AP);
                 wifi_init_softap();
                 curr_state = AP;
 		control_nw_led(&ppr_queue, &curr_state);
                 return;
         }
-        int state = get_nw_state(nw_state);
-        if (state == AP) {
+        if (mode == CONFIG_NW_AP) {
                 curr_state = AP;
 		control_nw_led(&ppr_queue, &curr_state);
                 wifi_init_softap();
@@ -117,21 +121,21 @@ static void button_logic(void)
                                 switch (curr_state) {
                                 case STA:
                                         count = 0;
-                                        write_nw_state("AP");
+                                        config_set_nw_mode(CONFIG_NW_AP);
                                         // TODO: start buzzer for 2 seconds
                                         buz_sound(LEDC_OUTPUT_IO, E, 2000);
 					
                                         break;
                                 case AP:
                                         count = 0;
-                                        write_nw_state("STA");
+                                        config_set_nw_mode(CONFIG_NW_STA);
                                         // TODO: start buzzer for 2 seconds
 					buz_sound(LEDC_OUTPUT_IO, E, 2000);
 					
                                         break;
                                 default:
 					ESP_LOGE("BUTTON", "Failed to specify state, setting state to AP and restart device");
-					write_nw_state("AP");
+					config_set_nw_mode(CONFIG_NW_AP);
 					vTaskDelay(300 / portTICK_PERIOD_MS);
 				}
                                 esp_restart();
@@ -143,6 +147,53 @@ static void button_logic(void)
         }
 }
 
+#if DEBUG_KERNEL
+/**
+ * @brief Compare float32 kernels with reference path and report speed-up 
+ * of SVM decision function and point cloud transform
+ * 
+ */
+static void kernel_benchmark(void)
+{
+	const int loops = 100;
+	static float pts[750*3];
+	static float out[750*3];
+	float rot[9] = {1, 0, 0, 0, 0.906f, -0.423f, 0, 0.423f, 0.906f};
+	struct svm_params params;
+	double X[29];
+	volatile double sink = 0;
+
+	ESP_LOGI(TAG, "Kernel backend: %s, selfcheck %s", calc_kernel_backend(), 
+		 calc_kernel_selfcheck() ? "passed" : "FAILED");
+	int_svm_params(&params);
+	for (int i = 0; i < 29; i++)
+		X[i] = 0.1 * (i % 7) - 0.3;
+	for (int i = 0; i < 750*3; i++)
+		pts[i] = 0.01f * (i % 300) - 1.5f;
+
+	int64_t t0 = esp_timer_get_time();
+	for (int i = 0; i < loops; i++) 
+		sink += decision_function(&params, X, params.support_vectors);
+	int64_t t1 = esp_timer_get_time();
+	for (int i = 0; i < loops; i++) 
+		sink += decision_function_f32(&params, X);
+	int64_t t2 = esp_timer_get_time();
+	ESP_LOGI(TAG, "SVM decision: double %lld us, f32 %lld us per call", 
+		 (t1 - t0) / loops, (t2 - t1) / loops);
+
+	t0 = esp_timer_get_time();
+	for (int i = 0; i < loops; i++) 
+		calc_mat_mult_f32_ref(pts, rot, out, 750, 3, 3);
+	t1 = esp_timer_get_time();
+	for (int i = 0; i < loops; i++) 
+		calc_mat_mult_f32(pts, rot, out, 750, 3, 3);
+	t2 = esp_timer_get_time();
+	ESP_LOGI(TAG, "Point cloud transform (750 points): reference %lld us, %s %lld us", 
+		 (t1 - t0) / loops, calc_kernel_backend(), (t2 - t1) / loops);
+	(void)sink;
+}
+#endif
+
 static void read_data_task(){
 	printf("============ Starting extract radar data ============\n");
 	while (true){
@@ -192,7 +243,7 @@ static void fall_logic_processing_task()
 	printf("============ Starting fall logic task ============\n");
 	vTaskDelay(100/portTICK_PERIOD_MS);
 	for (;;) {
-		struct fall_features* feat;
+		struct fall_features* feat = NULL;
 
 		if(uxQueueMessagesWaiting(q_radar2fall) == 0 ) {
 			vTaskDelay(49/portTICK_PERIOD_MS);
@@ -204,6 +255,12 @@ static void fall_logic_processing_task()
 			}
 			xSemaphoreGive(mutex_q_radar2fall);
 		}
+		// Still queued, taken on the next round
+		if (feat == NULL)
+			continue;
+		int64_t taken_us = esp_timer_get_time();
+		latency_record(LATENCY_QUEUE, feat->features_us, taken_us);
+		TRACE_BEGIN(TRACE_FALL_LOGIC, feat->frame_number);
 		/* Presence */
 		if (feat->num_targets > 0) {
 			if (fall_state == IDLE) {
@@ -214,7 +271,7 @@ static void fall_logic_processing_task()
 			}
 			presence_count += 1;
 			if (presence_count == 1) 
-				pub_to_mqtt(&q_fall2mqtt, 0, "true");
+				pub_presence_to_mqtt(&q_presence2mqtt, OCCUPIED, feat->num_targets);
 		} else {
 			if (fall_state == OCCUPIED) {
 				abscent_count += 1;
@@ -223,7 +280,7 @@ static void fall_logic_processing_task()
 					presence_count = 0;
 					fall_state = VACANT;
 					control_fall_led(&ppr_queue, &fall_state);
-					pub_to_mqtt(&q_fall2mqtt, 0, "false");
+					pub_presence_to_mqtt(&q_presence2mqtt, VACANT, 0);
 					fall_state = IDLE;
 					// TODO: Is fill queue action with value 0 need?
 					ESP_LOGI(TAG, "[TRACKING] Empty room");
@@ -232,15 +289,15 @@ static void fall_logic_processing_task()
 		}
 		/* Fall process */
 		for (int tid = 0; tid < feat->num_targets; tid++) {
-			printf("====\nFrame %u = Taget %.2f - (%f), tid: %d\n", 
-				feat->frame_number, 
-				feat->target[tid*num_feat], 
-				feat->target[tid*num_feat + 6], 
-				tid);
+			BINLOG(BINLOG_TARGET, 
+			       feat->frame_number, 
+			       binlog_f(feat->target[tid*num_feat]), 
+			       binlog_f(feat->target[tid*num_feat + 6]), 
+			       tid);
 			uint8_t target_index = (uint8_t)feat->target[tid*num_feat];
 			
 			if (target_index - feat->target[tid*num_feat] !=0) {
-				ESP_LOGE(TAG, "Wrong tid from features");
+				BINLOG(BINLOG_WRONG_TID);
 			}
 	
 			float absH = feat->abs_height[target_index];
@@ -249,12 +306,17 @@ static void fall_logic_processing_task()
 				absH = *(p_avgH + (target_index + 1)*qlen - 1);
 			fill_computation_queue( &p_absH, &p_avgH, &p_vel, target_index, qlen, absH,
 						feat->target[tid*num_feat + 6]);
+			telemetry_record(feat->frame_number, &feat->target[tid*num_feat], absH);
 			#if CLOSE == 0
 			/* Model classification */
 			if (classify[tid]) {
 				if (fall_timer > 10) {
 					// Get model label here
-					if (predict(frame_queue, num_computation_frame) == 1) {
+					int label = predict(frame_queue, num_computation_frame);
+					if (label == PREDICT_ERROR) {
+						// No answer from the model, the fall is kept rather than cleared
+						ESP_LOGE(TAG, "[FALL] Model has no result, frame arena exhausted");
+					} else if (label == 1) {
 						ESP_LOGI(TAG, "[FALL] Fall detected after model");
 					} else {
 						ESP_LOGI(TAG, "[FALL] Fall exit by model");
@@ -270,20 +332,20 @@ static void fall_logic_processing_task()
 				if (fall_timer == FALL_CONFIRMED_TIME*20) {
 					fall_state = FALL_CONFIRMED;
 					send2mqtt = true;
-					pub_to_mqtt(&q_fall2mqtt, 1, "fall confirmed");
+					pub_fall_to_mqtt(&q_fall2mqtt, FALL_CONFIRMED, target_index, absH, feat->header_us);
 					ESP_LOGI(TAG, "[FALL] Fall confirmed");
 				}
 
 				if (fall_timer == CALLING_TIME*20) {
 					//TODO: turn on buzzer here
 					fall_state = CALLING;
-					pub_to_mqtt(&q_fall2mqtt, 1, "calling");
+					pub_fall_to_mqtt(&q_fall2mqtt, CALLING, target_index, absH, feat->header_us);
 					ESP_LOGI(TAG, "[FALL] Calling");
 				}
 
 				if (fall_timer == FINISHED_TIME*20) {
 					fall_state = FINISHED;
-					pub_to_mqtt(&q_fall2mqtt, 1, "finished");
+					pub_fall_to_mqtt(&q_fall2mqtt, FINISHED, target_index, absH, feat->header_us);
 					ESP_LOGI(TAG, "[FALL] Finished");
 					fall_state = FALL_EXITED;
 				}
@@ -296,7 +358,7 @@ static void fall_logic_processing_task()
 					
 					if (fall_state == FALL_EXITED) {
 						if (send2mqtt) 
-							pub_to_mqtt(&q_fall2mqtt, 1, "fall exited");
+							pub_fall_to_mqtt(&q_fall2mqtt, FALL_EXITED, target_index, absH, feat->header_us);
 						fall_state = IDLE;
 						fall_timer = 0;
 						send2mqtt = false;
@@ -325,14 +387,25 @@ static void fall_logic_processing_task()
 					fall_timer = 0;
 					fall_state = FALL_DETECTED;
 					classify[target_index] = true;
-					pub_to_mqtt(&q_fall2mqtt, 1, "fall detected");
+					pub_fall_to_mqtt(&q_fall2mqtt, FALL_DETECTED, target_index, absH, feat->header_us);
+					fall_capture_trigger(target_index);
 					control_fall_led(&ppr_queue, &fall_state);
 					ESP_LOGI(TAG, "[FALL] [Target %u] Fall detected", target_index);
 				}
 			}
 		}			
-		free(feat);
+		latency_record(LATENCY_FALL_LOGIC, taken_us, esp_timer_get_time());
+		TRACE_END(TRACE_FALL_LOGIC, feat->frame_number);
+		radar_release_features(feat);
 		feat = NULL;
+		calc_arena_reset(calc_frame_arena());
+		#if DEBUG_ALLOC
+		static uint32_t last_alloc_count = 0;
+		if (calc_heap_alloc_count() != last_alloc_count) {
+			ESP_LOGW(TAG, "Matrix heap allocations in frame: %u", calc_heap_alloc_count() - last_alloc_count);
+			last_alloc_count = calc_heap_alloc_count();
+		}
+		#endif
 		// printf("%d\n", uxTaskGetStackHighWaterMark(NULL));
 
 	}
@@ -343,26 +416,25 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
 {
         ESP_LOGD(MQTT, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
 	static enum DEVICE_STATE nw_state;
-        // printf("%s\n", TOPIC_UPSTREAM_EVENTS("device123"));
         esp_mqtt_event_handle_t event = event_data;
         esp_mqtt_client_handle_t client = event->client;
         switch ((esp_mqtt_event_id_t)event_id)
         {
         case MQTT_EVENT_CONNECTED:
 		nw_state = MQTT_CONNECTED;
+		mqtt_set_connected(true);
+		xSemaphoreGive(sem_mqtt_kick);
 		control_nw_led(&ppr_queue, &nw_state);
                 ESP_LOGI(MQTT, "MQTT_EVENT_CONNECTED");
-                char* dscfg = s_get_mqtt_topic(TOPIC_DOWNSTREAM_CONFIG);
-                char* dscmd = s_get_mqtt_topic(TOPIC_DOWNSTREAM_COMMANDS);
-                ESP_LOGI(MQTT, "Subscribing to %s", dscfg);
-                esp_mqtt_client_subscribe(client, dscfg, 1);
-                ESP_LOGI(MQTT, "Subscribing to %s", dscmd);
-                esp_mqtt_client_subscribe(client, dscmd, 1);
-                free(dscfg);
-                free(dscmd);
+                mqtt_topics_build();
+                ESP_LOGI(MQTT, "Subscribing to %s", mqtt_topic(MQTT_TOPIC_CONFIG));
+                esp_mqtt_client_subscribe(client, mqtt_topic(MQTT_TOPIC_CONFIG), 1);
+                ESP_LOGI(MQTT, "Subscribing to %s", mqtt_topic(MQTT_TOPIC_COMMANDS));
+                esp_mqtt_client_subscribe(client, mqtt_topic(MQTT_TOPIC_COMMANDS), 1);
                 break;
         case MQTT_EVENT_DISCONNECTED:
                 ESP_LOGI(MQTT,"Disconnected from MQTT broker");
+		mqtt_set_connected(false);
 		nw_state = MQTT_DISCONNECTED;
 		control_nw_led(&ppr_queue, &nw_state);
                 break;
@@ -371,6 +443,13 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
                 break;
         case MQTT_EVENT_PUBLISHED:
                 ESP_LOGI(MQTT, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+                mqtt_on_published(event->msg_id);
+		xSemaphoreGive(sem_mqtt_kick);
+                break;
+        case MQTT_EVENT_DELETED:
+                ESP_LOGW(MQTT, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+                mqtt_on_deleted(event->msg_id);
+		xSemaphoreGive(sem_mqtt_kick);
                 break;
         case MQTT_EVENT_DATA:
                 s_handle_mqtt_topic(event);
@@ -392,6 +471,143 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         }
 }
 
+/**
+ * @brief Wall clock time of an event from its monotonic enqueue time
+ * 
+ * @param enqueue_us esp_timer time of the event
+ * @return intmax_t unix time the event happened, not when it was dequeued
+ */
+static intmax_t s_event_wall_time(int64_t enqueue_us)
+{
+	return (intmax_t)time(NULL) - (intmax_t)((esp_timer_get_time() - enqueue_us) / 1000000);
+}
+
+/**
+ * @brief Ticks until the next periodic upload (telemetry, point cloud) is due
+ * 
+ * @param last tick of the last upload
+ * @param period_ms upload period, 0 when disabled
+ * @return TickType_t portMAX_DELAY when disabled
+ */
+static TickType_t s_period_wait(TickType_t last, uint32_t period_ms)
+{
+	TickType_t period = pdMS_TO_TICKS(period_ms);
+	TickType_t elapsed = xTaskGetTickCount() - last;
+
+	if (period == 0)
+		return portMAX_DELAY;
+	return elapsed >= period ? 0 : period - elapsed;
+}
+
+/**
+ * @brief Close the publish and frame to alert stages of a fall event handed to the client
+ * 
+ * @param event fall event
+ */
+static void s_record_publish(const struct mqtt_event* event)
+{
+	int64_t now = esp_timer_get_time();
+
+	latency_record(LATENCY_PUBLISH, event->enqueue_us, now);
+	latency_record(LATENCY_FRAME_TO_ALERT, event->frame_us, now);
+}
+
+/* ================================================	Commands	================================================*/
+/**
+ * @brief reset-radar, pulse NRESET and send the running config again
+ * 
+ */
+static enum command_code s_cmd_reset_radar(struct command_ctx* ctx)
+{
+	reset_radar();
+	vTaskDelay(10/portTICK_PERIOD_MS);
+	if (!send_running_config())
+		return COMMAND_HARDWARE_ISSUE;
+	return COMMAND_SUCCESS;
+}
+
+/**
+ * @brief set-threshold {"name": string, "value": number}
+ * 
+ */
+static enum command_code s_cmd_set_threshold(struct command_ctx* ctx)
+{
+	const cJSON* name = cJSON_GetObjectItemCaseSensitive(ctx->args, "name");
+	const cJSON* value = cJSON_GetObjectItemCaseSensitive(ctx->args, "value");
+
+	if (!cJSON_IsString(name) || !cJSON_IsNumber(value) ||
+	    !fall_set_threshold(name->valuestring, (float)value->valuedouble)) {
+		snprintf(ctx->msg, sizeof(ctx->msg), "Expected known name and value");
+		return COMMAND_INVALID;
+	}
+	return COMMAND_SUCCESS;
+}
+
+/**
+ * @brief start-capture {"seconds": int}, point cloud upload for a while, 0 until stopped by config
+ * 
+ */
+static enum command_code s_cmd_start_capture(struct command_ctx* ctx)
+{
+	const cJSON* seconds = cJSON_GetObjectItemCaseSensitive(ctx->args, "seconds");
+
+	cloud_upload_enable_for(cJSON_IsNumber(seconds) && seconds->valueint > 0 ? seconds->valueint : 0);
+	return COMMAND_SUCCESS;
+}
+
+/**
+ * @brief dump-recorder {"seconds": int}, publish flight recorder sectors oldest first, 0 for all of them
+ * 
+ */
+static enum command_code s_cmd_dump_recorder(struct command_ctx* ctx)
+{
+	static uint8_t sector[RECORDER_SECTOR_SIZE];
+	const cJSON* seconds = cJSON_GetObjectItemCaseSensitive(ctx->args, "seconds");
+	uint32_t seq;
+	size_t len;
+	int count = 0;
+
+	// Frames still in RAM go out too, the flush is skipped when the writer is busy
+	recorder_flush(1000);
+	seq = recorder_first(cJSON_IsNumber(seconds) && seconds->valueint > 0 ? seconds->valueint : 0);
+	while ((len = recorder_read(&seq, sector)) > 0) {
+		if (esp_mqtt_client_publish(ctx->client, mqtt_topic(MQTT_TOPIC_RECORDER), (const char*)sector, len, 0, 0) < 0) {
+			snprintf(ctx->msg, sizeof(ctx->msg), "Stopped after %d sectors", count);
+			return COMMAND_NETWORK_TIMEOUT;
+		}
+		count++;
+		// Leave room on the link for fall events
+		vTaskDelay(20 / portTICK_PERIOD_MS);
+	}
+	snprintf(ctx->msg, sizeof(ctx->msg), "%d sectors", count);
+	return COMMAND_SUCCESS;
+}
+
+/**
+ * @brief reload-model, rebuild the float32 SVM on the next prediction
+ * 
+ */
+static enum command_code s_cmd_reload_model(struct command_ctx* ctx)
+{
+	if (!svm_reload_model()) {
+		snprintf(ctx->msg, sizeof(ctx->msg), "Kernel selfcheck failed (%s)", calc_kernel_backend());
+		return COMMAND_HARDWARE_ISSUE;
+	}
+	return COMMAND_SUCCESS;
+}
+
+#if TRACE_ENABLE
+/**
+ * @brief dump-trace, print the trace ring on the console UART for tools/trace_to_chrome.py
+ * 
+ */
+static enum command_code s_cmd_dump_trace(struct command_ctx* ctx)
+{
+	trace_print();
+	return COMMAND_SUCCESS;
+}
+#endif
+
 static void mqtt_station_task(){
 	
 	static enum DEVICE_STATE nw_state;
@@ -400,6 +616,14 @@ static void mqtt_station_task(){
 	// sntp_init();
 
 
+	mqtt_command_register("reset-radar", s_cmd_reset_radar);
+	mqtt_command_register("set-threshold", s_cmd_set_threshold);
+	mqtt_command_register("start-capture", s_cmd_start_capture);
+	mqtt_command_register("reload-model", s_cmd_reload_model);
+	mqtt_command_register("dump-recorder", s_cmd_dump_recorder);
+	#if TRACE_ENABLE
+	mqtt_command_register("dump-trace", s_cmd_dump_trace);
+	#endif
 	esp_mqtt_client_handle_t mqtt_client = init_mqtt_client(&mqtt_event_handler);
 	if (mqtt_client == NULL) {
 		nw_state = MQTT_DISCONNECTED;
@@ -412,46 +636,121 @@ static void mqtt_station_task(){
 		.is_present = false
 	};
 	intmax_t ts = 0, update_ts = 0, end_ts = 0;
+	bool presence_pending = false;
+	int64_t presence_enqueue_us = 0;
+	TickType_t telemetry_last = xTaskGetTickCount();
+	TickType_t cloud_last = xTaskGetTickCount();
+	TickType_t capture_last = xTaskGetTickCount();
+	TickType_t latency_last = xTaskGetTickCount();
+	TickType_t loss_last = xTaskGetTickCount();
 
+	if (qs_mqtt_lanes == NULL) {
+		ESP_LOGE(MQTT, "No event lanes, mqtt task exits");
+		vTaskDelete(NULL);
+	}
+	outbox_init();
 	for(;;) {
-		static struct mqtt_fall_event* fall_event;
-		if( q_fall2mqtt == 0 ) 
-			continue;
-		if( xQueueReceive(q_fall2mqtt, &fall_event, (TickType_t) 10)){
-			/*Presence event*/
-			if (fall_event->event_id == 0){
-				if (strcmp(fall_event->msg, "true")==0){
-					presence_p.is_present = true;
-				}else{
-					presence_p.is_present = false;
-				}
-			}
+		struct mqtt_event event;
+		TickType_t wait = s_period_wait(telemetry_last, telemetry_interval() * 1000);
+		TickType_t cloud_wait = s_period_wait(cloud_last, cloud_upload_enabled() ? CLOUD_FLUSH_MS : 0);
+		if (cloud_wait < wait)
+			wait = cloud_wait;
+		TickType_t capture_wait = s_period_wait(capture_last, fall_capture_pending() ? CAPTURE_POLL_MS : 0);
+		if (capture_wait < wait)
+			wait = capture_wait;
+		TickType_t latency_wait = s_period_wait(latency_last, LATENCY_SNAPSHOT_S * 1000);
+		if (latency_wait < wait)
+			wait = latency_wait;
+		TickType_t loss_wait = s_period_wait(loss_last, FRAME_LOSS_SUMMARY_S * 1000);
+		if (loss_wait < wait)
+			wait = loss_wait;
+		uint32_t outbox_wait_ms = mqtt_outbox_wait_ms();
+		if (outbox_wait_ms != UINT32_MAX && pdMS_TO_TICKS(outbox_wait_ms) < wait)
+			wait = pdMS_TO_TICKS(outbox_wait_ms);
+		/* Block until something is queued or an upload is due, only poll while a presence update waits behind fall events */
+		QueueSetMemberHandle_t lane = xQueueSelectFromSet(qs_mqtt_lanes, presence_pending ? 0 : wait);
 
-			if (fall_event->event_id == 1){
-				if (strcmp(fall_event->msg, "fall detected")==0){
-					ts = (intmax_t)time(NULL);
-					update_ts = (intmax_t)time(NULL);
-					end_ts = 0;
-				}else if (strcmp(fall_event->msg, "fall confirmed")==0){
-					ts = (intmax_t)time(NULL);
-					update_ts = (intmax_t)time(NULL);
-					end_ts = 0;
-				}else if (strcmp(fall_event->msg, "calling")==0){
-					update_ts = (intmax_t)time(NULL);
-					end_ts = 0;
-				}else if (strcmp(fall_event->msg, "finished")==0){
-					update_ts = (intmax_t)time(NULL);
-					end_ts = (intmax_t)time(NULL);
-				}else if (strcmp(fall_event->msg, "fall exited")==0){
-					update_ts = (intmax_t)time(NULL);
-					end_ts = (intmax_t)time(NULL);
-				}
-				// send_fall(mqtt_client, fall_event->msg, ts, update_ts, end_ts);
+		if (lane == q_fall2mqtt) {
+			xQueueReceive(q_fall2mqtt, &event, 0);
+			const struct fall_status* entry = mqtt_fall_status(event.status);
+			if (entry == NULL) {
+				ESP_LOGE(MQTT, "Unknown fall event %u", event.status);
+				continue;
+			}
+			intmax_t at = s_event_wall_time(event.enqueue_us);
+			if (entry->opens) {
+				ts = at;
+				// Frames before the fall reach flash now, not with the next full sector
+				recorder_flush(0);
+			}
+			update_ts = at;
+			end_ts = entry->closes ? at : 0;
+			ESP_LOGI(MQTT, "[Target %u] %s at height %.2f", event.target_id, entry->name, event.data.abs_height);
+			TRACE_BEGIN(TRACE_MQTT_PUBLISH, 0);
+			if (outbox_ready()) {
+				/* Persist first, the outbox publishes it now or replays it after reconnect */
+				struct outbox_entry record = {
+					.status = event.status,
+					.target_id = event.target_id,
+					.ts = ts,
+					.update_ts = update_ts,
+					.end_ts = end_ts,
+				};
+				uint32_t seq;
+				if (outbox_append(&record, &seq) == ESP_OK)
+					mqtt_outbox_track(seq, event.enqueue_us, event.frame_us);
+				else
+					ESP_LOGE(MQTT, "Cannot persist fall event");
+				// Timed when its batch goes out and when that batch is acked
+				mqtt_outbox_service(mqtt_client);
+			} else {
+				int msg_id = send_fall(mqtt_client, entry->name, ts, update_ts, end_ts);
+				mqtt_track_publish(msg_id, MQTT_LANE_FALL, event.enqueue_us);
+				if (msg_id > 0)
+					s_record_publish(&event);
 			}
+			TRACE_END(TRACE_MQTT_PUBLISH, 0);
+		} else if (lane == sem_mqtt_kick) {
+			/* Connected or acked, continue replaying the outbox */
+			xSemaphoreTake(sem_mqtt_kick, 0);
+			mqtt_outbox_service(mqtt_client);
+		} else if (lane == q_presence2mqtt) {
+			/* Presence is a state, only the latest value is published once the fall lane is empty */
+			xQueueReceive(q_presence2mqtt, &event, 0);
+			presence_p.is_present = (event.status == OCCUPIED);
+			if (!presence_pending)
+				presence_enqueue_us = event.enqueue_us;
+			presence_pending = true;
+		} else if (mqtt_outbox_wait_ms() == 0) {
+			/* Batch in flight not acked in time, publish it again */
+			mqtt_outbox_service(mqtt_client);
+		} else if (presence_pending) {
+			TRACE_BEGIN(TRACE_MQTT_PUBLISH, 0);
+			int msg_id = send_presence(&presence_p);
+			TRACE_END(TRACE_MQTT_PUBLISH, 0);
+			mqtt_track_publish(msg_id, MQTT_LANE_PRESENCE, presence_enqueue_us);
+			presence_pending = false;
+		}
+		if (s_period_wait(telemetry_last, telemetry_interval() * 1000) == 0) {
+			telemetry_last = xTaskGetTickCount();
+			send_telemetry(mqtt_client);
+		}
+		if (cloud_upload_enabled() && s_period_wait(cloud_last, CLOUD_FLUSH_MS) == 0) {
+			cloud_last = xTaskGetTickCount();
+			send_point_cloud(mqtt_client);
+		}
+		if (fall_capture_pending() && s_period_wait(capture_last, CAPTURE_POLL_MS) == 0) {
+			capture_last = xTaskGetTickCount();
+			send_fall_capture(mqtt_client);
+		}
+		if (s_period_wait(latency_last, LATENCY_SNAPSHOT_S * 1000) == 0) {
+			latency_last = xTaskGetTickCount();
+			send_latency_snapshot(mqtt_client);
+		}
+		if (s_period_wait(loss_last, FRAME_LOSS_SUMMARY_S * 1000) == 0) {
+			loss_last = xTaskGetTickCount();
+			send_frame_loss_summary(mqtt_client);
 		}
-		// send_presence((void*)&presence_p);
-		// ESP_LOGI(TAG, "Send to mqtt");
-		vTaskDelay(8000/portTICK_PERIOD_MS);
 	}
 }
 
@@ -465,14 +764,20 @@ static void uart_event_task(void *pvParameters)
 			switch(event.type) {
 			case UART_DATA:
 				// printf("[Radar] get data\n");
+				TRACE_BEGIN(TRACE_UART_READ, 0);
 				read_and_send_to_ring_buffer(&rb_data_cube, &mutex_rb_data_cube);
+				TRACE_END(TRACE_UART_READ, 0);
 				break;
 			case UART_FIFO_OVF:
+				metric_inc(METRIC_UART_FIFO_OVF);
+				frame_loss_note(FRAME_LOSS_UART_OVERFLOW);
 				ESP_LOGI(TAG, "hw fifo overflow");
 				uart_flush_input(UART_NUM_1);
 				xQueueReset(isr_uart);
 				break;
 			case UART_BUFFER_FULL:
+				metric_inc(METRIC_UART_BUFFER_FULL);
+				frame_loss_note(FRAME_LOSS_UART_OVERFLOW);
 				ESP_LOGI(TAG, "ring buffer full");
 				uart_flush_input(UART_NUM_1);
 				xQueueReset(isr_uart);
@@ -622,8 +927,9 @@ static void peripherals_control_task()
 
 void app_main()
 {   
+	json_arena_init();
 	init_spiffs();
-	char* uuid = "aura_GHAJSDGSA27625";
+	struct config_device device = {"aura_GHAJSDGSA27625"};
 	esp_log_level_set("mqtt", ESP_LOG_VERBOSE);
 	esp_log_level_set("main", ESP_LOG_DEBUG);
 	// /* Wifi */
@@ -633,6 +939,9 @@ void app_main()
 	  ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(ret);
+	if (config_init() != ESP_OK)
+		ESP_LOGE(TAG, "Cannot open config store");
+	recorder_init();
 	
 		/* Init setting */
 	mutex_rb_data_cube = xSemaphoreCreateMutex();
@@ -643,7 +952,7 @@ void app_main()
 	if( mutex_q_radar2fall == NULL ) {
 		ESP_LOGE(TAG, "Failed to create mutex features queue\n");
 	}
-	rb_data_cube  = xRingbufferCreate(1024*10, RINGBUF_TYPE_BYTEBUF);
+	rb_data_cube  = xRingbufferCreate(RADAR_RING_SIZE, RINGBUF_TYPE_BYTEBUF);
 	if (rb_data_cube == NULL) {
 		ESP_LOGE(TAG, "Failed to create ring buffer\n");
 	}
@@ -653,17 +962,40 @@ void app_main()
 		ESP_LOGE(TAG, "Cannot create peripherals queue");
 		//TODO: need to reset
 	}
-	q_radar2fall = xQueueCreate( 40*2, sizeof(struct fall_features *));
+	q_radar2fall = xQueueCreate( RADAR_FEATURES_QUEUE_LEN, sizeof(struct fall_features *));
 	if( q_radar2fall == 0 ){
 		ESP_LOGE(TAG, "Cannot create features queue");
 		// TODO: need to reset
 	}
-	q_fall2mqtt = xQueueCreate( 10*2, sizeof( struct mqtt_fall_event * ) );
-	if( q_fall2mqtt == 0 ){
+	q_fall2mqtt = xQueueCreate( FALL_LANE_LEN, sizeof( struct mqtt_event ) );
+	q_presence2mqtt = xQueueCreate( PRESENCE_LANE_LEN, sizeof( struct mqtt_event ) );
+	if( q_fall2mqtt == 0 || q_presence2mqtt == 0 ){
 		ESP_LOGE(TAG, "Cannot create mqtt event queue");
 		// TODO: Some thing wrong need to reset?
 	}
+	/* Lanes join the set while still empty, before any producer runs */
+	sem_mqtt_kick = xSemaphoreCreateBinary();
+	qs_mqtt_lanes = xQueueCreateSet( FALL_LANE_LEN + PRESENCE_LANE_LEN + 1 );
+	if( qs_mqtt_lanes == NULL || sem_mqtt_kick == NULL ||
+	    xQueueAddToSet(q_fall2mqtt, qs_mqtt_lanes) != pdPASS ||
+	    xQueueAddToSet(q_presence2mqtt, qs_mqtt_lanes) != pdPASS ||
+	    xQueueAddToSet(sem_mqtt_kick, qs_mqtt_lanes) != pdPASS ){
+		ESP_LOGE(TAG, "Cannot create mqtt lane set");
+		qs_mqtt_lanes = NULL;
+	}
+	metrics_register_queue("radar2fall", q_radar2fall);
+	metrics_register_queue("fall2mqtt", q_fall2mqtt);
+	metrics_register_queue("presence2mqtt", q_presence2mqtt);
+	metrics_register_queue("peripherals", ppr_queue);
+	#if DEBUG_KERNEL
+	kernel_benchmark();
+	#endif
+	trace_init();
+	binlog_init();
 	init_uart_port(&isr_uart); 
+	// Only reader of UART1, above the parser so the ring is filled before it runs
+	xTaskCreatePinnedToCore(uart_event_task, "uart_event_task", 
+				1024*8, NULL, 11, NULL, 1);
 	vTaskDelay(10/portTICK_PERIOD_MS);
 	/* Assign task */
 	xTaskCreatePinnedToCore(fall_logic_processing_task, "fall_logic_processing_task", 
@@ -679,9 +1011,15 @@ void app_main()
 	change_radar_running_mode();
 	reset_radar();
 	vTaskDelay(10/portTICK_PERIOD_MS);
-	send_sensor_config(cfg);
+	static struct config_radar radar_cfg;
+	config_get_radar(&radar_cfg);
+	if (!send_sensor_config(cfg, &radar_cfg))
+		ESP_LOGE(TAG, "Radar is not configured, reset-radar to retry");
 
-	write_uuid(uuid);
+	struct config_device stored_device;
+	config_get_device(&stored_device);
+	if (strcmp(stored_device.uuid, device.uuid) != 0)
+		config_set_device(&device);
 
         init_btn();
         nw_led_off();
@@ -690,6 +1028,9 @@ void app_main()
         xTaskCreatePinnedToCore(button_logic, "button_logic", 1024 * 10, NULL, 10, NULL, 0);
 	if (STA == curr_state ) {
 		vTaskDelay(500 / portTICK_PERIOD_MS);
-		xTaskCreatePinnedToCore(mqtt_station_task, "mqtt_station_task", 1024*2, NULL, 10, NULL, 0);
+		xTaskCreatePinnedToCore(mqtt_station_task, "mqtt_station_task", MQTT_STATION_STACK, NULL, 10, NULL, 0);
+		#if LAB_UART_TAP
+		uart_tap_start();
+		#endif
 	}
 }
@@ -1,26 +1,91 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<math.h>
+#include<string.h>
 #include"matrix_calc.h"
+#if MATRIX_CALC_USE_DSP
+#include "esp_dsp.h"
+#endif
 
+static double frame_arena_buf[CALC_FRAME_ARENA_SIZE / sizeof(double)];
+static struct calc_arena frame_arena = {
+	.base = (uint8_t*)frame_arena_buf,
+	.size = sizeof(frame_arena_buf),
+};
+static uint32_t heap_alloc_count = 0;
 
 
+/* ================================================	Scratch arena	================================================*/
+/*
+* @brief:	Take count doubles from the arena
+* @param:	arena	target arena
+* @param:	count	number of doubles
+* @return:	pointer aligned for double, NULL if arena exhausted
+*/
+double* calc_arena_alloc(struct calc_arena* arena, int count)
+{
+	size_t offset = (arena->used + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	size_t bytes = (size_t)count * sizeof(double);
+
+	if (count < 0 || offset + bytes > arena->size) {
+		printf("Calc arena exhausted: %u + %u > %u\n", (unsigned)offset, (unsigned)bytes, (unsigned)arena->size);
+		return NULL;
+	}
+	arena->used = offset + bytes;
+	if (arena->used > arena->high_water)
+		arena->high_water = arena->used;
+	return (double*)(arena->base + offset);
+}
+
+size_t calc_arena_mark(struct calc_arena* arena)
+{
+	return arena->used;
+}
+
+void calc_arena_release(struct calc_arena* arena, size_t mark)
+{
+	if (mark <= arena->used)
+		arena->used = mark;
+}
+
+void calc_arena_reset(struct calc_arena* arena)
+{
+	arena->used = 0;
+}
+
+struct calc_arena* calc_frame_arena(void)
+{
+	return &frame_arena;
+}
+
+uint32_t calc_heap_alloc_count(void)
+{
+	return heap_alloc_count;
+}
+
+static double* s_heap_matrix(int m, int n)
+{
+	heap_alloc_count++;
+	return (double*)malloc(m * n * sizeof(double));
+}
+
+
+/* ================================================	Output buffer	================================================*/
 /*
 * @brief:	Subtract a matrix by a matrix (same size)
 * @param:	src	source matrix
 * @param:	des	matrix to subtract
 * @param:	m	matrix row
 * @param:	n	matrix col
+* @param:	result	output matrix (m, n), may alias src
 */
-double* substract_two_matrixes(double* src, double* des, int m, int n)
+void substract_two_matrixes_to(double* src, double* des, int m, int n, double* result)
 {
-	double* result = (double*)malloc(m * n * sizeof(double));
 	for (int i = 0; i < m; i++) {
 		for (int j = 0; j < n; j++) {
 			*(result + i * n + j) = *(src + i * n + j) - *(des + i * n + j);
 		}
 	}
-	return result;
 }
 
 
@@ -30,16 +95,15 @@ double* substract_two_matrixes(double* src, double* des, int m, int n)
 * @param:	arr	array to subtract
 * @param:	m	matrix row
 * @param:	n	matrix col
+* @param:	result	output matrix (m, n), may alias mat
 */
-double* substract_matrix_array(double* mat, double* arr, int m, int n)
+void substract_matrix_array_to(double* mat, double* arr, int m, int n, double* result)
 {
-	double* result = (double*)malloc(m * n * sizeof(double));
 	for (int i = 0; i < m; i++) {
 		for (int j = 0; j < n; j++) {
 			*(result + i * n + j) = *(mat + i * n + j) - *(arr + j);
 		}
 	}
-	return result;
 }
 
 /*
@@ -47,32 +111,70 @@ double* substract_matrix_array(double* mat, double* arr, int m, int n)
 * @param:	mat	target matrix
 * @param:	m	number of rows
 * @param:	n	number of cols
+* @param:	result	output matrix (n, m)
 */
-double* transpose_matrix(double* mat, int m, int n) {
-	double* result = (double*)malloc(n * m * sizeof(double));
+void transpose_matrix_to(double* mat, int m, int n, double* result)
+{
 	for (int row = 0; row < m; row++) {
 		for (int col = 0; col < n; col++) {
 			*(result + col * m + row) = *(mat + row * n + col);
 		}
 	}
-	return result;
 }
 
-double* dot_two_matrixes(double* src, double* des, int msrc, int nsrc, int mdes, int ndes)
+/*
+* @brief:	Dot product of two matrixes
+* @param:	result	output matrix (msrc, ndes)
+* @return:	false when shapes do not match
+*/
+bool dot_two_matrixes_to(double* src, double* des, int msrc, int nsrc, int mdes, int ndes, double* result)
 {
 	if (nsrc != mdes) {
 		printf("Cannot dot matix with shape (%d, %d) with (%d, %d)\n", msrc, nsrc, mdes, ndes);
-		return NULL;
+		return false;
 	}
-	double* result = (double*)malloc(msrc * ndes * sizeof(double));
 	for (int src_row = 0; src_row < msrc; src_row++) {
 		for (int des_col = 0; des_col < ndes; des_col++) {
-			*(result + src_row * ndes + des_col) = 0;
+			double acc = 0;
 			for (int idx = 0; idx < nsrc; idx++) {
-				*(result + src_row * ndes + des_col) += *(src + src_row * nsrc + idx) * *(des + idx * ndes + des_col);
+				acc += *(src + src_row * nsrc + idx) * *(des + idx * ndes + des_col);
 			}
+			*(result + src_row * ndes + des_col) = acc;
 		}
 	}
+	return true;
+}
+
+
+/* ================================================	Legacy heap	================================================*/
+double* substract_two_matrixes(double* src, double* des, int m, int n)
+{
+	double* result = s_heap_matrix(m, n);
+	substract_two_matrixes_to(src, des, m, n, result);
+	return result;
+}
+
+double* substract_matrix_array(double* mat, double* arr, int m, int n)
+{
+	double* result = s_heap_matrix(m, n);
+	substract_matrix_array_to(mat, arr, m, n, result);
+	return result;
+}
+
+double* transpose_matrix(double* mat, int m, int n) {
+	double* result = s_heap_matrix(n, m);
+	transpose_matrix_to(mat, m, n, result);
+	return result;
+}
+
+double* dot_two_matrixes(double* src, double* des, int msrc, int nsrc, int mdes, int ndes)
+{
+	if (nsrc != mdes) {
+		printf("Cannot dot matix with shape (%d, %d) with (%d, %d)\n", msrc, nsrc, mdes, ndes);
+		return NULL;
+	}
+	double* result = s_heap_matrix(msrc, ndes);
+	dot_two_matrixes_to(src, des, msrc, nsrc, mdes, ndes, result);
 	return result;
 }
 
@@ -90,14 +192,19 @@ void print_matrix(double* matrix, int m, int n)
 
 
 /* ================================================	Interact elementwise with array	================================================*/
-void exp_array(double* arr, int n) 
+void substract_matrix_array_inplace(double* mat, double* arr, int m, int n)
+{
+	substract_matrix_array_to(mat, arr, m, n, mat);
+}
+
+void exp_array(double* arr, int n)
 {
 	for (int i = 0; i < n; i++) {
 		*(arr + i) = exp(*(arr + i));
 	}
 }
 
-void mul_array(double* arr, int n, double t) 
+void mul_array(double* arr, int n, double t)
 {
 	for (int i = 0; i < n; i++) {
 		*(arr + i) = *(arr + i) * t;
@@ -105,9 +212,171 @@ void mul_array(double* arr, int n, double t)
 }
 
 
-void pow_array(double* arr, int n, double pow_value) 
+void pow_array(double* arr, int n, double pow_value)
 {
 	for (int i = 0; i < n; i++) {
 		*(arr + i) = pow(*(arr + i), pow_value);
 	}
-}
\ No newline at end of file
+}
+
+
+
+/* ================================================	Float32 kernels	================================================*/
+float calc_dot_f32_ref(const float* a, const float* b, int len)
+{
+	float acc = 0;
+	for (int i = 0; i < len; i++) {
+		acc += a[i] * b[i];
+	}
+	return acc;
+}
+
+/*
+* @brief:	C(m, k) = A(m, n) . B(n, k)
+*/
+void calc_mat_mult_f32_ref(const float* a, const float* b, float* c, int m, int n, int k)
+{
+	for (int row = 0; row < m; row++) {
+		for (int col = 0; col < k; col++) {
+			float acc = 0;
+			for (int idx = 0; idx < n; idx++) {
+				acc += a[row * n + idx] * b[idx * k + col];
+			}
+			c[row * k + col] = acc;
+		}
+	}
+}
+
+void calc_mul_array_f32_ref(float* arr, int n, float t)
+{
+	for (int i = 0; i < n; i++) {
+		arr[i] *= t;
+	}
+}
+
+float calc_dot_f32(const float* a, const float* b, int len)
+{
+#if MATRIX_CALC_USE_DSP
+	float res;
+	if (dsps_dotprod_f32(a, b, &res, len) == ESP_OK)
+		return res;
+#endif
+	return calc_dot_f32_ref(a, b, len);
+}
+
+void calc_mat_mult_f32(const float* a, const float* b, float* c, int m, int n, int k)
+{
+#if MATRIX_CALC_USE_DSP
+	if (dspm_mult_f32(a, b, c, m, n, k) == ESP_OK)
+		return;
+#endif
+	calc_mat_mult_f32_ref(a, b, c, m, n, k);
+}
+
+void calc_mul_array_f32(float* arr, int n, float t)
+{
+#if MATRIX_CALC_USE_DSP
+	if (dsps_mulc_f32(arr, arr, n, t, 1, 1) == ESP_OK)
+		return;
+#endif
+	calc_mul_array_f32_ref(arr, n, t);
+}
+
+/* No esp-dsp equivalent, single precision libm is still far cheaper than double on the FPU */
+void calc_exp_array_f32(float* arr, int n)
+{
+	for (int i = 0; i < n; i++) {
+		arr[i] = expf(arr[i]);
+	}
+}
+
+void calc_pow_array_f32(float* arr, int n, float pow_value)
+{
+	if (pow_value == 2.0f) {
+		for (int i = 0; i < n; i++)
+			arr[i] = arr[i] * arr[i];
+	} else if (pow_value == 0.5f) {
+		for (int i = 0; i < n; i++)
+			arr[i] = sqrtf(arr[i]);
+	} else {
+		for (int i = 0; i < n; i++)
+			arr[i] = powf(arr[i], pow_value);
+	}
+}
+
+const char* calc_kernel_backend(void)
+{
+	return MATRIX_CALC_USE_DSP ? "esp-dsp" : "reference";
+}
+
+static bool s_close_f32(float a, float b)
+{
+	return fabsf(a - b) <= 1e-4f * (1.0f + fabsf(b));
+}
+
+/**
+ * @brief Compare a float32 result with the same computation in double
+ * @details With the reference backend the dispatched kernel is the reference one, the double
+ *  result is what still checks it.
+ */
+static bool s_check_f32(const char* kernel, float got, float ref, double exact)
+{
+	if (s_close_f32(got, (float)exact) && s_close_f32(ref, (float)exact))
+		return true;
+	printf("Kernel %s: %s %f, reference %f, double %f\n", kernel, calc_kernel_backend(), got, ref, exact);
+	return false;
+}
+
+bool calc_kernel_selfcheck(void)
+{
+	// Sizes cover the SVM row (29) and a point cloud block (n, 3) . (3, 3)
+	enum { LEN = 29, ROWS = 7 };
+	float a[LEN], b[LEN];
+	float pts[ROWS * 3], rot[9], out[ROWS * 3], out_ref[ROWS * 3];
+	float scaled[LEN], scaled_ref[LEN], powed[LEN];
+	double exact;
+	bool ok = true;
+
+	for (int i = 0; i < LEN; i++) {
+		a[i] = sinf(0.37f * i) * 2.5f;
+		b[i] = cosf(0.11f * i) - 0.5f;
+	}
+	for (int i = 0; i < ROWS * 3; i++)
+		pts[i] = 0.25f * (i % 11) - 1.0f;
+	for (int i = 0; i < 9; i++)
+		rot[i] = (i % 4 == 0) ? 0.9f : 0.1f * (i - 4);
+
+	exact = 0;
+	for (int i = 0; i < LEN; i++)
+		exact += (double)a[i] * b[i];
+	ok &= s_check_f32("dot", calc_dot_f32(a, b, LEN), calc_dot_f32_ref(a, b, LEN), exact);
+
+	calc_mat_mult_f32(pts, rot, out, ROWS, 3, 3);
+	calc_mat_mult_f32_ref(pts, rot, out_ref, ROWS, 3, 3);
+	for (int i = 0; i < ROWS * 3; i++) {
+		exact = 0;
+		for (int j = 0; j < 3; j++)
+			exact += (double)pts[i / 3 * 3 + j] * rot[j * 3 + i % 3];
+		ok &= s_check_f32("mat_mult", out[i], out_ref[i], exact);
+	}
+
+	memcpy(scaled, a, sizeof(a));
+	memcpy(scaled_ref, a, sizeof(a));
+	calc_mul_array_f32(scaled, LEN, -0.0014f);
+	calc_mul_array_f32_ref(scaled_ref, LEN, -0.0014f);
+	for (int i = 0; i < LEN; i++)
+		ok &= s_check_f32("mul", scaled[i], scaled_ref[i], (double)a[i] * -0.0014f);
+
+	// exp and pow have no second path, they are only held to double
+	memcpy(powed, b, sizeof(b));
+	calc_exp_array_f32(scaled, LEN);
+	calc_pow_array_f32(powed, LEN, 2.0f);
+	for (int i = 0; i < LEN; i++) {
+		ok &= s_check_f32("exp", scaled[i], scaled[i], exp((double)scaled_ref[i]));
+		ok &= s_check_f32("pow", powed[i], powed[i], (double)b[i] * b[i]);
+	}
+
+	if (!ok)
+		printf("Kernel selfcheck failed for backend %s\n", calc_kernel_backend());
+	return ok;
+}
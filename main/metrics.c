@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+
+#include "ex_com_mqtt.h"
+#include "metrics.h"
+#include "latency.h"
+#include "frame_loss.h"
+
+#define PREFIX "fall_"
+
+static const char* TAG = "metrics";
+
+struct metric_desc {
+	const char* name;
+	const char* help;
+};
+
+struct metric_queue {
+	const char* name;
+	QueueHandle_t queue;
+};
+
+/* Written from any task or core, read by the HTTP task without locks */
+uint32_t metric_counters[METRIC_COUNTER_COUNT];
+uint32_t metric_peaks[METRIC_PEAK_COUNT];
+
+static const struct metric_desc counter_desc[METRIC_COUNTER_COUNT] = {
+	[METRIC_FRAMES_PARSED]		= {"frames_parsed_total", "Radar frames handed to the fall logic"},
+	[METRIC_FRAMES_MISSING]		= {"frames_missing_total", "Radar frame numbers never received"},
+	[METRIC_RESYNCS]		= {"uart_resyncs_total", "Frame headers found after skipping bytes"},
+	[METRIC_RESYNC_BYTES]		= {"uart_resync_bytes_total", "Bytes skipped to find a frame header"},
+	[METRIC_CHECKSUM_ERRORS]	= {"frame_checksum_errors_total", "Frame headers failing their checksum"},
+	[METRIC_UART_FIFO_OVF]		= {"uart_fifo_overflows_total", "UART hardware FIFO overflows"},
+	[METRIC_UART_BUFFER_FULL]	= {"uart_buffer_full_total", "UART driver buffer full events"},
+	[METRIC_RING_SEND_FAILS]	= {"ring_send_failures_total", "UART reads dropped by the ring buffer"},
+	[METRIC_QUEUE_SEND_FAILS]	= {"feature_queue_failures_total", "Frames dropped by the features queue"},
+	[METRIC_LOG_DROPPED]		= {"log_dropped_total", "Log records dropped by a full ring"},
+	[METRIC_LOG_SUPPRESSED]		= {"log_suppressed_total", "Log records over the rate of their message"},
+	[METRIC_RADAR_RECOVERIES]	= {"radar_recoveries_total", "Radar resets after a failed reconfiguration"},
+	[METRIC_METRICS_DROPPED]	= {"metrics_lines_dropped_total", "Lines left out of /metrics for being longer than a chunk"},
+	[METRIC_OUTBOX_RETRIES]		= {"outbox_retries_total", "Outbox batches published again without ack"},
+	[METRIC_FALL_EVENTS_DROPPED]	= {"mqtt_fall_events_dropped_total", "Fall events not taken by a full fall lane"},
+	[METRIC_PRESENCE_EVENTS_DROPPED] = {"mqtt_presence_events_dropped_total", "Presence changes not taken by a full presence lane"},
+};
+
+static const struct metric_desc peak_desc[METRIC_PEAK_COUNT] = {
+	[METRIC_PEAK_RING_BYTES]	= {"ring_high_water_bytes", "Most bytes waiting in the UART ring buffer"},
+	[METRIC_PEAK_RADAR2FALL]	= {"feature_queue_high_water", "Most frames waiting for the fall logic"},
+};
+
+/* Tasks looked up by name on each scrape, missing ones are skipped */
+static const char* const task_names[] = {
+	"radar_interface", "fall_logic_processing_task", "peripherals_control_task", "uart_event_task",
+	"mqtt_station_task", "mqtt_command", "mqtt_task", "button_logic", "recorder", "uart_tap", "binlog", "httpd",
+};
+
+static const char* const lane_names[MQTT_LANE_COUNT] = {
+	[MQTT_LANE_FALL]	= "fall",
+	[MQTT_LANE_PRESENCE]	= "presence",
+};
+
+static struct metric_queue queues[METRICS_QUEUES_MAX];
+static int queue_count = 0;
+
+_Static_assert(sizeof(counter_desc) / sizeof(counter_desc[0]) == METRIC_COUNTER_COUNT, "every counter needs a name");
+
+
+void metrics_register_queue(const char* name, QueueHandle_t queue)
+{
+	if (queue == NULL || queue_count >= METRICS_QUEUES_MAX)
+		return;
+	queues[queue_count].name = name;
+	queues[queue_count].queue = queue;
+	queue_count++;
+}
+
+struct metrics_out {
+	char* buf;
+	size_t cap;
+	size_t len;
+	size_t sent;
+	metrics_sink_t sink;
+	void* ctx;
+	bool failed;			/**< sink refused a chunk, nothing more is written*/
+	uint32_t dropped;		/**< lines longer than the buffer*/
+};
+
+static void s_flush(struct metrics_out* o)
+{
+	if (o->failed || o->len == 0)
+		return;
+	if (!o->sink(o->ctx, o->buf, o->len))
+		o->failed = true;
+	o->sent += o->len;
+	o->len = 0;
+}
+
+/**
+ * @brief Append a line, the buffer goes to the sink first when the line does not fit
+ *
+ */
+static void s_line(struct metrics_out* o, const char* fmt, ...)
+{
+	va_list args;
+	int n;
+
+	for (int attempt = 0; attempt < 2 && !o->failed; attempt++) {
+		va_start(args, fmt);
+		n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, args);
+		va_end(args);
+		if (n >= 0 && (size_t)n < o->cap - o->len) {
+			o->len += n;
+			return;
+		}
+		o->buf[o->len] = '\0';
+		if (o->len == 0)
+			break;
+		s_flush(o);
+	}
+	if (!o->failed)
+		o->dropped++;
+}
+
+static void s_head(struct metrics_out* o, const char* name, const char* type, const char* help)
+{
+	s_line(o, "# HELP " PREFIX "%s %s\n# TYPE " PREFIX "%s %s\n", name, help, name, type);
+}
+
+size_t metrics_write(char* buf, size_t cap, metrics_sink_t sink, void* ctx)
+{
+	struct metrics_out o = {.buf = buf, .cap = cap, .sink = sink, .ctx = ctx, .failed = (cap == 0)};
+
+	for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+		s_head(&o, counter_desc[i].name, "counter", counter_desc[i].help);
+		s_line(&o, PREFIX "%s %u\n", counter_desc[i].name,
+		       (unsigned)__atomic_load_n(&metric_counters[i], __ATOMIC_RELAXED));
+	}
+	for (int i = 0; i < METRIC_PEAK_COUNT; i++) {
+		s_head(&o, peak_desc[i].name, "gauge", peak_desc[i].help);
+		s_line(&o, PREFIX "%s %u\n", peak_desc[i].name,
+		       (unsigned)__atomic_load_n(&metric_peaks[i], __ATOMIC_RELAXED));
+	}
+
+	s_head(&o, "queue_depth", "gauge", "Items waiting in a queue");
+	for (int i = 0; i < queue_count; i++)
+		s_line(&o, PREFIX "queue_depth{queue=\"%s\"} %u\n", queues[i].name,
+		       (unsigned)uxQueueMessagesWaiting(queues[i].queue));
+
+	s_head(&o, "mqtt_publish_latency_ms", "summary", "Time from enqueue to broker ack");
+	for (int i = 0; i < MQTT_LANE_COUNT; i++) {
+		struct mqtt_publish_latency lat;
+		mqtt_get_publish_latency(i, &lat);
+		s_line(&o, PREFIX "mqtt_publish_latency_ms_sum{lane=\"%s\"} %llu\n", lane_names[i],
+		       (unsigned long long)lat.total_ms);
+		s_line(&o, PREFIX "mqtt_publish_latency_ms_count{lane=\"%s\"} %u\n", lane_names[i], (unsigned)lat.count);
+	}
+	s_head(&o, "mqtt_publish_latency_max_ms", "gauge", "Worst time from enqueue to broker ack");
+	for (int i = 0; i < MQTT_LANE_COUNT; i++) {
+		struct mqtt_publish_latency lat;
+		mqtt_get_publish_latency(i, &lat);
+		s_line(&o, PREFIX "mqtt_publish_latency_max_ms{lane=\"%s\"} %u\n", lane_names[i], (unsigned)lat.max_ms);
+	}
+
+	s_head(&o, "stage_latency_us", "summary", "Latency of a frame pipeline stage since boot");
+	for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+		struct latency_summary sum;
+		const char* stage = latency_stage_name(i);
+		latency_get_summary(i, &sum);
+		s_line(&o, PREFIX "stage_latency_us{stage=\"%s\",quantile=\"0.5\"} %u\n", stage, (unsigned)sum.p50);
+		s_line(&o, PREFIX "stage_latency_us{stage=\"%s\",quantile=\"0.9\"} %u\n", stage, (unsigned)sum.p90);
+		s_line(&o, PREFIX "stage_latency_us{stage=\"%s\",quantile=\"0.99\"} %u\n", stage, (unsigned)sum.p99);
+		s_line(&o, PREFIX "stage_latency_us_sum{stage=\"%s\"} %llu\n", stage, (unsigned long long)sum.sum);
+		s_line(&o, PREFIX "stage_latency_us_count{stage=\"%s\"} %u\n", stage, (unsigned)sum.count);
+	}
+	s_head(&o, "stage_latency_max_us", "gauge", "Worst latency of a frame pipeline stage since boot");
+	for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+		struct latency_summary sum;
+		latency_get_summary(i, &sum);
+		s_line(&o, PREFIX "stage_latency_max_us{stage=\"%s\"} %u\n", latency_stage_name(i), (unsigned)sum.max);
+	}
+
+	s_head(&o, "frames_lost_total", "counter", "Radar frames lost, by the stage that lost them");
+	for (int i = 0; i < FRAME_LOSS_STAGE_COUNT; i++) {
+		struct frame_loss_stats stats;
+		frame_loss_get(i, &stats);
+		s_line(&o, PREFIX "frames_lost_total{stage=\"%s\",cause=\"%s\"} %u\n", frame_loss_stage_name(i),
+		       frame_loss_cause_name(frame_loss_cause_of(i)), (unsigned)stats.lost);
+	}
+
+	s_head(&o, "heap_free_bytes", "gauge", "Free heap");
+	s_line(&o, PREFIX "heap_free_bytes %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+	s_head(&o, "heap_min_free_bytes", "gauge", "Least free heap since boot");
+	s_line(&o, PREFIX "heap_min_free_bytes %u\n", (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+
+	s_head(&o, "task_stack_high_water_bytes", "gauge", "Least free stack of a task since it started");
+	for (size_t i = 0; i < sizeof(task_names) / sizeof(task_names[0]); i++) {
+		TaskHandle_t task = xTaskGetHandle(task_names[i]);
+		if (task != NULL)
+			s_line(&o, PREFIX "task_stack_high_water_bytes{task=\"%s\"} %u\n", task_names[i],
+			       (unsigned)uxTaskGetStackHighWaterMark(task));
+	}
+
+	s_head(&o, "uptime_seconds", "counter", "Seconds since boot");
+	s_line(&o, PREFIX "uptime_seconds %u\n", (unsigned)(esp_timer_get_time() / 1000000));
+	s_flush(&o);
+	if (o.dropped > 0) {
+		metric_add(METRIC_METRICS_DROPPED, o.dropped);
+		ESP_LOGW(TAG, "%u lines longer than %u bytes left out of /metrics", (unsigned)o.dropped, (unsigned)cap);
+	}
+	return o.failed ? 0 : o.sent;
+}
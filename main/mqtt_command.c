@@ -0,0 +1,177 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "cJSON.h"
+
+#include "json_arena.h"
+#include "ex_com_mqtt.h"
+#include "mqtt_command.h"
+
+#define WORKER_PRIORITY 5				/**< below the fall and mqtt tasks*/
+
+static const char* TAG = "mqtt_command";
+
+struct command_entry {
+	const char* name;
+	command_fn fn;
+};
+
+struct command_slot {
+	command_fn fn;					/**< NULL for unknown commands*/
+	bool reply;
+	char name[COMMAND_NAME_MAX + 1];
+	size_t len;
+	char payload[COMMAND_PAYLOAD_MAX + 1];
+};
+
+struct command_key {
+	const char* name;
+	size_t len;
+};
+
+static struct command_entry handlers[COMMAND_HANDLERS_MAX];
+static int num_handlers = 0;
+static struct command_slot slots[COMMAND_SLOTS];
+/* Slot indexes, free ones wait in q_free, filled ones in q_ready */
+static QueueHandle_t q_free = NULL;
+static QueueHandle_t q_ready = NULL;
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+static uint32_t dropped = 0;
+static char response_buf[EVENT_PAYLOAD_MAX];
+
+
+bool mqtt_command_register(const char* name, command_fn fn)
+{
+	int pos = num_handlers;
+
+	// The event task reads the table without lock, it is fixed once the worker runs
+	if (q_ready != NULL || num_handlers == COMMAND_HANDLERS_MAX || strlen(name) > COMMAND_NAME_MAX)
+		return false;
+	for (int i = 0; i < num_handlers; i++) {
+		int cmp = strcmp(name, handlers[i].name);
+		if (cmp == 0)
+			return false;
+		if (cmp < 0 && pos == num_handlers)
+			pos = i;
+	}
+	memmove(&handlers[pos + 1], &handlers[pos], (num_handlers - pos) * sizeof(handlers[0]));
+	handlers[pos].name = name;
+	handlers[pos].fn = fn;
+	num_handlers++;
+	return true;
+}
+
+static int s_compare(const void* key, const void* elem)
+{
+	const struct command_key* k = key;
+	const struct command_entry* e = elem;
+	int cmp = strncmp(k->name, e->name, k->len);
+
+	if (cmp != 0)
+		return cmp;
+	// Key is a prefix of the entry name, the shorter sorts first
+	return e->name[k->len] == '\0' ? 0 : -1;
+}
+
+bool mqtt_command_post(const char* name, size_t name_len, const char* data, size_t len, bool reply)
+{
+	struct command_key key = {name, name_len};
+	const struct command_entry* entry;
+	uint8_t idx;
+
+	if (q_free == NULL || name_len > COMMAND_NAME_MAX || len > COMMAND_PAYLOAD_MAX ||
+	    xQueueReceive(q_free, &idx, 0) != pdTRUE) {
+		dropped++;
+		ESP_LOGW(TAG, "Dropped %.*s (%u bytes)", (int)name_len, name, (unsigned)len);
+		return false;
+	}
+	entry = bsearch(&key, handlers, num_handlers, sizeof(handlers[0]), s_compare);
+	slots[idx].fn = entry != NULL ? entry->fn : NULL;
+	slots[idx].reply = reply;
+	memcpy(slots[idx].name, name, name_len);
+	slots[idx].name[name_len] = '\0';
+	memcpy(slots[idx].payload, data, len);
+	slots[idx].payload[len] = '\0';
+	slots[idx].len = len;
+	xQueueSend(q_ready, &idx, 0);
+	return true;
+}
+
+/**
+ * @brief Publish the response (type 2) of a command on the events topic
+ *
+ */
+static void s_reply(const cJSON* args, enum command_code code, const char* msg)
+{
+	const cJSON* id = cJSON_GetObjectItemCaseSensitive(args, "id");
+	size_t len = event_payload_response(mqtt_payload_encoding(), response_buf, sizeof(response_buf),
+					    cJSON_IsString(id) ? id->valuestring : "", code,
+					    msg[0] != '\0' ? msg : (code == COMMAND_SUCCESS ? "Success" : "Failed"),
+					    (uint32_t)time(NULL));
+	if (len > 0)
+		esp_mqtt_client_publish(mqtt_client, mqtt_topic(MQTT_TOPIC_EVENTS), response_buf, len, 1, 0);
+}
+
+static void s_worker_task(void* arg)
+{
+	uint8_t idx;
+
+	for (;;) {
+		xQueueReceive(q_ready, &idx, portMAX_DELAY);
+		struct command_slot* slot = &slots[idx];
+		struct command_ctx ctx = {
+			.client = mqtt_client,
+			.payload = slot->payload,
+			.len = slot->len,
+		};
+		enum command_code code;
+
+		json_arena_begin();
+		// Parsed where it was copied, string values point into the arena until json_arena_end
+		cJSON* args = cJSON_Parse(slot->payload);
+		ctx.args = args;
+		if (slot->fn != NULL) {
+			code = slot->fn(&ctx);
+		} else {
+			ESP_LOGW(TAG, "Unknown command %s", slot->name);
+			snprintf(ctx.msg, sizeof(ctx.msg), "Unknown command %s", slot->name);
+			code = COMMAND_INVALID;
+		}
+		ESP_LOGI(TAG, "%s: %d %s", slot->name, code, ctx.msg);
+		if (slot->reply)
+			s_reply(args, code, ctx.msg);
+		cJSON_Delete(args);
+		json_arena_end();
+		xQueueSend(q_free, &idx, 0);
+	}
+}
+
+esp_err_t mqtt_command_start(esp_mqtt_client_handle_t client)
+{
+	if (q_ready != NULL)
+		return ESP_OK;
+	mqtt_client = client;
+	q_free = xQueueCreate(COMMAND_SLOTS, sizeof(uint8_t));
+	q_ready = xQueueCreate(COMMAND_SLOTS, sizeof(uint8_t));
+	if (q_free == NULL || q_ready == NULL) {
+		ESP_LOGE(TAG, "Cannot create command queues");
+		return ESP_ERR_NO_MEM;
+	}
+	for (uint8_t i = 0; i < COMMAND_SLOTS; i++)
+		xQueueSend(q_free, &i, 0);
+	if (xTaskCreatePinnedToCore(s_worker_task, "mqtt_command", 1024*4, NULL, WORKER_PRIORITY, NULL, 0) != pdPASS) {
+		ESP_LOGE(TAG, "Cannot create command task");
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+uint32_t mqtt_command_dropped(void)
+{
+	return dropped;
+}
@@ -0,0 +1,327 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
+
+#include "outbox.h"
+
+#define SECTOR_SIZE 4096
+#define SLOT_SIZE 32
+#define SLOTS_PER_SECTOR (SECTOR_SIZE / SLOT_SIZE)	/**< slot 0 holds the sector header*/
+#define SECTOR_MAGIC 0x3158424F				/**< "OBX1"*/
+
+/* Record states, flash only clears bits so each step clears one more */
+#define SLOT_FREE 0xFF
+#define SLOT_WRITTEN 0xFE
+#define SLOT_ACKED 0xFC
+
+static const char* TAG = "outbox";
+
+struct sector_header {
+	uint32_t magic;
+	uint32_t seq;			/**< increases by one per rotation, newest sector is the head*/
+	uint32_t erase_count;
+	uint32_t crc;
+	uint8_t pad[16];
+};
+
+struct slot {
+	uint8_t state;
+	uint8_t pad[3];
+	uint32_t seq;
+	struct outbox_entry entry;
+	uint32_t crc;			/**< over seq and entry*/
+	uint32_t pad2;
+};
+
+_Static_assert(sizeof(struct sector_header) == SLOT_SIZE, "sector header must fill one slot");
+_Static_assert(sizeof(struct slot) == SLOT_SIZE, "record must fill one slot");
+
+struct cursor {
+	uint32_t sector;
+	uint32_t slot;
+};
+
+static const esp_partition_t* part = NULL;
+static uint32_t sector_count = 0;
+static uint32_t head_seq = 0;
+static struct cursor head;		/**< next free slot*/
+static struct cursor tail;		/**< oldest record not known to be acked*/
+static uint32_t next_record_seq = 1;
+static struct cursor peeked[OUTBOX_BATCH_MAX];
+static int peeked_count = 0;
+static struct outbox_stats stats;
+
+
+static size_t s_addr(const struct cursor* c)
+{
+	return c->sector * SECTOR_SIZE + c->slot * SLOT_SIZE;
+}
+
+static uint32_t s_slot_crc(const struct slot* s)
+{
+	return esp_crc32_le(0, (const uint8_t*)&s->seq, sizeof(s->seq) + sizeof(s->entry));
+}
+
+static bool s_at_head(const struct cursor* c)
+{
+	return c->sector == head.sector && c->slot >= head.slot;
+}
+
+/**
+ * @brief Move a cursor to the next slot in log order, never past the head
+ *
+ * @param c cursor
+ */
+static void s_advance(struct cursor* c)
+{
+	c->slot++;
+	if (c->sector != head.sector && c->slot == SLOTS_PER_SECTOR) {
+		c->sector = (c->sector + 1) % sector_count;
+		c->slot = 1;
+	}
+}
+
+static bool s_read_header(uint32_t sector, struct sector_header* hdr)
+{
+	if (esp_partition_read(part, sector * SECTOR_SIZE, hdr, sizeof(*hdr)) != ESP_OK)
+		return false;
+	return hdr->magic == SECTOR_MAGIC &&
+	       hdr->crc == esp_crc32_le(0, (const uint8_t*)hdr, offsetof(struct sector_header, crc));
+}
+
+/**
+ * @brief Erase a sector and stamp it as the new head
+ *
+ * @param sector sector index
+ * @param seq sector sequence number
+ */
+static esp_err_t s_format_sector(uint32_t sector, uint32_t seq)
+{
+	struct sector_header hdr;
+	uint32_t erase_count = s_read_header(sector, &hdr) ? hdr.erase_count : 0;
+	esp_err_t ret = esp_partition_erase_range(part, sector * SECTOR_SIZE, SECTOR_SIZE);
+	if (ret != ESP_OK)
+		return ret;
+	memset(&hdr, 0xFF, sizeof(hdr));
+	hdr.magic = SECTOR_MAGIC;
+	hdr.seq = seq;
+	hdr.erase_count = erase_count + 1;
+	hdr.crc = esp_crc32_le(0, (const uint8_t*)&hdr, offsetof(struct sector_header, crc));
+	if (hdr.erase_count > stats.max_erase_count)
+		stats.max_erase_count = hdr.erase_count;
+	return esp_partition_write(part, sector * SECTOR_SIZE, &hdr, sizeof(hdr));
+}
+
+/**
+ * @brief Read a record slot
+ *
+ * @return state of the slot, SLOT_FREE for corrupt records so they are skipped
+ */
+static uint8_t s_read_slot(const struct cursor* c, struct slot* s)
+{
+	if (esp_partition_read(part, s_addr(c), s, sizeof(*s)) != ESP_OK)
+		return SLOT_FREE;
+	if (s->state == SLOT_FREE)
+		return SLOT_FREE;
+	if (s->crc != s_slot_crc(s))
+		return SLOT_FREE;
+	return s->state;
+}
+
+esp_err_t outbox_init(void)
+{
+	struct sector_header hdr;
+	bool found = false;
+	uint32_t oldest = 0, oldest_seq = UINT32_MAX;
+
+	// Everything is rebuilt from flash, mounting again is the same as after a reboot
+	memset(&stats, 0, sizeof(stats));
+	memset(&head, 0, sizeof(head));
+	head_seq = 0;
+	next_record_seq = 1;
+	peeked_count = 0;
+	part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+	if (part == NULL) {
+		ESP_LOGW(TAG, "No %s partition, events are not persisted", OUTBOX_PARTITION_LABEL);
+		return ESP_ERR_NOT_FOUND;
+	}
+	sector_count = part->size / SECTOR_SIZE;
+	if (sector_count < 2) {
+		ESP_LOGE(TAG, "Partition needs at least 2 sectors");
+		part = NULL;
+		return ESP_ERR_INVALID_SIZE;
+	}
+	for (uint32_t i = 0; i < sector_count; i++) {
+		if (!s_read_header(i, &hdr))
+			continue;
+		if (hdr.erase_count > stats.max_erase_count)
+			stats.max_erase_count = hdr.erase_count;
+		if (!found || hdr.seq > head_seq) {
+			head.sector = i;
+			head_seq = hdr.seq;
+		}
+		if (hdr.seq < oldest_seq) {
+			oldest = i;
+			oldest_seq = hdr.seq;
+		}
+		found = true;
+	}
+	if (!found) {
+		ESP_LOGI(TAG, "Formatting %u sectors", sector_count);
+		esp_err_t ret = s_format_sector(0, 1);
+		if (ret != ESP_OK) {
+			part = NULL;
+			return ret;
+		}
+		head.sector = 0;
+		head.slot = 1;
+		head_seq = 1;
+		tail = head;
+		return ESP_OK;
+	}
+
+	/* Free space of the head sector starts after the last programmed slot */
+	struct slot s;
+	head.slot = SLOTS_PER_SECTOR;
+	for (uint32_t i = SLOTS_PER_SECTOR - 1; i >= 1; i--) {
+		struct cursor c = {head.sector, i};
+		esp_partition_read(part, s_addr(&c), &s, sizeof(s));
+		if (s.state != SLOT_FREE || s.seq != UINT32_MAX)
+			break;
+		head.slot = i;
+	}
+
+	/* Walk from the oldest sector to the head, the tail is the first written record */
+	bool tail_found = false;
+	struct cursor c = {oldest, 1};
+	while (!s_at_head(&c)) {
+		uint8_t state = s_read_slot(&c, &s);
+		if (state == SLOT_FREE && s.state != SLOT_FREE) {
+			stats.corrupt++;
+		} else if (state != SLOT_FREE) {
+			if (s.seq >= next_record_seq)
+				next_record_seq = s.seq + 1;
+			if (state == SLOT_WRITTEN) {
+				if (!tail_found)
+					tail = c;
+				tail_found = true;
+				stats.pending++;
+			}
+		}
+		s_advance(&c);
+	}
+	if (!tail_found)
+		tail = head;
+	ESP_LOGI(TAG, "Mounted, %u records pending, head %u:%u", stats.pending, head.sector, head.slot);
+	return ESP_OK;
+}
+
+bool outbox_ready(void)
+{
+	return part != NULL;
+}
+
+esp_err_t outbox_append(const struct outbox_entry* entry, uint32_t* seq)
+{
+	struct slot s;
+	esp_err_t ret;
+
+	if (part == NULL)
+		return ESP_ERR_INVALID_STATE;
+	if (head.slot == SLOTS_PER_SECTOR) {
+		uint32_t next = (head.sector + 1) % sector_count;
+		if (stats.pending > 0 && tail.sector == next) {
+			/* Log full, the oldest sector goes with whatever is still unacked in it */
+			struct cursor c = tail;
+			while (c.sector == next) {
+				if (s_read_slot(&c, &s) == SLOT_WRITTEN) {
+					stats.dropped++;
+					stats.pending--;
+				}
+				s_advance(&c);
+			}
+			tail.sector = (next + 1) % sector_count;
+			tail.slot = 1;
+			peeked_count = 0;
+			ESP_LOGW(TAG, "Log full, %u records dropped so far", stats.dropped);
+		}
+		ret = s_format_sector(next, head_seq + 1);
+		if (ret != ESP_OK)
+			return ret;
+		head.sector = next;
+		head.slot = 1;
+		head_seq++;
+		if (stats.pending == 0)
+			tail = head;
+	}
+
+	memset(&s, 0xFF, sizeof(s));
+	s.state = SLOT_WRITTEN;
+	s.seq = next_record_seq++;
+	s.entry = *entry;
+	s.crc = s_slot_crc(&s);
+	ret = esp_partition_write(part, s_addr(&head), &s, sizeof(s));
+	// Slot is consumed even on failure, a partial write fails its CRC
+	head.slot++;
+	if (ret != ESP_OK)
+		return ret;
+	stats.appended++;
+	stats.pending++;
+	if (seq != NULL)
+		*seq = s.seq;
+	return ESP_OK;
+}
+
+int outbox_peek(struct outbox_entry* entries, uint32_t* seqs, int max)
+{
+	struct slot s;
+	struct cursor c = tail;
+
+	peeked_count = 0;
+	if (part == NULL)
+		return 0;
+	if (max > OUTBOX_BATCH_MAX)
+		max = OUTBOX_BATCH_MAX;
+	while (peeked_count < max && !s_at_head(&c)) {
+		if (s_read_slot(&c, &s) == SLOT_WRITTEN) {
+			entries[peeked_count] = s.entry;
+			if (seqs != NULL)
+				seqs[peeked_count] = s.seq;
+			peeked[peeked_count++] = c;
+		} else if (peeked_count == 0) {
+			// Nothing to deliver before this slot, skip it for good
+			s_advance(&tail);
+		}
+		s_advance(&c);
+	}
+	return peeked_count;
+}
+
+void outbox_ack(int count)
+{
+	// Only the state byte changes, the rest of the word is still erased
+	const uint32_t acked_word = 0xFFFFFF00 | SLOT_ACKED;
+
+	if (count > peeked_count)
+		count = peeked_count;
+	for (int i = 0; i < count; i++) {
+		if (esp_partition_write(part, s_addr(&peeked[i]), &acked_word, sizeof(acked_word)) != ESP_OK)
+			ESP_LOGE(TAG, "Cannot trim record at %u:%u", peeked[i].sector, peeked[i].slot);
+		stats.acked++;
+		stats.pending--;
+	}
+	if (count > 0) {
+		tail = peeked[count - 1];
+		s_advance(&tail);
+	}
+	peeked_count = 0;
+}
+
+void outbox_get_stats(struct outbox_stats* out)
+{
+	*out = stats;
+}
@@ -5,12 +5,23 @@
 #include "esp_log.h"
 #include "string.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
 
 #include "common.h"
 #include "matrix_calc.h"
 #include "utils.h"
 #include "fall_logic.h"
+#include "config_store.h"
 #include "radar_interface.h"
+#include "cloud_upload.h"
+#include "recorder.h"
+#include "fall_capture.h"
+#include "metrics.h"
+#include "latency.h"
+#include "trace.h"
+#include "binlog.h"
+#include "frame_loss.h"
+#include "uart_tap.h"
 
 
 /* Port to receive data*/
@@ -25,9 +36,23 @@
 #define CONFIG_CTS  UART_PIN_NO_CHANGE			/**< Pin ignore*/
 
 #define BUF_SIZE 4096					/**< Maximum size read from radar each loop*/
+#define FEATURES_SLOTS (RADAR_FEATURES_QUEUE_LEN + 2)	/**< queued, one in the fall task, one being built*/
 
 static const char *TAG = "radar_interface";
 
+/* Lines the radar runs with, updated by #send_sensor_config and #radar_reconfigure */
+static char running_cfg[RADAR_CFG_LINES][RADAR_CFG_LINE_MAX];
+static int running_len = 0;
+/* Bumped before the radar starts with a new config or after a reset, the parser drops what it holds */
+static volatile uint32_t pipeline_epoch = 0;
+/* Next frame only becomes the previous frame of #feature_processing */
+static bool frame_restart = false;
+/* Written by whichever task configures the radar, boot or command worker, never both */
+static struct radar_cfg_stats cfg_stats;
+/* Features handed to the fall task, allocated the first time a slot is needed and reused after */
+static struct fall_features* features_pool[FEATURES_SLOTS];
+static bool features_busy[FEATURES_SLOTS];
+
 /**
  * @brief Use for extract magicword
  * 
@@ -57,40 +82,50 @@ struct frame_header {
 };
 
 
-//TODO: Need to modify calc.c because of removing malloc
-void dot_two_matrixes_radar(double* src, double* des, int msrc, int nsrc, int mdes, int ndes, double* result)
-{
-	for (int src_row = 0; src_row < msrc; src_row++) {
-		for (int des_col = 0; des_col < ndes; des_col++) {
-			*(result + src_row * ndes + des_col) = 0;
-			for (int idx = 0; idx < nsrc; idx++) {
-				*(result + src_row * ndes + des_col) += *(src + src_row * nsrc + idx) * *(des + idx * ndes + des_col);
-			}
-		}
-	}
-}
+#define PC_ROT_BLOCK 32				/**< Points rotated per kernel call, keeps scratch on stack small*/
 
 /**
- * @brief Rotate point with a specific angle follow by x-axis
+ * @brief Rotate point clouds with a specific angle follow by x-axis then elevate by sensor height
+ * @details
+ *  Rows of pcs are (x, y, z, doppler, snr). Coordinates are gathered in blocks of
+ *  #PC_ROT_BLOCK points and multiplied by transpose of Rx in one float32 kernel call,
+ *  rotation matrix is computed once instead of cos/sin for every point.
  * 
- * @param x x axis
- * @param y y axis
- * @param z z axis
+ * @param pcs point clouds matrix M(num_points, 5)
+ * @param num_points number of points
  * @param theta angle in degree
  * @warning angle need to be in degree
  */
-static void rotX(float* x, float* y, float* z, float theta) {
-	float theta_rad = theta * PI / 180;
-	double Rx[9] = {1, 0, 0, 0, cos(theta_rad), sin(theta_rad), 0, -sin(theta_rad), cos(theta_rad)};
-	double target[3];
-	target[0] = (double)*x;
-	target[1] = (double)*y;
-	target[2] = (double)*z;
-	double res[3];
-	dot_two_matrixes_radar(Rx, target, 3, 3, 3, 1, res);
-	*x = (float)*(res);
-	*y = (float)*(res+1);
-	*z = (float)*(res+2) + SENSOR_HEIGHT;
+static void rotX_point_clouds(float* pcs, int num_points, float theta) {
+	static float rot_t[9];
+	static float rot_theta = -1000;
+	float in[PC_ROT_BLOCK*3];
+	float out[PC_ROT_BLOCK*3];
+
+	if (rot_theta != theta) {
+		float theta_rad = theta * PI / 180;
+		float c = cosf(theta_rad);
+		float s = sinf(theta_rad);
+		// Rx = {1, 0, 0, 0, c, s, 0, -s, c}, points are rows so multiply by its transpose
+		float rt[9] = {1, 0, 0, 0, c, -s, 0, s, c};
+		memcpy(rot_t, rt, sizeof(rt));
+		rot_theta = theta;
+	}
+	for (int start = 0; start < num_points; start += PC_ROT_BLOCK) {
+		int n = num_points - start < PC_ROT_BLOCK ? num_points - start : PC_ROT_BLOCK;
+		float* p = pcs + start*5;
+		for (int i = 0; i < n; i++) {
+			in[i*3 + 0] = p[i*5 + 0];
+			in[i*3 + 1] = p[i*5 + 1];
+			in[i*3 + 2] = p[i*5 + 2];
+		}
+		calc_mat_mult_f32(in, rot_t, out, n, 3, 3);
+		for (int i = 0; i < n; i++) {
+			p[i*5 + 0] = out[i*3 + 0];
+			p[i*5 + 1] = out[i*3 + 1];
+			p[i*5 + 2] = out[i*3 + 2] + SENSOR_HEIGHT;
+		}
+	}
 }
 
 /**
@@ -208,9 +243,8 @@ static int parseCapon3DPolar(uint8_t* data, int data_len, float** pc_data)
 		*(*(pc_data) + i*5 + 2) = sin(elevU) * ranU;		
 		*(*(pc_data) + i*5 + 3) = dopplerU;
 		*(*(pc_data) + i*5 + 4) = snrU;
-		// TODO: Rotate dimension
-		rotX(&(*(*(pc_data) + i*5 + 0)), &(*(*(pc_data) + i*5 + 1)), &(*(*(pc_data) + i*5 + 2)), TILT_ANGLE);
 	}
+	rotX_point_clouds(*pc_data, numDetectedObj, TILT_ANGLE);
 	return numDetectedObj;
 }
 
@@ -284,6 +318,36 @@ static int parseTargetAssociations(uint8_t* data, int data_len, uint8_t** indexe
 	return numIndexes;
 }
 
+/**
+ * @brief Take a free features slot, only the radar task takes
+ *
+ * @return struct fall_features* NULL when every slot is in use or the first allocation failed
+ */
+static struct fall_features* s_features_take(void)
+{
+	for (int i = 0; i < FEATURES_SLOTS; i++) {
+		if (__atomic_load_n(&features_busy[i], __ATOMIC_ACQUIRE))
+			continue;
+		if (features_pool[i] == NULL)
+			features_pool[i] = malloc(sizeof(struct fall_features));
+		if (features_pool[i] == NULL)
+			return NULL;
+		features_busy[i] = true;
+		return features_pool[i];
+	}
+	return NULL;
+}
+
+void radar_release_features(struct fall_features* feat)
+{
+	for (int i = 0; i < FEATURES_SLOTS; i++) {
+		if (features_pool[i] == feat) {
+			__atomic_store_n(&features_busy[i], false, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+}
+
 /**
  * @brief Process frame data before sending to computation task 
  * 
@@ -300,22 +364,35 @@ static struct fall_features* feature_processing(struct frame_struct* curr_f)
 	struct timeval tv_start;
 	struct timeval tv_stop;
 
-	struct fall_features* res = (struct fall_features*)malloc(sizeof(struct fall_features));
-	if (res == NULL) {
-		ESP_LOGE(TAG, "Cannot malloc fall features!");
-		//TODO: reset
-	}
+	struct fall_features* res = s_features_take();
 
 	prev_f->point_clouds 	= prev_pc;
 	prev_f->targets 	= prev_tar;
 	prev_f->indexes 	= prev_idx;
+	if (res == NULL) {
+		ESP_LOGE(TAG, "No free slot for fall features!");
+		if (prev_f->frame_number != 0)
+			frame_loss_drop(FRAME_LOSS_FEATURES, prev_f->frame_number);
+		goto end;
+	}
+	if (frame_restart) {
+		// Indexes of the first frame after a reconfiguration refer to a frame we dropped
+		frame_restart = false;
+		radar_release_features(res);
+		res = NULL;
+		goto end;
+	}
 
 	gettimeofday(&tv_start, NULL);
 	// printf("Frame prev: %u vs %u\n", curr_f->frame_number, prev_f->frame_number);
 	if (curr_f->frame_number - prev_f->frame_number > 1) {
-		ESP_LOGW(TAG, "Missing Frame");
-		prev_f->frame_number = curr_f->frame_number;
-		return NULL;
+		// Points of the previous frame are associated in the missing one, its features are lost
+		BINLOG(BINLOG_MISSING_FEATURES, curr_f->frame_number, prev_f->frame_number);
+		if (prev_f->frame_number != 0)
+			frame_loss_drop(FRAME_LOSS_FEATURES, prev_f->frame_number);
+		radar_release_features(res);
+		res = NULL;
+		goto end;
 	}
 	res->frame_number 	= 	prev_f->frame_number;
 	res->num_targets 	=	prev_f->num_targets;
@@ -333,6 +410,9 @@ static struct fall_features* feature_processing(struct frame_struct* curr_f)
 									curr_f->num_indexes,
 									target_index);
 	}
+	// Points of the previous frame are associated to its tracks only now
+	fall_capture_record(prev_f->frame_number, prev_f->targets, prev_f->num_targets, prev_f->point_clouds,
+			    prev_f->num_point_clouds, curr_f->indexes, curr_f->num_indexes);
 	if (curr_f->frame_number == 1) 
 		goto end;
 	if (curr_f->num_indexes == 0) 
@@ -369,12 +449,12 @@ end:
  *  @param buf_len   		length of that buffer
  *  @param num_tlv	   	number of tlv has been sent in that buffer
  *  @param fn 			frame number
- *  @retval 1	success
- *  @retval 0	fail
+ *  @param header_us		esp_timer time the frame header was found
+ *  @retval true	features built or the frame had no target
+ *  @retval false	a TLV header out of range, the frame is dropped
 */
-static bool extract_frame_info(uint8_t** buf,  QueueHandle_t* data_queue, int buf_len, uint16_t num_tlv, uint32_t fn)
+static bool extract_frame_info(uint8_t** buf,  QueueHandle_t* data_queue, int buf_len, uint16_t num_tlv, uint32_t fn, int64_t header_us)
 {
-	bool err = 0;
 	uint8_t move = 0;
 	static uint32_t tlv_type;
 	static uint32_t tlv_length;
@@ -398,10 +478,10 @@ static bool extract_frame_info(uint8_t** buf,  QueueHandle_t* data_queue, int bu
 		struct_unpack_one_value(buf, &buf_len, &tlv_type, "I");
 		struct_unpack_one_value(buf, &buf_len, &tlv_length, "I");
 		if ((tlv_type > 20) | (tlv_length > 10000)) {
-			ESP_LOGE(TAG, "Wrong bytes data when extract frame info %u %u", tlv_type, tlv_length);
-			err = 1;
-			move += 8;
-			return -1;
+			BINLOG(BINLOG_BAD_TLV, tlv_type, tlv_length);
+			frame_loss_drop(FRAME_LOSS_PARSE, fn);
+			*buf -= move + tlv_struct_length;
+			return false;
 		}
 		if (tlv_type == 6) 
 			f_ptr->num_point_clouds = parseCapon3DPolar( *buf, 
@@ -418,18 +498,32 @@ static bool extract_frame_info(uint8_t** buf,  QueueHandle_t* data_queue, int bu
 		*buf += (tlv_length - tlv_struct_length);
 		move += tlv_length;
 	}
+	int64_t parsed_us = esp_timer_get_time();
+	latency_record(LATENCY_PARSE, header_us, parsed_us);
+	cloud_upload_record(fn, f_ptr->point_clouds, f_ptr->num_point_clouds);
+	recorder_record(fn, f_ptr->targets, f_ptr->num_targets, f_ptr->point_clouds, f_ptr->num_point_clouds);
 	struct fall_features* feat = feature_processing(&frame);
-	if (feat != NULL)
-		xQueueSend(*data_queue, &feat, ( TickType_t ) 1000 );
+	if (feat != NULL) {
+		feat->header_us = header_us;
+		feat->features_us = esp_timer_get_time();
+		latency_record(LATENCY_FEATURES, parsed_us, feat->features_us);
+		if (xQueueSend(*data_queue, &feat, ( TickType_t ) 1000 ) == pdTRUE) {
+			metric_inc(METRIC_FRAMES_PARSED);
+			metric_peak(METRIC_PEAK_RADAR2FALL, uxQueueMessagesWaiting(*data_queue));
+		} else {
+			metric_inc(METRIC_QUEUE_SEND_FAILS);
+			frame_loss_drop(FRAME_LOSS_QUEUE, feat->frame_number);
+			radar_release_features(feat);
+		}
+	}
 	*buf -= move;
-	if (err == 1) return -1;
-	return 0;
+	return true;
 }
 
 
 /**
  *  @brief Fetch data from radar with given size
- *  @param data  memory to allocate new data
+ *  @param data  memory to allocate new data, BUF_SIZE bytes
  *  @return len of data read from uart
 */
 static int read_sensor_data(uint8_t *data)
@@ -440,6 +534,9 @@ static int read_sensor_data(uint8_t *data)
 	if (is_ok != ESP_OK || tmp_size < 2048) {
 		return 0;
 	}
+	// The driver buffers up to 32 KB, the rest is read at the next event
+	if (tmp_size > BUF_SIZE)
+		tmp_size = BUF_SIZE;
 	int len = uart_read_bytes(UART_NUM_1, data, tmp_size, 1000 / portTICK_PERIOD_MS);
 	return len;
 }
@@ -519,7 +616,7 @@ static bool verify_checksum(void* packet, uint16_t checksum)
 	}
 	calc_checksum = ~((sum >> 16) + (sum & 0xFFFF));
 	if (calc_checksum != checksum) {
-		ESP_LOGE(TAG, "Wrong check sum! %u %u", checksum, calc_checksum);
+		BINLOG(BINLOG_BAD_CHECKSUM, checksum, calc_checksum);
 		return false;
 	}
 	return true;
@@ -557,6 +654,25 @@ void init_uart_port(QueueHandle_t* q_uart_event)
 }
 
 
+/**
+ * @brief Drop every byte waiting in the ring buffer
+ * 
+ * @param rb ring buffer
+ * @param mutex mutex for buffer
+ */
+static void s_drop_rb_data(RingbufHandle_t* rb, SemaphoreHandle_t* mutex)
+{
+	size_t item_len;
+	uint8_t* item;
+
+	if (xSemaphoreTake(*mutex, 200/portTICK_PERIOD_MS) != pdTRUE)
+		return;
+	while ((item = (uint8_t *)xRingbufferReceiveUpTo(*rb, &item_len, 0, BUF_SIZE)) != NULL)
+		vRingbufferReturnItem(*rb, (void *)item);
+	xSemaphoreGive(*mutex);
+}
+
+
 bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  SemaphoreHandle_t* buffer_mutex, SemaphoreHandle_t* data_key)
 {
 	int fh_len = 48;
@@ -566,12 +682,24 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 	uint8_t fh_buf[48];
 	uint8_t* data = fh_buf;
 
+	static uint32_t seen_epoch = 0;
+	static uint32_t lastframe = 0;
+
 	memset((void*)&fh, 0, sizeof(struct frame_header));
+	if (seen_epoch != pipeline_epoch) {
+		seen_epoch = pipeline_epoch;
+		s_drop_rb_data(rb, buffer_mutex);
+		frame_loss_flush();
+		lastframe = 0;
+		frame_restart = true;
+		ESP_LOGI(TAG, "Pipeline flushed for reconfiguration");
+	}
 	if (!check_rb_data_enough(rb, buffer_mutex, fh_len, false))
 		return 0;
 
 	fetch_rb_data(rb, buffer_mutex, fh_len, data, 100);
 	// Find in data until indentify magicword (8 bytes)
+	uint32_t skipped = 0;
 	while (true) {
 		for (uint8_t i = 0; i < 8; i++)
 			magic_word.u8_arr[i] = data[i];
@@ -580,11 +708,18 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 		if (check_rb_data_enough(rb, buffer_mutex, 1, false)) {
 			memcpy(data, data + 1, fh_len - 1);
 			if (!fetch_rb_data(rb, buffer_mutex, 1, data + fh_len - 1, 5)) {
-				ESP_LOGE(TAG, "Cant receive buf from Ring");
+				BINLOG(BINLOG_RING_FETCH);
 				continue;
 			}
+			skipped++;
 		}
 	}
+	int64_t header_us = esp_timer_get_time();
+	if (skipped > 0) {
+		metric_inc(METRIC_RESYNCS);
+		metric_add(METRIC_RESYNC_BYTES, skipped);
+		frame_loss_note(FRAME_LOSS_RESYNC);
+	}
 	// Got frame extract information bellow
 	fh.sync = 0x0708050603040102;
 	fh.version                  =   data[8]  << 0 | data[9] << 8  | data[10] << 16 | data[11] << 24;
@@ -599,14 +734,22 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 	fh.numTLVs                  =   data[44] << 0 | data[45] << 8;
 	// Check the checksum to make sure right packet
 	fh.checksum		    =   0;
-	if (!verify_checksum((void*)&fh, data[46] << 0 | data[47] << 8))
+	if (!verify_checksum((void*)&fh, data[46] << 0 | data[47] << 8)) {
+		metric_inc(METRIC_CHECKSUM_ERRORS);
+		frame_loss_note(FRAME_LOSS_CHECKSUM);
 		return 0;
+	}
 	/* Check whether missing frame */
-	static uint32_t lastframe = 0;
-	if (fh.frameNumber - lastframe > 1) {
-		ESP_LOGE(TAG, "Missing frame: %u, %u", lastframe, fh.frameNumber);
+	if (lastframe != 0 && fh.frameNumber - lastframe > 1) {
+		BINLOG(BINLOG_MISSING_FRAME, lastframe, fh.frameNumber);
+		metric_add(METRIC_FRAMES_MISSING, fh.frameNumber - lastframe - 1);
 	}
+	if (lastframe != 0)
+		frame_loss_gap(lastframe, fh.frameNumber);
+	else
+		frame_loss_flush();
 	lastframe = fh.frameNumber;
+	TRACE_BEGIN(TRACE_FRAME_READ, fh.frameNumber);
 
 	log_frame_header(&fh);
 
@@ -617,6 +760,11 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 	
 	num_bytes_read = 0;
 	while (tlv_data_len - num_bytes_read > 0) { 
+		// The rest of this frame was flushed with the old config
+		if (seen_epoch != pipeline_epoch) {
+			TRACE_END(TRACE_FRAME_READ, fh.frameNumber);
+			return 0;
+		}
 		if (!check_rb_data_enough(rb, buffer_mutex, tlv_data_len - num_bytes_read, false)) {
 			// vTaskDelay(100/portTICK_PERIOD_MS);
 			continue;
@@ -629,7 +777,7 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 									    tlv_data_len - num_bytes_read );
 			if (item == NULL) {
 				xSemaphoreGive(*buffer_mutex);
-				ESP_LOGE(TAG, "(Frame data) No data in Ring buffer!");
+				BINLOG(BINLOG_RING_EMPTY);
 				continue;
 			}
 			xSemaphoreGive(*buffer_mutex);
@@ -638,22 +786,24 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 			vRingbufferReturnItem(*rb, (void *)item);
 			num_bytes_read += item_len;
 		} else {
-			printf("Cannot get mutex!!!\n");
+			BINLOG(BINLOG_RING_MUTEX);
 		}
 	}
+	TRACE_END(TRACE_FRAME_READ, fh.frameNumber);
+	TRACE_BEGIN(TRACE_FEATURES, fh.frameNumber);
 	for(;;) {
 		if(xSemaphoreTake(*data_key, (TickType_t)100) == pdTRUE) {
-			if (extract_frame_info(&p_frame_data, data_queue, tlv_data_len, 
-						fh.numTLVs, fh.frameNumber) == 0) {
-				ESP_LOGE(TAG, "Error when extract frame information");
-				printf("Frame Num: %u\n", fh.frameNumber);
+			if (!extract_frame_info(&p_frame_data, data_queue, tlv_data_len, 
+						fh.numTLVs, fh.frameNumber, header_us)) {
+				BINLOG(BINLOG_EXTRACT_FAILED, fh.frameNumber);
 			}
 			xSemaphoreGive(*data_key);
 			break;
 		} else {
-			ESP_LOGE(TAG, "Busy in accessing Data Queue");
+			BINLOG(BINLOG_QUEUE_BUSY);
 		}
 	}
+	TRACE_END(TRACE_FEATURES, fh.frameNumber);
 	// check_rb_data_enough(rb, buffer_mutex, 1, true);
 	return true;
 }
@@ -661,7 +811,7 @@ bool extract_radar_data(RingbufHandle_t* rb, QueueHandle_t* data_queue,  Semapho
 
 int read_and_send_to_ring_buffer(RingbufHandle_t* buffer, SemaphoreHandle_t* buffer_mutex)
 {
-	uint8_t tx_item[4096];
+	uint8_t tx_item[BUF_SIZE];
 	
 	if (xSemaphoreTake(*buffer_mutex, 10/portTICK_PERIOD_MS) != pdTRUE) {
 		return 0;
@@ -672,31 +822,293 @@ int read_and_send_to_ring_buffer(RingbufHandle_t* buffer, SemaphoreHandle_t* buf
 		return 0;
 	}
 	UBaseType_t res =  xRingbufferSend(*buffer, tx_item, data_len, pdMS_TO_TICKS(1000));
+	metric_peak(METRIC_PEAK_RING_BYTES, RADAR_RING_SIZE - xRingbufferGetCurFreeSize(*buffer));
+	xSemaphoreGive( *buffer_mutex );
+	// Lab capture gets the bytes whether or not the parser could take them
+	uart_tap_feed(tx_item, data_len);
 	if (res != pdTRUE) {
-		ESP_LOGE(TAG, "Cannot send data to ring buffer");
+		metric_inc(METRIC_RING_SEND_FAILS);
+		frame_loss_note(FRAME_LOSS_RING_FULL);
+		BINLOG(BINLOG_RING_SEND);
 		data_len = 0;
 	}
-	xSemaphoreGive( *buffer_mutex );
 	return data_len;
 }
 
 
-bool send_sensor_config(char*cfg[])
+/**
+ * @brief Write one line to the config port and wait for the CLI to answer
+ * @details
+ *  The CLI echoes the line then prints "Done", or "Error ..." / "... not recognized ..."
+ *  when it rejects it. The next line goes out as soon as the answer is in.
+ * 
+ * @param line CLI command without newline
+ * @return enum radar_cmd_status 
+ */
+static enum radar_cmd_status s_send_once(const char* line)
 {
 	const char* endline = "\n";
-	uint8_t data[4666];
-	uint8_t* p_data = data;
-
-	for (int i = 0; i < 32; i++) {
-		ESP_LOGI(TAG, "%s", cfg[i]);
-		uart_write_bytes(UART_NUM_2, (const char *)cfg[i] , strlen(cfg[i]));
-		uart_write_bytes(UART_NUM_2, endline , strlen(endline));
-		vTaskDelay(10);
-		//TODO: check return done from sensor
-		int len = uart_read_bytes(UART_NUM_2, p_data, BUF_SIZE, 20 / portTICK_PERIOD_MS);
-		ESP_LOGI(TAG, "%d", len);
+	static char reply[RADAR_REPLY_MAX + 1];
+	size_t len = 0;
+	int64_t deadline = esp_timer_get_time() + RADAR_CMD_TIMEOUT_MS * 1000;
+
+	// Prompt and banner left from the previous command or a reset
+	uart_flush_input(UART_NUM_2);
+	uart_write_bytes(UART_NUM_2, line, strlen(line));
+	uart_write_bytes(UART_NUM_2, endline, strlen(endline));
+	for (int64_t now = esp_timer_get_time(); now < deadline; now = esp_timer_get_time()) {
+		// Block for the time left, at least a tick or a 100 Hz tick rate turns the wait into a spin
+		TickType_t wait = pdMS_TO_TICKS((deadline - now) / 1000);
+		if (wait == 0)
+			wait = 1;
+		if (len == RADAR_REPLY_MAX) {
+			// Keep the tail, the status comes last
+			memmove(reply, reply + RADAR_REPLY_MAX / 2, RADAR_REPLY_MAX / 2);
+			len = RADAR_REPLY_MAX / 2;
+		}
+		int n = uart_read_bytes(UART_NUM_2, (uint8_t*)reply + len, RADAR_REPLY_MAX - len, wait);
+		if (n <= 0)
+			continue;
+		len += n;
+		reply[len] = '\0';
+		if (strstr(reply, "Done") != NULL)
+			return RADAR_CMD_DONE;
+		if (strstr(reply, "Error") != NULL || strstr(reply, "not recognized") != NULL) {
+			ESP_LOGE(TAG, "Radar rejected \"%s\": %s", line, reply);
+			return RADAR_CMD_ERROR;
+		}
 	}
-	return true;
+	return RADAR_CMD_TIMEOUT;
+}
+
+/**
+ * @brief Send one line, retried on error or timeout
+ * 
+ * @param line CLI command without newline
+ * @retval 1 acknowledged
+ * @retval 0 still failing after #RADAR_CMD_RETRIES retries
+ */
+static bool s_send_command(const char* line)
+{
+	enum radar_cmd_status status = RADAR_CMD_TIMEOUT;
+
+	for (int attempt = 0; attempt <= RADAR_CMD_RETRIES; attempt++) {
+		int64_t start_us = esp_timer_get_time();
+		status = s_send_once(line);
+		uint32_t ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+
+		cfg_stats.commands++;
+		if (ms > cfg_stats.max_cmd_ms)
+			cfg_stats.max_cmd_ms = ms;
+		ESP_LOGI(TAG, "%s: %s in %u ms", line, status == RADAR_CMD_DONE ? "Done" : 
+			 (status == RADAR_CMD_ERROR ? "Error" : "timeout"), ms);
+		if (status == RADAR_CMD_DONE)
+			return true;
+		if (status == RADAR_CMD_ERROR)
+			cfg_stats.errors++;
+		else
+			cfg_stats.timeouts++;
+		if (attempt < RADAR_CMD_RETRIES)
+			cfg_stats.retries++;
+	}
+	snprintf(cfg_stats.failed, sizeof(cfg_stats.failed), "%s", line);
+	return false;
+}
+
+/**
+ * @brief Length of the command word, the first token of a line
+ * 
+ */
+static size_t s_command_word_len(const char* line)
+{
+	return strcspn(line, " \t");
+}
+
+/**
+ * @brief Compare two lines token by token, spacing is ignored
+ * 
+ */
+static bool s_same_line(const char* a, const char* b)
+{
+	for (;;) {
+		a += strspn(a, " \t");
+		b += strspn(b, " \t");
+		size_t la = strcspn(a, " \t");
+		size_t lb = strcspn(b, " \t");
+		if (la != lb || strncmp(a, b, la) != 0)
+			return false;
+		if (la == 0)
+			return true;
+		a += la;
+		b += lb;
+	}
+}
+
+/**
+ * @brief Running line with the command word of line, only commands sent once can be changed
+ * 
+ * @return int index in running_cfg, -1 when missing or sent more than once
+ */
+static int s_find_running(const char* line)
+{
+	size_t len = s_command_word_len(line);
+	int found = -1;
+
+	for (int i = 0; i < running_len; i++) {
+		if (s_command_word_len(running_cfg[i]) != len || strncmp(running_cfg[i], line, len) != 0)
+			continue;
+		if (found >= 0)
+			return -1;
+		found = i;
+	}
+	return found;
+}
+
+/**
+ * @brief Line of a radar config key, "key value"
+ * 
+ * @return bool false when it does not fit in a line
+ */
+static bool s_config_line(char* line, const struct config_radar* cfg, int i)
+{
+	int len = snprintf(line, RADAR_CFG_LINE_MAX, "%s %s", cfg->item[i].key, cfg->item[i].value);
+	return len > 0 && len < RADAR_CFG_LINE_MAX;
+}
+
+/**
+ * @brief Drop the bytes sent before now, the parser flushes its ring buffer before the next header
+ * 
+ */
+static void s_flush_pipeline(void)
+{
+	uart_flush_input(UART_NUM_1);
+	pipeline_epoch++;
+}
+
+bool send_sensor_config(char*cfg[], const struct config_radar* overrides)
+{
+	char line[RADAR_CFG_LINE_MAX];
+
+	// Kept even when the radar rejects a line, reset-radar retries with it
+	running_len = 0;
+	for (int i = 0; cfg[i] != NULL && running_len < RADAR_CFG_LINES; i++)
+		snprintf(running_cfg[running_len++], RADAR_CFG_LINE_MAX, "%s", cfg[i]);
+	for (int i = 0; overrides != NULL && i < overrides->num_keys; i++) {
+		int idx = s_config_line(line, overrides, i) ? s_find_running(line) : -1;
+		if (idx < 0) {
+			ESP_LOGW(TAG, "Stored %s ignored", overrides->item[i].key);
+			continue;
+		}
+		strcpy(running_cfg[idx], line);
+	}
+	return send_running_config();
+}
+
+
+bool send_running_config(void)
+{
+	int64_t start_us = esp_timer_get_time();
+
+	// A reset radar numbers its frames from 1 again, nothing of the previous run reaches the features
+	s_flush_pipeline();
+
+	cfg_stats.failed[0] = '\0';
+	for (int i = 0; i < running_len; i++) {
+		if (!s_send_command(running_cfg[i])) {
+			// Later lines would go to a radar missing this one, stop here so it stays visibly down
+			ESP_LOGE(TAG, "Radar config aborted at line %d \"%s\"", i, running_cfg[i]);
+			return false;
+		}
+	}
+	cfg_stats.last_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+	ESP_LOGI(TAG, "Radar configured with %d lines in %u ms", running_len, cfg_stats.last_ms);
+	return running_len > 0;
+}
+
+
+/**
+ * @brief Reset the radar and send the running config, after a reconfiguration left it stopped
+ * 
+ */
+static void s_recover(void)
+{
+	cfg_stats.recoveries++;
+	metric_inc(METRIC_RADAR_RECOVERIES);
+	ESP_LOGE(TAG, "Radar not restarted after \"%s\", reset with the running config", cfg_stats.failed);
+	reset_radar();
+	if (!send_running_config())
+		ESP_LOGE(TAG, "Radar is not configured, reset-radar to retry");
+}
+
+int radar_reconfigure(const char* lines[], int num_lines)
+{
+	int changed[RADAR_CFG_LINES];
+	int num_changed = 0;
+	int sent = 0;
+
+	if (num_lines > RADAR_CFG_LINES)
+		return -1;
+	for (int i = 0; i < num_lines; i++) {
+		int idx = s_find_running(lines[i]);
+		if (idx < 0 || strlen(lines[i]) >= RADAR_CFG_LINE_MAX) {
+			ESP_LOGE(TAG, "Cannot change \"%s\" at runtime", lines[i]);
+			return -1;
+		}
+		if (!s_same_line(lines[i], running_cfg[idx]))
+			changed[num_changed++] = i;
+	}
+	if (num_changed == 0)
+		return 0;
+
+	int64_t start_us = esp_timer_get_time();
+	bool restored = true;
+	cfg_stats.failed[0] = '\0';
+	if (!s_send_command("sensorStop")) {
+		// Stopped or still running, the radar is in a state nothing here knows
+		s_recover();
+		return -1;
+	}
+	while (sent < num_changed && s_send_command(lines[changed[sent]]))
+		sent++;
+	// Put back what was already changed, the radar restarts with its old config
+	for (int i = 0; sent < num_changed && i < sent; i++)
+		restored &= s_send_command(running_cfg[s_find_running(lines[changed[i]])]);
+	// Bytes of the old config are all in by now, drop them before the first new frame
+	s_flush_pipeline();
+	if (!restored || !s_send_command("sensorStart")) {
+		s_recover();
+		return -1;
+	}
+	// Only a started radar runs the new lines
+	for (int i = 0; sent == num_changed && i < num_changed; i++) {
+		const char* line = lines[changed[i]];
+		snprintf(running_cfg[s_find_running(line)], RADAR_CFG_LINE_MAX, "%s", line);
+	}
+	cfg_stats.last_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+	ESP_LOGI(TAG, "Reconfigured %d lines, radar stopped for %u ms", sent, cfg_stats.last_ms);
+	return sent < num_changed ? -1 : num_changed;
+}
+
+
+int radar_apply_config(const struct config_radar* cfg)
+{
+	static char line_buf[CONFIG_RADAR_KEYS][RADAR_CFG_LINE_MAX];
+	const char* lines[CONFIG_RADAR_KEYS];
+
+	for (int i = 0; i < cfg->num_keys; i++) {
+		if (!s_config_line(line_buf[i], cfg, i))
+			return -1;
+		lines[i] = line_buf[i];
+	}
+	if (cfg->num_keys == 0)
+		return 0;
+	return radar_reconfigure(lines, cfg->num_keys);
+}
+
+
+void radar_get_cfg_stats(struct radar_cfg_stats* out)
+{
+	*out = cfg_stats;
 }
 
 
@@ -0,0 +1,429 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
+
+#include "lzf.h"
+#include "frame_codec.h"
+#include "recorder.h"
+
+#define WRITER_PRIORITY 3				/**< below the command worker, flash work can wait*/
+#define SECTOR_VERSION 1
+#define PAYLOAD_STORED 0
+#define PAYLOAD_LZF 1
+#define PAYLOAD_MAX (RECORDER_SECTOR_SIZE - sizeof(struct recorder_sector))
+#define RAW_MAX (1024*12)				/**< frames encoded before compression, LZF rarely gains 3x*/
+#define RAW_FRAMES_MAX 512
+#define POINT_WORST (3 * CODEC_I16_WORST + 2)
+#define FRAME_WORST (2 * CODEC_U32_WORST + 1 + RECORDER_TRACKS_MAX * CODEC_TRACK_WORST + 1 + RECORDER_POINTS_MAX * POINT_WORST)
+#define IDLE_FLUSH_MS 2000				/**< frames stop, radar is down, write what is left*/
+
+static const char* TAG = "recorder";
+
+struct rec_track {
+	int16_t pos[3];			/**< cm*/
+	int16_t vel[3];			/**< cm/s*/
+	uint8_t tid;
+};
+
+struct rec_point {
+	int16_t x;			/**< RECORDER_POINT_CM per step*/
+	int16_t y;
+	int16_t z;
+	int8_t doppler;			/**< 0.1 m/s*/
+	uint8_t snr;
+};
+
+struct rec_frame {
+	uint32_t frame;
+	uint32_t ms;			/**< uptime*/
+	uint8_t num_tracks;
+	uint8_t num_points;
+	struct rec_track tracks[RECORDER_TRACKS_MAX];
+	struct rec_point points[RECORDER_POINTS_MAX];
+};
+
+_Static_assert(sizeof(struct recorder_sector) == 32, "sector header layout is read by the host decoder");
+_Static_assert(FRAME_WORST <= PAYLOAD_MAX, "a single frame must fit a sector uncompressed");
+_Static_assert(RAW_MAX <= UINT16_MAX, "raw length is stored in 16 bits");
+
+static const esp_partition_t* part = NULL;
+static uint32_t sector_count = 0;
+static volatile uint32_t head_seq = 0;		/**< newest sector written, 0 for none*/
+static TaskHandle_t writer = NULL;
+static SemaphoreHandle_t flushed = NULL;
+static volatile bool flush_req = false;
+static struct recorder_stats stats;
+
+/* Radar task stages, writer task takes */
+static portMUX_TYPE stage_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct rec_frame stage[RECORDER_STAGE_FRAMES];
+static uint32_t stage_head = 0;
+static uint32_t stage_tail = 0;
+
+/* Writer task only */
+static uint8_t raw_buf[RAW_MAX];
+static size_t raw_len = 0;
+static int raw_frames = 0;
+static uint16_t frame_end[RAW_FRAMES_MAX];	/**< raw_buf offset after each frame*/
+static uint32_t frame_no[RAW_FRAMES_MAX];
+static uint32_t frame_ms[RAW_FRAMES_MAX];
+static uint32_t base_frame = 0;
+static uint32_t base_ms = 0;
+static bool have_base = false;
+static size_t raw_target = PAYLOAD_MAX;		/**< raw bytes expected to fill a sector, follows the ratio*/
+static uint64_t covered_ms = 0;			/**< time spanned by the sectors written*/
+static uint8_t sector_buf[RECORDER_SECTOR_SIZE];
+static struct lzf_state lzf;
+
+
+void recorder_record(uint32_t frame, const float* targets, int num_targets, const float* pcs, int num_points)
+{
+	static struct rec_frame f;
+	static uint32_t calls = 0;
+	bool staged = false;
+
+	if (writer == NULL)
+		return;
+	f.frame = frame;
+	f.ms = (uint32_t)(esp_timer_get_time() / 1000);
+	f.num_tracks = num_targets > RECORDER_TRACKS_MAX ? RECORDER_TRACKS_MAX : num_targets;
+	for (int i = 0; i < f.num_tracks; i++) {
+		const float* t = targets + i*CODEC_TARGET_COLS;
+		f.tracks[i].tid = (uint8_t)t[0];
+		for (int k = 0; k < 3; k++) {
+			f.tracks[i].pos[k] = codec_scaled(t[1 + k], 100.0f);
+			f.tracks[i].vel[k] = codec_scaled(t[4 + k], 100.0f);
+		}
+	}
+	f.num_points = 0;
+	if (calls++ % RECORDER_CLOUD_EVERY == 0) {
+		int stride = num_points > RECORDER_POINTS_MAX ? (num_points + RECORDER_POINTS_MAX - 1) / RECORDER_POINTS_MAX : 1;
+		for (int i = 0; i < num_points && f.num_points < RECORDER_POINTS_MAX; i += stride) {
+			const float* p = pcs + i*5;
+			struct rec_point* pt = &f.points[f.num_points++];
+			pt->x = codec_scaled(p[0], 100.0f / RECORDER_POINT_CM);
+			pt->y = codec_scaled(p[1], 100.0f / RECORDER_POINT_CM);
+			pt->z = codec_scaled(p[2], 100.0f / RECORDER_POINT_CM);
+			pt->doppler = p[3] * 10 > 127 ? 127 : p[3] * 10 < -127 ? -127 : (int8_t)lroundf(p[3] * 10);
+			pt->snr = p[4] > 255 ? 255 : p[4] < 0 ? 0 : (uint8_t)lroundf(p[4]);
+		}
+	}
+
+	portENTER_CRITICAL(&stage_lock);
+	// The writer may be reading the oldest frame, the newest one is dropped instead
+	if (stage_head - stage_tail < RECORDER_STAGE_FRAMES) {
+		memcpy(&stage[stage_head % RECORDER_STAGE_FRAMES], &f,
+		       offsetof(struct rec_frame, points) + f.num_points * sizeof(struct rec_point));
+		stage_head++;
+		stats.frames++;
+		staged = true;
+	} else {
+		stats.dropped++;
+	}
+	portEXIT_CRITICAL(&stage_lock);
+	if (staged)
+		xTaskNotifyGive(writer);
+}
+
+
+/* ================================================	Encoding	================================================*/
+static bool s_take(struct rec_frame* f)
+{
+	bool taken = false;
+
+	portENTER_CRITICAL(&stage_lock);
+	if (stage_tail != stage_head) {
+		memcpy(f, &stage[stage_tail % RECORDER_STAGE_FRAMES], sizeof(*f));
+		stage_tail++;
+		taken = true;
+	}
+	portEXIT_CRITICAL(&stage_lock);
+	return taken;
+}
+
+/**
+ * @brief Append a frame to raw_buf, the caller made room for #FRAME_WORST bytes
+ *
+ */
+static void s_encode(const struct rec_frame* f)
+{
+	uint32_t prev_frame = raw_frames > 0 ? frame_no[raw_frames - 1] : base_frame;
+	uint32_t prev_ms = raw_frames > 0 ? frame_ms[raw_frames - 1] : base_ms;
+	struct rec_point prev = {0};
+	uint8_t* p = raw_buf + raw_len;
+
+	if (!have_base) {
+		prev_frame = base_frame = f->frame;
+		prev_ms = base_ms = f->ms;
+		have_base = true;
+	}
+	p = codec_put_uvarint(p, f->frame - prev_frame);
+	p = codec_put_uvarint(p, f->ms - prev_ms);
+	*p++ = f->num_tracks;
+	for (int i = 0; i < f->num_tracks; i++) {
+		const struct rec_track* t = &f->tracks[i];
+		*p++ = t->tid;
+		for (int k = 0; k < 3; k++)
+			p = codec_put_svarint(p, t->pos[k]);
+		for (int k = 0; k < 3; k++)
+			p = codec_put_svarint(p, t->vel[k]);
+	}
+	*p++ = f->num_points;
+	for (int i = 0; i < f->num_points; i++) {
+		const struct rec_point* pt = &f->points[i];
+		p = codec_put_svarint(p, pt->x - prev.x);
+		p = codec_put_svarint(p, pt->y - prev.y);
+		p = codec_put_svarint(p, pt->z - prev.z);
+		*p++ = (uint8_t)pt->doppler;
+		*p++ = pt->snr;
+		prev = *pt;
+	}
+	raw_len = p - raw_buf;
+	frame_end[raw_frames] = raw_len;
+	frame_no[raw_frames] = f->frame;
+	frame_ms[raw_frames] = f->ms;
+	raw_frames++;
+}
+
+
+/* ================================================	Flash	================================================*/
+/**
+ * @brief Compress the first n frames into sector_buf
+ *
+ * @return size_t payload length, 0 when they do not fit a sector
+ */
+static size_t s_pack(int n)
+{
+	struct recorder_sector* hdr = (struct recorder_sector*)sector_buf;
+	uint8_t* payload = sector_buf + sizeof(*hdr);
+	size_t len_raw = frame_end[n - 1];
+	size_t len = lzf_compress(&lzf, raw_buf, len_raw, payload, PAYLOAD_MAX);
+
+	if (len == 0 || len >= len_raw) {
+		if (len_raw > PAYLOAD_MAX)
+			return 0;
+		memcpy(payload, raw_buf, len_raw);
+		len = len_raw;
+		hdr->format = PAYLOAD_STORED;
+	} else {
+		hdr->format = PAYLOAD_LZF;
+	}
+	hdr->len = len;
+	hdr->raw_len = len_raw;
+	hdr->frames = n;
+	return len;
+}
+
+/**
+ * @brief Erase the sector after the head and program the packed sector_buf into it
+ * @details The head moves on even when flash fails, a broken sector is skipped on read.
+ */
+static void s_program(void)
+{
+	struct recorder_sector* hdr = (struct recorder_sector*)sector_buf;
+	uint32_t seq = head_seq + 1;
+	size_t addr = (seq % sector_count) * RECORDER_SECTOR_SIZE;
+	time_t now = time(NULL);
+	uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+	esp_err_t ret;
+
+	hdr->magic = RECORDER_MAGIC;
+	hdr->seq = seq;
+	hdr->base_frame = base_frame;
+	hdr->base_ms = base_ms;
+	hdr->unix_s = (uint32_t)(now - (now_ms - base_ms) / 1000);
+	hdr->version = SECTOR_VERSION;
+	hdr->crc = esp_crc32_le(0, sector_buf, offsetof(struct recorder_sector, crc));
+	hdr->crc = esp_crc32_le(hdr->crc, sector_buf + sizeof(*hdr), hdr->len);
+	ret = esp_partition_erase_range(part, addr, RECORDER_SECTOR_SIZE);
+	if (ret == ESP_OK)
+		ret = esp_partition_write(part, addr, sector_buf, sizeof(*hdr) + hdr->len);
+	head_seq = seq;
+	if (ret != ESP_OK) {
+		stats.errors++;
+		ESP_LOGE(TAG, "Cannot write sector %u (%s)", seq, esp_err_to_name(ret));
+	}
+}
+
+/**
+ * @brief Write the largest run of oldest frames that fits one sector
+ *
+ */
+static void s_flush_sector(void)
+{
+	int64_t start = esp_timer_get_time();
+	int n = raw_frames;
+	size_t len, used;
+
+	// Fewer frames until the compressed run fits, one frame always fits stored
+	while ((len = s_pack(n)) == 0)
+		n = n * 3 / 4 > 0 ? n * 3 / 4 : 1;
+	s_program();
+	used = frame_end[n - 1];
+	stats.sectors++;
+	stats.raw_bytes += used;
+	stats.bytes += len;
+	covered_ms += frame_ms[n - 1] - base_ms;
+	stats.history_s = (uint64_t)(sector_count - 1) * covered_ms / stats.sectors / 1000;
+
+	// Aim the next sector at the ratio just seen, a little short of full
+	raw_target = (uint64_t)used * PAYLOAD_MAX / len * 15 / 16;
+	if (raw_target < PAYLOAD_MAX / 2)
+		raw_target = PAYLOAD_MAX / 2;
+	if (raw_target > RAW_MAX - FRAME_WORST)
+		raw_target = RAW_MAX - FRAME_WORST;
+
+	base_frame = frame_no[n - 1];
+	base_ms = frame_ms[n - 1];
+	memmove(raw_buf, raw_buf + used, raw_len - used);
+	for (int i = n; i < raw_frames; i++) {
+		frame_end[i - n] = frame_end[i] - used;
+		frame_no[i - n] = frame_no[i];
+		frame_ms[i - n] = frame_ms[i];
+	}
+	raw_len -= used;
+	raw_frames -= n;
+
+	uint32_t elapsed = (uint32_t)((esp_timer_get_time() - start) / 1000);
+	if (elapsed > stats.max_write_ms)
+		stats.max_write_ms = elapsed;
+	if (stats.sectors == 16 && stats.history_s < RECORDER_HISTORY_MIN_S)
+		ESP_LOGW(TAG, "Partition holds %u s at the current rate, %u s wanted", stats.history_s, RECORDER_HISTORY_MIN_S);
+}
+
+static void s_writer_task(void* arg)
+{
+	static struct rec_frame f;
+
+	for (;;) {
+		bool idle = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_FLUSH_MS)) == 0;
+
+		while (s_take(&f)) {
+			while (raw_len + FRAME_WORST > RAW_MAX || raw_frames == RAW_FRAMES_MAX)
+				s_flush_sector();
+			s_encode(&f);
+			if (raw_len >= raw_target)
+				s_flush_sector();
+		}
+		if (flush_req || (idle && raw_frames > 0)) {
+			while (raw_frames > 0)
+				s_flush_sector();
+			if (flush_req) {
+				flush_req = false;
+				xSemaphoreGive(flushed);
+			}
+		}
+	}
+}
+
+esp_err_t recorder_init(void)
+{
+	struct recorder_sector hdr;
+	uint32_t newest = 0;
+
+	part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, RECORDER_PARTITION_LABEL);
+	if (part == NULL) {
+		ESP_LOGW(TAG, "No %s partition, frames are not recorded", RECORDER_PARTITION_LABEL);
+		return ESP_ERR_NOT_FOUND;
+	}
+	sector_count = part->size / RECORDER_SECTOR_SIZE;
+	if (sector_count < 2) {
+		ESP_LOGE(TAG, "Partition needs at least 2 sectors");
+		part = NULL;
+		return ESP_ERR_INVALID_SIZE;
+	}
+	// Headers only, payload CRCs are checked when a sector is read back
+	for (uint32_t i = 0; i < sector_count; i++) {
+		if (esp_partition_read(part, i * RECORDER_SECTOR_SIZE, &hdr, sizeof(hdr)) != ESP_OK)
+			continue;
+		if (hdr.magic == RECORDER_MAGIC && hdr.seq % sector_count == i && hdr.seq > newest)
+			newest = hdr.seq;
+	}
+	head_seq = newest;
+	flushed = xSemaphoreCreateBinary();
+	if (flushed == NULL)
+		return ESP_ERR_NO_MEM;
+	if (xTaskCreatePinnedToCore(s_writer_task, "recorder", 1024*4, NULL, WRITER_PRIORITY, &writer, 0) != pdPASS) {
+		writer = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+	ESP_LOGI(TAG, "%u sectors, newest %u", sector_count, newest);
+	return ESP_OK;
+}
+
+bool recorder_flush(uint32_t wait_ms)
+{
+	if (writer == NULL)
+		return false;
+	xSemaphoreTake(flushed, 0);
+	flush_req = true;
+	xTaskNotifyGive(writer);
+	return xSemaphoreTake(flushed, pdMS_TO_TICKS(wait_ms)) == pdTRUE;
+}
+
+
+/* ================================================	Retrieval	================================================*/
+uint32_t recorder_first(uint32_t seconds)
+{
+	struct recorder_sector hdr;
+	uint32_t head = head_seq;
+	uint32_t oldest = head >= sector_count ? head - sector_count + 1 : 1;
+	uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+	uint32_t first = head + 1;
+	uint32_t later_ms = now_ms;
+
+	if (part == NULL || seconds == 0)
+		return oldest;
+	for (uint32_t s = head; s >= oldest && s > 0; s--) {
+		if (esp_partition_read(part, (s % sector_count) * RECORDER_SECTOR_SIZE, &hdr, sizeof(hdr)) != ESP_OK ||
+		    hdr.magic != RECORDER_MAGIC || hdr.seq != s)
+			continue;
+		// Uptime went backwards, the sector is from an earlier boot
+		if (hdr.base_ms > later_ms)
+			break;
+		first = s;
+		if (now_ms - hdr.base_ms >= seconds * 1000)
+			break;
+		later_ms = hdr.base_ms;
+	}
+	return first;
+}
+
+size_t recorder_read(uint32_t* seq, uint8_t* buf)
+{
+	struct recorder_sector* hdr = (struct recorder_sector*)buf;
+
+	if (part == NULL)
+		return 0;
+	while ((int32_t)(head_seq - *seq) >= 0) {
+		uint32_t s = (*seq)++;
+		size_t addr = (s % sector_count) * RECORDER_SECTOR_SIZE;
+		if (esp_partition_read(part, addr, hdr, sizeof(*hdr)) != ESP_OK ||
+		    hdr->magic != RECORDER_MAGIC || hdr->seq != s || hdr->len > PAYLOAD_MAX)
+			continue;
+		if (esp_partition_read(part, addr + sizeof(*hdr), buf + sizeof(*hdr), hdr->len) != ESP_OK)
+			continue;
+		uint32_t crc = esp_crc32_le(0, buf, offsetof(struct recorder_sector, crc));
+		if (esp_crc32_le(crc, buf + sizeof(*hdr), hdr->len) != hdr->crc)
+			continue;
+		return sizeof(*hdr) + hdr->len;
+	}
+	return 0;
+}
+
+void recorder_get_stats(struct recorder_stats* out)
+{
+	portENTER_CRITICAL(&stage_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&stage_lock);
+}
@@ -9,6 +9,9 @@
 #include "svm.h"
 
 #define NUM_FORMULA 29
+#define SVM_SV_MAX 167						/**< Support vectors of the exported model*/
+
+_Static_assert((SVM_SV_MAX + NUM_FORMULA) * sizeof(double) <= CALC_FRAME_ARENA_SIZE, "decision_function needs its scratch in the frame arena");
 
 const char* FORMULA_POOL[29] = { "delta_X", "delta_Y", "delta_Z",
                         "max_vel_vector", "min_vel_vector", "mean_vel_vector",
@@ -22,7 +25,7 @@ const char* FORMULA_POOL[29] = { "delta_X", "delta_Y", "delta_Z",
 };
 
 
-double support_vectors[167*29] = {
+double support_vectors[SVM_SV_MAX*NUM_FORMULA] = {
     1.256221937710949, -0.0021745717665592893, 0.6607272041145993, -0.3553332186462337, -0.5326428331742408, -0.8223031853861926, 0.2358795241438122, 0.4705860065253484, 0.11432955874377511, -1.1755064053840598, 1.328166258371986, -0.17170019415589305, -1.1642793127800661, 1.20906153360496, 0.47034304416247746, -0.89265836973753, -0.3960086325470914, 0.7016247235673279, -0.8523120632801969, -0.24759256197101664, -0.20441853289866702, -0.41029814730504716, -0.9446453444968992, 0.42728141107930023, 1.2113810395922615, -0.5336998626191004, -0.1373456832134954, -0.08611247675387484, 0.26916411208090757, 
 	-0.07719764396927505, -0.25375675538014303, 1.9825576100474342, -1.1088121579425245, -0.5326428331742408, -0.9306984207798255, 0.3748052938214979, 0.8967237165453682, 0.34796895538559947, -0.07075400013781726, 0.7978448474200838, -0.8264510187322687, -0.23939579361882257, 0.7483400906769959, -0.8158545854411716, -0.40017291405296845, -1.6090809557685561, -0.722493759534278, -0.2873747530933804, -1.783069093386615, -0.5968319181394516, -0.41029814730504716, -0.6684828306376908, -1.3272865518052213, 0.447089990455597, -1.2948481201846227, -0.6796166006666206, -1.2935396680274769, -1.4906988751566168, 
 	-0.13298880443199834, -0.3977763499341203, 0.28927035035606313, -1.1249946242607942, -0.5326428331742408, -0.7946782546004112, -0.8886985491581185, -0.06997096694528115, 0.6371573435513683, 0.13737581166292806, 1.5089000658449179, 0.39875682715707744, -0.032945294044930816, 1.3878261378462684, -0.7069883905630479, -0.9262154424231445, -0.669167238374323, -0.8998256988338461, -0.8496565153271124, -1.0477658912530894, -1.069573085928194, -0.41029814730504716, -0.5436117564266248, -0.6447791546513434, 1.230103099628419, -0.5830611661486766, -0.5328821049515934, -1.328293247801084, -1.1658196725277155, 
@@ -267,29 +270,44 @@ int create_vector_from_frame_struct(struct frame_struct* q_frame, uint8_t len, u
 }
 
 static double s_get_max(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* feature_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* feature_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (feature_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     vector_len = create_vector_from_frame_struct(q_frame, len, col, feature_vector);
     double res = s_get_vector_max(feature_vector, vector_len);
-    free(feature_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return res;
 }
 
 static double s_get_min(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* feature_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* feature_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (feature_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     vector_len = create_vector_from_frame_struct(q_frame, len, col, feature_vector);
     double res = s_get_vector_min(feature_vector, vector_len);
-    free(feature_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return res;
 }
 
 static double s_get_mean(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* feature_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* feature_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (feature_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     vector_len = create_vector_from_frame_struct(q_frame, len, col, feature_vector);
     double res = s_get_vector_mean(feature_vector, vector_len);
-    free(feature_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return res;
 }
 
@@ -303,7 +321,12 @@ static double s_get_range(struct frame_struct* q_frame, uint8_t len, uint8_t col
 
 static double s_get_std(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
     double mean_value = s_get_mean(q_frame, len, col);
-    double* feature_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* feature_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (feature_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = create_vector_from_frame_struct(q_frame, len, col, feature_vector);
     double std_value = 0;
     for (uint8_t i = 0; i < vector_len; i++) {
@@ -311,7 +334,7 @@ static double s_get_std(struct frame_struct* q_frame, uint8_t len, uint8_t col)
     }
     std_value /= vector_len;
     std_value = sqrt(std_value);
-    free(feature_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return (std_value);
 }
 
@@ -319,9 +342,14 @@ static double s_get_std(struct frame_struct* q_frame, uint8_t len, uint8_t col)
  *  sqrt(x^2 + y^2 +z^2) 
 */
 static double s_get_max_distance(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* y_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* y_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || y_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
     create_vector_from_frame_struct(q_frame, len, col + 1, y_vector);
@@ -334,9 +362,7 @@ static double s_get_max_distance(struct frame_struct* q_frame, uint8_t len, uint
     }
     pow_array(x_vector, vector_len, 0.5);
     double vector_max = s_get_vector_max(x_vector, vector_len);
-    free(x_vector);
-    free(y_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return vector_max;
 }
 
@@ -344,9 +370,14 @@ static double s_get_max_distance(struct frame_struct* q_frame, uint8_t len, uint
  *  sqrt(x^2 + y^2 +z^2)
 */
 static double s_get_min_distance(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* y_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* y_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || y_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
     create_vector_from_frame_struct(q_frame, len, col + 1, y_vector);
@@ -359,9 +390,7 @@ static double s_get_min_distance(struct frame_struct* q_frame, uint8_t len, uint
     }
     pow_array(x_vector, vector_len, 0.5);
     double vector_min = s_get_vector_min(x_vector, vector_len);
-    free(x_vector);
-    free(y_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return vector_min;
 }
 
@@ -370,9 +399,14 @@ static double s_get_min_distance(struct frame_struct* q_frame, uint8_t len, uint
  *  sqrt(x^2 + y^2 +z^2)
 */
 static double s_get_mean_distance(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* y_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* y_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || y_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
     
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -386,9 +420,7 @@ static double s_get_mean_distance(struct frame_struct* q_frame, uint8_t len, uin
     }
     pow_array(x_vector, vector_len, 0.5);
     double vector_mean = s_get_vector_mean(x_vector, vector_len);
-    free(x_vector);
-    free(y_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return vector_mean;
 }
 
@@ -413,9 +445,14 @@ static double s_get_vector_std(double* arr, int len) {
 
 
 static double s_get_c1_value(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* y_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* y_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || y_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
 
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -425,16 +462,19 @@ static double s_get_c1_value(struct frame_struct* q_frame, uint8_t len, uint8_t
     double x_sum = s_get_sum_array(x_vector, vector_len);
     double y_sum = s_get_sum_array(y_vector, vector_len);
     double z_sum = s_get_sum_array(z_vector, vector_len);
-    free(x_vector);
-    free(y_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return sqrt(pow(x_sum, 2) + pow(y_sum, 2) + pow(z_sum, 2));
 }
 
 
 static double s_get_c2_value(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
 
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -442,15 +482,19 @@ static double s_get_c2_value(struct frame_struct* q_frame, uint8_t len, uint8_t
 
     double x_sum = s_get_sum_array(x_vector, vector_len);
     double z_sum = s_get_sum_array(z_vector, vector_len);
-    free(x_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return sqrt(pow(x_sum, 2) + pow(z_sum, 2));
 }
 
 
 static double s_get_c3_value(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
 
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -458,15 +502,19 @@ static double s_get_c3_value(struct frame_struct* q_frame, uint8_t len, uint8_t
 
     double x_sum = s_get_vector_max(x_vector, vector_len);
     double z_sum = s_get_vector_min(z_vector, vector_len);
-    free(x_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return sqrt(pow(x_sum, 2) + pow(z_sum, 2));
 }
 
 
 static double s_get_c8_value(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
 
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -474,16 +522,20 @@ static double s_get_c8_value(struct frame_struct* q_frame, uint8_t len, uint8_t
 
     double x_std = s_get_vector_std(x_vector, vector_len);
     double z_std = s_get_vector_std(z_vector, vector_len);
-    free(x_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return sqrt(pow(x_std, 2) + pow(z_std, 2));
 }
 
 
 static double s_get_c9_value(struct frame_struct* q_frame, uint8_t len, uint8_t col) {
-    double* x_vector = (double*)malloc(len * sizeof(double));
-    double* y_vector = (double*)malloc(len * sizeof(double));
-    double* z_vector = (double*)malloc(len * sizeof(double));
+    size_t mark = calc_arena_mark(calc_frame_arena());
+    double* x_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* y_vector = calc_arena_alloc(calc_frame_arena(), len);
+    double* z_vector = calc_arena_alloc(calc_frame_arena(), len);
+    if (x_vector == NULL || y_vector == NULL || z_vector == NULL) {
+        calc_arena_release(calc_frame_arena(), mark);
+        return NAN;
+    }
     int vector_len = 0;
 
     vector_len = create_vector_from_frame_struct(q_frame, len, col, x_vector);
@@ -493,9 +545,7 @@ static double s_get_c9_value(struct frame_struct* q_frame, uint8_t len, uint8_t
     double x_std = s_get_vector_std(x_vector, vector_len);
     double y_std = s_get_vector_std(y_vector, vector_len);
     double z_std = s_get_vector_std(z_vector, vector_len);
-    free(x_vector);
-    free(y_vector);
-    free(z_vector);
+    calc_arena_release(calc_frame_arena(), mark);
     return sqrt(pow(x_std, 2) + pow(y_std, 2) + pow(z_std, 2));
 }
 
@@ -618,51 +668,127 @@ static double s_get_value_from_formula(struct frame_struct* q_frame, uint8_t len
     return res;
 }
 
-void get_features(struct frame_struct* q_frame, uint8_t len, double * features)
+/*
+* @brief:	Compute every formula of FORMULA_POOL over the frames
+* @return:	false when a formula ran out of frame arena, features are then unusable
+*/
+bool get_features(struct frame_struct* q_frame, uint8_t len, double * features)
 {
+	bool ok = true;
+
 	for (uint8_t i = 0; i < NUM_FORMULA; i++){
 		*(features + i) = s_get_value_from_formula(q_frame, len, FORMULA_POOL[i]);
+		ok &= !isnan(*(features + i));
 	}
+	return ok;
 }
 
 
+/*
+* @brief:	RBF SVC decision value of X_test, scratch taken from the frame arena
+* @return:	NAN when the frame arena is exhausted
+*/
 double decision_function(struct svm_params* params, double* X_test, double*support_vectors)
 {
-	double* z_scaled = substract_matrix_array(support_vectors, X_test, params->num_sv, params->num_features);
-	double* norm2 = (double*)malloc(sizeof(double) * params->num_sv);
+	struct calc_arena* arena = calc_frame_arena();
+	size_t mark = calc_arena_mark(arena);
+	double res = NAN;
+	double* z_scaled = calc_arena_alloc(arena, params->num_features);
+	double* norm2 = calc_arena_alloc(arena, params->num_sv);
+	if (z_scaled == NULL || norm2 == NULL)
+		goto end;
+	// One row of (support_vectors - X_test) at a time instead of the whole (num_sv, num_features) matrix
 	for (int i = 0; i < params->num_sv; i++) {
-		*(norm2 + i) = frobenius_norm(&(* (z_scaled + i * params->num_features)), params->num_features);
+		substract_matrix_array_to(support_vectors + i * params->num_features, X_test, 1, params->num_features, z_scaled);
+		*(norm2 + i) = frobenius_norm(z_scaled, params->num_features);
 	}
-	free(z_scaled);
-	z_scaled = NULL;
 	pow_array(norm2, params->num_sv, 2);
 	mul_array(norm2, params->num_sv, -params->gamma);
 	exp_array(norm2, params->num_sv);
-	double* trans_norm2 = transpose_matrix(norm2, 1, params->num_sv);
-	free(norm2);
-	norm2 = NULL;
-	double* res = dot_two_matrixes(params->dual_coefs, trans_norm2, 1, params->num_sv, params->num_sv, 1);
-	free(trans_norm2);
-	*res = *res + params->intercept;
-	return *res;
+	// A (1, num_sv) row has the same layout as its (num_sv, 1) transpose
+	res = 0;
+	dot_two_matrixes_to(params->dual_coefs, norm2, 1, params->num_sv, params->num_sv, 1, &res);
+	res = res + params->intercept;
+end:
+	calc_arena_release(arena, mark);
+	return res;
 }
 
 
-int predict(struct frame_struct* q_frame, uint8_t len)
+/*
+* @brief:	Fill model parameters exported from the trained sklearn SVC
+* @param:	params	target parameters
+*/
+void int_svm_params(struct svm_params* params)
 {
-	return 1;
-	struct svm_params* params = (struct svm_params*)malloc(sizeof(struct svm_params));
-    params->dual_coefs = (double[167]){ -958.16796875, -958.16796875, -715.93241934, -737.25994177, -958.16796875, -442.91828196, -35.73089955, -647.41433212, -958.16796875, -958.16796875, -59.16528487, -958.16796875, -958.16796875, -153.93361337, -368.22686039, -295.29491952, -958.16796875, -203.94343504, -639.3407011, -305.75772717, -429.60807628, -459.47315812, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -74.68627345, -283.6103554, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -88.93410293, -797.80319813, -608.95400653, -958.16796875, -958.16796875, -958.16796875, -877.05777911, -958.16796875, -958.16796875, -958.16796875, -393.87927662, -958.16796875, -958.16796875, -958.16796875, -415.29545873, -958.16796875, -958.16796875, -714.55857684, -294.01398767, -958.16796875, -958.16796875, -249.45315821, -958.16796875, -285.52761291, -958.16796875, -248.30106382, -958.16796875, -728.59505219, -958.16796875, -509.2503356, -447.08124129, -367.64254498, -958.16796875, -493.88417949, -661.0905751, -417.61277594, -61.24100977, -685.64295758, -444.45619655, -467.45814336, -760.08079462, -958.16796875, -357.7286453, -958.16796875, -885.66675931, -934.51754022, -958.16796875, -402.07398779, -958.16796875, -958.16796875, -958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 424.77569599, 958.16796875, 958.16796875, 504.33391651, 148.20559526, 655.19732721, 958.16796875, 851.18168886, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 730.81855127, 958.16796875, 441.95738773, 958.16796875, 958.16796875, 958.16796875, 642.26601717, 958.16796875, 481.45026854, 958.16796875, 130.27354272, 958.16796875, 958.16796875, 139.17721693, 958.16796875, 958.16796875, 37.31865361, 96.77871685, 958.16796875, 958.16796875, 958.16796875, 43.50053341, 546.38741242, 554.39831854, 958.16796875, 252.06534756, 62.44842745, 958.16796875, 958.16796875, 508.04336332, 958.16796875, 165.70583228, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 344.64684457, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 555.76010731, 325.24756643, 646.77195998, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 931.23544673, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 358.5597709, 958.16796875, 248.08001179, 958.16796875, 958.16796875, 958.16796875 };
+	static double dual_coefs[SVM_SV_MAX] = { -958.16796875, -958.16796875, -715.93241934, -737.25994177, -958.16796875, -442.91828196, -35.73089955, -647.41433212, -958.16796875, -958.16796875, -59.16528487, -958.16796875, -958.16796875, -153.93361337, -368.22686039, -295.29491952, -958.16796875, -203.94343504, -639.3407011, -305.75772717, -429.60807628, -459.47315812, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -74.68627345, -283.6103554, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -958.16796875, -88.93410293, -797.80319813, -608.95400653, -958.16796875, -958.16796875, -958.16796875, -877.05777911, -958.16796875, -958.16796875, -958.16796875, -393.87927662, -958.16796875, -958.16796875, -958.16796875, -415.29545873, -958.16796875, -958.16796875, -714.55857684, -294.01398767, -958.16796875, -958.16796875, -249.45315821, -958.16796875, -285.52761291, -958.16796875, -248.30106382, -958.16796875, -728.59505219, -958.16796875, -509.2503356, -447.08124129, -367.64254498, -958.16796875, -493.88417949, -661.0905751, -417.61277594, -61.24100977, -685.64295758, -444.45619655, -467.45814336, -760.08079462, -958.16796875, -357.7286453, -958.16796875, -885.66675931, -934.51754022, -958.16796875, -402.07398779, -958.16796875, -958.16796875, -958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 424.77569599, 958.16796875, 958.16796875, 504.33391651, 148.20559526, 655.19732721, 958.16796875, 851.18168886, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 730.81855127, 958.16796875, 441.95738773, 958.16796875, 958.16796875, 958.16796875, 642.26601717, 958.16796875, 481.45026854, 958.16796875, 130.27354272, 958.16796875, 958.16796875, 139.17721693, 958.16796875, 958.16796875, 37.31865361, 96.77871685, 958.16796875, 958.16796875, 958.16796875, 43.50053341, 546.38741242, 554.39831854, 958.16796875, 252.06534756, 62.44842745, 958.16796875, 958.16796875, 508.04336332, 958.16796875, 165.70583228, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 344.64684457, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 555.76010731, 325.24756643, 646.77195998, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 931.23544673, 958.16796875, 958.16796875, 958.16796875, 958.16796875, 358.5597709, 958.16796875, 248.08001179, 958.16796875, 958.16796875, 958.16796875 };
+	params->support_vectors = support_vectors;
+	params->dual_coefs = dual_coefs;
 	params->gamma = 0.0014262616956558422;
 	params->intercept = 9.61573232;
-	params->num_sv = 167;
-	params->num_features = 29;
-	double* X = (double*)malloc(sizeof(double)*29);
-	get_features(q_frame, len, X);
-	double res = decision_function(params, X, support_vectors);
+	params->num_sv = SVM_SV_MAX;
+	params->num_features = NUM_FORMULA;
+}
+
+
+/* Set by svm_reload_model from another task, consumed by the next prediction */
+static volatile bool model_stale = true;
+
+bool svm_reload_model(void)
+{
+	model_stale = true;
+	return calc_kernel_selfcheck();
+}
+
+/*
+* @brief:	Same as decision_function in float32 through the matrix_calc kernels
+* @note:	Support vectors and dual coefs are converted to float on first call and after svm_reload_model
+*/
+float decision_function_f32(struct svm_params* params, double* X_test)
+{
+	static float sv_f32[SVM_SV_MAX*NUM_FORMULA];
+	static float dual_f32[SVM_SV_MAX];
+	float x_f32[NUM_FORMULA];
+	float z_scaled[NUM_FORMULA];
+	float norm2[SVM_SV_MAX];
+
+	if (params->num_sv > SVM_SV_MAX || params->num_features != NUM_FORMULA)
+		return (float)decision_function(params, X_test, params->support_vectors);
+	if (model_stale) {
+		for (int i = 0; i < params->num_sv * params->num_features; i++)
+			sv_f32[i] = (float)params->support_vectors[i];
+		for (int i = 0; i < params->num_sv; i++)
+			dual_f32[i] = (float)params->dual_coefs[i];
+		model_stale = false;
+	}
+	for (int j = 0; j < params->num_features; j++)
+		x_f32[j] = (float)X_test[j];
+	for (int i = 0; i < params->num_sv; i++) {
+		const float* sv = sv_f32 + i * params->num_features;
+		for (int j = 0; j < params->num_features; j++)
+			z_scaled[j] = sv[j] - x_f32[j];
+		norm2[i] = calc_dot_f32(z_scaled, z_scaled, params->num_features);
+	}
+	calc_mul_array_f32(norm2, params->num_sv, (float)-params->gamma);
+	calc_exp_array_f32(norm2, params->num_sv);
+	return calc_dot_f32(dual_f32, norm2, params->num_sv) + (float)params->intercept;
+}
+
+
+int predict(struct frame_struct* q_frame, uint8_t len)
+{
+	return 1;
+	struct svm_params params;
+	double X[NUM_FORMULA];
+	int_svm_params(&params);
+	if (!get_features(q_frame, len, X))
+		return PREDICT_ERROR;
+	float res = decision_function_f32(&params, X);
+	if (isnan(res))
+		return PREDICT_ERROR;
 	if (res > 0){
 		return 1;
 	}else{
 		return 0;
 	}
-}
\ No newline at end of file
+}
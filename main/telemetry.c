@@ -0,0 +1,181 @@
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "event_payload.h"
+#include "telemetry.h"
+
+#define FIELDS 5					/**< x, y, z, velocity, height*/
+#define MAX_TRACKED 16					/**< targets delta encoded at once*/
+#define SAMPLE_JSON_MAX 56				/**< worst case of one sample in JSON*/
+#define PAYLOAD_TAIL 4					/**< closing of samples, payload and message*/
+
+struct sample {
+	uint32_t frame;
+	uint8_t tid;
+	int16_t value[FIELDS];
+};
+
+struct track_state {
+	uint8_t tid;
+	int16_t value[FIELDS];
+};
+
+/* Fall task pushes, mqtt task builds and commits */
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct sample ring[TELEMETRY_RING_LEN];
+static uint32_t ring_head = 0;				/**< total samples recorded*/
+static uint32_t ring_tail = 0;				/**< total samples published or dropped*/
+static uint32_t dropped = 0;
+static volatile uint32_t interval_sec = TELEMETRY_INTERVAL_DEFAULT;
+
+
+static int16_t s_quantise(float value)
+{
+	float scaled = value * TELEMETRY_SCALE;
+	if (scaled > INT16_MAX)
+		return INT16_MAX;
+	if (scaled < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)(scaled + (scaled >= 0 ? 0.5f : -0.5f));
+}
+
+void telemetry_record(uint32_t frame, const float* target, float abs_height)
+{
+	struct sample s = {
+		.frame = frame,
+		.tid = (uint8_t)target[0],
+		.value = {
+			s_quantise(target[1]),
+			s_quantise(target[2]),
+			s_quantise(target[3]),
+			s_quantise(target[6]),
+			s_quantise(abs_height),
+		},
+	};
+
+	if (interval_sec == 0)
+		return;
+	portENTER_CRITICAL(&ring_lock);
+	if (ring_head - ring_tail == TELEMETRY_RING_LEN) {
+		ring_tail++;
+		dropped++;
+	}
+	ring[ring_head % TELEMETRY_RING_LEN] = s;
+	ring_head++;
+	portEXIT_CRITICAL(&ring_lock);
+}
+
+/**
+ * @brief Previous values of a target in the batch being built
+ *
+ * @return state, NULL when more than MAX_TRACKED targets are in the batch
+ */
+static struct track_state* s_track(struct track_state* tracks, int* num_tracks, uint8_t tid)
+{
+	for (int i = 0; i < *num_tracks; i++) {
+		if (tracks[i].tid == tid)
+			return &tracks[i];
+	}
+	if (*num_tracks == MAX_TRACKED)
+		return NULL;
+	// First sample of a target is sent as a delta from zero, i.e. absolute
+	tracks[*num_tracks].tid = tid;
+	memset(tracks[*num_tracks].value, 0, sizeof(tracks[*num_tracks].value));
+	return &tracks[(*num_tracks)++];
+}
+
+size_t telemetry_build(enum payload_encoding encoding, char* buf, size_t cap, uint32_t* until)
+{
+	struct payload_writer w;
+	struct track_state tracks[MAX_TRACKED];
+	int num_tracks = 0;
+	uint32_t head, tail, prev_frame;
+	struct sample s;
+
+	portENTER_CRITICAL(&ring_lock);
+	head = ring_head;
+	tail = ring_tail;
+	s = ring[tail % TELEMETRY_RING_LEN];
+	portEXIT_CRITICAL(&ring_lock);
+	*until = tail;
+	if (head == tail)
+		return 0;
+
+	prev_frame = s.frame;
+	pw_init(&w, encoding, buf, cap);
+	pw_map_begin(&w);
+	pw_key(&w, "timestamp");
+	pw_uint(&w, (uint32_t)time(NULL));
+	pw_key(&w, "frame");
+	pw_uint(&w, s.frame);
+	pw_key(&w, "scale");
+	pw_uint(&w, TELEMETRY_SCALE);
+	pw_key(&w, "samples");
+	pw_array_begin(&w);
+	for (uint32_t i = tail; i != head; i++) {
+		struct track_state* track;
+
+		if (w.len + SAMPLE_JSON_MAX + PAYLOAD_TAIL >= cap)
+			break;
+		portENTER_CRITICAL(&ring_lock);
+		// Samples may have been overwritten by the fall task meanwhile
+		bool valid = (ring_head - i) <= TELEMETRY_RING_LEN;
+		if (valid)
+			s = ring[i % TELEMETRY_RING_LEN];
+		portEXIT_CRITICAL(&ring_lock);
+		if (!valid)
+			break;
+		track = s_track(tracks, &num_tracks, s.tid);
+		if (track == NULL)
+			break;
+		/* dframe, tid, then fields as deltas from the previous sample of the same tid */
+		pw_uint(&w, s.frame - prev_frame);
+		pw_uint(&w, s.tid);
+		for (int f = 0; f < FIELDS; f++) {
+			pw_int(&w, s.value[f] - track->value[f]);
+			track->value[f] = s.value[f];
+		}
+		prev_frame = s.frame;
+		*until = i + 1;
+	}
+	pw_array_end(&w);
+	pw_map_end(&w);
+	return pw_finish(&w);
+}
+
+void telemetry_commit(uint32_t until)
+{
+	portENTER_CRITICAL(&ring_lock);
+	// Overwrites during the publish may already have moved the tail further
+	if ((int32_t)(until - ring_tail) > 0)
+		ring_tail = until;
+	portEXIT_CRITICAL(&ring_lock);
+}
+
+uint32_t telemetry_pending(void)
+{
+	return ring_head - ring_tail;
+}
+
+uint32_t telemetry_dropped(void)
+{
+	return dropped;
+}
+
+void telemetry_set_interval(uint32_t seconds)
+{
+	interval_sec = seconds;
+	if (seconds == 0) {
+		portENTER_CRITICAL(&ring_lock);
+		ring_tail = ring_head;
+		portEXIT_CRITICAL(&ring_lock);
+	}
+}
+
+uint32_t telemetry_interval(void)
+{
+	return interval_sec;
+}
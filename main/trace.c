@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "esp_idf_version.h"
+#include "esp_tls_crypto.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_cpu.h"
+#define s_cycles() esp_cpu_get_cycle_count()
+#else
+#include "hal/cpu_hal.h"
+#define s_cycles() cpu_hal_get_cycle_count()
+#endif
+
+#include "trace.h"
+
+#define CORES 2
+#define ANCHOR_MS 1000				/**< well below the 2^31 cycles a signed difference holds*/
+#define CALIBRATION_ROUNDS 4
+#define CALIBRATION_EVENTS 16
+#define PRINT_LINE 48				/**< bytes per base64 line of trace_print*/
+
+_Static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be a power of two");
+_Static_assert(sizeof(struct trace_event) == 12, "dump format");
+_Static_assert(sizeof(struct trace_header) == 36, "dump format");
+
+struct trace_name {
+	const char* span;
+	const char* task;			/**< thread of the span in the trace viewer*/
+};
+
+static const struct trace_name names[TRACE_SPAN_COUNT] = {
+	[TRACE_ANCHOR]		= {"anchor", "-"},
+	[TRACE_UART_READ]	= {"uartRead", "uart_event_task"},
+	[TRACE_FRAME_READ]	= {"frameRead", "radar_interface"},
+	[TRACE_FEATURES]	= {"features", "radar_interface"},
+	[TRACE_FALL_LOGIC]	= {"fallLogic", "fall_logic_processing_task"},
+	[TRACE_MQTT_PUBLISH]	= {"mqttPublish", "mqtt_station_task"},
+};
+
+#if TRACE_ENABLE
+/* Slots are claimed with one atomic add, both cores write the same ring */
+static struct trace_event ring[TRACE_EVENTS];
+static uint32_t head = 0;
+static uint32_t skipped = 0;
+static uint32_t event_cycles = 0;
+static bool paused = false;
+static uint32_t dump_end = 0;
+
+/* Written by the owning core with its interrupts masked */
+static TickType_t anchor_tick[CORES];
+static bool anchored[CORES];
+
+
+static void s_put(uint8_t span, uint8_t flags, uint32_t cycles, uint32_t frame)
+{
+	struct trace_event* e = &ring[__atomic_fetch_add(&head, 1, __ATOMIC_RELAXED) & (TRACE_EVENTS - 1)];
+
+	e->cycles = cycles;
+	e->frame = frame;
+	e->span = span;
+	e->flags = flags;
+	e->reserved = 0;
+}
+
+void trace_record(enum trace_span span, bool begin, uint32_t frame)
+{
+	// Masked, the task can neither move to the other core nor be caught half way by trace_pause()
+	UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+	int core = xPortGetCoreID();
+	uint32_t cycles = s_cycles();
+	TickType_t tick = xTaskGetTickCount();
+
+	if (__atomic_load_n(&paused, __ATOMIC_RELAXED)) {
+		portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+		__atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	// The counters of the cores drift apart and wrap every few seconds, the host rebuilds time from anchors
+	if (!anchored[core] || tick - anchor_tick[core] >= pdMS_TO_TICKS(ANCHOR_MS)) {
+		anchored[core] = true;
+		anchor_tick[core] = tick;
+		s_put(TRACE_ANCHOR, core << 1, cycles, (uint32_t)esp_timer_get_time());
+	}
+	s_put(span, (core << 1) | begin, cycles, frame);
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+void trace_init(void)
+{
+	uint32_t best = UINT32_MAX;
+
+	for (int r = 0; r < CALIBRATION_ROUNDS; r++) {
+		uint32_t start = s_cycles();
+		for (int i = 0; i < CALIBRATION_EVENTS; i++)
+			trace_record(TRACE_ANCHOR, i & 1, 0);
+		uint32_t spent = (s_cycles() - start) / CALIBRATION_EVENTS;
+		if (spent < best)
+			best = spent;
+	}
+	event_cycles = best;
+	// Nothing of the calibration is left in the dump
+	head = 0;
+	for (int c = 0; c < CORES; c++)
+		anchored[c] = false;
+}
+
+uint32_t trace_pause(struct trace_header* hdr)
+{
+	uint32_t count;
+
+	__atomic_store_n(&paused, true, __ATOMIC_SEQ_CST);
+	// A writer already past the check has interrupts masked and is done within the tick
+	vTaskDelay(1);
+	dump_end = __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+	count = dump_end < TRACE_EVENTS ? dump_end : TRACE_EVENTS;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACE_VERSION;
+	hdr->event_size = sizeof(struct trace_event);
+	hdr->cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	hdr->count = count;
+	hdr->recorded = dump_end;
+	hdr->skipped = __atomic_load_n(&skipped, __ATOMIC_RELAXED);
+	hdr->event_cycles = event_cycles;
+	hdr->now_us = esp_timer_get_time();
+	hdr->names_len = trace_names(NULL, 0);
+	return dump_end - count;
+}
+
+size_t trace_read(uint32_t* pos, struct trace_event* out, size_t max)
+{
+	size_t n = 0;
+
+	while (n < max && *pos != dump_end)
+		out[n++] = ring[(*pos)++ & (TRACE_EVENTS - 1)];
+	return n;
+}
+
+void trace_resume(void)
+{
+	__atomic_store_n(&paused, false, __ATOMIC_SEQ_CST);
+}
+#else
+void trace_init(void)
+{
+}
+
+uint32_t trace_pause(struct trace_header* hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = TRACE_VERSION;
+	hdr->event_size = sizeof(struct trace_event);
+	hdr->cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	hdr->now_us = esp_timer_get_time();
+	hdr->names_len = trace_names(NULL, 0);
+	return 0;
+}
+
+size_t trace_read(uint32_t* pos, struct trace_event* out, size_t max)
+{
+	return 0;
+}
+
+void trace_resume(void)
+{
+}
+#endif
+
+size_t trace_names(char* buf, size_t cap)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < TRACE_SPAN_COUNT; i++) {
+		int n = snprintf(buf ? buf + len : NULL, buf ? cap - len : 0, "%s %s\n", names[i].span, names[i].task);
+		if (buf && (size_t)n >= cap - len)
+			return len;
+		len += n;
+	}
+	return len;
+}
+
+struct print_line {
+	uint8_t bytes[PRINT_LINE];
+	size_t len;
+};
+
+/**
+ * @brief Print a line of base64
+ *
+ */
+static void s_print_flush(struct print_line* line)
+{
+	unsigned char text[PRINT_LINE / 3 * 4 + 1];
+	size_t out;
+
+	if (line->len == 0)
+		return;
+	esp_crypto_base64_encode(text, sizeof(text), &out, line->bytes, line->len);
+	printf("%.*s\n", (int)out, text);
+	line->len = 0;
+}
+
+/**
+ * @brief Queue bytes for the console, a full line is printed
+ *
+ */
+static void s_print(struct print_line* line, const void* data, size_t len)
+{
+	const uint8_t* p = data;
+
+	while (len > 0) {
+		size_t n = PRINT_LINE - line->len < len ? PRINT_LINE - line->len : len;
+		memcpy(line->bytes + line->len, p, n);
+		line->len += n;
+		p += n;
+		len -= n;
+		if (line->len == PRINT_LINE)
+			s_print_flush(line);
+	}
+}
+
+void trace_print(void)
+{
+	struct trace_header hdr;
+	struct trace_event events[8];
+	char text[256];
+	struct print_line line = {.len = 0};
+	uint32_t pos = trace_pause(&hdr);
+	size_t n;
+
+	printf("TRACE BEGIN\n");
+	s_print(&line, &hdr, sizeof(hdr));
+	s_print(&line, text, trace_names(text, sizeof(text)));
+	while ((n = trace_read(&pos, events, sizeof(events) / sizeof(events[0]))) > 0)
+		s_print(&line, events, n * sizeof(events[0]));
+	s_print_flush(&line);
+	printf("TRACE END\n");
+	trace_resume();
+}
@@ -0,0 +1,153 @@
+#include <string.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/stream_buffer.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "uart_tap.h"
+
+#define CHUNK_DATA_MAX 2048				/**< longer reads are split, bounds the copy in the reader*/
+#define SEND_BUF_SIZE (1024*4)
+#define TAP_TASK_PRIORITY 5				/**< below the radar and fall tasks*/
+
+static const char* TAG = "uart_tap";
+
+static StreamBufferHandle_t sb_tap = NULL;
+static volatile bool client_connected = false;
+static uint32_t dropped_since_connect = 0;
+static struct uart_tap_stats stats;
+/* Header and data go in with one send so the client only ever sees whole chunks */
+static uint8_t chunk_buf[sizeof(struct uart_tap_chunk) + CHUNK_DATA_MAX];
+static uint8_t send_buf[SEND_BUF_SIZE];
+
+
+void uart_tap_feed(const uint8_t* data, size_t len)
+{
+	struct uart_tap_chunk hdr = {
+		.magic = UART_TAP_MAGIC,
+		.time_ms = (uint32_t)(esp_timer_get_time() / 1000),
+	};
+
+	if (sb_tap == NULL || !client_connected)
+		return;
+	while (len > 0) {
+		size_t n = len > CHUNK_DATA_MAX ? CHUNK_DATA_MAX : len;
+		size_t total = sizeof(hdr) + n;
+
+		// Only this task writes, the space can only grow until the send
+		if (xStreamBufferSpacesAvailable(sb_tap) < total) {
+			stats.dropped_chunks++;
+			stats.dropped_bytes += n;
+			dropped_since_connect += n;
+		} else {
+			hdr.len = n;
+			hdr.dropped = dropped_since_connect;
+			memcpy(chunk_buf, &hdr, sizeof(hdr));
+			memcpy(chunk_buf + sizeof(hdr), data, n);
+			xStreamBufferSend(sb_tap, chunk_buf, total, 0);
+			stats.chunks++;
+			stats.bytes += n;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static int s_send_all(int sock, const uint8_t* buf, size_t len)
+{
+	while (len > 0) {
+		int n = send(sock, buf, len, 0);
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int s_listen(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(UART_TAP_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	int opt = 1;
+	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+	if (sock < 0)
+		return -1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 1) != 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * @brief Serve one client at a time with the bytes queued by #uart_tap_feed
+ *
+ */
+static void s_tap_task(void* arg)
+{
+	int listen_sock;
+
+	while ((listen_sock = s_listen()) < 0) {
+		ESP_LOGE(TAG, "Cannot listen on port %d, errno %d", UART_TAP_PORT, errno);
+		vTaskDelay(5000 / portTICK_PERIOD_MS);
+	}
+	ESP_LOGI(TAG, "Raw radar stream on port %d", UART_TAP_PORT);
+	for (;;) {
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		int sock = accept(listen_sock, (struct sockaddr*)&peer, &peer_len);
+		if (sock < 0) {
+			vTaskDelay(1000 / portTICK_PERIOD_MS);
+			continue;
+		}
+		stats.clients++;
+		dropped_since_connect = 0;
+		client_connected = true;
+		ESP_LOGI(TAG, "Client connected");
+		for (;;) {
+			size_t n = xStreamBufferReceive(sb_tap, send_buf, sizeof(send_buf), 1000 / portTICK_PERIOD_MS);
+			if (n == 0)
+				continue;
+			if (s_send_all(sock, send_buf, n) != 0)
+				break;
+			stats.sent_bytes += n;
+		}
+		client_connected = false;
+		ESP_LOGI(TAG, "Client gone, %u bytes dropped while connected", dropped_since_connect);
+		shutdown(sock, 0);
+		close(sock);
+		// A chunk fed while the flag flipped may remain, it is whole and goes to the next client
+		while (xStreamBufferReceive(sb_tap, send_buf, sizeof(send_buf), 0) > 0)
+			;
+	}
+}
+
+esp_err_t uart_tap_start(void)
+{
+	if (sb_tap != NULL)
+		return ESP_OK;
+	sb_tap = xStreamBufferCreate(UART_TAP_BUF_SIZE, 1);
+	if (sb_tap == NULL) {
+		ESP_LOGE(TAG, "Cannot create tap buffer");
+		return ESP_ERR_NO_MEM;
+	}
+	if (xTaskCreatePinnedToCore(s_tap_task, "uart_tap", 1024*3, NULL, TAP_TASK_PRIORITY, NULL, 0) != pdPASS) {
+		ESP_LOGE(TAG, "Cannot create tap task");
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+void uart_tap_get_stats(struct uart_tap_stats* out)
+{
+	*out = stats;
+}
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Compare the payloads printed by test_event_payload with the golden documents.
+
+Documents are compared after parsing, so key order and escaping style do not matter,
+only the values and their types. The CBOR encoding of every case is decoded and must
+give the same document, byte strings standing for their base64 JSON text.
+
+Usage: check_payloads.py <test_event_payload> <golden.jsonl>
+"""
+import base64
+import json
+import struct
+import subprocess
+import sys
+
+
+def load_golden(path):
+    golden = {}
+    with open(path) as f:
+        for line in f:
+            if line.startswith("#") or not line.strip():
+                continue
+            name, doc = line.rstrip("\n").split("\t", 1)
+            golden[name] = json.loads(doc)
+    return golden
+
+
+def run(binary, encoding):
+    out = subprocess.run([binary, encoding], check=True, stdout=subprocess.PIPE).stdout.decode()
+    return dict(line.split("\t", 1) for line in out.splitlines())
+
+
+class Cbor:
+    """Decoder of the CBOR subset event_payload writes, shortest heads only."""
+
+    BREAK = object()
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated at %d" % self.pos)
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return chunk
+
+    def argument(self, info):
+        if info < 24:
+            return info
+        size = {24: 1, 25: 2, 26: 4}.get(info)
+        if size is None:
+            raise ValueError("argument %d at %d" % (info, self.pos))
+        value = int.from_bytes(self.take(size), "big")
+        if value < (24 if size == 1 else 1 << (4 * size)):
+            raise ValueError("argument %d not in shortest form at %d" % (value, self.pos))
+        return value
+
+    def item(self):
+        head = self.take(1)[0]
+        major, info = head >> 5, head & 0x1F
+        if head == 0xFF:
+            return self.BREAK
+        if head in (0xF4, 0xF5):
+            return head == 0xF5
+        if major in (4, 5) and info == 31:
+            items = []
+            while (value := self.item()) is not self.BREAK:
+                items.append(value)
+            if major == 4:
+                return items
+            if len(items) % 2:
+                raise ValueError("map with a key and no value")
+            return dict(zip(items[0::2], items[1::2]))
+        value = self.argument(info)
+        if major == 0:
+            return value
+        if major == 1:
+            return -1 - value
+        if major == 2:
+            return base64.b64encode(self.take(value)).decode()
+        if major == 3:
+            return self.take(value).decode()
+        raise ValueError("unexpected head 0x%02x" % head)
+
+    def document(self):
+        doc = self.item()
+        if self.pos != len(self.data):
+            raise ValueError("%d bytes after the document" % (len(self.data) - self.pos))
+        return doc
+
+
+def same(a, b):
+    """Equal values of equal JSON types, True is not 1 as it is for Python."""
+    if type(a) is not type(b):
+        return False
+    if isinstance(a, dict):
+        return a.keys() == b.keys() and all(same(a[k], b[k]) for k in a)
+    if isinstance(a, list):
+        return len(a) == len(b) and all(same(x, y) for x, y in zip(a, b))
+    return a == b
+
+
+def main():
+    binary, golden_path = sys.argv[1:3]
+    golden = load_golden(golden_path)
+    printed = run(binary, "json")
+    failed = sorted(set(golden) ^ set(printed))
+    for name in failed:
+        print("%s: only in %s" % (name, "golden" if name in golden else "output"))
+    for name in sorted(set(golden) & set(printed)):
+        doc = json.loads(printed[name])
+        if not same(doc, golden[name]):
+            print("%s: got %s\n  expected %s" % (name, printed[name], json.dumps(golden[name])))
+            failed.append(name)
+    cbor = run(binary, "cbor")
+    for name in sorted(set(printed) & set(cbor)):
+        data = bytes.fromhex(cbor[name])
+        try:
+            doc = Cbor(data).document()
+        except ValueError as e:
+            print("%s: CBOR %s" % (name, e))
+            failed.append(name)
+            continue
+        if not same(doc, json.loads(printed[name])):
+            print("%s: CBOR decodes to %s" % (name, json.dumps(doc)))
+            failed.append(name)
+        print("%-16s json %4d bytes, cbor %4d bytes" % (name, len(printed[name]), len(data)))
+        # Size is the reason for CBOR, the event and telemetry streams must shrink
+        if name.startswith(("fall", "presence", "telemetry")) and len(data) >= len(printed[name]):
+            print("%s: CBOR not smaller than JSON" % name)
+            failed.append(name)
+    print("%d payloads, %d differ" % (len(golden), len(failed)))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
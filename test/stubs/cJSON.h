@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+
+/* Declarations the firmware compiles against, the code paths parsing JSON are not run on host */
+typedef int cJSON_bool;
+
+typedef struct cJSON {
+	struct cJSON* next;
+	struct cJSON* prev;
+	struct cJSON* child;
+	int type;
+	char* valuestring;
+	int valueint;
+	double valuedouble;
+	char* string;
+} cJSON;
+
+typedef struct cJSON_Hooks {
+	void* (*malloc_fn)(size_t sz);
+	void (*free_fn)(void* ptr);
+} cJSON_Hooks;
+
+void cJSON_InitHooks(cJSON_Hooks* hooks);
+cJSON* cJSON_ParseWithLength(const char* value, size_t len);
+void cJSON_Delete(cJSON* item);
+cJSON* cJSON_GetObjectItemCaseSensitive(const cJSON* object, const char* string);
+cJSON_bool cJSON_IsString(const cJSON* item);
+cJSON_bool cJSON_IsNumber(const cJSON* item);
+cJSON_bool cJSON_IsBool(const cJSON* item);
+cJSON_bool cJSON_IsTrue(const cJSON* item);
+cJSON_bool cJSON_IsObject(const cJSON* item);
+
+#define cJSON_ArrayForEach(element, array) \
+	for (element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
@@ -0,0 +1,43 @@
+#include <stddef.h>
+#include "esp_dsp.h"
+
+float host_dsp_fault = 0;
+
+/* Four partial sums like the Xtensa kernels, the rounding differs from the reference loop */
+static float s_dot(const float* a, int stride_a, const float* b, int stride_b, int len)
+{
+	float acc[4] = {0, 0, 0, 0};
+	int i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		for (int j = 0; j < 4; j++)
+			acc[j] += a[(i + j) * stride_a] * b[(i + j) * stride_b];
+	}
+	for (; i < len; i++)
+		acc[0] += a[i * stride_a] * b[i * stride_b];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+esp_err_t dsps_dotprod_f32(const float* src1, const float* src2, float* dest, int len)
+{
+	if (src1 == NULL || src2 == NULL || dest == NULL)
+		return ESP_ERR_INVALID_ARG;
+	*dest = s_dot(src1, 1, src2, 1, len) + host_dsp_fault;
+	return ESP_OK;
+}
+
+esp_err_t dspm_mult_f32(const float* A, const float* B, float* C, int m, int n, int k)
+{
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < k; j++)
+			C[i * k + j] = s_dot(A + i * n, 1, B + j, k, n);
+	}
+	return ESP_OK;
+}
+
+esp_err_t dsps_mulc_f32(const float* input, float* output, int len, float C, int step_in, int step_out)
+{
+	for (int i = 0; i < len; i++)
+		output[i * step_out] = input[i * step_in] * C;
+	return ESP_OK;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "esp_err.h"
+
+/*
+ * The three esp-dsp kernels matrix_calc.c dispatches to. Only the test of the dispatch puts this
+ * directory on its include path, the other tests keep the reference kernels.
+ */
+esp_err_t dsps_dotprod_f32(const float* src1, const float* src2, float* dest, int len);
+esp_err_t dspm_mult_f32(const float* A, const float* B, float* C, int m, int n, int k);
+esp_err_t dsps_mulc_f32(const float* input, float* output, int len, float C, int step_in, int step_out);
+
+/**
+ * @brief Added to every dot product, to check that a wrong kernel is caught
+ *
+ */
+extern float host_dsp_fault;
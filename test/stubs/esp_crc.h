@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+/* Same as the ROM function, esp_crc32_le(0, buf, len) is the CRC-32 of zlib */
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
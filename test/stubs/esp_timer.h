@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+/* Host clock, moved by the test with host_clock_advance() */
+int64_t esp_timer_get_time(void);
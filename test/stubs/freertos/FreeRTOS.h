@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Single threaded host build, critical sections and locks only keep the firmware compiling */
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE			1
+#define pdFALSE			0
+#define pdPASS			pdTRUE
+#define pdFAIL			pdFALSE
+#define portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ	1000
+#define portTICK_PERIOD_MS	(1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)	((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	0
+#define portENTER_CRITICAL(mux)		((void)(mux))
+#define portEXIT_CRITICAL(mux)		((void)(mux))
+#define portSET_INTERRUPT_MASK_FROM_ISR()	0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)	((void)(x))
@@ -0,0 +1,6 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef void* QueueHandle_t;
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
@@ -0,0 +1,361 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "host.h"
+
+#define PARTITIONS_MAX 4
+#define NVS_BLOBS_MAX 16
+#define NVS_BLOB_MAX 4096
+#define WALL_EPOCH 1700000000			/**< time() when esp_timer_get_time() is 0*/
+
+struct host_partition {
+	esp_partition_t part;
+	uint8_t* data;
+};
+
+struct host_blob {
+	char key[16];
+	size_t len;
+	uint8_t data[NVS_BLOB_MAX];
+};
+
+static int64_t clock_us = 1000000;
+static struct host_blob blobs[NVS_BLOBS_MAX];
+static int blob_count = 0;
+static struct host_partition partitions[PARTITIONS_MAX];
+static int partition_count = 0;
+static long cut_after = -1;
+static long flash_bytes = 0;
+static bool power_cut = false;
+
+
+int64_t esp_timer_get_time(void)
+{
+	return clock_us;
+}
+
+time_t time(time_t* out)
+{
+	time_t now = WALL_EPOCH + clock_us / 1000000;
+
+	if (out != NULL)
+		*out = now;
+	return now;
+}
+
+void host_clock_advance(int64_t us)
+{
+	clock_us += us;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(clock_us / 1000 / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	clock_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+				   UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+{
+	if (handle != NULL)
+		*handle = NULL;
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	return 0;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	static int mutex;
+	return &mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	static int binary;
+	return &binary;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	return 0;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+	return code == ESP_OK ? "ESP_OK" : "ESP_ERR";
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+	va_list args;
+
+	if (level > ESP_LOG_WARN)
+		return;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	return 100 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+	return 80 * 1024;
+}
+
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/* ================================================	Flash	================================================*/
+
+void host_flash_add(const char* label, uint32_t size)
+{
+	struct host_partition* p = &partitions[partition_count++];
+
+	CHECK(partition_count <= PARTITIONS_MAX);
+	memset(p, 0, sizeof(*p));
+	p->part.type = ESP_PARTITION_TYPE_DATA;
+	p->part.subtype = ESP_PARTITION_SUBTYPE_ANY;
+	p->part.size = size;
+	p->part.erase_size = 4096;
+	snprintf(p->part.label, sizeof(p->part.label), "%s", label);
+	p->data = malloc(size);
+	CHECK(p->data != NULL);
+	memset(p->data, 0xFF, size);
+}
+
+static struct host_partition* s_find(const char* label)
+{
+	for (int i = 0; i < partition_count; i++) {
+		if (strcmp(partitions[i].part.label, label) == 0)
+			return &partitions[i];
+	}
+	return NULL;
+}
+
+uint8_t* host_flash_data(const char* label)
+{
+	struct host_partition* p = s_find(label);
+	return p != NULL ? p->data : NULL;
+}
+
+void host_flash_cut_after(long bytes)
+{
+	cut_after = bytes;
+	flash_bytes = 0;
+}
+
+void host_flash_power_on(void)
+{
+	power_cut = false;
+	cut_after = -1;
+	flash_bytes = 0;
+}
+
+long host_flash_bytes(void)
+{
+	return flash_bytes;
+}
+
+bool host_flash_is_cut(void)
+{
+	return power_cut;
+}
+
+/**
+ * @brief Count a byte about to be programmed or erased
+ *
+ * @return false when the power is cut before it
+ */
+static bool s_flash_byte(void)
+{
+	if (power_cut)
+		return false;
+	if (cut_after >= 0 && flash_bytes >= cut_after) {
+		power_cut = true;
+		return false;
+	}
+	flash_bytes++;
+	return true;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+	struct host_partition* p = label != NULL ? s_find(label) : NULL;
+	return p != NULL ? &p->part : NULL;
+}
+
+static struct host_partition* s_of(const esp_partition_t* part, size_t offset, size_t size)
+{
+	struct host_partition* p = (struct host_partition*)part;
+
+	if (part == NULL || offset > p->part.size || size > p->part.size - offset)
+		return NULL;
+	return p;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+	struct host_partition* p = s_of(partition, src_offset, size);
+
+	if (p == NULL)
+		return ESP_ERR_INVALID_ARG;
+	if (power_cut)
+		return ESP_FAIL;
+	memcpy(dst, p->data + src_offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+	struct host_partition* p = s_of(partition, dst_offset, size);
+	const uint8_t* bytes = src;
+
+	if (p == NULL)
+		return ESP_ERR_INVALID_ARG;
+	// NOR flash only clears bits, programming over programmed bytes ANDs them
+	for (size_t i = 0; i < size; i++) {
+		if (!s_flash_byte())
+			return ESP_FAIL;
+		p->data[dst_offset + i] &= bytes[i];
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+	struct host_partition* p = s_of(partition, offset, size);
+
+	if (p == NULL || offset % p->part.erase_size != 0 || size % p->part.erase_size != 0)
+		return ESP_ERR_INVALID_ARG;
+	for (size_t i = 0; i < size; i++) {
+		if (!s_flash_byte())
+			return ESP_FAIL;
+		p->data[offset + i] = 0xFF;
+	}
+	return ESP_OK;
+}
+
+/* ================================================	NVS	================================================*/
+
+void host_nvs_erase(void)
+{
+	blob_count = 0;
+}
+
+static struct host_blob* s_blob(const char* key)
+{
+	for (int i = 0; i < blob_count; i++) {
+		if (strcmp(blobs[i].key, key) == 0)
+			return &blobs[i];
+	}
+	return NULL;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+	*out_handle = 1;
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+	struct host_blob* b = s_blob(key);
+
+	if (power_cut)
+		return ESP_FAIL;
+	if (b == NULL)
+		return ESP_ERR_NVS_NOT_FOUND;
+	if (*length < b->len)
+		return ESP_ERR_INVALID_SIZE;
+	memcpy(out_value, b->data, b->len);
+	*length = b->len;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+	struct host_blob* b = s_blob(key);
+	const uint8_t* bytes = value;
+
+	CHECK(strlen(key) < sizeof(b->key) && length <= NVS_BLOB_MAX);
+	if (power_cut)
+		return ESP_FAIL;
+	if (b == NULL) {
+		CHECK(blob_count < NVS_BLOBS_MAX);
+		b = &blobs[blob_count++];
+		strcpy(b->key, key);
+		memset(b->data, 0xFF, sizeof(b->data));
+	}
+	// Worse than NVS, which keeps the old entry until the new one is complete: rewritten in place
+	b->len = length;
+	for (size_t i = 0; i < length; i++) {
+		if (!s_flash_byte())
+			return ESP_FAIL;
+		b->data[i] = bytes[i];
+	}
+	return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	return s_flash_byte() ? ESP_OK : ESP_FAIL;
+}
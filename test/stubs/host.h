@@ -0,0 +1,65 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Move the clock returned by esp_timer_get_time()
+ * @details time() follows the same clock from 1700000000, so payloads are reproducible.
+ */
+void host_clock_advance(int64_t us);
+
+/**
+ * @brief Add a RAM partition found by esp_partition_find_first, erased to 0xFF
+ *
+ */
+void host_flash_add(const char* label, uint32_t size);
+
+/**
+ * @brief Content of a partition, to check it or corrupt it
+ *
+ */
+uint8_t* host_flash_data(const char* label);
+
+/**
+ * @brief Cut the power after this many more bytes are programmed or erased
+ * @details
+ *  The write or erase in progress stops at that byte and every later flash operation fails,
+ *  until host_flash_power_on(). A negative count never cuts.
+ */
+void host_flash_cut_after(long bytes);
+
+/**
+ * @brief Power back on, flash operations work again
+ *
+ */
+void host_flash_power_on(void);
+
+/**
+ * @brief Bytes programmed or erased since the last cut or power on
+ *
+ */
+long host_flash_bytes(void);
+
+/**
+ * @brief Power was cut
+ *
+ */
+bool host_flash_is_cut(void);
+
+/**
+ * @brief Forget every NVS blob
+ * @details
+ *  Blobs are rewritten in place one byte at a time and count as flash bytes for
+ *  host_flash_cut_after(), nvs_commit() counts one. A cut leaves a torn blob.
+ */
+void host_nvs_erase(void);
+
+#define CHECK(cond) do {									\
+	if (!(cond)) {										\
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);	\
+		exit(1);									\
+	}											\
+} while (0)
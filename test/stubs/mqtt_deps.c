@@ -0,0 +1,247 @@
+#include <string.h>
+#include "mqtt_client.h"
+#include "common.h"
+#include "ex_com_mqtt.h"
+#include "utils.h"
+#include "config_store.h"
+#include "kv_store.h"
+#include "json_arena.h"
+#include "telemetry.h"
+#include "cloud_upload.h"
+#include "uart_tap.h"
+#include "recorder.h"
+#include "fall_capture.h"
+#include "latency.h"
+#include "metrics.h"
+#include "matrix_calc.h"
+#include "mqtt_command.h"
+#include "radar_interface.h"
+
+/* Modules ex_com_mqtt.c calls that the MQTT tests do not exercise, every one idle */
+
+uint32_t metric_counters[METRIC_COUNTER_COUNT];
+uint32_t metric_peaks[METRIC_PEAK_COUNT];
+/* Stages closed by ex_com_mqtt.c, counted for the tests */
+uint32_t latency_records[LATENCY_STAGE_COUNT];
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+	return NULL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, int event,
+					 void (*handler)(void*, esp_event_base_t, int32_t, void*), void* arg)
+{
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+	return ESP_OK;
+}
+
+void get_device_id(char* device_id)
+{
+	strcpy(device_id, "aura-host");
+}
+
+void config_get_mqtt(struct config_mqtt* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+void config_get_radar(struct config_radar* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+void config_get_app(struct config_app* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+esp_err_t config_set_app(const struct config_app* cfg)
+{
+	return ESP_OK;
+}
+
+esp_err_t config_set_radar(const struct config_radar* cfg)
+{
+	return ESP_OK;
+}
+
+size_t cloud_upload_build(uint8_t* buf, size_t cap, uint32_t* until)
+{
+	return 0;
+}
+
+bool cloud_upload_spend(size_t len)
+{
+	return false;
+}
+
+void cloud_upload_commit(uint32_t until, size_t sent_len)
+{
+}
+
+void cloud_upload_enable(bool enable)
+{
+}
+
+void cloud_upload_set_budget(uint32_t bytes_per_min)
+{
+}
+
+void cloud_upload_get_stats(struct cloud_upload_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+bool fall_capture_ready(void)
+{
+	return false;
+}
+
+size_t fall_capture_build(uint8_t* buf, size_t cap, uint8_t* scratch, struct fall_capture_info* info)
+{
+	return 0;
+}
+
+void fall_capture_release(bool published)
+{
+}
+
+void fall_capture_get_stats(struct fall_capture_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+uint32_t json_arena_heap_fallbacks(void)
+{
+	return 0;
+}
+
+void kv_get_stats(struct kv_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+void latency_record(enum latency_stage stage, int64_t start_us, int64_t end_us)
+{
+	latency_records[stage]++;
+}
+
+void latency_get_summary(enum latency_stage stage, struct latency_summary* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+const char* latency_stage_name(enum latency_stage stage)
+{
+	return "stage";
+}
+
+uint32_t calc_heap_alloc_count(void)
+{
+	return 0;
+}
+
+struct calc_arena* calc_frame_arena(void)
+{
+	static struct calc_arena arena;
+
+	return &arena;
+}
+
+bool mqtt_command_register(const char* name, command_fn fn)
+{
+	return true;
+}
+
+esp_err_t mqtt_command_start(esp_mqtt_client_handle_t client)
+{
+	return ESP_OK;
+}
+
+bool mqtt_command_post(const char* name, size_t name_len, const char* data, size_t len, bool reply)
+{
+	return false;
+}
+
+uint32_t mqtt_command_dropped(void)
+{
+	return 0;
+}
+
+int radar_apply_config(const struct config_radar* cfg)
+{
+	return 0;
+}
+
+void radar_get_cfg_stats(struct radar_cfg_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+void recorder_get_stats(struct recorder_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+size_t telemetry_build(enum payload_encoding encoding, char* buf, size_t cap, uint32_t* until)
+{
+	return 0;
+}
+
+void telemetry_commit(uint32_t until)
+{
+}
+
+uint32_t telemetry_pending(void)
+{
+	return 0;
+}
+
+uint32_t telemetry_dropped(void)
+{
+	return 0;
+}
+
+void telemetry_set_interval(uint32_t seconds)
+{
+}
+
+void uart_tap_get_stats(struct uart_tap_stats* out)
+{
+	memset(out, 0, sizeof(*out));
+}
+
+cJSON* cJSON_GetObjectItemCaseSensitive(const cJSON* object, const char* string)
+{
+	return NULL;
+}
+
+cJSON_bool cJSON_IsString(const cJSON* item)
+{
+	return 0;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON* item)
+{
+	return 0;
+}
+
+cJSON_bool cJSON_IsBool(const cJSON* item)
+{
+	return 0;
+}
+
+cJSON_bool cJSON_IsTrue(const cJSON* item)
+{
+	return 0;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON* item)
+{
+	return 0;
+}
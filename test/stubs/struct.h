@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+
+/* Python struct style unpacking, only radar_interface.c uses it */
+int struct_calcsize(const char* fmt);
+int struct_unpack(const void* buf, const char* fmt, ...);
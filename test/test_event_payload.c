@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event_payload.h"
+#include "telemetry.h"
+#include "host.h"
+
+/*
+ * Prints every payload case as "<name>\t<payload>", text for JSON and hex for CBOR.
+ * check_payloads.py compares them with the documents in golden/.
+ */
+
+static const uint8_t capture_data[] = {0x00, 0x01, 0x02, 0xFF, 0x7E};
+/* tid, x, y, z, vx, vy, vz of two targets over three frames, with a negative delta and a gap */
+static const float telemetry_rows[][7] = {
+	{1, 0.50f, 1.20f, 1.60f, 0, 0, -0.10f},
+	{2, -1.00f, 2.00f, 1.70f, 0, 0, 0.00f},
+	{1, 0.52f, 1.18f, 1.20f, 0, 0, -1.35f},
+	{2, -1.01f, 2.00f, 1.70f, 0, 0, 0.02f},
+	{1, 0.55f, 1.15f, 0.40f, 0, 0, -2.10f},
+};
+static const uint32_t telemetry_frames[] = {100, 100, 101, 101, 104};
+static enum payload_encoding encoding;
+
+static void s_emit(const char* name, const char* buf, size_t len)
+{
+	CHECK(len > 0);
+	printf("%s\t", name);
+	if (encoding == PAYLOAD_JSON) {
+		CHECK(strlen(buf) == len);
+		fwrite(buf, 1, len, stdout);
+	} else {
+		for (size_t i = 0; i < len; i++)
+			printf("%02x", (uint8_t)buf[i]);
+	}
+	printf("\n");
+}
+
+/**
+ * @brief A payload one byte short of its size must be refused, not cut
+ *
+ */
+static void s_check_overflow(size_t (*build)(char* buf, size_t cap), size_t len)
+{
+	char buf[EVENT_PAYLOAD_MAX];
+
+	for (size_t cap = 0; cap <= len; cap++)
+		CHECK(build(buf, cap) == 0);
+	CHECK(build(buf, len + 1) == len);
+}
+
+static size_t s_fall(char* buf, size_t cap)
+{
+	return event_payload_fall(encoding, buf, cap, "fall detected", 1700000000, 1700000003, 0);
+}
+
+static size_t s_response(char* buf, size_t cap)
+{
+	return event_payload_response(encoding, buf, cap, "cmd-7", -2, "bad \"key\"", 1700000100);
+}
+
+int main(int argc, char** argv)
+{
+	char buf[EVENT_PAYLOAD_MAX];
+	struct payload_writer w;
+	size_t len;
+
+	static char telemetry_buf[TELEMETRY_PAYLOAD_MAX];
+	uint32_t until;
+
+	CHECK(argc == 2 && payload_encoding_from_name(argv[1], &encoding));
+
+	len = s_fall(buf, sizeof(buf));
+	s_emit("fall_detected", buf, len);
+	s_check_overflow(s_fall, len);
+	len = event_payload_fall(encoding, buf, sizeof(buf), "fall exited", 1700000000, 1700000042, 1700000042);
+	s_emit("fall_exited", buf, len);
+	len = event_payload_fall(encoding, buf, sizeof(buf), "calling", 4294967295u, 23, 24);
+	s_emit("fall_limits", buf, len);
+	len = event_payload_fall(encoding, buf, sizeof(buf), "say \"hi\"\\\n\t\x01", 1, 2, 3);
+	s_emit("fall_escaped", buf, len);
+	len = event_payload_presence(encoding, buf, sizeof(buf), true, 1700000200);
+	s_emit("presence_true", buf, len);
+	len = event_payload_presence(encoding, buf, sizeof(buf), false, 0);
+	s_emit("presence_false", buf, len);
+	len = s_response(buf, sizeof(buf));
+	s_emit("response", buf, len);
+	s_check_overflow(s_response, len);
+	len = event_payload_capture(encoding, buf, sizeof(buf), 3, 1700000300, 20, 60, capture_data, sizeof(capture_data));
+	s_emit("capture", buf, len);
+	len = event_payload_capture(encoding, buf, sizeof(buf), 4, 1700000301, 0, 1, capture_data, 4);
+	s_emit("capture_padded", buf, len);
+
+	// Outbox batch, the array event_payload_fall_write builds for several records
+	pw_init(&w, encoding, buf, sizeof(buf));
+	pw_array_begin(&w);
+	event_payload_fall_write(&w, "fall detected", 1700000000, 1700000000, 0);
+	event_payload_fall_write(&w, "finished", 1700000000, 1700000060, 1700000060);
+	pw_array_end(&w);
+	len = pw_finish(&w);
+	s_emit("batch", buf, len);
+
+	for (size_t i = 0; i < sizeof(telemetry_frames) / sizeof(telemetry_frames[0]); i++)
+		telemetry_record(telemetry_frames[i], telemetry_rows[i], telemetry_rows[i][3] - 0.1f);
+	len = telemetry_build(encoding, telemetry_buf, sizeof(telemetry_buf), &until);
+	CHECK(until == sizeof(telemetry_frames) / sizeof(telemetry_frames[0]));
+	s_emit("telemetry", telemetry_buf, len);
+	return 0;
+}
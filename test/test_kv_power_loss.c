@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include "kv_store.h"
+#include "host.h"
+
+/*
+ * Power is cut after every byte of a run of writes to one key, the store is opened again and
+ * read back. The key must hold one of the values written, never an older one than the last
+ * write that returned ESP_OK, and a key not written meanwhile must be untouched.
+ */
+
+#define SCHEMA 3
+#define WRITES 4			/**< values written to "mqtt", the first before the cuts*/
+
+struct value {
+	uint32_t index;
+	uint8_t body[96];
+};
+
+static void s_value(struct value* v, uint32_t index)
+{
+	v->index = index;
+	for (size_t i = 0; i < sizeof(v->body); i++)
+		v->body[i] = (uint8_t)(index * 31 + i);
+}
+
+/**
+ * @brief Fresh NVS with "wifi" and the first "mqtt" value
+ *
+ */
+static void s_boot(void)
+{
+	struct value v;
+
+	host_flash_power_on();
+	host_nvs_erase();
+	CHECK(kv_init() == ESP_OK);
+	s_value(&v, 100);
+	CHECK(kv_set("wifi", SCHEMA, &v, sizeof(v)) == ESP_OK);
+	s_value(&v, 1);
+	CHECK(kv_set("mqtt", SCHEMA, &v, sizeof(v)) == ESP_OK);
+}
+
+/**
+ * @brief Write the other values with the power cut after cut bytes
+ *
+ * @return index of the last value acked
+ */
+static uint32_t s_write_cut(long cut)
+{
+	uint32_t acked = 1;
+	struct value v;
+
+	host_flash_cut_after(cut);
+	for (uint32_t i = 2; i <= WRITES; i++) {
+		s_value(&v, i);
+		if (kv_set("mqtt", SCHEMA, &v, sizeof(v)) != ESP_OK)
+			break;
+		acked = i;
+	}
+	return acked;
+}
+
+int main(void)
+{
+	struct value v, expected;
+	long total;
+	long cuts = 0;
+
+	// Bytes the writes take without a cut
+	s_boot();
+	host_flash_cut_after(-1);
+	CHECK(s_write_cut(-1) == WRITES);
+	total = host_flash_bytes();
+	CHECK(total > 0);
+
+	for (long cut = 0; cut <= total; cut++) {
+		s_boot();
+		uint32_t acked = s_write_cut(cut);
+		CHECK(acked == WRITES || host_flash_is_cut());
+
+		// Reboot
+		host_flash_power_on();
+		CHECK(kv_init() == ESP_OK);
+		CHECK(kv_get("mqtt", SCHEMA, &v, sizeof(v)) == ESP_OK);
+		CHECK(v.index >= acked && v.index <= (acked < WRITES ? acked + 1 : WRITES));
+		s_value(&expected, v.index);
+		CHECK(memcmp(&v, &expected, sizeof(v)) == 0);
+		CHECK(kv_get("wifi", SCHEMA, &v, sizeof(v)) == ESP_OK);
+		s_value(&expected, 100);
+		CHECK(memcmp(&v, &expected, sizeof(v)) == 0);
+
+		// The torn copy is written over by the next value
+		s_value(&expected, 50);
+		CHECK(kv_set("mqtt", SCHEMA, &expected, sizeof(expected)) == ESP_OK);
+		CHECK(kv_get("mqtt", SCHEMA, &v, sizeof(v)) == ESP_OK);
+		CHECK(memcmp(&v, &expected, sizeof(v)) == 0);
+		cuts++;
+	}
+
+	struct kv_stats stats;
+	kv_get_stats(&stats);
+	CHECK(kv_get("mqtt", SCHEMA + 1, &v, sizeof(v)) == ESP_ERR_INVALID_VERSION);
+	printf("%ld power cuts over %ld bytes, every read intact, %u torn copies skipped\n",
+	       cuts, total, (unsigned)stats.corrupt);
+	return 0;
+}
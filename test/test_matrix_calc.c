@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "matrix_calc.h"
+#include "host.h"
+#if MATRIX_CALC_USE_DSP
+#include "esp_dsp.h"
+#endif
+
+/*
+ * Built twice: against the esp-dsp stand-in in stubs/dsp/, where the dispatched kernels are
+ * not the reference ones, and with MATRIX_CALC_FORCE_REFERENCE. Both paths must agree with
+ * each other and with the same sums in double, then each kernel is timed on the sizes the
+ * SVM and the point cloud use.
+ */
+
+#define LEN_MAX 200
+#define ROWS_MAX 64
+#define BENCH_CALLS 200000
+
+static float a[LEN_MAX], b[LEN_MAX];
+static float pts[ROWS_MAX * 3], rot[9], out[ROWS_MAX * 3], out_ref[ROWS_MAX * 3];
+static volatile float sink;
+
+
+static float s_random(void)
+{
+	return (float)rand() / RAND_MAX * 8.0f - 4.0f;
+}
+
+static void s_fill(float* arr, int n)
+{
+	for (int i = 0; i < n; i++)
+		arr[i] = s_random();
+}
+
+/**
+ * @brief Same bound as the selfcheck, the error of a float sum grows with its terms
+ *
+ */
+static void s_check_close(float got, double exact, double scale)
+{
+	CHECK(fabs(got - exact) <= 1e-5 * scale + 1e-4 * fabs(exact));
+}
+
+static void s_check_dot(void)
+{
+	for (int len = 0; len <= LEN_MAX; len++) {
+		double exact = 0, scale = 0;
+
+		s_fill(a, len);
+		s_fill(b, len);
+		for (int i = 0; i < len; i++) {
+			exact += (double)a[i] * b[i];
+			scale += fabs((double)a[i] * b[i]);
+		}
+		s_check_close(calc_dot_f32(a, b, len), exact, scale);
+		s_check_close(calc_dot_f32_ref(a, b, len), exact, scale);
+	}
+}
+
+static void s_check_mat_mult(void)
+{
+	for (int rows = 1; rows <= ROWS_MAX; rows++) {
+		s_fill(pts, rows * 3);
+		s_fill(rot, 9);
+		calc_mat_mult_f32(pts, rot, out, rows, 3, 3);
+		calc_mat_mult_f32_ref(pts, rot, out_ref, rows, 3, 3);
+		for (int i = 0; i < rows * 3; i++) {
+			double exact = 0, scale = 0;
+			for (int j = 0; j < 3; j++) {
+				exact += (double)pts[i / 3 * 3 + j] * rot[j * 3 + i % 3];
+				scale += fabs((double)pts[i / 3 * 3 + j] * rot[j * 3 + i % 3]);
+			}
+			s_check_close(out[i], exact, scale);
+			s_check_close(out_ref[i], exact, scale);
+		}
+	}
+}
+
+static void s_check_mul(void)
+{
+	float scaled[LEN_MAX], scaled_ref[LEN_MAX];
+	float t = -0.0014f;
+
+	s_fill(a, LEN_MAX);
+	memcpy(scaled, a, sizeof(scaled));
+	memcpy(scaled_ref, a, sizeof(scaled_ref));
+	calc_mul_array_f32(scaled, LEN_MAX, t);
+	calc_mul_array_f32_ref(scaled_ref, LEN_MAX, t);
+	for (int i = 0; i < LEN_MAX; i++) {
+		s_check_close(scaled[i], (double)a[i] * t, 0);
+		s_check_close(scaled_ref[i], (double)a[i] * t, 0);
+	}
+}
+
+static double s_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void s_bench_dot(int len)
+{
+	double start, dispatched, reference;
+
+	s_fill(a, len);
+	s_fill(b, len);
+	start = s_now_ns();
+	for (int i = 0; i < BENCH_CALLS; i++)
+		sink = calc_dot_f32(a, b, len);
+	dispatched = (s_now_ns() - start) / BENCH_CALLS;
+	start = s_now_ns();
+	for (int i = 0; i < BENCH_CALLS; i++)
+		sink = calc_dot_f32_ref(a, b, len);
+	reference = (s_now_ns() - start) / BENCH_CALLS;
+	printf("dot %3d:           %s %7.1f ns, reference %7.1f ns\n", len, calc_kernel_backend(), dispatched, reference);
+}
+
+static void s_bench_mat_mult(int rows)
+{
+	double start, dispatched, reference;
+
+	s_fill(pts, rows * 3);
+	s_fill(rot, 9);
+	start = s_now_ns();
+	for (int i = 0; i < BENCH_CALLS; i++) {
+		calc_mat_mult_f32(pts, rot, out, rows, 3, 3);
+		sink = out[0];
+	}
+	dispatched = (s_now_ns() - start) / BENCH_CALLS;
+	start = s_now_ns();
+	for (int i = 0; i < BENCH_CALLS; i++) {
+		calc_mat_mult_f32_ref(pts, rot, out_ref, rows, 3, 3);
+		sink = out_ref[0];
+	}
+	reference = (s_now_ns() - start) / BENCH_CALLS;
+	printf("mat_mult (%2d,3)x3: %s %7.1f ns, reference %7.1f ns\n", rows, calc_kernel_backend(), dispatched, reference);
+}
+
+int main(int argc, char** argv)
+{
+	CHECK(argc == 2);
+	CHECK(strcmp(calc_kernel_backend(), argv[1]) == 0);
+	srand(1);
+
+	CHECK(calc_kernel_selfcheck());
+#if MATRIX_CALC_USE_DSP
+	// A dispatched kernel off by a little more than the tolerance is caught
+	host_dsp_fault = 0.01f;
+	CHECK(!calc_kernel_selfcheck());
+	host_dsp_fault = 0;
+#endif
+	s_check_dot();
+	s_check_mat_mult();
+	s_check_mul();
+
+	// Timings are printed only, the host says little about the ESP32
+	s_bench_dot(29);
+	s_bench_dot(167);
+	s_bench_mat_mult(16);
+	s_bench_mat_mult(64);
+	return 0;
+}
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_client.h"
+#include "common.h"
+#include "ex_com_mqtt.h"
+#include "outbox.h"
+#include "metrics.h"
+#include "latency.h"
+#include "esp_timer.h"
+#include "host.h"
+
+/*
+ * Fall events go through the outbox to a broker stand-in behind esp_mqtt_client_publish.
+ * The broker is killed and restarted mid-stream, swallows publishes and acks some of them
+ * before the publish call returns, the way the MQTT client task can. Every event must
+ * reach it, in order, and the outbox must end empty. The log is then mounted again with
+ * records pending, as after a reboot, and filled past its size while the broker is away.
+ */
+
+#define EVENTS 60
+#define REBOOT_EVENTS 12
+#define FULL_EVENTS (16 * 127 + 100)		/**< more than the 16 sectors of 127 records hold*/
+#define EVENTS_MAX (EVENTS + REBOOT_EVENTS + 1 + FULL_EVENTS)
+#define ACKS_MAX 16
+
+enum ack_mode {
+	ACK_IN_PUBLISH,		/**< PUBLISHED handled before esp_mqtt_client_publish returns*/
+	ACK_LATER,		/**< PUBLISHED handled by the test, after the call*/
+	ACK_NEVER,		/**< publish swallowed, the broker or the link is down*/
+};
+
+static struct {
+	enum ack_mode mode;
+	int next_id;
+	int later[ACKS_MAX];
+	int later_count;
+	int last_id;
+	uint32_t first_seen[EVENTS_MAX + 1];	/**< order the event first arrived in, 0 before*/
+	uint32_t arrivals;
+	uint32_t duplicates;
+} broker;
+
+extern uint32_t latency_records[LATENCY_STAGE_COUNT];
+
+static int client_stub;
+static esp_mqtt_client_handle_t client = (esp_mqtt_client_handle_t)&client_stub;
+static uint32_t next_event = 1;
+
+
+/**
+ * @brief Count the events of a JSON payload, the update timestamp carries the event number
+ *
+ */
+static void s_receive(const char* data, int len)
+{
+	static const char key[] = "\"statusUpdateTimestamp\":";
+	char payload[EVENT_PAYLOAD_MAX * 4 + 1];
+	const char* p = payload;
+
+	CHECK(len > 0 && (size_t)len < sizeof(payload));
+	memcpy(payload, data, len);
+	payload[len] = '\0';
+	while ((p = strstr(p, key)) != NULL) {
+		uint32_t event = strtoul(p + sizeof(key) - 1, NULL, 10);
+		CHECK(event >= 1 && event <= EVENTS_MAX);
+		if (broker.first_seen[event] == 0)
+			broker.first_seen[event] = ++broker.arrivals;
+		else
+			broker.duplicates++;
+		p++;
+	}
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t c, const char* topic, const char* data, int len, int qos, int retain)
+{
+	int msg_id;
+
+	CHECK(c == client && qos == 1);
+	CHECK(strcmp(topic, "/devices/aura-host/events") == 0);
+	broker.next_id = broker.next_id % 0xFFFF + 1;
+	msg_id = broker.next_id;
+	broker.last_id = msg_id;
+	switch (broker.mode) {
+	case ACK_IN_PUBLISH:
+		s_receive(data, len);
+		mqtt_on_published(msg_id);
+		break;
+	case ACK_LATER:
+		s_receive(data, len);
+		CHECK(broker.later_count < ACKS_MAX);
+		broker.later[broker.later_count++] = msg_id;
+		break;
+	case ACK_NEVER:
+		break;
+	}
+	return msg_id;
+}
+
+/**
+ * @brief Deliver the acks held back, each one followed by a service call as sem_mqtt_kick does
+ *
+ */
+static void s_deliver_acks(void)
+{
+	while (broker.later_count > 0) {
+		int msg_id = broker.later[0];
+		memmove(broker.later, broker.later + 1, --broker.later_count * sizeof(int));
+		mqtt_on_published(msg_id);
+		mqtt_outbox_service(client);
+	}
+}
+
+static void s_append(int count)
+{
+	for (int i = 0; i < count; i++) {
+		struct outbox_entry record = {
+			.status = FALL_DETECTED,
+			.target_id = 1,
+			.ts = 1700000000,
+			.update_ts = next_event++,
+			.end_ts = 0,
+		};
+		uint32_t seq;
+		CHECK(outbox_append(&record, &seq) == ESP_OK);
+		mqtt_outbox_track(seq, esp_timer_get_time(), esp_timer_get_time());
+		mqtt_outbox_service(client);
+	}
+}
+
+static uint32_t s_pending(void)
+{
+	struct outbox_stats stats;
+
+	outbox_get_stats(&stats);
+	return stats.pending;
+}
+
+int main(void)
+{
+	host_flash_add(OUTBOX_PARTITION_LABEL, 64 * 1024);
+	CHECK(outbox_init() == ESP_OK);
+	CHECK(mqtt_topics_build());
+	mqtt_set_connected(true);
+
+	// Acks that beat the msg_id back to the caller
+	broker.mode = ACK_IN_PUBLISH;
+	s_append(10);
+	CHECK(s_pending() == 0);
+
+	// Broker killed mid-stream, the client only notices at the keepalive
+	broker.mode = ACK_NEVER;
+	s_append(5);
+	CHECK(s_pending() == 5);
+	mqtt_set_connected(false);
+	s_append(10);
+	CHECK(mqtt_outbox_service(client) == 0);
+
+	// Restarted, the new session replays from the tail
+	broker.mode = ACK_LATER;
+	mqtt_set_connected(true);
+	mqtt_outbox_service(client);
+	s_deliver_acks();
+	CHECK(s_pending() == 0);
+
+	// Connection kept but the ack never comes, published again at the deadline only
+	broker.mode = ACK_NEVER;
+	s_append(3);
+	CHECK(mqtt_outbox_wait_ms() <= OUTBOX_ACK_TIMEOUT_MS);
+	host_clock_advance((OUTBOX_ACK_TIMEOUT_MS - 1) * 1000LL);
+	broker.mode = ACK_LATER;
+	CHECK(mqtt_outbox_service(client) == 0);
+	host_clock_advance(1000);
+	CHECK(mqtt_outbox_wait_ms() == 0);
+	CHECK(mqtt_outbox_service(client) > 0);
+	s_deliver_acks();
+	CHECK(s_pending() == 0);
+	CHECK(mqtt_outbox_wait_ms() == UINT32_MAX);
+
+	// The client gives up on a publish, MQTT_EVENT_DELETED
+	broker.mode = ACK_NEVER;
+	s_append(4);
+	mqtt_on_deleted(broker.last_id);
+	broker.mode = ACK_IN_PUBLISH;
+	mqtt_outbox_service(client);
+	CHECK(s_pending() == 0);
+
+	// Killed again while acks are on the way, one of them lands after the restart
+	broker.mode = ACK_LATER;
+	s_append(8);
+	int late = broker.later[0];
+	broker.later_count = 0;
+	mqtt_set_connected(false);
+	broker.mode = ACK_IN_PUBLISH;
+	mqtt_set_connected(true);
+	mqtt_on_published(late);
+	mqtt_outbox_service(client);
+	s_append(EVENTS - (next_event - 1));
+	CHECK(s_pending() == 0);
+
+	struct outbox_stats stats;
+	outbox_get_stats(&stats);
+	CHECK(stats.dropped == 0 && stats.corrupt == 0);
+	CHECK(stats.acked == EVENTS);
+	for (uint32_t event = 1; event <= EVENTS; event++) {
+		CHECK(broker.first_seen[event] == event);
+	}
+	CHECK(metric_counters[METRIC_OUTBOX_RETRIES] == 3);
+	// Every event timed once, including those sent in a later batch than their own
+	struct mqtt_publish_latency fall_latency;
+	mqtt_get_publish_latency(MQTT_LANE_FALL, &fall_latency);
+	CHECK(latency_records[LATENCY_PUBLISH] == EVENTS && latency_records[LATENCY_FRAME_TO_ALERT] == EVENTS);
+	CHECK(fall_latency.count == EVENTS && fall_latency.untracked == 0);
+	CHECK(fall_latency.deleted == 1);
+	printf("%d events delivered in order, %u duplicates, %u batches published again\n",
+	       EVENTS, (unsigned)broker.duplicates, (unsigned)metric_counters[METRIC_OUTBOX_RETRIES]);
+
+	// Rebooted with records pending, head, tail and sequence numbers come back from flash
+	uint32_t first = next_event;
+	mqtt_set_connected(false);
+	s_append(REBOOT_EVENTS / 2);
+	// Left by a firmware with another status numbering, dropped at replay
+	struct outbox_entry unknown = {.status = 200, .target_id = 1, .ts = 1700000000};
+	CHECK(outbox_append(&unknown, NULL) == ESP_OK);
+	s_append(REBOOT_EVENTS - REBOOT_EVENTS / 2);
+	CHECK(outbox_init() == ESP_OK);
+	CHECK(s_pending() == REBOOT_EVENTS + 1);
+	broker.mode = ACK_IN_PUBLISH;
+	mqtt_set_connected(true);
+	mqtt_outbox_service(client);
+	CHECK(s_pending() == 0);
+	for (uint32_t event = first; event < next_event; event++) {
+		CHECK(broker.first_seen[event] == broker.first_seen[first] + (event - first));
+	}
+	// Appended after the remount, after the replayed ones
+	s_append(1);
+	CHECK(s_pending() == 0 && broker.first_seen[next_event - 1] == broker.arrivals);
+
+	// Broker away long enough to fill the log, the oldest records go and the rest stay in order
+	first = next_event;
+	mqtt_set_connected(false);
+	s_append(FULL_EVENTS);
+	outbox_get_stats(&stats);
+	CHECK(stats.dropped > 0 && stats.corrupt == 0);
+	CHECK(stats.pending + stats.dropped == FULL_EVENTS);
+	mqtt_set_connected(true);
+	mqtt_outbox_service(client);
+	CHECK(s_pending() == 0);
+	for (uint32_t event = first; event < first + stats.dropped; event++) {
+		CHECK(broker.first_seen[event] == 0);
+	}
+	for (uint32_t event = first + stats.dropped + 1; event < next_event; event++) {
+		CHECK(broker.first_seen[event] == broker.first_seen[event - 1] + 1);
+	}
+	printf("%d events replayed after a remount, %u of %d dropped with the log full\n",
+	       REBOOT_EVENTS, (unsigned)stats.dropped, FULL_EVENTS);
+	return 0;
+}
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Turn the deferred log records served on /log back into text, oldest first.
+
+Each line is formatted like the console, "E (ms) tag: message", from the format table
+carried by the dump. Arguments are 32-bit words, floats as their bits.
+
+Usage: binlog_decode.py <dump> [--out log.txt]
+"""
+import argparse
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<4sBBHIIII")
+RECORD = struct.Struct("<IIHBBI4I")
+MAGIC = b"FLOG"
+SPEC = re.compile(r"%([-+ #0-9.]*)[hlzjt]*([a-zA-Z%])")
+
+
+def format_message(fmt, args):
+    """printf with 32-bit arguments, the way the formatter task does it."""
+    args = iter(args)
+
+    def conversion(m):
+        flags, conv = m.groups()
+        if conv == "%":
+            return "%"
+        word = next(args, 0)
+        if conv in "feg":
+            return ("%" + flags + conv) % struct.unpack("<f", struct.pack("<I", word))[0]
+        if conv in "di":
+            return ("%" + flags + "d") % (word - (1 << 32) if word & 0x80000000 else word)
+        if conv == "c":
+            return ("%" + flags + "c") % (word & 0xFF)
+        return ("%" + flags + ("d" if conv == "u" else conv)) % word
+
+    return SPEC.sub(conversion, fmt)
+
+
+def decode_dump(data):
+    magic, version, record_size, table_len, count, dropped, suppressed, now_ms = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit("not a version 1 log dump")
+    pos = HEADER.size
+    table = []
+    for line in data[pos:pos + table_len].decode().splitlines():
+        head, fmt = line.split("\t", 1)
+        level, tag = head.split(" ", 1)
+        table.append((level, tag, fmt))
+    pos += table_len
+    for i in range(count):
+        _seq, ms, msg, argc, _, skipped, *args = RECORD.unpack_from(data, pos + i * RECORD.size)
+        if msg >= len(table):
+            yield "? (%d) unknown message %d" % (ms, msg)
+            continue
+        level, tag, fmt = table[msg]
+        line = "%s (%d) %s: %s" % (level, ms, tag, format_message(fmt, args[:argc]))
+        yield line + (" (%d suppressed)" % skipped if skipped else "")
+    print("%d records, %d dropped and %d suppressed since boot, dump at %d ms"
+          % (count, dropped, suppressed, now_ms), file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--out", help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    out = open(args.out, "w") if args.out else sys.stdout
+    for line in decode_dump(data):
+        out.write(line + "\n")
+
+
+if __name__ == "__main__":
+    main()
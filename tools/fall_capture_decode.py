@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Decode the fall capture attached to a type 3 event into JSON lines, one frame per line.
+
+Input is the event as received on /devices/<id>/events, JSON or CBOR, or the bare capture bytes.
+Each output line holds the frame number, the time relative to the fall detection (ms), the
+tracks (cm, cm/s) and the points associated to a track (cm, tid, doppler in m/s).
+
+Usage: fall_capture_decode.py <event file> [--out frames.jsonl]
+"""
+import argparse
+import base64
+import json
+import struct
+import sys
+
+from recorder_decode import LZF, POINT_CM, Reader, lzf_decompress
+
+HEADER = struct.Struct("<2BH2I")
+
+
+def capture_data(blob):
+    """Return the capture bytes and the event payload, or None for a bare capture."""
+    try:
+        payload = json.loads(blob)["payload"]
+        return base64.b64decode(payload["data"]), payload
+    except (UnicodeDecodeError, ValueError):
+        pass
+    try:
+        import cbor2
+        payload = cbor2.loads(blob)["payload"]
+        return payload["data"], payload
+    except ImportError:
+        pass
+    except Exception:
+        pass
+    return blob, None
+
+
+def decode_capture(data):
+    fmt, _version, raw_len, frame, lead_ms = HEADER.unpack_from(data)
+    body = data[HEADER.size:]
+    raw = lzf_decompress(body, raw_len) if fmt == LZF else body
+    r = Reader(raw)
+    ms = -lead_ms
+    while r.pos < len(raw):
+        frame = (frame + r.uvarint()) & 0xFFFFFFFF
+        ms += r.uvarint()
+        tracks = []
+        for _ in range(r.byte()):
+            tid = r.byte()
+            pos = [r.svarint() for _ in range(3)]
+            vel = [r.svarint() for _ in range(3)]
+            tracks.append({"tid": tid, "pos": pos, "vel": vel})
+        points = []
+        x = y = z = 0
+        for _ in range(r.byte()):
+            tid = r.byte()
+            x += r.svarint()
+            y += r.svarint()
+            z += r.svarint()
+            points.append([x * POINT_CM, y * POINT_CM, z * POINT_CM, tid, r.int8() / 10])
+        yield {"frame": frame, "ms": ms, "tracks": tracks, "points": points}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--out", help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data, payload = capture_data(f.read())
+    out = open(args.out, "w") if args.out else sys.stdout
+    count = 0
+    for frame in decode_capture(data):
+        out.write(json.dumps(frame) + "\n")
+        count += 1
+    if payload is not None:
+        print("target %d at %d, %d frames expected, %d before the detection"
+              % (payload["targetId"], payload["timestamp"], payload["frames"], payload["preFrames"]), file=sys.stderr)
+    print("%d frames" % count, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Decode flight recorder sectors of the firmware into JSON lines, one frame per line.
+
+Input is any concatenation of sectors as served by the device:
+  curl -u user:pass http://<device ip>/recorder?seconds=600 -o rec.bin
+or the payloads of /devices/<id>/events/recorder saved one file per message, in order.
+
+Each output line holds the sector sequence number, frame number, device uptime (ms), an
+estimated unix time, the tracks (cm, cm/s) and the point cloud (cm) when recorded.
+
+Usage: recorder_decode.py <file> [<file> ...] [--out frames.jsonl]
+"""
+import argparse
+import json
+import struct
+import sys
+import zlib
+
+MAGIC = 0x31434552
+HEADER = struct.Struct("<5I3H2BI")
+POINT_CM = 5
+STORED, LZF = 0, 1
+
+
+def lzf_decompress(data, out_len):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        ctrl = data[i]
+        i += 1
+        if ctrl < 32:
+            out += data[i:i + ctrl + 1]
+            i += ctrl + 1
+            continue
+        length = ctrl >> 5
+        if length == 7:
+            length += data[i]
+            i += 1
+        ref = len(out) - ((ctrl & 0x1F) << 8) - data[i] - 1
+        i += 1
+        for k in range(length + 2):
+            out.append(out[ref + k])
+    if len(out) != out_len:
+        raise ValueError("LZF length %d, expected %d" % (len(out), out_len))
+    return bytes(out)
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def int8(self):
+        value = self.byte()
+        return value - 256 if value >= 128 else value
+
+    def uvarint(self):
+        value = shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return value
+
+    def svarint(self):
+        value = self.uvarint()
+        return (value >> 1) ^ -(value & 1)
+
+
+def decode_sector(blob):
+    (magic, seq, base_frame, base_ms, unix_s, frames, raw_len, length, fmt, _version, crc) = HEADER.unpack_from(blob)
+    payload = blob[HEADER.size:HEADER.size + length]
+    if zlib.crc32(payload, zlib.crc32(blob[:HEADER.size - 4])) != crc:
+        raise ValueError("sector %d fails its CRC" % seq)
+    raw = lzf_decompress(payload, raw_len) if fmt == LZF else payload
+    r = Reader(raw)
+    frame, ms = base_frame, base_ms
+    for _ in range(frames):
+        frame = (frame + r.uvarint()) & 0xFFFFFFFF
+        ms = (ms + r.uvarint()) & 0xFFFFFFFF
+        tracks = []
+        for _ in range(r.byte()):
+            tid = r.byte()
+            pos = [r.svarint() for _ in range(3)]
+            vel = [r.svarint() for _ in range(3)]
+            tracks.append({"tid": tid, "pos": pos, "vel": vel})
+        points = []
+        x = y = z = 0
+        for _ in range(r.byte()):
+            x += r.svarint()
+            y += r.svarint()
+            z += r.svarint()
+            points.append([x * POINT_CM, y * POINT_CM, z * POINT_CM, r.int8() / 10, r.byte()])
+        yield {"seq": seq, "frame": frame, "ms": ms, "unix": unix_s + (ms - base_ms) / 1000,
+               "tracks": tracks, "points": points}
+
+
+def sectors(data):
+    """Split a byte stream into sectors, bytes between them are skipped."""
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        if struct.unpack_from("<I", data, pos)[0] != MAGIC:
+            pos += 1
+            continue
+        length = struct.unpack_from("<H", data, pos + 24)[0]
+        yield data[pos:pos + HEADER.size + length]
+        pos += HEADER.size + length
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("--out", help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    out = open(args.out, "w") if args.out else sys.stdout
+    count = bad = 0
+    for name in args.files:
+        with open(name, "rb") as f:
+            data = f.read()
+        for blob in sectors(data):
+            try:
+                for frame in decode_sector(blob):
+                    out.write(json.dumps(frame) + "\n")
+                    count += 1
+            except (ValueError, IndexError) as e:
+                bad += 1
+                print("skipped: %s" % e, file=sys.stderr)
+    print("%d frames, %d sectors skipped" % (count, bad), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
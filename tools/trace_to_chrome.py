@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Convert a pipeline trace dump into Chrome trace JSON, for chrome://tracing or ui.perfetto.dev.
+
+Input is the body of GET /trace, or a console log holding the lines printed by the dump-trace
+command between "TRACE BEGIN" and "TRACE END". Each core is a process and each task a thread,
+spans carry the radar frame number.
+
+Usage: trace_to_chrome.py <dump or log> [--out trace.json]
+"""
+import argparse
+import base64
+import json
+import struct
+import sys
+
+HEADER = struct.Struct("<4sBBHIIIIqHH")
+EVENT = struct.Struct("<IIBBH")
+MAGIC = b"FTRC"
+ANCHOR = 0
+
+
+def dump_bytes(blob):
+    """Return the dump, decoding the base64 lines of a console log."""
+    if blob.startswith(MAGIC):
+        return blob
+    lines = blob.decode("utf-8", "replace").splitlines()
+    try:
+        start = lines.index("TRACE BEGIN")
+        end = lines.index("TRACE END", start)
+    except ValueError:
+        sys.exit("no trace in input")
+    return base64.b64decode("".join(line.strip() for line in lines[start + 1:end]))
+
+
+def decode_dump(data):
+    magic, version, event_size, mhz, count, recorded, skipped, cycles, now_us, names_len, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or event_size != EVENT.size:
+        sys.exit("not a version 1 trace")
+    pos = HEADER.size
+    names = [line.split(" ", 1) for line in data[pos:pos + names_len].decode().splitlines()]
+    pos += names_len
+    events = [EVENT.unpack_from(data, pos + i * EVENT.size) for i in range(count)]
+    info = {"mhz": mhz, "recorded": recorded, "skipped": skipped, "cycles": cycles, "now_us": now_us}
+    return info, names, events
+
+
+def chrome_events(info, names, events):
+    """Yield trace events in us, the cycle counter of a core is read from its last anchor."""
+    now_low = info["now_us"] & 0xFFFFFFFF
+    anchors = {}
+    tids = {}
+    dropped = 0
+    for cycles, frame, span, flags, _ in events:
+        core = flags >> 1
+        if span == ANCHOR:
+            anchors[core] = (cycles, info["now_us"] - ((now_low - frame) & 0xFFFFFFFF))
+            continue
+        if core not in anchors:
+            # Its anchor was overwritten, the time is unknown
+            dropped += 1
+            continue
+        anchor_cycles, anchor_us = anchors[core]
+        name, task = names[span] if span < len(names) else ("span%d" % span, "unknown")
+        tid = tids.setdefault(task, len(tids) + 1)
+        yield {"name": name, "ph": "B" if flags & 1 else "E", "pid": core, "tid": tid,
+               "ts": anchor_us + ((cycles - anchor_cycles) & 0xFFFFFFFF) / info["mhz"], "args": {"frame": frame}}
+    for core in sorted(anchors):
+        yield {"name": "process_name", "ph": "M", "pid": core, "args": {"name": "core %d" % core}}
+        for task, tid in tids.items():
+            yield {"name": "thread_name", "ph": "M", "pid": core, "tid": tid, "args": {"name": task}}
+    if dropped:
+        print("%d events before the first anchor of their core dropped" % dropped, file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--out", help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        info, names, events = decode_dump(dump_bytes(f.read()))
+    trace = sorted(chrome_events(info, names, events), key=lambda e: e.get("ts", -1))
+    out = open(args.out, "w") if args.out else sys.stdout
+    json.dump({"traceEvents": trace, "displayTimeUnit": "ns"}, out)
+    spans = [e for e in trace if e["ph"] != "M"]
+    print("%d events, %d recorded since boot, %d skipped while dumping"
+          % (len(events), info["recorded"], info["skipped"]), file=sys.stderr)
+    if len(spans) > 1 and info["mhz"]:
+        # Cost of recording over the window of the dump, anchors included
+        seconds = (spans[-1]["ts"] - spans[0]["ts"]) / 1e6
+        share = len(events) * info["cycles"] / (info["mhz"] * 1e6 * seconds) if seconds > 0 else 0
+        print("%d cycles per event, %.4f %% of one core at %d MHz over %.1f s"
+              % (info["cycles"], share * 100, info["mhz"], seconds), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Capture the raw radar stream served by a lab build (LAB_UART_TAP) of the firmware.
+
+Writes two files:
+  <out>.bin  radar bytes exactly as read from UART1, ready to be fed to the frame parser
+  <out>.idx  CSV of chunk offset in .bin, device time (ms) and bytes dropped on the device so far,
+             a growing dropped column marks a gap right before that offset
+
+Usage: uart_tap_capture.py <device ip> <out> [--port 5005] [--seconds N]
+"""
+import argparse
+import socket
+import struct
+import sys
+import time
+
+MAGIC = 0x31504154
+HEADER = struct.Struct("<4I")
+
+
+def read_exact(sock, n):
+    buf = bytearray()
+    while len(buf) < n:
+        part = sock.recv(n - len(buf))
+        if not part:
+            raise EOFError
+        buf += part
+    return bytes(buf)
+
+
+def resync(sock, head):
+    """Drop bytes until the next chunk magic, only needed after a partial chunk.
+
+    The search starts in the bad header itself, the next chunk may begin inside it.
+    """
+    magic = struct.pack("<I", MAGIC)
+    window = head[1:]
+    while magic not in window:
+        window = window[-3:] + read_exact(sock, 1)
+    window = window[window.index(magic):]
+    return window + read_exact(sock, HEADER.size - len(window))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("out")
+    parser.add_argument("--port", type=int, default=5005)
+    parser.add_argument("--seconds", type=float, default=0, help="stop after this time, 0 runs until Ctrl-C")
+    args = parser.parse_args()
+
+    sock = socket.create_connection((args.host, args.port))
+    start = time.monotonic()
+    offset = 0
+    last_dropped = 0
+    with open(args.out + ".bin", "wb") as data, open(args.out + ".idx", "w") as index:
+        index.write("offset,time_ms,dropped\n")
+        try:
+            while args.seconds == 0 or time.monotonic() - start < args.seconds:
+                head = read_exact(sock, HEADER.size)
+                magic, length, time_ms, dropped = HEADER.unpack(head)
+                if magic != MAGIC:
+                    print("stream out of sync, searching next chunk", file=sys.stderr)
+                    magic, length, time_ms, dropped = HEADER.unpack(resync(sock, head))
+                data.write(read_exact(sock, length))
+                index.write("%d,%d,%d\n" % (offset, time_ms, dropped))
+                if dropped != last_dropped:
+                    print("device dropped %d bytes before offset %d" % (dropped - last_dropped, offset), file=sys.stderr)
+                    last_dropped = dropped
+                offset += length
+        except (KeyboardInterrupt, EOFError):
+            pass
+    elapsed = time.monotonic() - start
+    print("%d bytes in %.1f s (%.0f B/s), %d dropped on device" % (offset, elapsed, offset / max(elapsed, 1e-3), last_dropped))
+
+
+if __name__ == "__main__":
+    main()